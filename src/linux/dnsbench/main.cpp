@@ -0,0 +1,538 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+#include <arpa/inet.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <atomic>
+#include <charconv>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include "common.h"
+#include "DnsServer.h"
+
+// Definitions normally provided by init, which the DNS server depends on.
+int g_LogFd = STDERR_FILENO;
+int g_TelemetryFd = -1;
+thread_local std::string g_threadName;
+
+namespace {
+
+// CPU time clock of the server thread, which is found by the name it gives itself.
+std::atomic<bool> g_serverClockValid{false};
+clockid_t g_serverClock{};
+
+} // namespace
+
+void UtilSetThreadName(const char* Name)
+{
+    g_threadName = Name;
+    if (g_threadName == "DnsServer" && pthread_getcpuclockid(pthread_self(), &g_serverClock) == 0)
+    {
+        g_serverClockValid.store(true, std::memory_order_release);
+    }
+}
+
+namespace {
+
+constexpr auto c_usage =
+    "Usage: dnsbench [options]\n"
+    "\n"
+    "Runs the GNS DNS server in-process, with a fake host answering the tunneled requests, and\n"
+    "measures it with UDP DNS clients. Reports queries per second, latency percentiles and the\n"
+    "CPU time the server and fake host threads used per query.\n"
+    "The server listens on port 53, so this needs to run as root.\n"
+    "\n"
+    "  --clients, -c LIST       Comma-separated client counts; each is a separate run.\n"
+    "  --depth, -d COUNT        Outstanding queries per client.\n"
+    "  --duration, -t SECONDS   Measurement time for each run.\n"
+    "  --host-delay, -r MICROS  Time the fake host takes to answer a request.\n"
+    "  --address, -a ADDRESS    IPv4 address the server listens on.\n";
+
+// Time without any response after which a client considers its outstanding queries lost.
+constexpr auto c_queryTimeout = std::chrono::milliseconds(200);
+
+struct RunOptions
+{
+    unsigned int Clients = 1;
+    unsigned int Depth = 16;
+    std::chrono::milliseconds Duration{5000};
+    std::chrono::microseconds HostDelay{0};
+    std::string Address = "127.0.0.153";
+};
+
+struct RunResult
+{
+    uint64_t Queries = 0;
+    uint64_t Lost = 0;
+    double Seconds = 0;
+    std::chrono::nanoseconds P50{};
+    std::chrono::nanoseconds P99{};
+    std::chrono::nanoseconds P999{};
+    std::chrono::nanoseconds CpuPerQuery{};
+};
+
+std::chrono::nanoseconds ReadClock(clockid_t clock)
+{
+    timespec time{};
+    THROW_LAST_ERROR_IF(clock_gettime(clock, &time) < 0);
+    return std::chrono::seconds{time.tv_sec} + std::chrono::nanoseconds{time.tv_nsec};
+}
+
+// Returns the CPU time used by the server thread so far.
+std::chrono::nanoseconds ServerCpuTime()
+{
+    return g_serverClockValid.load(std::memory_order_acquire) ? ReadClock(g_serverClock) : std::chrono::nanoseconds{};
+}
+
+// Stands in for Windows: answers each tunneled request after the configured delay, echoing it
+// back as a response. Like the tunneling channel, it reports the responses that are due
+// together and flushes the server once none are left.
+class FakeHost
+{
+public:
+    FakeHost(std::chrono::microseconds delay) : m_delay(delay)
+    {
+    }
+
+    ~FakeHost()
+    {
+        Stop();
+    }
+
+    void Start(DnsServer& server)
+    {
+        m_thread = std::thread([this, &server]() { Run(server); });
+    }
+
+    // Stops answering requests. Responses that are not due yet are dropped.
+    void Stop()
+    {
+        {
+            std::lock_guard lock{m_lock};
+            m_stop = true;
+        }
+
+        m_wakeUp.notify_all();
+        if (m_thread.joinable())
+        {
+            m_thread.join();
+        }
+    }
+
+    // Returns the CPU time used by the host thread so far.
+    std::chrono::nanoseconds CpuTime()
+    {
+        clockid_t clock;
+        THROW_ERRNO_IF(EINVAL, pthread_getcpuclockid(m_thread.native_handle(), &clock) != 0);
+        return ReadClock(clock);
+    }
+
+    void TunnelRequest(const gsl::span<gsl::byte> dnsBuffer, const LX_GNS_DNS_CLIENT_IDENTIFIER& dnsClientIdentifier)
+    {
+        Response response{std::chrono::steady_clock::now() + m_delay, dnsClientIdentifier, {dnsBuffer.begin(), dnsBuffer.end()}};
+
+        // Set the QR bit, making the request a response.
+        if (response.Buffer.size() > 2)
+        {
+            response.Buffer[2] |= gsl::byte{0x80};
+        }
+
+        {
+            std::lock_guard lock{m_lock};
+            m_responses.emplace_back(std::move(response));
+        }
+
+        m_wakeUp.notify_one();
+    }
+
+private:
+    struct Response
+    {
+        std::chrono::steady_clock::time_point Due;
+        LX_GNS_DNS_CLIENT_IDENTIFIER Client;
+        std::vector<gsl::byte> Buffer;
+    };
+
+    void Run(DnsServer& server)
+    {
+        std::vector<Response> ready;
+        std::unique_lock lock{m_lock};
+        while (!m_stop)
+        {
+            if (m_responses.empty())
+            {
+                m_wakeUp.wait(lock);
+                continue;
+            }
+
+            const auto now = std::chrono::steady_clock::now();
+            if (m_responses.front().Due > now)
+            {
+                m_wakeUp.wait_until(lock, m_responses.front().Due);
+                continue;
+            }
+
+            while (!m_responses.empty() && m_responses.front().Due <= now)
+            {
+                ready.emplace_back(std::move(m_responses.front()));
+                m_responses.pop_front();
+            }
+
+            lock.unlock();
+            for (auto& response : ready)
+            {
+                server.HandleDnsResponse(gsl::make_span(response.Buffer), response.Client);
+            }
+
+            ready.clear();
+            lock.lock();
+
+            if (m_responses.empty() || m_responses.front().Due > std::chrono::steady_clock::now())
+            {
+                lock.unlock();
+                server.FlushDnsResponses();
+                lock.lock();
+            }
+        }
+    }
+
+    std::chrono::microseconds m_delay;
+    std::mutex m_lock;
+    std::condition_variable m_wakeUp;
+    std::deque<Response> m_responses;
+    bool m_stop = false;
+    std::thread m_thread;
+};
+
+// Builds a query for an A record. The DNS id is set when the query is sent.
+std::vector<char> BuildQuery()
+{
+    std::vector<char> query{0, 0, 0x01, 0x00, 0, 1, 0, 0, 0, 0, 0, 0};
+    for (const std::string_view label : {"dnsbench", "example", "com"})
+    {
+        query.push_back(static_cast<char>(label.size()));
+        query.insert(query.end(), label.begin(), label.end());
+    }
+
+    query.insert(query.end(), {0, 0, 1, 0, 1});
+    return query;
+}
+
+// Sends queries from its own socket, keeping Depth of them outstanding, and records the latency
+// of each response.
+void RunClient(const sockaddr_in& server, const RunOptions& options, std::chrono::steady_clock::time_point deadline, std::vector<uint32_t>& latencies, uint64_t& lost)
+{
+    wil::unique_fd socket{::socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0)};
+    THROW_LAST_ERROR_IF(!socket);
+    THROW_LAST_ERROR_IF(connect(socket.get(), reinterpret_cast<const sockaddr*>(&server), sizeof(server)) < 0);
+
+    timeval timeout{0, std::chrono::duration_cast<std::chrono::microseconds>(c_queryTimeout).count()};
+    THROW_LAST_ERROR_IF(setsockopt(socket.get(), SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0);
+
+    // Queries are tracked by DNS id.
+    std::vector<std::chrono::steady_clock::time_point> sent(UINT16_MAX + 1);
+    uint16_t nextId = 0;
+    auto query = BuildQuery();
+    auto send = [&]() {
+        const auto id = nextId++;
+        const uint16_t networkId = htons(id);
+        memcpy(query.data(), &networkId, sizeof(networkId));
+        sent[id] = std::chrono::steady_clock::now();
+
+        // A query that can't be sent is handled like a dropped one.
+        ::send(socket.get(), query.data(), query.size(), 0);
+    };
+
+    for (unsigned int index = 0; index < options.Depth; index++)
+    {
+        send();
+    }
+
+    std::array<char, 512> response;
+    while (std::chrono::steady_clock::now() < deadline)
+    {
+        const auto bytesRead = recv(socket.get(), response.data(), response.size(), 0);
+        if (bytesRead < 0)
+        {
+            THROW_LAST_ERROR_IF(errno != EAGAIN && errno != EINTR);
+
+            // Nothing was received for a while, so the outstanding queries were dropped. Send new ones instead.
+            unsigned int dropped = 0;
+            for (auto& time : sent)
+            {
+                if (time != std::chrono::steady_clock::time_point{})
+                {
+                    time = {};
+                    dropped++;
+                }
+            }
+
+            lost += dropped;
+            for (unsigned int index = 0; index < dropped; index++)
+            {
+                send();
+            }
+
+            continue;
+        }
+
+        uint16_t id;
+        if (bytesRead < static_cast<ssize_t>(sizeof(id)))
+        {
+            continue;
+        }
+
+        memcpy(&id, response.data(), sizeof(id));
+        id = ntohs(id);
+        if (sent[id] == std::chrono::steady_clock::time_point{})
+        {
+            continue;
+        }
+
+        latencies.push_back(static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - sent[id]).count()));
+        sent[id] = {};
+        send();
+    }
+}
+
+// Returns the latency at the specified percentile. The samples are partially reordered.
+std::chrono::nanoseconds Percentile(std::vector<uint32_t>& samples, double percentile)
+{
+    if (samples.empty())
+    {
+        return {};
+    }
+
+    const auto index = std::min(samples.size() - 1, static_cast<size_t>(percentile * samples.size()));
+    std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+    return std::chrono::nanoseconds{samples[index]};
+}
+
+RunResult Run(const RunOptions& options)
+{
+    FakeHost host{options.HostDelay};
+    DnsServer server{[&host](const gsl::span<gsl::byte> dnsBuffer, const LX_GNS_DNS_CLIENT_IDENTIFIER& dnsClientIdentifier) {
+        host.TunnelRequest(dnsBuffer, dnsClientIdentifier);
+    }};
+
+    server.Start(options.Address);
+    host.Start(server);
+
+    // The host thread must not deliver responses once the server is stopped.
+    const auto stopServer = wil::scope_exit([&host, &server]() {
+        host.Stop();
+        server.Stop();
+        g_serverClockValid.store(false, std::memory_order_release);
+    });
+
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(53);
+    THROW_LAST_ERROR_IF(inet_pton(AF_INET, options.Address.c_str(), &address.sin_addr) != 1);
+
+    std::vector<std::vector<uint32_t>> latencies(options.Clients);
+    std::vector<uint64_t> lost(options.Clients);
+    std::vector<std::thread> clients;
+
+    const auto startCpu = ServerCpuTime() + host.CpuTime();
+    const auto start = std::chrono::steady_clock::now();
+    const auto deadline = start + options.Duration;
+    for (unsigned int index = 0; index < options.Clients; index++)
+    {
+        clients.emplace_back([&, index]() {
+            try
+            {
+                RunClient(address, options, deadline, latencies[index], lost[index]);
+            }
+            catch (...)
+            {
+                std::fprintf(stderr, "Client %u failed: %s\n", index, strerror(wil::ResultFromCaughtException()));
+            }
+        });
+    }
+
+    for (auto& client : clients)
+    {
+        client.join();
+    }
+
+    RunResult result;
+    result.Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    const auto cpu = ServerCpuTime() + host.CpuTime() - startCpu;
+
+    std::vector<uint32_t> samples;
+    for (unsigned int index = 0; index < options.Clients; index++)
+    {
+        samples.insert(samples.end(), latencies[index].begin(), latencies[index].end());
+        result.Lost += lost[index];
+    }
+
+    result.Queries = samples.size();
+    result.P50 = Percentile(samples, 0.5);
+    result.P99 = Percentile(samples, 0.99);
+    result.P999 = Percentile(samples, 0.999);
+    if (result.Queries > 0)
+    {
+        result.CpuPerQuery = cpu / result.Queries;
+    }
+
+    return result;
+}
+
+template <typename T>
+bool ParseNumber(std::string_view value, T& result)
+{
+    const auto end = value.data() + value.size();
+    const auto parsed = std::from_chars(value.data(), end, result);
+    return parsed.ec == std::errc{} && parsed.ptr == end;
+}
+
+std::optional<std::vector<unsigned int>> ParseList(std::string_view value)
+{
+    std::vector<unsigned int> result;
+    while (!value.empty())
+    {
+        const auto comma = value.find(',');
+        unsigned int number;
+        if (!ParseNumber(value.substr(0, comma), number) || number == 0)
+        {
+            return {};
+        }
+
+        result.push_back(number);
+        value = comma == std::string_view::npos ? std::string_view{} : value.substr(comma + 1);
+    }
+
+    if (result.empty())
+    {
+        return {};
+    }
+
+    return result;
+}
+
+int Usage(const char* message = nullptr)
+{
+    if (message != nullptr)
+    {
+        std::fprintf(stderr, "%s\n\n", message);
+    }
+
+    std::fputs(c_usage, stderr);
+    return 1;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+try
+{
+    const option options[] = {
+        {"clients", required_argument, nullptr, 'c'},
+        {"depth", required_argument, nullptr, 'd'},
+        {"duration", required_argument, nullptr, 't'},
+        {"host-delay", required_argument, nullptr, 'r'},
+        {"address", required_argument, nullptr, 'a'},
+        {"help", no_argument, nullptr, 'h'},
+        {}};
+
+    RunOptions runOptions;
+    std::vector<unsigned int> clients{1};
+    int current;
+    while ((current = getopt_long(argc, argv, "c:d:t:r:a:h", options, nullptr)) != -1)
+    {
+        const std::string_view value{optarg != nullptr ? optarg : ""};
+        bool valid = true;
+        switch (current)
+        {
+        case 'c':
+            if (auto list = ParseList(value))
+            {
+                clients = std::move(*list);
+            }
+            else
+            {
+                valid = false;
+            }
+
+            break;
+
+        case 'd':
+            valid = ParseNumber(value, runOptions.Depth) && runOptions.Depth > 0 && runOptions.Depth <= UINT16_MAX;
+            break;
+
+        case 't':
+        {
+            double seconds;
+            valid = ParseNumber(value, seconds) && seconds > 0;
+            runOptions.Duration = std::chrono::milliseconds{static_cast<int64_t>(seconds * 1000)};
+            break;
+        }
+
+        case 'r':
+        {
+            unsigned int micros;
+            valid = ParseNumber(value, micros);
+            runOptions.HostDelay = std::chrono::microseconds{micros};
+            break;
+        }
+
+        case 'a':
+            runOptions.Address = value;
+            break;
+
+        default:
+            return Usage();
+        }
+
+        if (!valid)
+        {
+            return Usage(std::format("Invalid value for {}: '{}'", argv[optind - 1], value).c_str());
+        }
+    }
+
+    if (optind < argc)
+    {
+        return Usage(std::format("Unexpected argument: '{}'", argv[optind]).c_str());
+    }
+
+    std::printf(
+        "%8s %6s %12s %10s %10s %10s %12s %8s\n", "clients", "depth", "queries/s", "p50(us)", "p99(us)", "p999(us)", "cpu/query(us)", "lost");
+
+    bool answered = true;
+    for (const auto count : clients)
+    {
+        auto options = runOptions;
+        options.Clients = count;
+        const auto result = Run(options);
+
+        auto micros = [](std::chrono::nanoseconds value) { return std::chrono::duration<double, std::micro>(value).count(); };
+        std::printf(
+            "%8u %6u %12.0f %10.1f %10.1f %10.1f %12.2f %8llu\n",
+            options.Clients,
+            options.Depth,
+            result.Queries / result.Seconds,
+            micros(result.P50),
+            micros(result.P99),
+            micros(result.P999),
+            micros(result.CpuPerQuery),
+            static_cast<unsigned long long>(result.Lost));
+
+        std::fflush(stdout);
+        answered = answered && result.Queries > 0;
+    }
+
+    // The server logs its own errors, so a run without any answer most likely means it couldn't start.
+    if (!answered)
+    {
+        std::fprintf(stderr, "Some runs had no answered queries. The server needs to run as root to listen on port 53.\n");
+        return 1;
+    }
+
+    return 0;
+}
+catch (...)
+{
+    std::fprintf(stderr, "dnsbench failed: %s\n", strerror(wil::ResultFromCaughtException()));
+    return 1;
+}
@@ -17,6 +17,8 @@ constexpr int c_epollWaitMaxEvents = 100;
 constexpr int c_maxUdpDnsBufferSize = 4096;
 // Max number of pending connections in the TCP listen queue
 constexpr int c_maxListenBacklog = 1000;
+// Initial number of slots in the UDP request table. The table grows when it is half full.
+constexpr size_t c_initialUdpRequestTableSize = 64;
 
 DnsServer::DnsServer(DnsTunnelingCallback&& tunnelDnsRequest) : m_tunnelDnsRequest(std::move(tunnelDnsRequest))
 {
@@ -64,6 +66,20 @@ try
     // Bind socket
     Syscall(bind, m_udpSocket.get(), reinterpret_cast<sockaddr*>(&serverAddr), sizeof(serverAddr));
 
+    // Prepare the buffers used to read a batch of DNS requests
+    m_udpRequestBuffer.resize(c_maxUdpDnsBatchSize * c_maxUdpDnsBufferSize);
+    m_udpRequestMessages.resize(c_maxUdpDnsBatchSize);
+    m_udpRequestVectors.resize(c_maxUdpDnsBatchSize);
+    m_udpRequestAddresses.resize(c_maxUdpDnsBatchSize);
+    for (int index = 0; index < c_maxUdpDnsBatchSize; index++)
+    {
+        m_udpRequestVectors[index].iov_base = m_udpRequestBuffer.data() + index * c_maxUdpDnsBufferSize;
+        m_udpRequestVectors[index].iov_len = c_maxUdpDnsBufferSize;
+        m_udpRequestMessages[index].msg_hdr.msg_iov = &m_udpRequestVectors[index];
+        m_udpRequestMessages[index].msg_hdr.msg_iovlen = 1;
+        m_udpRequestMessages[index].msg_hdr.msg_name = &m_udpRequestAddresses[index];
+    }
+
     // Configure epoll to track the UDP socket. EPOLLIN is used to get epoll notifications
     // whenever there is data available to be read from the socket
     epoll_event event{};
@@ -111,30 +127,86 @@ try
 
     std::scoped_lock<std::mutex> lock{m_udpLock};
 
-    auto it = m_udpRequests.find(dnsClientIdentifier.DnsClientId);
-    if (it == m_udpRequests.end())
+    // Stop tracking the request, irrespective of the DNS response being successfully sent
+    const auto remoteAddr = m_udpRequests.Remove(dnsClientIdentifier.DnsClientId);
+    if (!remoteAddr.has_value())
     {
         GNS_LOG_ERROR("Received a response for a UDP request that is not tracked, UDP request id: {}", dnsClientIdentifier.DnsClientId);
         return;
     }
 
-    // Stop tracking the request, irrespective of the DNS response being successfully sent
-    const auto removeDnsRequest = wil::scope_exit([&] { m_udpRequests.erase(dnsClientIdentifier.DnsClientId); });
+    // Queue the DNS response. It is sent back to the Linux DNS client with the other responses received in the meantime.
+    const auto offset = m_udpResponseBuffer.size();
+    m_udpResponseBuffer.insert(m_udpResponseBuffer.end(), dnsBuffer.begin(), dnsBuffer.end());
+    m_udpResponses.push_back({remoteAddr.value(), offset, dnsBuffer.size()});
 
-    sockaddr_in& remoteAddr = it->second;
+    if (m_udpResponses.size() >= c_maxUdpDnsBatchSize)
+    {
+        SendUdpDnsResponses();
+    }
+}
+CATCH_LOG()
 
-    // Send DNS response buffer back to the Linux DNS client
-    int bufferSize = dnsBuffer.size();
-    int totalBytesSent = 0;
+void DnsServer::FlushDnsResponses() noexcept
+{
+    std::scoped_lock<std::mutex> lock{m_udpLock};
 
-    while (totalBytesSent < bufferSize)
+    SendUdpDnsResponses();
+}
+
+void DnsServer::SendUdpDnsResponses() noexcept
+{
+    if (m_udpResponses.empty())
     {
-        int bytesSent = Syscall(
-            sendto, m_udpSocket.get(), dnsBuffer.data() + totalBytesSent, bufferSize - totalBytesSent, 0, reinterpret_cast<sockaddr*>(&remoteAddr), sizeof(remoteAddr));
-        totalBytesSent += bytesSent;
+        return;
+    }
+
+    const auto clearResponses = wil::scope_exit([&] {
+        m_udpResponses.clear();
+        m_udpResponseBuffer.clear();
+    });
+
+    std::array<mmsghdr, c_maxUdpDnsBatchSize> messages{};
+    std::array<iovec, c_maxUdpDnsBatchSize> vectors{};
+
+    for (size_t start = 0; start < m_udpResponses.size(); start += c_maxUdpDnsBatchSize)
+    {
+        const auto count = std::min<size_t>(c_maxUdpDnsBatchSize, m_udpResponses.size() - start);
+        for (size_t index = 0; index < count; index++)
+        {
+            auto& response = m_udpResponses[start + index];
+            vectors[index].iov_base = m_udpResponseBuffer.data() + response.m_offset;
+            vectors[index].iov_len = response.m_size;
+
+            messages[index] = {};
+            messages[index].msg_hdr.msg_name = &response.m_remoteAddr;
+            messages[index].msg_hdr.msg_namelen = sizeof(response.m_remoteAddr);
+            messages[index].msg_hdr.msg_iov = &vectors[index];
+            messages[index].msg_hdr.msg_iovlen = 1;
+        }
+
+        // Send the DNS responses back to the Linux DNS clients. sendmmsg() stops at the first response that can't be sent,
+        // which is dropped, like a response that is lost on the network.
+        size_t sent = 0;
+        while (sent < count)
+        {
+            const int result = sendmmsg(m_udpSocket.get(), messages.data() + sent, count - sent, 0);
+            if (result < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+
+                GNS_LOG_ERROR("sendmmsg failed for UDP DNS response, errno {}", errno);
+                sent++;
+                continue;
+            }
+
+            sent += result;
+        }
     }
 }
-CATCH_LOG()
 
 void DnsServer::HandleTcpDnsResponse(const gsl::span<gsl::byte> dnsBuffer, const LX_GNS_DNS_CLIENT_IDENTIFIER& dnsClientIdentifier) noexcept
 try
@@ -351,65 +423,160 @@ void DnsServer::ServerLoop() noexcept
 void DnsServer::HandleUdpDnsRequest() noexcept
 try
 {
-    static std::array<gsl::byte, c_maxUdpDnsBufferSize> s_dnsBuffer;
+    std::array<uint32_t, c_maxUdpDnsBatchSize> udpRequestIds{};
 
-    gsl::span<gsl::byte> dnsRequest;
-    uint32_t udpRequestId{};
+    // Read the available DNS requests, up to c_maxUdpDnsBatchSize. The buffers are only used by the server loop, so the
+    // requests can be read without holding m_udpLock.
+    for (auto& message : m_udpRequestMessages)
+    {
+        // Since we only configure an IPv4 DNS server in Linux, we expect all Linux DNS clients to use IPv4 addresses
+        message.msg_hdr.msg_namelen = sizeof(sockaddr_in);
+        message.msg_len = 0;
+    }
+
+    const int requestCount = Syscall(recvmmsg, m_udpSocket.get(), m_udpRequestMessages.data(), c_maxUdpDnsBatchSize, 0, nullptr);
 
     // Scoped m_udpLock
     {
         std::scoped_lock<std::mutex> lock{m_udpLock};
 
-        // Since we only configure an IPv4 DNS server in Linux, we expect all Linux DNS clients to use IPv4 addresses
-        sockaddr_in remoteAddr{};
-        socklen_t remoteAddrLen = sizeof(remoteAddr);
+        for (int index = 0; index < requestCount; index++)
+        {
+            if (m_udpRequestMessages[index].msg_len == 0)
+            {
+                GNS_LOG_ERROR("recvmmsg returned 0 bytes");
+                continue;
+            }
 
-        // Read the DNS request
-        int bytesReceived = Syscall(
-            recvfrom, m_udpSocket.get(), s_dnsBuffer.data(), c_maxUdpDnsBufferSize, 0, reinterpret_cast<sockaddr*>(&remoteAddr), &remoteAddrLen);
+            const auto& remoteAddr = m_udpRequestAddresses[index];
 
-        if (bytesReceived == 0)
+            // Get next request id. If value reaches UINT_MAX + 1 it will be automatically reset to 0
+            const auto requestId = m_currentUdpRequestId++;
+
+            GNS_LOG_INFO(
+                "New UDP DNS request DNS client IP: {}, DNS client port {}, DNS buffer size: {}, UDP request id: {}",
+                Address::FromBinary(AF_INET, 0, &remoteAddr.sin_addr).Addr().c_str(),
+                ntohs(remoteAddr.sin_port),
+                m_udpRequestMessages[index].msg_len,
+                requestId);
+
+            udpRequestIds[index] = requestId;
+
+            // Track the request
+            m_udpRequests.Insert(requestId, remoteAddr);
+        }
+    }
+
+    for (int index = 0; index < requestCount; index++)
+    {
+        if (m_udpRequestMessages[index].msg_len == 0)
         {
-            GNS_LOG_ERROR("recvfrom returned 0 bytes");
-            return;
+            continue;
         }
 
-        // Get next request id. If value reaches UINT_MAX + 1 it will be automatically reset to 0
-        const auto requestId = m_currentUdpRequestId++;
+        // A request that can't be tunneled is dropped, without affecting the rest of the batch
+        const auto udpRequestId = udpRequestIds[index];
+        try
+        {
+            auto removeRequestOnError = wil::scope_exit([&] {
+                std::scoped_lock<std::mutex> lock{m_udpLock};
+                m_udpRequests.Remove(udpRequestId);
+            });
 
-        GNS_LOG_INFO(
-            "New UDP DNS request DNS client IP: {}, DNS client port {}, DNS buffer size: {}, UDP request id: {}",
-            Address::FromBinary(AF_INET, 0, &remoteAddr.sin_addr).Addr().c_str(),
-            ntohs(remoteAddr.sin_port),
-            bytesReceived,
-            requestId);
+            // Tunnel request to Windows
+            LX_GNS_DNS_CLIENT_IDENTIFIER dnsClientIdentifier{};
+            dnsClientIdentifier.Protocol = IPPROTO_UDP;
+            dnsClientIdentifier.DnsClientId = udpRequestId;
 
-        // Move request to a local variable
-        dnsRequest = std::move(gsl::make_span(s_dnsBuffer).subspan(0, bytesReceived));
-        udpRequestId = requestId;
+            const auto dnsRequest =
+                gsl::make_span(m_udpRequestBuffer).subspan(index * c_maxUdpDnsBufferSize, m_udpRequestMessages[index].msg_len);
+            m_tunnelDnsRequest(dnsRequest, dnsClientIdentifier);
 
-        // Track the request
-        m_udpRequests.emplace(requestId, remoteAddr);
+            removeRequestOnError.release();
+        }
+        CATCH_LOG()
     }
+}
+CATCH_LOG()
 
-    if (!dnsRequest.empty())
+void DnsServer::UdpRequestTable::Insert(uint32_t requestId, const sockaddr_in& remoteAddr)
+{
+    // Keep the table at most half full, so the probe sequences stay short
+    if ((m_count + 1) * 2 > m_entries.size())
     {
-        auto removeRequestOnError = wil::scope_exit([&] {
-            std::scoped_lock<std::mutex> lock{m_udpLock};
-            m_udpRequests.erase(udpRequestId);
-        });
+        Grow();
+    }
 
-        // Tunnel request to Windows
-        LX_GNS_DNS_CLIENT_IDENTIFIER dnsClientIdentifier{};
-        dnsClientIdentifier.Protocol = IPPROTO_UDP;
-        dnsClientIdentifier.DnsClientId = udpRequestId;
+    const size_t mask = m_entries.size() - 1;
+    for (size_t index = requestId & mask;; index = (index + 1) & mask)
+    {
+        auto& entry = m_entries[index];
+        if (!entry.m_used)
+        {
+            entry = {requestId, true, remoteAddr};
+            m_count++;
+            return;
+        }
+        else if (entry.m_requestId == requestId)
+        {
+            entry.m_remoteAddr = remoteAddr;
+            return;
+        }
+    }
+}
+
+std::optional<sockaddr_in> DnsServer::UdpRequestTable::Remove(uint32_t requestId) noexcept
+{
+    if (m_entries.empty())
+    {
+        return {};
+    }
+
+    const size_t mask = m_entries.size() - 1;
+    size_t index = requestId & mask;
+    while (m_entries[index].m_used && m_entries[index].m_requestId != requestId)
+    {
+        index = (index + 1) & mask;
+    }
+
+    if (!m_entries[index].m_used)
+    {
+        return {};
+    }
+
+    const auto remoteAddr = m_entries[index].m_remoteAddr;
 
-        m_tunnelDnsRequest(dnsRequest, dnsClientIdentifier);
+    // Shift back the following entries of the probe sequence into the free slot, so lookups don't need tombstones.
+    // An entry can move to the free slot if its home slot isn't between the free slot and its current slot.
+    for (size_t next = (index + 1) & mask; m_entries[next].m_used; next = (next + 1) & mask)
+    {
+        const size_t home = m_entries[next].m_requestId & mask;
+        if (((next - home) & mask) >= ((next - index) & mask))
+        {
+            m_entries[index] = m_entries[next];
+            index = next;
+        }
+    }
+
+    m_entries[index].m_used = false;
+    m_count--;
+    return remoteAddr;
+}
 
-        removeRequestOnError.release();
+void DnsServer::UdpRequestTable::Grow()
+{
+    std::vector<Entry> entries(std::max(c_initialUdpRequestTableSize, m_entries.size() * 2));
+    std::swap(entries, m_entries);
+    m_count = 0;
+
+    for (const auto& entry : entries)
+    {
+        if (entry.m_used)
+        {
+            Insert(entry.m_requestId, entry.m_remoteAddr);
+        }
     }
 }
-CATCH_LOG()
 
 void DnsServer::Stop() noexcept
 try
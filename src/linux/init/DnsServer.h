@@ -3,6 +3,10 @@
 #pragma once
 
 #include <map>
+#include <optional>
+#include <vector>
+#include <netinet/in.h>
+#include <sys/socket.h>
 #include "common.h"
 #include "lxinitshared.h"
 
@@ -11,6 +15,9 @@ using DnsTunnelingCallback = std::function<void(const gsl::span<gsl::byte>, cons
 // Number of bytes used to store the length of DNS over TCP requests
 constexpr int c_byteCountTcpRequestLength = 2;
 
+// Max number of DNS over UDP requests read, or responses sent, with a single system call
+constexpr int c_maxUdpDnsBatchSize = 32;
+
 class DnsServer
 {
 public:
@@ -30,11 +37,17 @@ public:
 
     // Process DNS response received from Windows.
     //
+    // Note: UDP responses are queued, so that responses received together can be sent with a single system call. They are
+    // sent once c_maxUdpDnsBatchSize responses are queued, or when FlushDnsResponses() is called.
+    //
     // Arguments:
     //    dnsBuffer - buffer containing DNS response.
     //    dnsClientIdentifier - struct containing protocol (TCP/UDP) and unique id of the Linux DNS client making the request.
     void HandleDnsResponse(const gsl::span<gsl::byte> dnsBuffer, const LX_GNS_DNS_CLIENT_IDENTIFIER& dnsClientIdentifier) noexcept;
 
+    // Send the queued UDP DNS responses. Called when there are no more DNS responses immediately available.
+    void FlushDnsResponses() noexcept;
+
     void Stop() noexcept;
 
 private:
@@ -68,6 +81,43 @@ private:
         TcpConnectionContext& operator=(TcpConnectionContext&&) = delete;
     };
 
+    // Open-addressed hash table mapping the id of an UDP DNS request to the sockaddr_in struct storing the IP and port used
+    // by the Linux DNS client that made the request. Request ids are sequential, so they are used as their own hash and
+    // requests in flight at the same time occupy consecutive slots.
+    class UdpRequestTable
+    {
+    public:
+        // Track a request, replacing any request with the same id.
+        void Insert(uint32_t requestId, const sockaddr_in& remoteAddr);
+
+        // Stop tracking a request, returning the address of its DNS client if it was tracked.
+        std::optional<sockaddr_in> Remove(uint32_t requestId) noexcept;
+
+    private:
+        struct Entry
+        {
+            uint32_t m_requestId{};
+            bool m_used = false;
+            sockaddr_in m_remoteAddr{};
+        };
+
+        void Grow();
+
+        std::vector<Entry> m_entries;
+
+        size_t m_count = 0;
+    };
+
+    // UDP DNS response waiting to be sent.
+    struct UdpDnsResponse
+    {
+        sockaddr_in m_remoteAddr{};
+
+        // Location of the response in m_udpResponseBuffer.
+        size_t m_offset = 0;
+        size_t m_size = 0;
+    };
+
     void StartUdpDnsServer(const std::string& ipAddress) noexcept;
 
     void StartTcpDnsServer(const std::string& ipAddress) noexcept;
@@ -81,9 +131,12 @@ private:
     // Handle new data received on an existing TCP connection.
     void HandleNewTcpData(TcpConnectionContext* context) noexcept;
 
-    // Read the next DNS request from the UDP socket.
+    // Read the next DNS requests from the UDP socket.
     void HandleUdpDnsRequest() noexcept;
 
+    // Send the queued UDP DNS responses. m_udpLock must be held.
+    void SendUdpDnsResponses() noexcept;
+
     void HandleUdpDnsResponse(const gsl::span<gsl::byte> dnsBuffer, const LX_GNS_DNS_CLIENT_IDENTIFIER& dnsClientIdentifier) noexcept;
 
     void HandleTcpDnsResponse(const gsl::span<gsl::byte> dnsBuffer, const LX_GNS_DNS_CLIENT_IDENTIFIER& dnsClientIdentifier) noexcept;
@@ -105,7 +158,20 @@ private:
     // Mapping id of an UDP DNS request to the sockaddr_in struct storing the IP and port used by the Linux DNS client that made
     // the DNS request. Note: Since we only configure an IPv4 DNS server in Linux, we expect all Linux DNS clients to use IPv4
     // addresses. _Guarded_by_(m_udpLock)
-    std::map<uint32_t, sockaddr_in> m_udpRequests;
+    UdpRequestTable m_udpRequests;
+
+    // Buffers used to read a batch of DNS requests from the UDP socket. Only used by the server loop.
+    std::vector<gsl::byte> m_udpRequestBuffer;
+    std::vector<mmsghdr> m_udpRequestMessages;
+    std::vector<iovec> m_udpRequestVectors;
+    std::vector<sockaddr_in> m_udpRequestAddresses;
+
+    // UDP DNS responses waiting to be sent, and the buffer containing them.
+    // _Guarded_by_(m_udpLock)
+    std::vector<UdpDnsResponse> m_udpResponses;
+
+    // _Guarded_by_(m_udpLock)
+    std::vector<gsl::byte> m_udpResponseBuffer;
 
     wil::unique_fd m_tcpListenSocket;
 
@@ -8,8 +8,10 @@
 #include "Syscall.h"
 #include "message.h"
 
-DnsTunnelingChannel::DnsTunnelingChannel(int channelFd, DnsTunnelingCallback&& reportDnsResponse) :
-    m_channel(wil::unique_fd{channelFd}, "DnsTunneling"), m_reportDnsResponse(std::move(reportDnsResponse))
+DnsTunnelingChannel::DnsTunnelingChannel(int channelFd, DnsTunnelingCallback&& reportDnsResponse, std::function<void()>&& reportDnsResponsesDone) :
+    m_channel(wil::unique_fd{channelFd}, "DnsTunneling"),
+    m_reportDnsResponse(std::move(reportDnsResponse)),
+    m_reportDnsResponsesDone(std::move(reportDnsResponsesDone))
 {
     // Create a pipe to be used for signalling the receive loop to stop
     m_shutdownReceiveWorkerPipe = wil::unique_pipe::create(0);
@@ -128,6 +130,14 @@ void DnsTunnelingChannel::ReceiveLoop() noexcept
                 // Invoke callback to notify about the new DNS response
                 m_reportDnsResponse(dnsBuffer, dnsMessage->DnsClientIdentifier);
 
+                // If no other message is immediately available, notify that this burst of DNS responses is done, so
+                // the responses can be sent together.
+                pollfd channelPoll{.fd = m_channel.Socket(), .events = POLLIN, .revents = 0};
+                if (poll(&channelPoll, 1, 0) <= 0)
+                {
+                    m_reportDnsResponsesDone();
+                }
+
                 break;
             }
 
@@ -11,7 +11,12 @@ using DnsTunnelingCallback = std::function<void(const gsl::span<gsl::byte>, cons
 class DnsTunnelingChannel
 {
 public:
-    DnsTunnelingChannel(int channelFd, DnsTunnelingCallback&& reportDnsResponse);
+    // Arguments:
+    // channelFd - hvsocket used to communicate with Windows.
+    // reportDnsResponse - callback invoked for each DNS response received from Windows.
+    // reportDnsResponsesDone - callback invoked when there are no more messages immediately available on the channel, after
+    //                          DNS responses were reported.
+    DnsTunnelingChannel(int channelFd, DnsTunnelingCallback&& reportDnsResponse, std::function<void()>&& reportDnsResponsesDone);
     ~DnsTunnelingChannel();
 
     DnsTunnelingChannel(const DnsTunnelingChannel&) = delete;
@@ -44,4 +49,7 @@ private:
 
     // Callback used to notify when there is a new DNS response message on the channel.
     const DnsTunnelingCallback m_reportDnsResponse;
+
+    // Callback used to notify when the DNS responses available on the channel were all reported.
+    const std::function<void()> m_reportDnsResponsesDone;
 };
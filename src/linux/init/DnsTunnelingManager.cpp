@@ -12,7 +12,8 @@ DnsTunnelingManager::DnsTunnelingManager(int hvsocketFd, const std::string& dnsT
         hvsocketFd,
         [this](const gsl::span<gsl::byte> dnsBuffer, const LX_GNS_DNS_CLIENT_IDENTIFIER& dnsClientIdentifier) {
             m_dnsServer.HandleDnsResponse(dnsBuffer, dnsClientIdentifier);
-        }),
+        },
+        [this]() { m_dnsServer.FlushDnsResponses(); }),
     m_dnsServer([this](const gsl::span<gsl::byte> dnsBuffer, const LX_GNS_DNS_CLIENT_IDENTIFIER& dnsClientIdentifier) {
         if (m_stopped)
         {
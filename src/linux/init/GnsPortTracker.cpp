@@ -1,6 +1,5 @@
 // Copyright (C) Microsoft Corporation. All rights reserved.
 
-#include <filesystem>
 #include <optional>
 #include <regex>
 #include <iostream>
@@ -16,14 +15,59 @@
 
 constexpr size_t c_bind_timeout_seconds = 60;
 constexpr auto c_sock_diag_refresh_delay = std::chrono::milliseconds(500);
-constexpr auto c_sock_diag_poll_timeout = std::chrono::milliseconds(10);
 constexpr auto c_bpf_poll_timeout = std::chrono::milliseconds(500);
 
+// Maximum number of port allocation requests sent to the host before reading the responses. This
+// keeps the requests and responses of a batch well within the hvsocket buffers.
+constexpr size_t c_max_port_requests = 64;
+
+// Maximum number of ports matched by a sock_diag filter. The filter compares each socket against
+// every port, so past this many ports it's cheaper to list all the sockets of a family and protocol.
+constexpr size_t c_sock_diag_max_filter_ports = 64;
+
+namespace {
+
+std::pair<dev_t, ino_t> GetNetworkNamespace(const std::string& Path)
+{
+    struct stat64 namespaceInfo{};
+    Syscall(stat64, Path.c_str(), &namespaceInfo);
+
+    return {namespaceInfo.st_dev, namespaceInfo.st_ino};
+}
+
+// Build an inet_diag bytecode filter matching sockets bound to any of the given ports.
+//
+// Each port is compared by an S_EQ operation (whose second word holds the port), followed by a JMP to
+// the end of the program, which accepts the socket. If the port doesn't match, the next comparison
+// is tried, and the last one jumps past the end of the program, which rejects the socket.
+std::vector<inet_diag_bc_op> BuildPortFilter(const std::vector<std::uint16_t>& Ports)
+{
+    constexpr auto opSize = sizeof(inet_diag_bc_op);
+    constexpr auto blockSize = 3 * opSize;
+    const auto length = Ports.size() * blockSize;
+
+    std::vector<inet_diag_bc_op> program;
+    program.reserve(Ports.size() * 3);
+    for (size_t index = 0; index < Ports.size(); index++)
+    {
+        const auto offset = index * blockSize;
+        const auto last = index + 1 == Ports.size();
+
+        program.push_back({INET_DIAG_BC_S_EQ, 2 * opSize, static_cast<std::uint16_t>(last ? blockSize + opSize : blockSize)});
+        program.push_back({0, 0, Ports[index]});
+        program.push_back({INET_DIAG_BC_JMP, opSize, static_cast<std::uint16_t>(length - offset - 2 * opSize)});
+    }
+
+    return program;
+}
+
+} // namespace
+
 GnsPortTracker::GnsPortTracker(
     std::shared_ptr<wsl::shared::SocketChannel> hvSocketChannel, NetlinkChannel&& netlinkChannel, std::shared_ptr<SecCompDispatcher> seccompDispatcher) :
     m_hvSocketChannel(std::move(hvSocketChannel)), m_channel(std::move(netlinkChannel)), m_seccompDispatcher(seccompDispatcher)
 {
-    m_networkNamespace = std::filesystem::read_symlink("/proc/self/ns/net").string();
+    m_networkNamespace = GetNetworkNamespace("/proc/self/ns/net");
 }
 
 void GnsPortTracker::RunPortRefresh()
@@ -35,16 +79,26 @@ void GnsPortTracker::RunPortRefresh()
     // Doing this in a separate thread allows the main thread not to be delayed
     // because of transient sock_diag failures
 
+    auto destroyNotifications = OpenSocketDestroyNotifications();
+    std::set<PortAllocation> trackedPorts;
     for (;;)
     {
         // Netlink will sometimes return EBUSY. Don't fail for that
         try
         {
-            std::promise<void> resume;
-            auto result = PortRefreshResult{ListAllocatedPorts(), time(nullptr), std::bind(&std::promise<void>::set_value, &resume)};
+            std::promise<std::set<PortAllocation>> resume;
+            auto result = PortRefreshResult{
+                ListAllocatedPorts(trackedPorts), time(nullptr), [&resume](std::set<PortAllocation> ports) {
+                    resume.set_value(std::move(ports));
+                }};
+
             m_allocatedPortsRefresh.set_value(result);
 
-            resume.get_future().wait();
+            // Wake the main thread if it's waiting for a bind() call, so released ports are
+            // processed right away.
+            m_requests.interrupt();
+
+            trackedPorts = resume.get_future().get();
         }
         catch (const NetlinkTransactionError& e)
         {
@@ -54,21 +108,20 @@ void GnsPortTracker::RunPortRefresh()
             }
         }
 
-        std::this_thread::sleep_for(c_sock_diag_refresh_delay);
+        WaitForPortRelease(destroyNotifications, trackedPorts);
     }
 }
 
-int GnsPortTracker::ProcessSecCompNotification(seccomp_notif* notification)
+void GnsPortTracker::ProcessSecCompNotification(const seccomp_notif& notification)
 {
-    seccomp_notif notificationCopy = *notification;
-    m_request.post(notificationCopy);
-    return m_reply.get();
+    m_requests.post(notification);
 }
 
 void GnsPortTracker::Run()
 {
     // This method consumes seccomp notifications and allows / disallows port allocations
-    // depending on wsl core's response.
+    // depending on wsl core's response. All the pending notifications are processed together,
+    // so the host is only waited on once for all of them.
     // After dealing with a notification it also looks at the bound ports list to check
     // for port deallocation
 
@@ -79,46 +132,15 @@ void GnsPortTracker::Run()
 
     for (;;)
     {
-        std::optional<BindCall> bindCall;
-        try
-        {
-            bindCall = ReadNextRequest();
-        }
-        catch (const std::exception& e)
-        {
-            GNS_LOG_ERROR("Failed to read bind request, {}", e.what());
-        }
-
-        if (bindCall.has_value())
+        const auto notifications = m_requests.try_get_all(c_bpf_poll_timeout, c_max_port_requests);
+        if (!notifications.empty())
         {
-            int result = 0;
-            if (bindCall->Request.has_value())
-            {
-                PortAllocation& allocationRequest = bindCall->Request.value();
-                result = HandleRequest(allocationRequest);
-                if (result == 0)
-                {
-                    m_allocatedPorts.emplace(std::make_pair(allocationRequest, std::make_optional(time(nullptr) + c_bind_timeout_seconds)));
-                    GNS_LOG_INFO(
-                        "Tracking bind call: family ({}) port ({}) protocol ({})",
-                        allocationRequest.Family,
-                        allocationRequest.Port,
-                        allocationRequest.Protocol);
-                }
-            }
-
-            try
-            {
-                CompleteRequest(bindCall->CallId, result);
-            }
-            catch (const std::exception& e)
-            {
-                GNS_LOG_ERROR("Failed to complete bind request, {}", e.what());
-            }
+            ProcessBindCalls(notifications);
         }
 
-        // If bindCall is empty, then the read() timed out. Look for any closed port
-        if (future.has_value() && future->wait_for(c_sock_diag_poll_timeout) == std::future_status::ready)
+        // If there were no notifications, then the read() timed out or the refresh completed. Look for any closed port.
+        // The refresh interrupts the wait for notifications when it completes, so there's no need to wait for it here.
+        if (future.has_value() && future->wait_for(std::chrono::seconds::zero()) == std::future_status::ready)
         {
             refreshResult.emplace(future->get());
             future.reset();
@@ -127,7 +149,7 @@ void GnsPortTracker::Run()
             // If this loop's iteration had a bind call, it's possible that RefreshAllocatedPort
             // was called before the bind called was processed. Make sure that the port list
             // is up to date (If this is called, the next block will schedule another refresh)
-            if (!bindCall.has_value())
+            if (notifications.empty())
             {
                 OnRefreshAllocatedPorts(refreshResult->Ports, refreshResult->Timestamp);
             }
@@ -136,20 +158,37 @@ void GnsPortTracker::Run()
         // Only look at bound ports if there's something to deallocate to avoid wasting cycles
         if (refreshResult.has_value() && !m_allocatedPorts.empty())
         {
+            std::set<PortAllocation> trackedPorts;
+            for (const auto& e : m_allocatedPorts)
+            {
+                trackedPorts.insert(e.first);
+            }
+
             future = m_allocatedPortsRefresh.get_future();
-            refreshResult->Resume(); // This will resume the sock_diag thread
+            refreshResult->Resume(std::move(trackedPorts)); // This will resume the sock_diag thread
             refreshResult.reset();
         }
     }
 }
 
-std::set<GnsPortTracker::PortAllocation> GnsPortTracker::ListAllocatedPorts()
+std::set<GnsPortTracker::PortAllocation> GnsPortTracker::ListAllocatedPorts(const std::set<PortAllocation>& TrackedPorts)
 {
+    // Only the sockets bound to tracked ports are looked up, using a bytecode filter so the kernel
+    // doesn't return the other sockets. Each family and protocol is only looked up if a port is
+    // tracked for it.
+    std::map<std::pair<int, int>, std::vector<std::uint16_t>> trackedPorts;
+    for (const auto& e : TrackedPorts)
+    {
+        auto& ports = trackedPorts[{e.Family, e.Protocol}];
+        if (ports.empty() || ports.back() != e.Port)
+        {
+            ports.push_back(e.Port);
+        }
+    }
+
     std::set<PortAllocation> ports;
 
     inet_diag_req_v2 message{};
-    message.sdiag_family = AF_INET;
-    message.sdiag_protocol = IPPROTO_TCP;
     message.idiag_states = ~0;
 
     auto onMessage = [&](const NetlinkResponse& response) {
@@ -173,31 +212,71 @@ std::set<GnsPortTracker::PortAllocation> GnsPortTracker::ListAllocatedPorts()
         }
     };
 
+    for (const auto& [key, familyPorts] : trackedPorts)
     {
-        auto transaction = m_channel.CreateTransaction(message, SOCK_DIAG_BY_FAMILY, NLM_F_DUMP);
+        message.sdiag_family = key.first;
+        message.sdiag_protocol = key.second;
+
+        if (familyPorts.size() > c_sock_diag_max_filter_ports)
+        {
+            auto transaction = m_channel.CreateTransaction(message, SOCK_DIAG_BY_FAMILY, NLM_F_DUMP);
+            transaction.Execute(onMessage);
+            continue;
+        }
+
+        const auto filter = BuildPortFilter(familyPorts);
+        const auto filterSize = filter.size() * sizeof(inet_diag_bc_op);
+
+        // The filter is passed as an attribute following the request.
+        std::vector<char> request(sizeof(message) + NLA_HDRLEN + filterSize);
+        memcpy(request.data(), &message, sizeof(message));
+        auto* attribute = reinterpret_cast<nlattr*>(request.data() + sizeof(message));
+        attribute->nla_len = NLA_HDRLEN + filterSize;
+        attribute->nla_type = INET_DIAG_REQ_BYTECODE;
+        memcpy(request.data() + sizeof(message) + NLA_HDRLEN, filter.data(), filterSize);
+
+        auto transaction = m_channel.CreateTransaction(request.data(), request.size(), SOCK_DIAG_BY_FAMILY, NLM_F_DUMP);
         transaction.Execute(onMessage);
     }
 
-    message.sdiag_family = AF_INET6;
+    return ports;
+}
+
+std::optional<SocketDestroyNotifications> GnsPortTracker::OpenSocketDestroyNotifications()
+{
+    // Subscribing to socket destruction requires CAP_NET_ADMIN. If it fails, ports are only
+    // released by the periodic refresh.
+    try
     {
-        auto transaction = m_channel.CreateTransaction(message, SOCK_DIAG_BY_FAMILY, NLM_F_DUMP);
-        transaction.Execute(onMessage);
+        return SocketDestroyNotifications{{SKNLGRP_INET_TCP_DESTROY, SKNLGRP_INET_UDP_DESTROY, SKNLGRP_INET6_TCP_DESTROY, SKNLGRP_INET6_UDP_DESTROY}};
     }
+    catch (const std::exception& e)
+    {
+        GNS_LOG_ERROR("Failed to subscribe to socket destruction, {}", e.what());
+        return {};
+    }
+}
 
-    message.sdiag_protocol = IPPROTO_UDP;
-    message.sdiag_family = AF_INET;
+void GnsPortTracker::WaitForPortRelease(std::optional<SocketDestroyNotifications>& DestroyNotifications, const std::set<PortAllocation>& TrackedPorts)
+{
+    // Wait until the next refresh is due, or until a socket bound to a tracked port is destroyed.
+    // The refresh is still needed to find out whether another socket is bound to the same port,
+    // and when bind() calls that were not visible yet complete.
+    if (!DestroyNotifications)
     {
-        auto transaction = m_channel.CreateTransaction(message, SOCK_DIAG_BY_FAMILY, NLM_F_DUMP);
-        transaction.Execute(onMessage);
+        std::this_thread::sleep_for(c_sock_diag_refresh_delay);
+        return;
     }
 
-    message.sdiag_family = AF_INET6;
+    std::set<std::pair<int, std::uint16_t>> trackedPorts;
+    for (const auto& e : TrackedPorts)
     {
-        auto transaction = m_channel.CreateTransaction(message, SOCK_DIAG_BY_FAMILY, NLM_F_DUMP);
-        transaction.Execute(onMessage);
+        trackedPorts.emplace(e.Family, e.Port);
     }
 
-    return ports;
+    DestroyNotifications->Wait(c_sock_diag_refresh_delay, [&trackedPorts](const inet_diag_msg& socket) {
+        return trackedPorts.contains({static_cast<int>(socket.idiag_family), ntohs(socket.id.idiag_sport)});
+    });
 }
 
 void GnsPortTracker::OnRefreshAllocatedPorts(const std::set<PortAllocation>& Ports, time_t Timestamp)
@@ -210,18 +289,14 @@ void GnsPortTracker::OnRefreshAllocatedPorts(const std::set<PortAllocation>& Por
     // - The port has been seen to be allocated (if so, then the timeout is empty)
     // - The timeout has expired
 
+    std::vector<PortAllocation> releasedPorts;
     for (auto it = m_allocatedPorts.begin(); it != m_allocatedPorts.end();)
     {
         if (Ports.find(it->first) == Ports.end())
         {
             if (!it->second.has_value() || it->second.value() < Timestamp)
             {
-                auto result = RequestPort(it->first, false);
-                if (result != 0)
-                {
-                    std::cerr << "GnsPortTracker: Failed to deallocate port " << it->first << ", " << result << std::endl;
-                }
-
+                releasedPorts.push_back(it->first);
                 GNS_LOG_INFO(
                     "No longer tracking bind call: family ({}) port ({}) protocol ({})",
                     it->first.Family,
@@ -238,55 +313,118 @@ void GnsPortTracker::OnRefreshAllocatedPorts(const std::set<PortAllocation>& Por
 
         it++;
     }
-}
 
-int GnsPortTracker::RequestPort(const PortAllocation& Port, bool allocate)
-{
-    LX_GNS_PORT_ALLOCATION_REQUEST request{};
-    request.Header.MessageType = LxGnsMessagePortMappingRequest;
-    request.Header.MessageSize = sizeof(request);
-    request.Af = Port.Family;
-    request.Protocol = Port.Protocol;
-    request.Port = Port.Port;
-    request.Allocate = allocate;
-    static_assert(sizeof(request.Address32) == 16);
-    static_assert(sizeof(request.Address32) == sizeof(Port.Address.s6_addr32));
-    memcpy(request.Address32, Port.Address.s6_addr32, sizeof(request.Address32));
-
-    const auto& response = m_hvSocketChannel->Transaction(request);
-
-    return response.Result;
+    const auto results = RequestPorts(releasedPorts, false);
+    for (size_t index = 0; index < releasedPorts.size(); index++)
+    {
+        if (results[index] != 0)
+        {
+            std::cerr << "GnsPortTracker: Failed to deallocate port " << releasedPorts[index] << ", " << results[index] << std::endl;
+        }
+    }
 }
 
-int GnsPortTracker::HandleRequest(const PortAllocation& Port)
+std::vector<int> GnsPortTracker::RequestPorts(const std::vector<PortAllocation>& Ports, bool Allocate)
 {
-    // If the port is already allocated, let the call go through and the kernel will
-    // decide if bind() should succeed or not
-    // Note: Returning 0 will also cause the port's timeout to be updated
+    // The host handles the requests in order, so all the requests of a batch are sent before reading
+    // their responses. This way the batch only waits for a single round trip to the host.
+    std::vector<int> results;
+    results.reserve(Ports.size());
 
-    if (m_allocatedPorts.contains(Port))
+    std::lock_guard lock{m_channelLock};
+    for (size_t offset = 0; offset < Ports.size(); offset += c_max_port_requests)
     {
-        GNS_LOG_INFO("Request for a port that's already reserved (family {}, port {}, protocol {})", Port.Family, Port.Port, Port.Protocol);
-        return 0;
+        const auto count = std::min(c_max_port_requests, Ports.size() - offset);
+        for (size_t index = offset; index < offset + count; index++)
+        {
+            const auto& port = Ports[index];
+            LX_GNS_PORT_ALLOCATION_REQUEST request{};
+            request.Header.MessageType = LxGnsMessagePortMappingRequest;
+            request.Header.MessageSize = sizeof(request);
+            request.Af = port.Family;
+            request.Protocol = port.Protocol;
+            request.Port = port.Port;
+            request.Allocate = Allocate;
+            static_assert(sizeof(request.Address32) == 16);
+            static_assert(sizeof(request.Address32) == sizeof(port.Address.s6_addr32));
+            memcpy(request.Address32, port.Address.s6_addr32, sizeof(request.Address32));
+
+            m_hvSocketChannel->SendMessage(request);
+        }
+
+        for (size_t index = 0; index < count; index++)
+        {
+            results.push_back(m_hvSocketChannel->ReceiveMessage<LX_GNS_PORT_ALLOCATION_REQUEST::TResponse>().Result);
+        }
     }
 
-    // Ask the host for this port otherwise
-    const auto error = RequestPort(Port, true);
-    GNS_LOG_INFO(
-        "Requested the host for port allocation on port (family {}, port {}, protocol {}) - returned {}", Port.Family, Port.Port, Port.Protocol, error);
-    return error;
+    return results;
 }
 
-std::optional<GnsPortTracker::BindCall> GnsPortTracker::ReadNextRequest()
+void GnsPortTracker::ProcessBindCalls(const std::vector<seccomp_notif>& Notifications)
 {
-    // Read the call information
-    auto request_value = m_request.try_get(c_bpf_poll_timeout);
-    if (!request_value.has_value())
+    // Calls that don't need a port allocation are completed right away. The ports needed by the
+    // other calls are requested from the host together, and calls for the same port share the
+    // host's response.
+    std::vector<PortAllocation> requests;
+    std::vector<std::vector<uint64_t>> requestCalls;
+    for (const auto& notification : Notifications)
     {
-        return {};
+        auto bindCall = ParseBindCall(notification);
+        if (!bindCall.Request.has_value())
+        {
+            CompleteRequest(bindCall.CallId, 0);
+            continue;
+        }
+
+        // If the port is already allocated, let the call go through and the kernel will
+        // decide if bind() should succeed or not
+        const auto& port = bindCall.Request.value();
+        if (m_allocatedPorts.contains(port))
+        {
+            GNS_LOG_INFO("Request for a port that's already reserved (family {}, port {}, protocol {})", port.Family, port.Port, port.Protocol);
+            CompleteRequest(bindCall.CallId, 0);
+            continue;
+        }
+
+        const auto request = std::find_if(requests.begin(), requests.end(), [&port](const PortAllocation& e) {
+            return !(e < port) && !(port < e);
+        });
+
+        if (request != requests.end())
+        {
+            requestCalls[request - requests.begin()].push_back(bindCall.CallId);
+            continue;
+        }
+
+        requests.push_back(port);
+        requestCalls.push_back({bindCall.CallId});
+    }
+
+    const auto results = RequestPorts(requests, true);
+    for (size_t index = 0; index < requests.size(); index++)
+    {
+        const auto& port = requests[index];
+        const auto result = results[index];
+        GNS_LOG_INFO(
+            "Requested the host for port allocation on port (family {}, port {}, protocol {}) - returned {}", port.Family, port.Port, port.Protocol, result);
+
+        if (result == 0)
+        {
+            m_allocatedPorts.emplace(std::make_pair(port, std::make_optional(time(nullptr) + c_bind_timeout_seconds)));
+            GNS_LOG_INFO("Tracking bind call: family ({}) port ({}) protocol ({})", port.Family, port.Port, port.Protocol);
+        }
+
+        for (const auto callId : requestCalls[index])
+        {
+            CompleteRequest(callId, result);
+        }
     }
+}
 
-    auto callInfo = request_value.value();
+GnsPortTracker::BindCall GnsPortTracker::ParseBindCall(const seccomp_notif& Notification)
+{
+    auto callInfo = Notification;
 
     // This logic needs to be defensive because the calling process is blocked until
     // CompleteRequest() is called, so if the call information can't be processed because
@@ -295,12 +433,13 @@ std::optional<GnsPortTracker::BindCall> GnsPortTracker::ReadNextRequest()
 
     try
     {
-        return GetCallInfo(callInfo.id, callInfo.pid, callInfo.data.arch, callInfo.data.nr, gsl::make_span(callInfo.data.args));
+        return GetCallInfo(callInfo.id, callInfo.pid, callInfo.data.arch, callInfo.data.nr, gsl::make_span(callInfo.data.args))
+            .value_or(BindCall{{}, callInfo.id});
     }
     catch (const std::exception& e)
     {
         GNS_LOG_ERROR("Fetch to read bind() call info with ID {}lu for pid {}, {}", callInfo.id, callInfo.pid, e.what());
-        return {{{}, callInfo.id}};
+        return {{}, callInfo.id};
     }
 }
 
@@ -313,10 +452,12 @@ std::optional<GnsPortTracker::BindCall> GnsPortTracker::GetCallInfo(
             return {{{}, CallId}}; // Invalid sockaddr. Let it go through.
         }
 
-        auto networkNamespace = std::filesystem::read_symlink(std::format("/proc/{}/ns/net", Pid)).string();
+        // The namespace is compared by inode, which only takes a single stat() call. It can't be cached
+        // for a pid, since a thread can switch to another namespace with setns() between its bind() calls.
+        const auto networkNamespace = GetNetworkNamespace(std::format("/proc/{}/ns/net", Pid));
         if (networkNamespace != m_networkNamespace)
         {
-            GNS_LOG_INFO("Skipping bind() call for pid {} in network namespace {}", Pid, networkNamespace.c_str());
+            GNS_LOG_INFO("Skipping bind() call for pid {} in network namespace {}", Pid, networkNamespace.second);
             return {{{}, CallId}}; // Different network namespace. Let it go through.
         }
 
@@ -403,32 +544,23 @@ std::optional<GnsPortTracker::BindCall> GnsPortTracker::GetCallInfo(
 
 void GnsPortTracker::CompleteRequest(uint64_t id, int result)
 {
-    m_reply.post(result);
+    m_seccompDispatcher->CompleteNotification(id, result);
 }
 
 int GnsPortTracker::GetSocketProtocol(int pid, int fd)
 {
     const auto path = std::format("/proc/{}/fd/{}", pid, fd);
 
-    // Because there's a race between the time where the buffer size is determined and
-    // and the actual getxattr() call, retry until the buffer size is big enough
-    std::string protocol;
-    int result = -1;
-    do
-    {
-        int bufferSize = Syscall(getxattr, path.c_str(), "system.sockprotoname", nullptr, 0);
-        protocol.resize(std::max(0, bufferSize - 1));
-
-        result = getxattr(path.c_str(), "system.sockprotoname", protocol.data(), bufferSize);
-    } while (result < 0 && errno == ERANGE);
-
+    // The protocol names are short, so they're read with a single getxattr() call.
+    char buffer[32];
+    const auto result = getxattr(path.c_str(), "system.sockprotoname", buffer, sizeof(buffer));
     if (result < 0)
     {
-        RuntimeErrorWithSourceLocation(std::format("Failed to read protocol for socket: {}, {}", path, errno));
+        throw RuntimeErrorWithSourceLocation(std::format("Failed to read protocol for socket: {}, {}", path, errno));
     }
 
-    // In case the size of the attribute shrunk between the two getxattr calls
-    protocol.resize(std::max(0, result - 1));
+    // The attribute includes the null terminator
+    const std::string_view protocol(buffer, strnlen(buffer, result));
 
     if (protocol == "TCP" || protocol == "TCPv6")
     {
@@ -6,10 +6,14 @@
 #include <utility>
 #include <optional>
 #include <NetlinkChannel.h>
+#include <SocketDestroyNotifications.h>
 #include <future>
 #include <functional>
 #include <memory>
+#include <mutex>
+#include <vector>
 #include <time.h>
+#include <sys/stat.h>
 #include "util.h"
 #include <linux/seccomp.h>
 #include "waitablevalue.h"
@@ -28,7 +32,17 @@ public:
 
     void Run();
 
-    int ProcessSecCompNotification(seccomp_notif* notification);
+    // Queue a bind() call. The call is completed once the host responded to its port allocation.
+    void ProcessSecCompNotification(const seccomp_notif& notification);
+
+    // Send a message to the host and return its result. The port allocation requests are sent
+    // on the same channel, so the transactions are serialized with them.
+    template <typename TMessage>
+    int Transaction(TMessage& Message)
+    {
+        std::lock_guard lock{m_channelLock};
+        return m_hvSocketChannel->Transaction(Message).Result;
+    }
 
     struct PortAllocation
     {
@@ -98,45 +112,54 @@ public:
         std::uint64_t CallId;
     };
 
+    // The ports found by a refresh. Resume starts the next refresh, which looks up the given
+    // tracked ports.
     struct PortRefreshResult
     {
         std::set<PortAllocation> Ports;
         time_t Timestamp;
-        std::function<void()> Resume;
+        std::function<void(std::set<PortAllocation>)> Resume;
     };
 
+    // Returns the sockets bound to the tracked ports. Also used by portbench.
+    std::set<PortAllocation> ListAllocatedPorts(const std::set<PortAllocation>& TrackedPorts);
+
+    static std::optional<SocketDestroyNotifications> OpenSocketDestroyNotifications();
+
+    // Waits until a socket bound to a tracked port is destroyed, or for the refresh interval.
+    static void WaitForPortRelease(std::optional<SocketDestroyNotifications>& DestroyNotifications, const std::set<PortAllocation>& TrackedPorts);
+
 private:
     void OnRefreshAllocatedPorts(const std::set<PortAllocation>& Ports, time_t Timestamp);
 
     void RunPortRefresh();
 
-    std::set<PortAllocation> ListAllocatedPorts();
+    void ProcessBindCalls(const std::vector<seccomp_notif>& Notifications);
 
-    std::optional<BindCall> ReadNextRequest();
+    BindCall ParseBindCall(const seccomp_notif& Notification);
 
     std::optional<BindCall> GetCallInfo(uint64_t CallId, pid_t Pid, int Arch, int SysCallNumber, const gsl::span<unsigned long long>& Arguments);
 
-    int RequestPort(const PortAllocation& Port, bool Allocate);
+    std::vector<int> RequestPorts(const std::vector<PortAllocation>& Ports, bool Allocate);
 
     int ClosePort(const PortAllocation& Port);
 
-    int HandleRequest(const PortAllocation& Request);
-
     void CompleteRequest(uint64_t Id, int Result);
 
     static int GetSocketProtocol(int Pid, int Fd);
 
     std::map<PortAllocation, std::optional<time_t>> m_allocatedPorts;
     std::shared_ptr<wsl::shared::SocketChannel> m_hvSocketChannel;
+    std::mutex m_channelLock;
     NetlinkChannel m_channel;
     std::promise<PortRefreshResult> m_allocatedPortsRefresh;
 
-    WaitableValue<seccomp_notif> m_request;
-    WaitableValue<int> m_reply;
+    WaitableQueue<seccomp_notif> m_requests;
 
     std::shared_ptr<SecCompDispatcher> m_seccompDispatcher;
 
-    std::string m_networkNamespace;
+    // Device and inode of this process' network namespace.
+    std::pair<dev_t, ino_t> m_networkNamespace;
 };
 
 std::ostream& operator<<(std::ostream& out, const GnsPortTracker::PortAllocation& portAllocation);
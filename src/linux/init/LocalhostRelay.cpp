@@ -0,0 +1,436 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include "LocalhostRelay.h"
+
+// Max number of events to be returned by epoll_wait()
+constexpr int c_epollWaitMaxEvents = 64;
+// Size of the buffer used to relay data if the host doesn't request one
+constexpr size_t c_defaultBufferSize = 64 * 1024;
+// Time after which accepting connections is retried if it was paused and no connection closed
+constexpr int c_acceptRetryTimeoutMs = 1000;
+
+LocalhostRelay::LocalhostRelay(const sockaddr_vm& hvSocketAddress, wil::unique_fd&& listenSocket) :
+    m_hvSocketAddress(hvSocketAddress), m_listenSocket(std::move(listenSocket))
+{
+    m_epollFd.reset(epoll_create1(EPOLL_CLOEXEC));
+    THROW_LAST_ERROR_IF(!m_epollFd);
+
+    // Connections are accepted until accept4 would block, so the listen socket must be non-blocking.
+    const int flags = fcntl(m_listenSocket.get(), F_GETFL);
+    THROW_LAST_ERROR_IF(flags < 0);
+    THROW_LAST_ERROR_IF(fcntl(m_listenSocket.get(), F_SETFL, flags | O_NONBLOCK) < 0);
+
+    // The listen socket is identified by null epoll data.
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.ptr = nullptr;
+    THROW_LAST_ERROR_IF(epoll_ctl(m_epollFd.get(), EPOLL_CTL_ADD, m_listenSocket.get(), &event) < 0);
+}
+
+void LocalhostRelay::Run()
+{
+    epoll_event events[c_epollWaitMaxEvents];
+    for (;;)
+    {
+        const int count = epoll_wait(m_epollFd.get(), events, COUNT_OF(events), m_acceptPaused ? c_acceptRetryTimeoutMs : -1);
+        if (count < 0)
+        {
+            THROW_LAST_ERROR_IF(errno != EINTR);
+            continue;
+        }
+
+        for (int index = 0; index < count; index += 1)
+        {
+            auto* endpoint = static_cast<Endpoint*>(events[index].data.ptr);
+            if (endpoint == nullptr)
+            {
+                AcceptConnections();
+            }
+            else if (!endpoint->m_connection->m_closed)
+            {
+                HandleEvent(*endpoint, events[index].events);
+            }
+        }
+
+        // N.B. Connections are only destroyed once all the notifications have been processed, since
+        //      later notifications may refer to them. Closing the sockets removes them from epoll.
+        const bool connectionsClosed = !m_closedConnections.empty();
+        for (auto* connection : m_closedConnections)
+        {
+            m_connections.erase(connection);
+        }
+
+        m_closedConnections.clear();
+
+        // Accepting is retried once resources were released, or after a delay since they may be
+        // held by something other than the relay.
+        if (m_acceptPaused && (connectionsClosed || count == 0))
+        {
+            SetAcceptPaused(false);
+        }
+    }
+}
+
+void LocalhostRelay::AcceptConnections()
+{
+    for (;;)
+    {
+        sockaddr_vm address = m_hvSocketAddress;
+        socklen_t addressSize = sizeof(address);
+        wil::unique_fd socket{accept4(m_listenSocket.get(), reinterpret_cast<sockaddr*>(&address), &addressSize, SOCK_CLOEXEC | SOCK_NONBLOCK)};
+        if (!socket)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                return;
+            }
+            else if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+
+            else if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM)
+            {
+                // N.B. The listen socket is level-triggered, so it must stop being watched until
+                //      resources are available, otherwise epoll_wait returns immediately forever.
+                LOG_ERROR("accept4 failed {}, pausing new connections", errno);
+                SetAcceptPaused(true);
+                return;
+            }
+
+            LOG_ERROR("accept4 failed {}", errno);
+            THROW_LAST_ERROR();
+        }
+
+        auto connection = std::make_unique<Connection>();
+        connection->m_hvSocket.m_connection = connection.get();
+        connection->m_hvSocket.m_socket = std::move(socket);
+        connection->m_tcpSocket.m_connection = connection.get();
+
+        // N.B. The sockets are edge-triggered, so all the available data is relayed for each
+        //      notification. A stream that can't make progress is always waiting for its source to
+        //      be readable or its destination to be writable, so no notification is missed.
+        epoll_event event{};
+        event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+        event.data.ptr = &connection->m_hvSocket;
+        if (epoll_ctl(m_epollFd.get(), EPOLL_CTL_ADD, connection->m_hvSocket.m_socket.get(), &event) < 0)
+        {
+            // N.B. Only the new connection is dropped, by closing its socket.
+            LOG_ERROR("epoll_ctl failed {}", errno);
+            continue;
+        }
+
+        auto* key = connection.get();
+        m_connections.emplace(key, std::move(connection));
+    }
+}
+
+void LocalhostRelay::SetAcceptPaused(bool paused)
+{
+    epoll_event event{};
+    event.events = paused ? 0 : EPOLLIN;
+    event.data.ptr = nullptr;
+    THROW_LAST_ERROR_IF(epoll_ctl(m_epollFd.get(), EPOLL_CTL_MOD, m_listenSocket.get(), &event) < 0);
+    m_acceptPaused = paused;
+}
+
+void LocalhostRelay::HandleEvent(Endpoint& endpoint, uint32_t events)
+{
+    auto& connection = *endpoint.m_connection;
+    if (events & EPOLLERR)
+    {
+        Close(connection);
+        return;
+    }
+
+    switch (connection.m_state)
+    {
+    case ConnectionState::Handshake:
+        ReceiveMessage(connection);
+        return;
+
+    case ConnectionState::Connecting:
+    {
+        if (&endpoint != &connection.m_tcpSocket)
+        {
+            return;
+        }
+
+        // N.B. While the relay was being set up, the server may have stopped listening.
+        int error = 0;
+        socklen_t errorSize = sizeof(error);
+        if (getsockopt(connection.m_tcpSocket.m_socket.get(), SOL_SOCKET, SO_ERROR, &error, &errorSize) < 0 || error != 0)
+        {
+            Close(connection);
+            return;
+        }
+
+        connection.m_state = ConnectionState::Relaying;
+        break;
+    }
+
+    case ConnectionState::Relaying:
+        break;
+    }
+
+    if (!Pump(connection, connection.m_toTcpSocket) || !Pump(connection, connection.m_toHvSocket))
+    {
+        Close(connection);
+        return;
+    }
+
+    // The connection is complete once both sides have finished sending data.
+    if (connection.m_toTcpSocket.m_shutdown && connection.m_toHvSocket.m_shutdown)
+    {
+        Close(connection);
+    }
+}
+
+void LocalhostRelay::ReceiveMessage(Connection& connection)
+{
+    auto* buffer = reinterpret_cast<gsl::byte*>(&connection.m_message);
+    while (connection.m_messageSize < sizeof(connection.m_message))
+    {
+        const auto bytesRead = read(
+            connection.m_hvSocket.m_socket.get(), buffer + connection.m_messageSize, sizeof(connection.m_message) - connection.m_messageSize);
+
+        if (bytesRead < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            else if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                Close(connection);
+            }
+
+            return;
+        }
+        else if (bytesRead == 0)
+        {
+            Close(connection);
+            return;
+        }
+
+        connection.m_messageSize += bytesRead;
+    }
+
+    if (connection.m_message.Header.MessageType != LxInitMessageStartSocketRelay)
+    {
+        LOG_ERROR("Unexpected message type {}", static_cast<int>(connection.m_message.Header.MessageType));
+        Close(connection);
+        return;
+    }
+
+    Connect(connection);
+}
+
+void LocalhostRelay::Connect(Connection& connection)
+{
+    const auto& message = connection.m_message;
+    sockaddr_storage socketAddress{};
+    socklen_t socketAddressSize;
+    if (message.Family == AF_INET)
+    {
+        auto* sockaddrIn = reinterpret_cast<sockaddr_in*>(&socketAddress);
+        sockaddrIn->sin_family = AF_INET;
+        sockaddrIn->sin_port = htons(message.Port);
+        sockaddrIn->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socketAddressSize = sizeof(*sockaddrIn);
+    }
+    else if (message.Family == AF_INET6)
+    {
+        auto* sockaddrIn6 = reinterpret_cast<sockaddr_in6*>(&socketAddress);
+        sockaddrIn6->sin6_family = AF_INET6;
+        sockaddrIn6->sin6_port = htons(message.Port);
+        sockaddrIn6->sin6_addr = IN6ADDR_LOOPBACK_INIT;
+        socketAddressSize = sizeof(*sockaddrIn6);
+    }
+    else
+    {
+        LOG_ERROR("Unexpected address family {}", message.Family);
+        Close(connection);
+        return;
+    }
+
+    auto& tcpSocket = connection.m_tcpSocket.m_socket;
+    tcpSocket.reset(socket(message.Family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP));
+    if (!tcpSocket)
+    {
+        LOG_ERROR("socket failed {}", errno);
+        Close(connection);
+        return;
+    }
+
+    if (connect(tcpSocket.get(), reinterpret_cast<sockaddr*>(&socketAddress), socketAddressSize) < 0 && errno != EINPROGRESS)
+    {
+        Close(connection);
+        return;
+    }
+
+    const size_t capacity = message.BufferSize != 0 ? message.BufferSize : c_defaultBufferSize;
+    connection.m_toTcpSocket.m_source = connection.m_hvSocket.m_socket.get();
+    connection.m_toTcpSocket.m_destination = tcpSocket.get();
+    connection.m_toTcpSocket.m_capacity = capacity;
+    connection.m_toHvSocket.m_source = tcpSocket.get();
+    connection.m_toHvSocket.m_destination = connection.m_hvSocket.m_socket.get();
+    connection.m_toHvSocket.m_capacity = capacity;
+
+    // N.B. The socket is writable once the connection completes, including if it already has.
+    epoll_event event{};
+    event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    event.data.ptr = &connection.m_tcpSocket;
+    if (epoll_ctl(m_epollFd.get(), EPOLL_CTL_ADD, tcpSocket.get(), &event) < 0)
+    {
+        LOG_ERROR("epoll_ctl failed {}", errno);
+        Close(connection);
+        return;
+    }
+
+    connection.m_state = ConnectionState::Connecting;
+}
+
+bool LocalhostRelay::Pump(Connection& connection, Stream& stream)
+{
+    for (;;)
+    {
+        bool progress = false;
+        if (stream.m_pending > 0)
+        {
+            const auto bytesWritten = Write(stream);
+            if (bytesWritten > 0)
+            {
+                stream.m_pending -= bytesWritten;
+                if (stream.m_pending == 0)
+                {
+                    stream.m_bufferOffset = 0;
+                }
+
+                progress = true;
+            }
+            else if (bytesWritten < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                return false;
+            }
+        }
+
+        if (stream.m_endOfData && stream.m_pending == 0 && !stream.m_shutdown)
+        {
+            shutdown(stream.m_destination, SHUT_WR);
+            stream.m_shutdown = true;
+        }
+
+        if (!stream.m_endOfData && stream.m_bufferOffset + stream.m_pending < stream.m_capacity)
+        {
+            const auto bytesRead = Read(connection, stream);
+            if (bytesRead > 0)
+            {
+                stream.m_pending += bytesRead;
+                progress = true;
+            }
+            else if (bytesRead == 0)
+            {
+                stream.m_endOfData = true;
+                progress = true;
+            }
+            else if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                return false;
+            }
+        }
+
+        if (!progress)
+        {
+            return true;
+        }
+    }
+}
+
+ssize_t LocalhostRelay::Read(Connection& connection, Stream& stream)
+{
+    if (!stream.m_useBuffer && !stream.m_pipeRead)
+    {
+        int pipeFds[2];
+        if (pipe2(pipeFds, O_NONBLOCK | O_CLOEXEC) < 0)
+        {
+            // N.B. Each spliced connection uses four more file descriptors, so fall back to a
+            //      buffer instead of failing the connection if the limit is reached.
+            if (errno != EMFILE && errno != ENFILE)
+            {
+                return -1;
+            }
+
+            SwitchToBuffer(connection, stream);
+        }
+        else
+        {
+            stream.m_pipeRead.reset(pipeFds[0]);
+            stream.m_pipeWrite.reset(pipeFds[1]);
+
+            // Size the pipe like the buffer requested by the host, if allowed.
+            fcntl(stream.m_pipeWrite.get(), F_SETPIPE_SZ, static_cast<int>(std::min<size_t>(stream.m_capacity, INT_MAX)));
+            const int pipeSize = fcntl(stream.m_pipeWrite.get(), F_GETPIPE_SZ);
+            if (pipeSize > 0)
+            {
+                stream.m_capacity = pipeSize;
+            }
+        }
+    }
+
+    if (!stream.m_useBuffer)
+    {
+        const auto bytesRead = splice(
+            stream.m_source, nullptr, stream.m_pipeWrite.get(), nullptr, stream.m_capacity - stream.m_pending, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+        if (bytesRead >= 0 || errno != EINVAL || stream.m_pending != 0)
+        {
+            return bytesRead;
+        }
+
+        SwitchToBuffer(connection, stream);
+    }
+
+    return TEMP_FAILURE_RETRY(
+        read(stream.m_source, stream.m_buffer.data() + stream.m_bufferOffset + stream.m_pending, stream.m_capacity - stream.m_bufferOffset - stream.m_pending));
+}
+
+ssize_t LocalhostRelay::Write(Stream& stream)
+{
+    if (!stream.m_useBuffer)
+    {
+        return splice(stream.m_pipeRead.get(), nullptr, stream.m_destination, nullptr, stream.m_pending, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    }
+
+    const auto bytesWritten =
+        TEMP_FAILURE_RETRY(write(stream.m_destination, stream.m_buffer.data() + stream.m_bufferOffset, stream.m_pending));
+
+    if (bytesWritten > 0)
+    {
+        stream.m_bufferOffset += bytesWritten;
+    }
+
+    return bytesWritten;
+}
+
+void LocalhostRelay::SwitchToBuffer(Connection& connection, Stream& stream)
+{
+    WI_ASSERT(stream.m_pending == 0);
+
+    stream.m_pipeRead.reset();
+    stream.m_pipeWrite.reset();
+    stream.m_useBuffer = true;
+    stream.m_capacity = connection.m_message.BufferSize != 0 ? connection.m_message.BufferSize : c_defaultBufferSize;
+    stream.m_buffer.resize(stream.m_capacity);
+}
+
+void LocalhostRelay::Close(Connection& connection)
+{
+    if (!connection.m_closed)
+    {
+        connection.m_closed = true;
+        m_closedConnections.push_back(&connection);
+    }
+}
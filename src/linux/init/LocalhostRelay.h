@@ -0,0 +1,141 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+#pragma once
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include <linux/vm_sockets.h>
+#include "common.h"
+#include "lxinitshared.h"
+
+// Relays connections from the host's localhost listeners to the TCP sockets listening on the guest's
+// loopback addresses. All connections are serviced by a single thread using epoll. Where possible,
+// data is moved between the sockets with splice() through a pipe for each direction, so it isn't
+// copied through a userspace buffer.
+class LocalhostRelay
+{
+public:
+    // Create a relay for connections accepted on the hvsocket listen socket.
+    //
+    // Arguments:
+    //    hvSocketAddress - Address the listen socket is bound to.
+    //    listenSocket - Listening hvsocket.
+    LocalhostRelay(const sockaddr_vm& hvSocketAddress, wil::unique_fd&& listenSocket);
+    ~LocalhostRelay() noexcept = default;
+
+    LocalhostRelay(const LocalhostRelay&) = delete;
+    LocalhostRelay(LocalhostRelay&&) = delete;
+    LocalhostRelay& operator=(const LocalhostRelay&) = delete;
+    LocalhostRelay& operator=(LocalhostRelay&&) = delete;
+
+    // Relay connections until an unrecoverable error occurs.
+    void Run();
+
+private:
+    enum class ConnectionState
+    {
+        // Waiting for the LX_INIT_START_SOCKET_RELAY message on the hvsocket.
+        Handshake,
+
+        // Waiting for the connection to the TCP socket to complete.
+        Connecting,
+
+        // Relaying data in both directions.
+        Relaying
+    };
+
+    struct Connection;
+
+    // One of the sockets of a connection. The address of the endpoint is used as the epoll data.
+    struct Endpoint
+    {
+        Connection* m_connection{};
+        wil::unique_fd m_socket;
+    };
+
+    // Data relayed from one socket of a connection to the other.
+    struct Stream
+    {
+        int m_source = -1;
+        int m_destination = -1;
+
+        // Pipe the data is spliced through. This is created when data is first relayed.
+        wil::unique_fd m_pipeRead;
+        wil::unique_fd m_pipeWrite;
+
+        // Buffer used instead of the pipe if splice is not supported by one of the sockets, or no
+        // more pipes can be created.
+        bool m_useBuffer = false;
+        std::vector<gsl::byte> m_buffer;
+        size_t m_bufferOffset = 0;
+
+        // Number of bytes read from the source that have not been written to the destination yet,
+        // and the maximum number of bytes that can be held in the pipe or buffer. Once it is full,
+        // the source is not read again until the destination is writable.
+        size_t m_pending = 0;
+        size_t m_capacity = 0;
+
+        // Whether the source reached the end of its data, and whether that was forwarded to the
+        // destination by shutting down its write side.
+        bool m_endOfData = false;
+        bool m_shutdown = false;
+    };
+
+    struct Connection
+    {
+        ConnectionState m_state = ConnectionState::Handshake;
+        Endpoint m_hvSocket;
+        Endpoint m_tcpSocket;
+
+        // The relay message, which may be received in several reads.
+        LX_INIT_START_SOCKET_RELAY m_message{};
+        size_t m_messageSize = 0;
+
+        Stream m_toTcpSocket;
+        Stream m_toHvSocket;
+
+        bool m_closed = false;
+    };
+
+    // Accept all pending connections on the listen socket.
+    void AcceptConnections();
+
+    // Stop or resume watching the listen socket. Accepting is paused when accept4 fails because
+    // file descriptors or memory are exhausted, so a transient shortage doesn't stop the relay.
+    void SetAcceptPaused(bool paused);
+
+    // Handle an epoll notification for a socket of a connection.
+    void HandleEvent(Endpoint& endpoint, uint32_t events);
+
+    // Read the relay message, and connect to the requested port once it was received.
+    void ReceiveMessage(Connection& connection);
+
+    // Start connecting to the TCP port requested by the relay message.
+    void Connect(Connection& connection);
+
+    // Relay as much data as possible without blocking. Returns false if the connection failed.
+    bool Pump(Connection& connection, Stream& stream);
+
+    ssize_t Read(Connection& connection, Stream& stream);
+
+    ssize_t Write(Stream& stream);
+
+    void SwitchToBuffer(Connection& connection, Stream& stream);
+
+    // Mark a connection to be destroyed after the current epoll notifications are processed.
+    void Close(Connection& connection);
+
+    sockaddr_vm m_hvSocketAddress{};
+
+    // Declared before the sockets, so it is closed after them.
+    wil::unique_fd m_epollFd;
+
+    wil::unique_fd m_listenSocket;
+
+    bool m_acceptPaused = false;
+
+    std::unordered_map<Connection*, std::unique_ptr<Connection>> m_connections;
+
+    std::vector<Connection*> m_closedConnections;
+};
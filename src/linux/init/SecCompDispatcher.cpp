@@ -72,8 +72,6 @@ void SecCompDispatcher::Run()
         }
     };
     std::vector<uint8_t> notification_buffer(m_notificationSizes.seccomp_notif);
-    std::vector<std::uint8_t> response_buffer(m_notificationSizes.seccomp_notif_resp);
-    assert(m_notificationSizes.seccomp_notif_resp >= sizeof(seccomp_notif_resp));
     for (;;)
     {
         if (!wait_for_fd(m_notifyFd.get(), POLLIN))
@@ -115,6 +113,20 @@ void SecCompDispatcher::Run()
             callInfo->data.args[4],
             callInfo->data.args[5]);
 
+        auto asyncHandler = m_asyncHandlers.find(callInfo->data.nr);
+        if (asyncHandler != m_asyncHandlers.end())
+        {
+            try
+            {
+                asyncHandler->second(*callInfo);
+                continue;
+            }
+            catch (std::exception& e)
+            {
+                GNS_LOG_ERROR("Dispatch of call failed, {}", e.what());
+            }
+        }
+
         auto handler = m_handlers.find(callInfo->data.nr);
 
         try
@@ -129,24 +141,33 @@ void SecCompDispatcher::Run()
             GNS_LOG_ERROR("Dispatch of call failed, {}", e.what());
         }
 
-        response_buffer.clear();
-        response_buffer.resize(m_notificationSizes.seccomp_notif_resp);
+        CompleteNotification(callInfo->id, result);
+    }
+}
 
+/**
+ * @brief Send the result of a call. If the result is 0, the call is allowed to continue, otherwise it fails with the given error.
+ *
+ */
+void SecCompDispatcher::CompleteNotification(uint64_t Id, int Result) noexcept
+{
+    assert(m_notificationSizes.seccomp_notif_resp >= sizeof(seccomp_notif_resp));
+
+    GNS_LOG_INFO("Responding to notification with id {}lu, result {}", Id, Result);
+    try
+    {
+        std::vector<std::uint8_t> response_buffer(m_notificationSizes.seccomp_notif_resp);
         auto* resultInfo = reinterpret_cast<seccomp_notif_resp*>(response_buffer.data());
-        resultInfo->id = callInfo->id;
-        resultInfo->error = -result;
+        resultInfo->id = Id;
+        resultInfo->error = -Result;
         resultInfo->val = 0;
-        resultInfo->flags = result == 0 ? SECCOMP_USER_NOTIF_FLAG_CONTINUE : 0;
+        resultInfo->flags = Result == 0 ? SECCOMP_USER_NOTIF_FLAG_CONTINUE : 0;
 
-        GNS_LOG_INFO("Responding to notification with id {}lu for pid {}, result {}", callInfo->id, callInfo->pid, result);
-        try
-        {
-            Syscall(ioctl, m_notifyFd.get(), SECCOMP_IOCTL_NOTIF_SEND, resultInfo);
-        }
-        catch (std::exception& e)
-        {
-            GNS_LOG_ERROR("Failed to respond to notification with id {}lu for pid {}, {}", callInfo->id, callInfo->pid, e.what());
-        }
+        Syscall(ioctl, m_notifyFd.get(), SECCOMP_IOCTL_NOTIF_SEND, resultInfo);
+    }
+    catch (std::exception& e)
+    {
+        GNS_LOG_ERROR("Failed to respond to notification with id {}lu, {}", Id, e.what());
     }
 }
 
@@ -169,9 +190,15 @@ void SecCompDispatcher::RegisterHandler(int SysCallNr, const std::function<int(s
     m_handlers[SysCallNr] = Handler;
 }
 
+void SecCompDispatcher::RegisterAsyncHandler(int SysCallNr, const std::function<void(const seccomp_notif&)>& Handler)
+{
+    m_asyncHandlers[SysCallNr] = Handler;
+}
+
 void SecCompDispatcher::UnregisterHandler(int SysCallNr)
 {
     m_handlers.erase(SysCallNr);
+    m_asyncHandlers.erase(SysCallNr);
 }
 
 std::optional<std::vector<gsl::byte>> SecCompDispatcher::ReadProcessMemory(uint64_t Cookie, pid_t Pid, size_t Address, size_t Length) noexcept
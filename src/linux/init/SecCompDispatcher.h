@@ -24,8 +24,16 @@ public:
     SecCompDispatcher& operator=(SecCompDispatcher&&) = delete;
 
     void RegisterHandler(int SysCallNr, const std::function<int(seccomp_notif*)>& Handler);
+
+    // Register a handler that doesn't complete the call when it returns. The call is completed later,
+    // possibly from another thread, with CompleteNotification(), so other notifications can be
+    // dispatched while the call is pending.
+    void RegisterAsyncHandler(int SysCallNr, const std::function<void(const seccomp_notif&)>& Handler);
+
     void UnregisterHandler(int SysCallNr);
 
+    void CompleteNotification(uint64_t Id, int Result) noexcept;
+
     bool ValidateCookie(uint64_t id) noexcept;
 
     std::optional<std::vector<gsl::byte>> ReadProcessMemory(uint64_t cookie, pid_t pid, size_t address, size_t length) noexcept;
@@ -35,6 +43,7 @@ private:
 
     seccomp_notif_sizes m_notificationSizes;
     std::map<int, std::function<int(seccomp_notif*)>> m_handlers;
+    std::map<int, std::function<void(const seccomp_notif&)>> m_asyncHandlers;
     wil::unique_fd m_notifyFd;
     wil::unique_fd m_shutdown;
     std::thread m_worker;
@@ -45,6 +45,10 @@ WslDistributionConfig::WslDistributionConfig(const char* configFilePath)
         ConfigKey("fileServer.logFile", Plan9LogFile),
         ConfigKey("fileServer.logLevel", Plan9LogLevel),
         ConfigKey("fileServer.logTruncate", Plan9LogTruncate),
+        ConfigKey("fileServer.requestLimit", Plan9RequestLimit),
+        ConfigKey("fileServer.warmThreads", Plan9WarmThreads),
+        ConfigKey("fileServer.writeBehind", Plan9WriteBehind),
+        ConfigKey("fileServer.epollThreads", Plan9EpollThreads),
 
         ConfigKey(c_ConfigGpuEnabledOption, GpuEnabled),
         ConfigKey(c_ConfigAppendGpuLibPathOption, AppendGpuLibPath),
@@ -73,6 +73,10 @@ struct WslDistributionConfig
     std::optional<std::string> Plan9LogFile;
     int Plan9LogLevel = TRACE_LEVEL_INFORMATION;
     bool Plan9LogTruncate = true;
+    int Plan9RequestLimit = 32;
+    int Plan9WarmThreads = 1;
+    bool Plan9WriteBehind = false;
+    int Plan9EpollThreads = 0;
     int Umask = 0022;
     bool AppendGpuLibPath = true;
     bool GpuEnabled = true;
@@ -30,6 +30,7 @@ Abstract:
 #include <cstddef>
 #include <lxbusapi.h>
 #include "p9tracelogging.h"
+#include "p9fs.h"
 #include "common.h"
 #include "config.h"
 #include "util.h"
@@ -3183,10 +3184,17 @@ unsigned int StartPlan9(int Argc, char** Argv)
 {
     constexpr auto* Usage = "Usage: plan9 " LX_INIT_PLAN9_CONTROL_SOCKET_ARG " fd " LX_INIT_PLAN9_SOCKET_PATH_ARG
                             " path " LX_INIT_PLAN9_SERVER_FD_ARG " fd " LX_INIT_PLAN9_LOG_FILE_ARG
-                            " log-file " LX_INIT_PLAN9_LOG_LEVEL_ARG " level " LX_INIT_PLAN9_PIPE_FD_ARG " fd [--log-truncate]\n";
+                            " log-file " LX_INIT_PLAN9_LOG_LEVEL_ARG " level " LX_INIT_PLAN9_PIPE_FD_ARG
+                            " fd [" LX_INIT_PLAN9_REQUEST_LIMIT_ARG " count] [" LX_INIT_PLAN9_WARM_THREADS_ARG
+                            " count] [" LX_INIT_PLAN9_WRITE_BEHIND_ARG "] [" LX_INIT_PLAN9_EPOLL_THREADS_ARG
+                            " count] [--log-truncate]\n";
 
     bool LogTruncate = false;
     int LogLevel = TRACE_LEVEL_INFORMATION;
+    int RequestLimit = p9fs::c_DefaultRequestLimit;
+    int WarmThreads = p9fs::c_DefaultWarmThreads;
+    bool WriteBehind = false;
+    int EpollThreads = p9fs::c_AutomaticEpollThreads;
     wil::unique_fd PipeFd;
     const char* SocketPath{};
     const char* LogFile{};
@@ -3201,6 +3209,10 @@ unsigned int StartPlan9(int Argc, char** Argv)
     parser.AddArgument(Integer{LogLevel}, LX_INIT_PLAN9_LOG_LEVEL_ARG);
     parser.AddArgument(UniqueFd{PipeFd}, LX_INIT_PLAN9_PIPE_FD_ARG);
     parser.AddArgument(LogTruncate, LX_INIT_PLAN9_TRUNCATE_LOG_ARG);
+    parser.AddArgument(Integer{RequestLimit}, LX_INIT_PLAN9_REQUEST_LIMIT_ARG);
+    parser.AddArgument(Integer{WarmThreads}, LX_INIT_PLAN9_WARM_THREADS_ARG);
+    parser.AddArgument(WriteBehind, LX_INIT_PLAN9_WRITE_BEHIND_ARG);
+    parser.AddArgument(Integer{EpollThreads}, LX_INIT_PLAN9_EPOLL_THREADS_ARG);
 
     try
     {
@@ -3212,7 +3224,7 @@ unsigned int StartPlan9(int Argc, char** Argv)
         return 1;
     }
 
-    RunPlan9Server(SocketPath, LogFile, LogLevel, LogTruncate, ControlSocket.get(), ServerFd.get(), PipeFd);
+    RunPlan9Server(SocketPath, LogFile, LogLevel, LogTruncate, ControlSocket.get(), ServerFd.get(), RequestLimit, WarmThreads, WriteBehind, EpollThreads, PipeFd);
 
     return 0;
 }
@@ -1,8 +1,10 @@
 // Copyright (C) Microsoft Corporation. All rights reserved.
 #include "common.h"
 #include <memory>
+#include <optional>
 #include <string>
 #include <string_view>
+#include <unordered_set>
 #include <vector>
 #include <iostream>
 
@@ -14,10 +16,15 @@
 #include <linux/unistd.h>
 #include <lxwil.h>
 #include <linux/if_tun.h>
+#include <linux/inet_diag.h>
+#include <linux/sock_diag.h>
 
 #include "util.h"
 #include "SocketChannel.h"
+#include "NetlinkTransactionError.h"
+#include "SocketDestroyNotifications.h"
 #include "GnsPortTracker.h"
+#include "LocalhostRelay.h"
 #include "SecCompDispatcher.h"
 #include "seccomp_defs.h"
 #include "CommandLine.h"
@@ -26,124 +33,9 @@
 
 namespace {
 
-void ListenThread(sockaddr_vm hvSocketAddress, int listenSocket)
-{
-    pollfd pollDescriptors[] = {{listenSocket, POLLIN}};
-    for (;;)
-    {
-        int result = poll(pollDescriptors, COUNT_OF(pollDescriptors), -1);
-        if (result < 0)
-        {
-            LOG_ERROR("poll failed {}", errno);
-            return;
-        }
-
-        if ((pollDescriptors[0].revents & POLLIN) == 0)
-        {
-            LOG_ERROR("unexpected revents {:x}", pollDescriptors[0].revents);
-            return;
-        }
-
-        // Accept a connection and start a relay worker thread.
-        wil::unique_fd relaySocket{UtilAcceptVsock(listenSocket, hvSocketAddress)};
-        THROW_LAST_ERROR_IF(!relaySocket);
-
-        std::thread([relaySocket = std::move(relaySocket)]() {
-            try
-            {
-                // Read a message to determine which TCP port to connect to.
-                std::vector<gsl::byte> buffer(sizeof(LX_INIT_START_SOCKET_RELAY));
-                auto bytesRead = UtilReadBuffer(relaySocket.get(), buffer);
-                if (bytesRead == 0)
-                {
-                    return;
-                }
-
-                auto* message = gslhelpers::try_get_struct<LX_INIT_START_SOCKET_RELAY>(gsl::make_span(buffer.data(), bytesRead));
-                THROW_ERRNO_IF(EINVAL, !message || (message->Header.MessageType != LxInitMessageStartSocketRelay));
-
-                // Connect to the actual socket address and set up a relay.
-                //
-                // N.B. While the relay was being set up, the server may have
-                //      stopped listening.
-                sockaddr* socketAddress;
-                int socketAddressSize;
-                sockaddr_in sockaddrIn{};
-                sockaddr_in6 sockaddrIn6{};
-                if (message->Family == AF_INET)
-                {
-                    sockaddrIn.sin_family = AF_INET;
-                    sockaddrIn.sin_port = htons(message->Port);
-                    sockaddrIn.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
-                    socketAddress = reinterpret_cast<sockaddr*>(&sockaddrIn);
-                    socketAddressSize = sizeof(sockaddrIn);
-                }
-                else if (message->Family == AF_INET6)
-                {
-                    sockaddrIn6.sin6_family = AF_INET6;
-                    sockaddrIn6.sin6_port = htons(message->Port);
-                    sockaddrIn6.sin6_addr = IN6ADDR_LOOPBACK_INIT;
-                    socketAddress = reinterpret_cast<sockaddr*>(&sockaddrIn6);
-                    socketAddressSize = sizeof(sockaddrIn6);
-                }
-                else
-                {
-                    THROW_ERRNO(EINVAL);
-                }
-
-                wil::unique_fd tcpSocket{socket(socketAddress->sa_family, SOCK_STREAM, IPPROTO_TCP)};
-                THROW_LAST_ERROR_IF(!tcpSocket);
-
-                if (TEMP_FAILURE_RETRY(connect(tcpSocket.get(), socketAddress, socketAddressSize)) < 0)
-                {
-                    return;
-                }
-
-                // Resize the buffer to be the requested size.
-                buffer.resize(message->BufferSize);
-
-                // Begin relaying data.
-                int outFd[2] = {tcpSocket.get(), relaySocket.get()};
-                pollfd pollDescriptors[] = {{relaySocket.get(), POLLIN}, {tcpSocket.get(), POLLIN}};
-
-                for (;;)
-                {
-                    if ((pollDescriptors[0].fd == -1) || (pollDescriptors[1].fd == -1))
-                    {
-                        return;
-                    }
-
-                    THROW_LAST_ERROR_IF(poll(pollDescriptors, COUNT_OF(pollDescriptors), -1) < 0);
-
-                    bytesRead = 0;
-                    for (int Index = 0; Index < COUNT_OF(pollDescriptors); Index += 1)
-                    {
-                        if (pollDescriptors[Index].revents & POLLIN)
-                        {
-                            bytesRead = UtilReadBuffer(pollDescriptors[Index].fd, buffer);
-                            if (bytesRead == 0)
-                            {
-                                pollDescriptors[Index].fd = -1;
-                                shutdown(outFd[Index], SHUT_WR);
-                            }
-                            else if (bytesRead < 0)
-                            {
-                                return;
-                            }
-                            else if (UtilWriteBuffer(outFd[Index], buffer.data(), bytesRead) < 0)
-                            {
-                                return;
-                            }
-                        }
-                    }
-                }
-            }
-            CATCH_LOG()
-        }).detach();
-    }
-
-    return;
-}
+// Interval between scans for listening TCP sockets. Closed listeners are noticed sooner through
+// destroy notifications when those are available.
+constexpr auto c_scanInterval = std::chrono::milliseconds(1000);
 
 std::vector<sockaddr_storage> ParseTcpFile(int family, FILE* file)
 {
@@ -197,10 +89,10 @@ std::vector<sockaddr_storage> ParseTcpFile(int family, FILE* file)
                     ipv6Sock.sin6_port = port;
                     for (int part = 0; part < 4; ++part)
                     {
-                        char next[5];
-                        next[4] = 0;
-                        memcpy(next, field + part * 4, 4);
-                        ipv6Sock.sin6_addr.__in6_union.__s6_addr32[part] = strtol(next, nullptr, 16);
+                        char next[9];
+                        next[8] = 0;
+                        memcpy(next, field + part * 8, 8);
+                        ipv6Sock.sin6_addr.__in6_union.__s6_addr32[part] = strtoul(next, nullptr, 16);
                     }
                     memcpy(&sock, &ipv6Sock, sizeof(ipv6Sock));
                 }
@@ -316,79 +208,236 @@ bool IsSameSockAddr(const sockaddr_storage& left, const sockaddr_storage& right)
     }
 }
 
-// Start looking for ports bound to localhost or wildcard.
-int ScanProcNetTCP(wsl::shared::SocketChannel& channel)
+struct SockAddrHash
 {
-    // Periodically scan procfs for listening TCP sockets.
-    std::vector<sockaddr_storage> relays{};
-    int result = 0;
-    for (;;)
+    size_t operator()(const sockaddr_storage& sock) const noexcept
     {
-        std::vector<sockaddr_storage> sockets;
-        wil::unique_file tcp4File{fopen("/proc/net/tcp", "r")};
-        if (tcp4File)
+        size_t hash = sock.ss_family;
+        if (sock.ss_family == AF_INET)
         {
-            sockets = ParseTcpFile(AF_INET, tcp4File.get());
+            auto ipv4 = reinterpret_cast<const sockaddr_in*>(&sock);
+            hash = hash * 31 + ipv4->sin_port;
+            hash = hash * 31 + ipv4->sin_addr.s_addr;
         }
-
-        wil::unique_file tcp6File{fopen("/proc/net/tcp6", "r")};
-        if (tcp6File)
+        else if (sock.ss_family == AF_INET6)
         {
-            auto ipv6Sockets = ParseTcpFile(AF_INET6, tcp6File.get());
-            sockets.insert(sockets.end(), ipv6Sockets.begin(), ipv6Sockets.end());
+            auto ipv6 = reinterpret_cast<const sockaddr_in6*>(&sock);
+            hash = hash * 31 + ipv6->sin6_port;
+            for (int part = 0; part < 4; ++part)
+            {
+                hash = hash * 31 + ipv6->sin6_addr.__in6_union.__s6_addr32[part];
+            }
         }
 
-        if (!tcp4File && !tcp6File)
+        return std::hash<size_t>{}(hash);
+    }
+};
+
+struct SockAddrEqual
+{
+    bool operator()(const sockaddr_storage& left, const sockaddr_storage& right) const
+    {
+        return IsSameSockAddr(left, right);
+    }
+};
+
+using SockAddrSet = std::unordered_set<sockaddr_storage, SockAddrHash, SockAddrEqual>;
+
+// List the listening TCP sockets with sock_diag.
+//
+// N.B. Like in /proc/net/tcp, the port is returned in host byte order.
+SockAddrSet ListTcpListeners(NetlinkChannel& channel)
+{
+    SockAddrSet sockets;
+
+    inet_diag_req_v2 message{};
+    message.sdiag_protocol = IPPROTO_TCP;
+    message.idiag_states = 1 << TCP_LISTEN;
+
+    auto onMessage = [&](const NetlinkResponse& response) {
+        for (const auto& e : response.Messages<inet_diag_msg>(SOCK_DIAG_BY_FAMILY))
         {
-            LOG_ERROR("Failed to open /proc/net/tcp and /proc/net/tcp6, closing port relay");
-            return 1;
+            const auto* payload = e.Payload();
+            const auto port = ntohs(payload->id.idiag_sport);
+            if (port == 0)
+            {
+                continue;
+            }
+
+            sockaddr_storage sock{};
+            if (payload->idiag_family == AF_INET)
+            {
+                auto ipv4 = reinterpret_cast<sockaddr_in*>(&sock);
+                ipv4->sin_family = AF_INET;
+                ipv4->sin_addr.s_addr = payload->id.idiag_src[0];
+                ipv4->sin_port = port;
+            }
+            else if (payload->idiag_family == AF_INET6)
+            {
+                auto ipv6 = reinterpret_cast<sockaddr_in6*>(&sock);
+                ipv6->sin6_family = AF_INET6;
+                static_assert(sizeof(ipv6->sin6_addr) == sizeof(payload->id.idiag_src));
+                memcpy(&ipv6->sin6_addr, payload->id.idiag_src, sizeof(ipv6->sin6_addr));
+                ipv6->sin6_port = port;
+            }
+            else
+            {
+                continue;
+            }
+
+            sockets.insert(sock);
         }
+    };
 
-        // Stop any relays that no longer match listening ports.
-        std::erase_if(relays, [&](const auto& entry) {
-            auto found =
-                std::find_if(sockets.begin(), sockets.end(), [&](const auto& socket) { return IsSameSockAddr(entry, socket); });
+    for (const auto family : {AF_INET, AF_INET6})
+    {
+        message.sdiag_family = family;
+        auto transaction = channel.CreateTransaction(message, SOCK_DIAG_BY_FAMILY, NLM_F_DUMP);
+        transaction.Execute(onMessage);
+    }
 
-            bool remove = (found == sockets.end());
-            if (remove)
+    return sockets;
+}
+
+// List the listening TCP sockets by parsing procfs, for kernels without sock_diag support.
+std::optional<SockAddrSet> ReadTcpListeners()
+{
+    SockAddrSet sockets;
+    wil::unique_file tcp4File{fopen("/proc/net/tcp", "r")};
+    if (tcp4File)
+    {
+        auto ipv4Sockets = ParseTcpFile(AF_INET, tcp4File.get());
+        sockets.insert(ipv4Sockets.begin(), ipv4Sockets.end());
+    }
+
+    wil::unique_file tcp6File{fopen("/proc/net/tcp6", "r")};
+    if (tcp6File)
+    {
+        auto ipv6Sockets = ParseTcpFile(AF_INET6, tcp6File.get());
+        sockets.insert(ipv6Sockets.begin(), ipv6Sockets.end());
+    }
+
+    if (!tcp4File && !tcp6File)
+    {
+        return {};
+    }
+
+    return sockets;
+}
+
+// Open a socket that is notified when TCP sockets are destroyed, so relays for listeners that are
+// closed can be stopped without waiting for the next scan. Subscribing requires CAP_NET_ADMIN, so
+// if this fails the scan interval is relied on instead.
+std::optional<SocketDestroyNotifications> OpenTcpDestroyNotifications()
+try
+{
+    return SocketDestroyNotifications{{SKNLGRP_INET_TCP_DESTROY, SKNLGRP_INET6_TCP_DESTROY}};
+}
+catch (...)
+{
+    return {};
+}
+
+// Wait until the next scan is due, or until a socket that may have been listening is destroyed.
+void WaitForListenerChange(std::optional<SocketDestroyNotifications>& destroyNotifications, std::chrono::milliseconds timeout)
+{
+    if (!destroyNotifications)
+    {
+        std::this_thread::sleep_for(timeout);
+        return;
+    }
+
+    // Connected sockets are destroyed much more often than listeners, but unlike listeners they
+    // have a destination port.
+    destroyNotifications->Wait(timeout, [](const inet_diag_msg& socket) { return socket.id.idiag_dport == 0; });
+}
+
+// Start looking for ports bound to localhost or wildcard.
+int ScanTcpListeners(wsl::shared::SocketChannel& channel)
+{
+    // Listening sockets are listed with sock_diag, falling back to procfs if it's not available.
+    std::optional<NetlinkChannel> sockDiagChannel;
+    try
+    {
+        sockDiagChannel.emplace(SOCK_RAW, NETLINK_SOCK_DIAG);
+    }
+    catch (const std::exception& e)
+    {
+        LOG_ERROR("Failed to open sock_diag channel, falling back to procfs, {}", e.what());
+    }
+
+    auto destroyNotifications = sockDiagChannel ? OpenTcpDestroyNotifications() : std::nullopt;
+
+    SockAddrSet relays{};
+    int result = 0;
+    for (;;)
+    {
+        std::optional<SockAddrSet> sockets;
+        if (sockDiagChannel)
+        {
+            // Netlink will sometimes return EBUSY. Don't fail for that.
+            try
+            {
+                sockets = ListTcpListeners(*sockDiagChannel);
+            }
+            catch (const NetlinkTransactionError& e)
             {
-                if (StopHostListener(channel, entry) < 0)
+                if (e.Error().value_or(0) != -EBUSY)
                 {
-                    result = -1;
+                    LOG_ERROR("Failed to list listening sockets, {}", e.what());
                 }
             }
+        }
+        else
+        {
+            sockets = ReadTcpListeners();
+            if (!sockets)
+            {
+                LOG_ERROR("Failed to open /proc/net/tcp and /proc/net/tcp6, closing port relay");
+                return 1;
+            }
+        }
 
-            return remove;
-        });
+        if (sockets)
+        {
+            // Stop any relays that no longer match listening ports.
+            std::erase_if(relays, [&](const auto& entry) {
+                bool remove = !sockets->contains(entry);
+                if (remove)
+                {
+                    if (StopHostListener(channel, entry) < 0)
+                    {
+                        result = -1;
+                    }
+                }
 
-        // Create relays for any new ports.
-        std::for_each(sockets.begin(), sockets.end(), [&](const auto& socket) {
-            auto found =
-                std::find_if(relays.begin(), relays.end(), [&](const auto& entry) { return IsSameSockAddr(entry, socket); });
+                return remove;
+            });
 
-            if (found == relays.end())
+            // Create relays for any new ports.
+            for (const auto& socket : *sockets)
             {
-                if (StartHostListener(channel, socket) < 0)
-                {
-                    result = -1;
-                }
-                else
+                if (!relays.contains(socket))
                 {
-                    relays.push_back(socket);
+                    if (StartHostListener(channel, socket) < 0)
+                    {
+                        result = -1;
+                    }
+                    else
+                    {
+                        relays.insert(socket);
+                    }
                 }
             }
-        });
 
-        // Ensure all start / stop operations were successful.
-        if (result < 0)
-        {
-            break;
+            // Ensure all start / stop operations were successful.
+            if (result < 0)
+            {
+                break;
+            }
         }
 
-        // Sleep before scanning again.
-        //
-        // TODO: Investigate using EBPF notifications instead of a sleep.
-        sleep(1);
+        WaitForListenerChange(destroyNotifications, c_scanInterval);
     }
 
     return result;
@@ -415,11 +464,12 @@ try
     wil::unique_fd listenSocket{GuestRelayFd};
     THROW_LAST_ERROR_IF(!listenSocket);
 
-    // Create a thread to accept incoming connections from the host listener
-    std::thread([hvSocketAddress, listenSocket = std::move(listenSocket)]() {
+    // Create a thread to accept and relay incoming connections from the host listener.
+    auto relay = std::make_unique<LocalhostRelay>(hvSocketAddress, std::move(listenSocket));
+    std::thread([relay = std::move(relay)]() {
         try
         {
-            ListenThread(hvSocketAddress, listenSocket.get());
+            relay->Run();
         }
         CATCH_LOG()
     }).detach();
@@ -432,7 +482,7 @@ try
 
     if (ScanForPorts)
     {
-        return ScanProcNetTCP(channel);
+        return ScanTcpListeners(channel);
     }
 
     return 0;
@@ -516,20 +566,20 @@ int RunPortTracker(int Argc, char** Argv)
 
     GnsPortTracker portTracker(hvSocketChannel, std::move(channel), seccompDispatcher);
 
-    seccompDispatcher->RegisterHandler(
-        __NR_bind, [&portTracker](seccomp_notif* notification) { return portTracker.ProcessSecCompNotification(notification); });
+    seccompDispatcher->RegisterAsyncHandler(
+        __NR_bind, [&portTracker](const seccomp_notif& notification) { portTracker.ProcessSecCompNotification(notification); });
 
 #ifdef __x86_64__
-    seccompDispatcher->RegisterHandler(I386_NR_socketcall, [&portTracker](seccomp_notif* notification) {
-        return portTracker.ProcessSecCompNotification(notification);
+    seccompDispatcher->RegisterAsyncHandler(I386_NR_socketcall, [&portTracker](const seccomp_notif& notification) {
+        portTracker.ProcessSecCompNotification(notification);
     });
 #else
-    seccompDispatcher->RegisterHandler(ARMV7_NR_bind, [&portTracker](seccomp_notif* notification) {
-        return portTracker.ProcessSecCompNotification(notification);
+    seccompDispatcher->RegisterAsyncHandler(ARMV7_NR_bind, [&portTracker](const seccomp_notif& notification) {
+        portTracker.ProcessSecCompNotification(notification);
     });
 #endif
 
-    seccompDispatcher->RegisterHandler(__NR_ioctl, [hvSocketChannel, seccompDispatcher](auto notification) -> int {
+    seccompDispatcher->RegisterHandler(__NR_ioctl, [&portTracker, seccompDispatcher](auto notification) -> int {
         LX_GNS_TUN_BRIDGE_REQUEST request{};
         request.Header.MessageType = LxGnsMessageIfStateChangeRequest;
         request.Header.MessageSize = sizeof(request);
@@ -543,9 +593,7 @@ int RunPortTracker(int Argc, char** Argv)
         auto& ifRequest = *reinterpret_cast<ifreq*>(ifreqMemory->data());
         memcpy(request.InterfaceName, ifRequest.ifr_ifrn.ifrn_name, sizeof(request.InterfaceName));
         request.InterfaceUp = ifRequest.ifr_ifru.ifru_flags & IFF_UP;
-        const auto& reply = hvSocketChannel->Transaction(request);
-
-        return reply.Result;
+        return portTracker.Transaction(request);
     });
 
     try
@@ -9,6 +9,7 @@
 
 #include <lxwil.h>
 #include <p9fs.h>
+#include <p9stats.h>
 #include <p9tracelogging.h>
 #include <optional>
 
@@ -148,6 +149,50 @@ catch (...)
     return true;
 }
 
+// Periodically writes the request statistics of the server to a file, which can be displayed by
+// running wslinfo --plan9-statistics. The file is only rewritten if requests were processed since
+// the last time it was written.
+// N.B. The file is replaced with a rename so readers never see a partially written file.
+void PublishPlan9Statistics() noexcept
+try
+{
+    std::thread([]() {
+        constexpr auto c_interval = std::chrono::seconds{5};
+        constexpr auto c_temporaryFile = WSL_PLAN9_STATISTICS_FILE ".tmp";
+        uint64_t published = 0;
+        for (;;)
+        {
+            std::this_thread::sleep_for(c_interval);
+            try
+            {
+                const auto snapshot = p9fs::RequestStatistics::Snapshot();
+                uint64_t requests = 0;
+                for (const auto& operation : snapshot.Operations)
+                {
+                    requests += operation.Count;
+                }
+
+                if (requests == published)
+                {
+                    continue;
+                }
+
+                const auto content = p9fs::RequestStatistics::Format(snapshot);
+                {
+                    wil::unique_fd fd{open(c_temporaryFile, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)};
+                    THROW_LAST_ERROR_IF(!fd);
+                    THROW_LAST_ERROR_IF(UtilWriteStringView(fd.get(), content) != content.size());
+                }
+
+                THROW_LAST_ERROR_IF(rename(c_temporaryFile, WSL_PLAN9_STATISTICS_FILE) < 0);
+                published = requests;
+            }
+            CATCH_LOG();
+        }
+    }).detach();
+}
+CATCH_LOG();
+
 void RunPlan9ControlFile(p9fs::IPlan9FileSystem& fileSystem, wsl::shared::SocketChannel& channel)
 try
 {
@@ -167,7 +212,18 @@ CATCH_LOG();
 
 } // namespace
 
-void RunPlan9Server(const char* socketPath, const char* logFile, int logLevel, bool truncateLog, int controlSocket, int serverFd, wil::unique_fd& pipeFd)
+void RunPlan9Server(
+    const char* socketPath,
+    const char* logFile,
+    int logLevel,
+    bool truncateLog,
+    int controlSocket,
+    int serverFd,
+    int requestLimit,
+    int warmThreads,
+    bool writeBehind,
+    int epollThreads,
+    wil::unique_fd& pipeFd)
 {
     // Initialize logging.
     InitializeLogging(false, LogPlan9Exception);
@@ -189,13 +245,21 @@ void RunPlan9Server(const char* socketPath, const char* logFile, int logLevel, b
 
     {
         // Create the file system server.
-        auto fileSystem = p9fs::CreateFileSystem(serverFd);
+        // N.B. A negative request limit, warm thread count or epoll thread count from the
+        //      configuration is treated as the default.
+        auto fileSystem = p9fs::CreateFileSystem(
+            serverFd,
+            requestLimit < 0 ? p9fs::c_DefaultRequestLimit : static_cast<size_t>(requestLimit),
+            warmThreads < 0 ? p9fs::c_DefaultWarmThreads : static_cast<unsigned int>(warmThreads),
+            writeBehind,
+            epollThreads < 0 ? p9fs::c_AutomaticEpollThreads : static_cast<unsigned int>(epollThreads));
 
         // Add the share (the share takes ownership of the fd).
         fileSystem->AddShare("", rootFd.get());
         rootFd.release();
 
         fileSystem->Resume();
+        PublishPlan9Statistics();
 
         // Close the pipe to signal the parent process that the plan9 server is started.
         pipeFd.reset();
@@ -269,6 +333,9 @@ try
             const std::string logLevelStr = std::to_string(Config.Plan9LogLevel);
             const std::string serverFdStr = std::to_string(server.get());
             const std::string pipeFdStr = std::to_string(pipe.get());
+            const std::string requestLimitStr = std::to_string(Config.Plan9RequestLimit);
+            const std::string warmThreadsStr = std::to_string(Config.Plan9WarmThreads);
+            const std::string epollThreadsStr = std::to_string(Config.Plan9EpollThreads);
             std::vector<const char*> Arguments{
                 LX_INIT_PLAN9,
                 LX_INIT_PLAN9_CONTROL_SOCKET_ARG,
@@ -278,7 +345,13 @@ try
                 LX_INIT_PLAN9_SERVER_FD_ARG,
                 serverFdStr.c_str(),
                 LX_INIT_PLAN9_PIPE_FD_ARG,
-                pipeFdStr.c_str()};
+                pipeFdStr.c_str(),
+                LX_INIT_PLAN9_REQUEST_LIMIT_ARG,
+                requestLimitStr.c_str(),
+                LX_INIT_PLAN9_WARM_THREADS_ARG,
+                warmThreadsStr.c_str(),
+                LX_INIT_PLAN9_EPOLL_THREADS_ARG,
+                epollThreadsStr.c_str()};
 
             if (!translatedSocketPath.empty())
             {
@@ -291,6 +364,11 @@ try
                 Arguments.emplace_back(LX_INIT_PLAN9_TRUNCATE_LOG_ARG);
             }
 
+            if (Config.Plan9WriteBehind)
+            {
+                Arguments.emplace_back(LX_INIT_PLAN9_WRITE_BEHIND_ARG);
+            }
+
             if (Config.Plan9LogFile.has_value())
             {
                 Arguments.emplace_back(LX_INIT_PLAN9_LOG_FILE_ARG);
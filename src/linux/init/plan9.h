@@ -8,6 +8,17 @@
 
 std::pair<unsigned int, wsl::shared::SocketChannel> StartPlan9Server(const char* socketWindowsPath, const wsl::linux::WslDistributionConfig& Config);
 
-void RunPlan9Server(const char* socketPath, const char* logFile, int logLevel, bool truncateLog, int controlSocket, int serverFd, wil::unique_fd& pipeFd);
+void RunPlan9Server(
+    const char* socketPath,
+    const char* logFile,
+    int logLevel,
+    bool truncateLog,
+    int controlSocket,
+    int serverFd,
+    int requestLimit,
+    int warmThreads,
+    bool writeBehind,
+    int epollThreads,
+    wil::unique_fd& pipeFd);
 
 bool StopPlan9Server(bool force, wsl::linux::WslDistributionConfig& Config);
\ No newline at end of file
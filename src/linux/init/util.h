@@ -77,6 +77,7 @@ struct WslDistributionConfig;
 #define WSL_TEMP_FOLDER RUN_FOLDER "/WSL"
 #define WSL_TEMP_FOLDER_MODE 0777
 #define WSL_INIT_INTEROP_SOCKET WSL_TEMP_FOLDER "/1_" WSL_INTEROP_SOCKET
+#define WSL_PLAN9_STATISTICS_FILE WSL_TEMP_FOLDER "/plan9-statistics"
 
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
 
@@ -2,9 +2,12 @@
 
 #pragma once
 
+#include <algorithm>
+#include <deque>
 #include <optional>
 #include <mutex>
 #include <condition_variable>
+#include <vector>
 
 /**
  * @brief Class that contains a value T that can contain a single value and
@@ -70,3 +73,72 @@ private:
     std::condition_variable m_cv;
     std::optional<T> m_value;
 };
+
+/**
+ * @brief Class that contains a queue of values T. Storing a value never blocks,
+ * and retrieving values blocks until at least one is available.
+ *
+ * @tparam Value stored in this class.
+ */
+template <typename T>
+struct WaitableQueue
+{
+public:
+    /**
+     * @brief Add a value at the end of the queue.
+     *
+     * @param[in] value Value to be stored.
+     */
+    void post(const T& value)
+    {
+        std::unique_lock lck(m_mtx);
+        m_values.push_back(value);
+        m_cv.notify_all();
+    }
+
+    /**
+     * @brief Attempt to retrieve the values at the front of the queue with timeout.
+     *
+     * @param[in] timeout Duration to wait before returning empty.
+     * @param[in] max Maximum number of values to retrieve.
+     * @return The values, or an empty vector on timeout or if interrupt() was called.
+     */
+    template <typename duration>
+    std::vector<T> try_get_all(duration timeout, size_t max)
+    {
+        std::unique_lock lck(m_mtx);
+        while (m_values.empty())
+        {
+            if (m_interrupted)
+            {
+                m_interrupted = false;
+                return {};
+            }
+
+            if (m_cv.wait_for(lck, timeout) == std::cv_status::timeout)
+                return {};
+        }
+
+        const auto count = std::min(max, m_values.size());
+        std::vector<T> return_value(m_values.begin(), m_values.begin() + count);
+        m_values.erase(m_values.begin(), m_values.begin() + count);
+        return return_value;
+    }
+
+    /**
+     * @brief Make a pending or the next call to try_get_all return without waiting
+     * for the timeout, if the queue is empty.
+     */
+    void interrupt()
+    {
+        std::unique_lock lck(m_mtx);
+        m_interrupted = true;
+        m_cv.notify_all();
+    }
+
+private:
+    std::mutex m_mtx;
+    std::condition_variable m_cv;
+    std::deque<T> m_values;
+    bool m_interrupted = false;
+};
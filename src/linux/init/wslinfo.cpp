@@ -30,7 +30,8 @@ enum class WslInfoMode
     GetNetworkingMode,
     MsalProxyPath,
     WslVersion,
-    VMId
+    VMId,
+    Plan9Statistics
 };
 
 int WslInfoEntry(int Argc, char* Argv[])
@@ -68,6 +69,7 @@ Return Value:
     parser.AddArgument(UniqueSetValue<WslInfoMode, WslInfoMode::WslVersion>{Mode, Usage}, WSLINFO_WSL_VERSION);
     parser.AddArgument(UniqueSetValue<WslInfoMode, WslInfoMode::WslVersion>{Mode, Usage}, WSLINFO_WSL_VERSION_LEGACY);
     parser.AddArgument(UniqueSetValue<WslInfoMode, WslInfoMode::VMId>{Mode, Usage}, WSLINFO_WSL_VMID);
+    parser.AddArgument(UniqueSetValue<WslInfoMode, WslInfoMode::Plan9Statistics>{Mode, Usage}, WSLINFO_PLAN9_STATISTICS);
     parser.AddArgument(NoOp{}, WSLINFO_WSL_HELP);
     parser.AddArgument(noNewLine, nullptr, WSLINFO_NO_NEWLINE);
 
@@ -165,6 +167,24 @@ Return Value:
             std::cout << "wsl1";
         }
     }
+    else if (Mode.value() == WslInfoMode::Plan9Statistics)
+    {
+        // N.B. The file is written periodically by the plan9 server, and only once it has
+        //      processed requests.
+        if (access(WSL_PLAN9_STATISTICS_FILE, R_OK) < 0)
+        {
+            std::cerr << Localization::MessageNoValueFound() << "\n";
+            return 1;
+        }
+
+        auto statistics = UtilReadFileContent(WSL_PLAN9_STATISTICS_FILE);
+        if (!statistics.empty() && statistics.back() == '\n')
+        {
+            statistics.pop_back();
+        }
+
+        std::cout << statistics;
+    }
     else
     {
         assert(false && "Unknown WslInfoMode");
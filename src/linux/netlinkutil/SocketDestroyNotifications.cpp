@@ -0,0 +1,72 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+#include <poll.h>
+#include <linux/netlink.h>
+#include <linux/sock_diag.h>
+#include "SocketDestroyNotifications.h"
+#include "Syscall.h"
+
+SocketDestroyNotifications::SocketDestroyNotifications(std::initializer_list<int> groups) : m_buffer(8192)
+{
+    m_socket = Syscall(socket, AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_SOCK_DIAG);
+
+    sockaddr_nl address{};
+    address.nl_family = AF_NETLINK;
+    for (const auto group : groups)
+    {
+        address.nl_groups |= 1 << (group - 1);
+    }
+
+    Syscall(bind, m_socket.get(), reinterpret_cast<sockaddr*>(&address), sizeof(address));
+}
+
+bool SocketDestroyNotifications::Wait(std::chrono::milliseconds timeout, const std::function<bool(const inet_diag_msg&)>& predicate)
+{
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    for (;;)
+    {
+        const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        if (remaining.count() <= 0)
+        {
+            return false;
+        }
+
+        pollfd pollDescriptor{m_socket.get(), POLLIN, 0};
+        if (poll(&pollDescriptor, 1, static_cast<int>(remaining.count())) <= 0)
+        {
+            return false;
+        }
+
+        // Read all the pending notifications. ENOBUFS means that some were dropped.
+        bool matched = false;
+        for (;;)
+        {
+            const auto bytesRead = recv(m_socket.get(), m_buffer.data(), m_buffer.size(), 0);
+            if (bytesRead < 0)
+            {
+                if (errno == ENOBUFS)
+                {
+                    matched = true;
+                    continue;
+                }
+
+                break;
+            }
+
+            int length = static_cast<int>(bytesRead);
+            for (auto* header = reinterpret_cast<nlmsghdr*>(m_buffer.data()); NLMSG_OK(header, length); header = NLMSG_NEXT(header, length))
+            {
+                if (header->nlmsg_type == SOCK_DIAG_BY_FAMILY && header->nlmsg_len >= NLMSG_LENGTH(sizeof(inet_diag_msg)) &&
+                    predicate(*reinterpret_cast<const inet_diag_msg*>(NLMSG_DATA(header))))
+                {
+                    matched = true;
+                }
+            }
+        }
+
+        if (matched)
+        {
+            return true;
+        }
+    }
+}
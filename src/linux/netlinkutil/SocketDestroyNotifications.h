@@ -0,0 +1,32 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <initializer_list>
+#include <vector>
+#include <linux/inet_diag.h>
+#include "lxwil.h"
+
+// Receives the sock_diag notifications sent when sockets are destroyed. Subscribing requires
+// CAP_NET_ADMIN, so callers are expected to fall back to polling if the constructor throws.
+class SocketDestroyNotifications
+{
+public:
+    // Subscribe to the specified sock_diag groups (SKNLGRP_*).
+    SocketDestroyNotifications(std::initializer_list<int> groups);
+
+    SocketDestroyNotifications(const SocketDestroyNotifications&) = delete;
+    SocketDestroyNotifications(SocketDestroyNotifications&&) = default;
+    SocketDestroyNotifications& operator=(const SocketDestroyNotifications&) = delete;
+    SocketDestroyNotifications& operator=(SocketDestroyNotifications&&) = default;
+
+    // Wait until the timeout expires, or until the predicate returns true for a destroyed socket.
+    // If notifications were dropped, the predicate is assumed to have matched one of them.
+    // Returns true if a destroyed socket matched.
+    bool Wait(std::chrono::milliseconds timeout, const std::function<bool(const inet_diag_msg&)>& predicate);
+
+private:
+    wil::unique_fd m_socket;
+    std::vector<char> m_buffer;
+};
@@ -0,0 +1,126 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+#include "precomp.h"
+#include "p9attrcache.h"
+#include <sys/sysmacros.h>
+
+namespace p9fs {
+
+namespace {
+
+// How long cached attributes are used for.
+constexpr auto c_entryLifetime = std::chrono::milliseconds(500);
+
+// Maximum number of cached entries. When the cache is full, it is cleared before adding more.
+constexpr size_t c_maximumEntries = 4096;
+
+struct CacheKey
+{
+    dev_t Device;
+    ino_t Inode;
+
+    bool operator==(const CacheKey&) const = default;
+};
+
+struct CacheKeyHash
+{
+    size_t operator()(const CacheKey& key) const noexcept
+    {
+        return std::hash<ino_t>{}(key.Inode) ^ (std::hash<dev_t>{}(key.Device) << 1);
+    }
+};
+
+struct CacheEntry
+{
+    struct statx Attributes;
+    AttributeCache::Clock::time_point Expiry;
+};
+
+std::atomic<UINT64> g_Generation;
+
+// N.B. The size is tracked separately so lookups can skip the lock when the cache is empty, which
+//      is the common case for clients that don't request attributes with directory entries.
+std::atomic<size_t> g_Size;
+std::mutex g_Lock;
+UINT64 g_CachedGeneration;
+std::unordered_map<CacheKey, CacheEntry, CacheKeyHash> g_Entries;
+
+} // namespace
+
+// Gets the current generation of the cache. Attributes must be retrieved after getting the
+// generation, and inserted with it, so modifications made concurrently with retrieving them are
+// not missed.
+UINT64 AttributeCache::Generation() noexcept
+{
+    return g_Generation.load(std::memory_order_acquire);
+}
+
+// Adds attributes to the cache, unless the cache was invalidated since they were retrieved.
+void AttributeCache::Insert(const struct statx& attributes, UINT64 generation)
+{
+    std::lock_guard<std::mutex> lock{g_Lock};
+    if (generation != g_CachedGeneration)
+    {
+        if (generation != Generation())
+        {
+            return;
+        }
+
+        g_Entries.clear();
+        g_CachedGeneration = generation;
+    }
+
+    if (g_Entries.size() >= c_maximumEntries)
+    {
+        g_Entries.clear();
+    }
+
+    const CacheKey key{makedev(attributes.stx_dev_major, attributes.stx_dev_minor), attributes.stx_ino};
+    g_Entries.insert_or_assign(key, CacheEntry{attributes, Clock::now() + c_entryLifetime});
+    g_Size.store(g_Entries.size(), std::memory_order_relaxed);
+}
+
+// Retrieves cached attributes for a file if they contain at least the specified statx fields and
+// have not expired.
+std::optional<struct statx> AttributeCache::Lookup(dev_t device, ino_t inode, unsigned int mask)
+{
+    if (g_Size.load(std::memory_order_relaxed) == 0)
+    {
+        return {};
+    }
+
+    std::lock_guard<std::mutex> lock{g_Lock};
+    if (g_CachedGeneration != Generation())
+    {
+        g_Entries.clear();
+        g_Size.store(0, std::memory_order_relaxed);
+        return {};
+    }
+
+    const auto entry = g_Entries.find({device, inode});
+    if (entry == g_Entries.end())
+    {
+        return {};
+    }
+
+    if (entry->second.Expiry <= Clock::now())
+    {
+        g_Entries.erase(entry);
+        g_Size.store(g_Entries.size(), std::memory_order_relaxed);
+        return {};
+    }
+
+    if ((entry->second.Attributes.stx_mask & mask) != mask)
+    {
+        return {};
+    }
+
+    return entry->second.Attributes;
+}
+
+// Invalidates all cached attributes. This must be called after every operation that changes files.
+void AttributeCache::Invalidate() noexcept
+{
+    g_Generation.fetch_add(1, std::memory_order_acq_rel);
+}
+
+} // namespace p9fs
@@ -0,0 +1,24 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+#pragma once
+
+namespace p9fs {
+
+// A short-lived cache of file attributes retrieved while enumerating directories, so the getattr
+// requests that clients send right after listing a directory don't need to stat every file again.
+// N.B. Every operation that modifies the file system through the server invalidates the entire
+//      cache. Changes made by other processes are picked up when the entries expire.
+class AttributeCache final
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static UINT64 Generation() noexcept;
+    static void Insert(const struct statx& attributes, UINT64 generation);
+    static std::optional<struct statx> Lookup(dev_t device, ino_t inode, unsigned int mask);
+    static void Invalidate() noexcept;
+
+private:
+    AttributeCache() = delete;
+};
+
+} // namespace p9fs
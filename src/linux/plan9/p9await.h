@@ -1,6 +1,7 @@
 // Copyright (C) Microsoft Corporation. All rights reserved.
 #pragma once
 
+#include "p9framepool.h"
 #include "p9scheduler.h"
 #include "p9errors.h"
 
@@ -68,8 +69,8 @@ private:
 };
 
 // Async task is an awaitable task object whose resources are released
-// asynchronously from being awaited on. This requires an extra heap allocation,
-// so only use this when you need to have a task that you don't plan to
+// asynchronously from being awaited on. This requires an extra allocation, so
+// only use this when you need to have a task that you don't plan to
 // immediately await.
 class AsyncTask
 {
@@ -130,7 +131,7 @@ public:
         await_resume();
     }
 
-    class promise_type
+    class promise_type : public PooledFrame
     {
     public:
         std::suspend_never initial_suspend()
@@ -178,7 +179,7 @@ public:
             m_Storage.reset();
         }
 
-        std::shared_ptr<Storage> m_Storage{std::make_shared<Storage>()};
+        std::shared_ptr<Storage> m_Storage{std::allocate_shared<Storage>(FramePoolAllocator<Storage>{})};
     };
 
 private:
@@ -186,7 +187,7 @@ private:
 };
 
 template <class T>
-class PromiseBase : public T
+class PromiseBase : public T, public PooledFrame
 {
 public:
     auto initial_suspend()
@@ -368,14 +369,34 @@ private:
 class ScheduledTask
 {
 public:
-    struct promise_type
+    // Schedules the coroutine once it has been suspended.
+    // N.B. The coroutine can't be scheduled when the task is created, since another thread could
+    //      then resume it before it reached its initial suspension point.
+    struct InitialAwaiter
+    {
+        static bool await_ready() noexcept
+        {
+            return false;
+        }
+
+        static void await_suspend(std::coroutine_handle<> handle) noexcept
+        {
+            g_Scheduler.Schedule(handle);
+        }
+
+        static void await_resume() noexcept
+        {
+        }
+    };
+
+    struct promise_type : PooledFrame
     {
         ScheduledTask get_return_object()
         {
-            return {*this};
+            return {};
         }
 
-        std::suspend_always initial_suspend()
+        InitialAwaiter initial_suspend()
         {
             return {};
         }
@@ -401,11 +422,6 @@ public:
         {
         }
     };
-
-    ScheduledTask(promise_type& promise)
-    {
-        g_Scheduler.Schedule(std::coroutine_handle<promise_type>::from_promise(promise));
-    }
 };
 
 /// Non-awaitable wrapper to schedule a coroutine to run on another thread.
@@ -500,25 +516,36 @@ public:
 
     void Release(uint64_t count) noexcept
     {
-        std::lock_guard<std::mutex> lock{m_Lock};
-        m_Count += count;
+        std::coroutine_handle<> awaiter;
 
-        // Wake all possible waiters.
-        AsyncSemaphoreTask** head = &m_Waiter;
-        if (*head != nullptr)
         {
-            const auto waiter = *head;
-            if (m_Count >= waiter->m_Count)
-            {
-                m_Count -= waiter->m_Count;
-                *head = waiter->m_Next;
-                g_Scheduler.Schedule(waiter->m_Awaiter);
-            }
-            else
+            std::lock_guard<std::mutex> lock{m_Lock};
+            m_Count += count;
+
+            // Wake all possible waiters.
+            AsyncSemaphoreTask** head = &m_Waiter;
+            if (*head != nullptr)
             {
-                head = &waiter->m_Next;
+                const auto waiter = *head;
+                if (m_Count >= waiter->m_Count)
+                {
+                    m_Count -= waiter->m_Count;
+                    *head = waiter->m_Next;
+                    awaiter = waiter->m_Awaiter;
+                }
+                else
+                {
+                    head = &waiter->m_Next;
+                }
             }
         }
+
+        // N.B. The waiter is scheduled after the lock is released, since it may run on another
+        //      thread right away and destroy the semaphore.
+        if (awaiter)
+        {
+            g_Scheduler.Schedule(awaiter);
+        }
     }
 
 private:
@@ -22,15 +22,22 @@ inline void SpanWriteStatResult(SpanWriter& writer, const StatResult& stat)
     writer.U64(stat.CtimeNsec);
 }
 
-// Writes a directory entry to a span writer, returning whether the entry fit.
-inline bool SpanWriteDirectoryEntry(SpanWriter& writer, std::string_view name, const Qid& qid, UINT64 nextOffset, UCHAR type, const StatResult* stat = nullptr)
+// Determines the size of a directory entry, as written by SpanWriteDirectoryEntry.
+inline size_t DirectoryEntrySize(std::string_view name, bool includeStat)
 {
     size_t dirEntrySize = QidSize + sizeof(UINT64) + sizeof(UCHAR) + sizeof(UINT16) + name.size();
-    if (stat != nullptr)
+    if (includeStat)
     {
         dirEntrySize += StatResultSize;
     }
 
+    return dirEntrySize;
+}
+
+// Writes a directory entry to a span writer, returning whether the entry fit.
+inline bool SpanWriteDirectoryEntry(SpanWriter& writer, std::string_view name, const Qid& qid, UINT64 nextOffset, UCHAR type, const StatResult* stat = nullptr)
+{
+    const size_t dirEntrySize = DirectoryEntrySize(name, stat != nullptr);
     if (static_cast<size_t>(writer.Peek().size()) < dirEntrySize)
     {
         return false;
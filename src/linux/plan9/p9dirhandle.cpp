@@ -0,0 +1,83 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+#include "precomp.h"
+#include "p9dirhandle.h"
+
+namespace p9fs {
+
+namespace {
+
+// Maximum number of directory handles that are kept open.
+constexpr size_t c_maxDirectoryHandles = 1024;
+
+// Open handles, most recently used first.
+std::mutex g_HandlesLock;
+std::list<DirectoryHandle*> g_Handles;
+
+} // namespace
+
+// Creates a new handle for the specified directory, closing old handles if there are too many.
+std::shared_ptr<DirectoryHandle> DirectoryHandle::Create(wil::unique_fd&& fd)
+{
+    auto handle = std::make_shared<DirectoryHandle>(std::move(fd));
+    Trim();
+    return handle;
+}
+
+DirectoryHandle::DirectoryHandle(wil::unique_fd&& fd) : m_Fd{std::move(fd)}
+{
+    std::lock_guard<std::mutex> lock{g_HandlesLock};
+    g_Handles.push_front(this);
+    m_Entry = g_Handles.begin();
+    m_Listed = true;
+}
+
+DirectoryHandle::~DirectoryHandle()
+{
+    std::lock_guard<std::mutex> lock{g_HandlesLock};
+    if (m_Listed)
+    {
+        g_Handles.erase(m_Entry);
+    }
+}
+
+// Marks the handle as recently used and returns its file descriptor, which stays open until the
+// lease is released. If the handle was closed, the lease is invalid.
+DirectoryHandle::Lease DirectoryHandle::Use()
+{
+    {
+        std::lock_guard<std::mutex> lock{g_HandlesLock};
+        if (m_Listed)
+        {
+            g_Handles.splice(g_Handles.begin(), g_Handles, m_Entry);
+        }
+    }
+
+    std::shared_lock<std::shared_mutex> lock{m_Lock};
+    const int fd = m_Fd.get();
+    return {std::move(lock), fd};
+}
+
+// Closes the least recently used handles until the number of open handles is within the limit.
+// N.B. Handles that are in use are skipped rather than waited for, since the thread using them may
+//      be waiting for the global lock.
+void DirectoryHandle::Trim()
+{
+    std::lock_guard<std::mutex> lock{g_HandlesLock};
+    auto it = g_Handles.end();
+    while (g_Handles.size() > c_maxDirectoryHandles && it != g_Handles.begin())
+    {
+        --it;
+        auto handle = *it;
+        std::unique_lock<std::shared_mutex> handleLock{handle->m_Lock, std::try_to_lock};
+        if (!handleLock)
+        {
+            continue;
+        }
+
+        handle->m_Fd.reset();
+        handle->m_Listed = false;
+        it = g_Handles.erase(it);
+    }
+}
+
+} // namespace p9fs
@@ -0,0 +1,56 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+#pragma once
+
+namespace p9fs {
+
+// An O_PATH file descriptor for a directory, used to resolve names relative to that directory
+// instead of relative to the share root.
+// N.B. The number of open handles is capped. When the cap is exceeded, the least recently used
+//      handle that isn't in use is closed, and its users must fall back to resolving the full path.
+class DirectoryHandle final
+{
+public:
+    // Keeps a handle's file descriptor open while it is being used.
+    class Lease
+    {
+    public:
+        Lease() = default;
+        Lease(std::shared_lock<std::shared_mutex>&& lock, int fd) : m_Lock{std::move(lock)}, m_Fd{fd}
+        {
+        }
+
+        int Fd() const noexcept
+        {
+            return m_Fd;
+        }
+
+        explicit operator bool() const noexcept
+        {
+            return m_Fd >= 0;
+        }
+
+    private:
+        std::shared_lock<std::shared_mutex> m_Lock;
+        int m_Fd{-1};
+    };
+
+    static std::shared_ptr<DirectoryHandle> Create(wil::unique_fd&& fd);
+
+    DirectoryHandle(wil::unique_fd&& fd);
+    ~DirectoryHandle();
+
+    DirectoryHandle(const DirectoryHandle&) = delete;
+    DirectoryHandle& operator=(const DirectoryHandle&) = delete;
+
+    Lease Use();
+
+private:
+    static void Trim();
+
+    std::shared_mutex m_Lock;
+    wil::unique_fd m_Fd;
+    std::list<DirectoryHandle*>::iterator m_Entry;
+    bool m_Listed{};
+};
+
+} // namespace p9fs
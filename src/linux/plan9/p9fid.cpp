@@ -9,6 +9,24 @@ Expected<Qid> Fid::Walk(std::string_view)
     return LxError{LX_EINVAL};
 }
 
+Expected<std::vector<Qid>> Fid::WalkMany(gsl::span<const std::string_view> names)
+{
+    std::vector<Qid> qids;
+    qids.reserve(names.size());
+    for (const auto& name : names)
+    {
+        auto qid = Walk(name);
+        if (!qid)
+        {
+            return qid.Unexpected();
+        }
+
+        qids.push_back(qid.Get());
+    }
+
+    return qids;
+}
+
 Expected<std::tuple<UINT64, Qid, StatResult>> Fid::GetAttr(UINT64)
 {
     return LxError{LX_EINVAL};
@@ -49,6 +67,11 @@ Task<Expected<UINT32>> Fid::Write(UINT64, gsl::span<const gsl::byte>)
     co_return LxError{LX_EINVAL};
 }
 
+Expected<UINT32> Fid::SpliceRead(UINT64, UINT32, int)
+{
+    return LxError{LX_EINVAL};
+}
+
 LX_INT Fid::UnlinkAt(std::string_view, UINT32)
 {
     return LX_EINVAL;
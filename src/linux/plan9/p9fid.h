@@ -17,6 +17,7 @@ public:
     virtual ~Fid() = default;
 
     virtual Expected<Qid> Walk(std::string_view Name);
+    virtual Expected<std::vector<Qid>> WalkMany(gsl::span<const std::string_view> Names);
     virtual Expected<std::tuple<UINT64, Qid, StatResult>> GetAttr(UINT64 Mask);
     virtual LX_INT SetAttr(UINT32 Valid, const StatResult& Stat);
     virtual Expected<Qid> Open(OpenFlags Flags);
@@ -25,6 +26,7 @@ public:
     virtual LX_INT ReadDir(UINT64 Offset, SpanWriter& Writer, bool IncludeAttributes);
     virtual Task<Expected<UINT32>> Read(UINT64 Offset, gsl::span<gsl::byte> Buffer);
     virtual Task<Expected<UINT32>> Write(UINT64 Offset, gsl::span<const gsl::byte> Buffer);
+    virtual Expected<UINT32> SpliceRead(UINT64 Offset, UINT32 Count, int Pipe);
     virtual LX_INT UnlinkAt(std::string_view Name, UINT32 Flags);
     virtual LX_INT Remove();
     virtual LX_INT RenameAt(std::string_view OldName, Fid& NewParent, std::string_view NewName);
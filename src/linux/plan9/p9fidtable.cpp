@@ -0,0 +1,73 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+#include "precomp.h"
+#include "p9fidtable.h"
+#include "p9fid.h"
+
+namespace p9fs {
+
+// Gets the object for a fid, or null if the fid doesn't exist.
+std::shared_ptr<Fid> FidTable::Find(UINT32 fid) const
+{
+    auto& shard = GetShard(fid);
+    std::shared_lock<std::shared_mutex> lock{shard.Lock};
+    const auto it = shard.Fids.find(fid);
+    if (it == shard.Fids.end())
+    {
+        return {};
+    }
+
+    return it->second;
+}
+
+// Adds a new fid. Returns false if the fid already exists.
+bool FidTable::Insert(UINT32 fid, std::shared_ptr<Fid> item)
+{
+    auto& shard = GetShard(fid);
+    std::lock_guard<std::shared_mutex> lock{shard.Lock};
+    return shard.Fids.try_emplace(fid, std::move(item)).second;
+}
+
+// Removes a fid, returning its object, or null if the fid doesn't exist.
+// N.B. The object is released outside of the lock by the caller.
+std::shared_ptr<Fid> FidTable::Remove(UINT32 fid)
+{
+    auto& shard = GetShard(fid);
+    std::lock_guard<std::shared_mutex> lock{shard.Lock};
+    const auto it = shard.Fids.find(fid);
+    if (it == shard.Fids.end())
+    {
+        return {};
+    }
+
+    auto item = std::move(it->second);
+    shard.Fids.erase(it);
+    return item;
+}
+
+// Replaces the object for a fid, if it's still the expected object.
+bool FidTable::Replace(UINT32 fid, const std::shared_ptr<Fid>& expected, std::shared_ptr<Fid> item)
+{
+    // N.B. The old object is swapped into item so it's released outside of the lock.
+    auto& shard = GetShard(fid);
+    {
+        std::lock_guard<std::shared_mutex> lock{shard.Lock};
+        const auto it = shard.Fids.find(fid);
+        if (it == shard.Fids.end() || it->second != expected)
+        {
+            return false;
+        }
+
+        std::swap(it->second, item);
+    }
+
+    return true;
+}
+
+// Selects the shard for a fid. Clients usually allocate fids sequentially, which spreads them evenly
+// across the shards.
+FidTable::Shard& FidTable::GetShard(UINT32 fid) const
+{
+    return m_Shards[fid % c_ShardCount];
+}
+
+} // namespace p9fs
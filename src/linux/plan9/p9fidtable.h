@@ -0,0 +1,34 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+#pragma once
+
+namespace p9fs {
+
+class Fid;
+
+// Maps the fids of a connection to their objects.
+// N.B. The table is split into shards that each have their own lock, so requests for different
+//      fids rarely contend with each other.
+class FidTable final
+{
+public:
+    std::shared_ptr<Fid> Find(UINT32 fid) const;
+    bool Insert(UINT32 fid, std::shared_ptr<Fid> item);
+    std::shared_ptr<Fid> Remove(UINT32 fid);
+    bool Replace(UINT32 fid, const std::shared_ptr<Fid>& expected, std::shared_ptr<Fid> item);
+
+private:
+    // N.B. Each shard is aligned to a cache line to avoid false sharing between the locks.
+    struct alignas(64) Shard
+    {
+        mutable std::shared_mutex Lock;
+        std::unordered_map<UINT32, std::shared_ptr<Fid>> Fids;
+    };
+
+    static constexpr size_t c_ShardCount = 64;
+
+    Shard& GetShard(UINT32 fid) const;
+
+    mutable std::array<Shard, c_ShardCount> m_Shards;
+};
+
+} // namespace p9fs
@@ -5,7 +5,8 @@
 #include "p9util.h"
 #include "p9commonutil.h"
 #include "p9xattr.h"
-#include <mountutilcpp.h>
+#include "p9mounttable.h"
+#include "p9attrcache.h"
 #include <sys/syscall.h>
 #include <sys/sysmacros.h>
 
@@ -17,6 +18,30 @@ constexpr std::string_view c_drvfsFsType = "drvfs"sv;
 constexpr std::string_view c_p9FsType = "9p"sv;
 constexpr std::string_view c_virtioFsType = "virtiofs"sv;
 
+// The statx fields returned for each entry by Twreaddir.
+constexpr unsigned int c_readDirStatxMask = STATX_TYPE | STATX_MODE | STATX_NLINK | STATX_UID | STATX_GID | STATX_ATIME |
+                                            STATX_MTIME | STATX_CTIME | STATX_SIZE | STATX_BLOCKS;
+
+// Maps the Tgetattr request mask to the statx fields needed to answer it.
+struct GetAttrMaskMapping
+{
+    UINT64 GetAttrMask;
+    unsigned int StatxMask;
+};
+
+const GetAttrMaskMapping c_getAttrMaskMapping[] = {
+    {GetAttrMode, STATX_TYPE | STATX_MODE},
+    {GetAttrNlink, STATX_NLINK},
+    {GetAttrUid, STATX_UID},
+    {GetAttrGid, STATX_GID},
+    {GetAttrRdev, STATX_TYPE},
+    {GetAttrAtime, STATX_ATIME},
+    {GetAttrMtime, STATX_MTIME},
+    {GetAttrCtime, STATX_CTIME},
+    {GetAttrSize, STATX_SIZE},
+    {GetAttrBlocks, STATX_BLOCKS},
+};
+
 struct OpenFlagMapping
 {
     OpenFlags P9Flag;
@@ -76,6 +101,41 @@ Qid StatToQid(const struct stat& st)
     return {st.st_ino, 0, ModeToQidType(st.st_mode)};
 }
 
+// Converts the result of a statx system call to the attributes returned to the client.
+StatResult StatxToStatResult(const struct statx& st)
+{
+    StatResult result{};
+    result.Mode = st.stx_mode;
+    result.Uid = st.stx_uid;
+    result.Gid = st.stx_gid;
+    result.NLink = st.stx_nlink;
+    result.RDev = makedev(st.stx_rdev_major, st.stx_rdev_minor);
+    result.Size = st.stx_size;
+    result.BlockSize = st.stx_blksize;
+    result.Blocks = st.stx_blocks;
+    result.AtimeSec = st.stx_atime.tv_sec;
+    result.AtimeNsec = st.stx_atime.tv_nsec;
+    result.MtimeSec = st.stx_mtime.tv_sec;
+    result.MtimeNsec = st.stx_mtime.tv_nsec;
+    result.CtimeSec = st.stx_ctime.tv_sec;
+    result.CtimeNsec = st.stx_ctime.tv_nsec;
+    return result;
+}
+
+// Checks whether a device is a drvfs, 9p or virtiofs mount, which must not be reachable through
+// the share.
+bool IsBlockedMount(dev_t device)
+{
+    try
+    {
+        const auto fileSystemType = MountTable::ForCurrentThread()->GetFileSystemType(device);
+        return fileSystemType == c_drvfsFsType || fileSystemType == c_p9FsType || fileSystemType == c_virtioFsType;
+    }
+    CATCH_LOG()
+
+    return false;
+}
+
 // Get the qid for a file.
 // N.B. The caller is responsible for setting the right thread uid/gid before calling this.
 Expected<Qid> GetFileQidByPath(int fd, const std::string& path)
@@ -130,7 +190,8 @@ Expected<struct stat> File::Stat()
     struct stat st;
     // Acquire the lock to prevent the file name from changing.
     std::shared_lock<std::shared_mutex> lock{m_Lock};
-    int result = fstatat(m_Root->RootFd, m_FileName.c_str(), &st, AT_SYMLINK_NOFOLLOW | AT_EMPTY_PATH);
+    const auto location = LocationWithLockHeld();
+    int result = fstatat(location.DirFd, location.Name.c_str(), &st, AT_SYMLINK_NOFOLLOW | AT_EMPTY_PATH);
     if (result < 0)
     {
         return LxError{-errno};
@@ -150,7 +211,8 @@ Expected<wil::unique_fd> File::OpenFile(int openFlags)
 {
     // Acquire the lock to prevent the file name from changing.
     std::shared_lock<std::shared_mutex> lock{m_Lock};
-    return util::OpenAt(m_Root->RootFd, m_FileName, openFlags | O_NOFOLLOW);
+    const auto location = LocationWithLockHeld();
+    return util::OpenAt(location.DirFd, location.Name, openFlags | O_NOFOLLOW);
 }
 
 // Validates that this file exists and sets the m_Qid member.
@@ -188,21 +250,36 @@ File::File(std::shared_ptr<const Root> root) : m_Root{root}
 }
 
 // Copies a file. This does not clone the open file state, just the name and qid.
-File::File(const File& file) : m_FileName{file.m_FileName}, m_Root{file.m_Root}, m_Qid{file.m_Qid}
+File::File(const File& file) :
+    m_FileName{file.m_FileName}, m_Parent{file.m_Parent}, m_Root{file.m_Root}, m_Qid{file.m_Qid}, m_Device{file.m_Device}
 {
 }
 
-// Updates the path to a child file entry in a directory. Must be called with a newly
-// constructed file, not one that has been opened.
+// Walks to a child of this directory.
 Expected<Qid> File::Walk(std::string_view name)
 {
-    // TODO: This is not safe if walk is called multiple times. While
-    // we verify that the item is not a symlink in this step, the file could've
-    // been replaced with a symlink since the qid was determined.
-    // The only way to make this foolproof is to open an fd for every file, and
-    // use fstatat for the next level. A chroot environment can be used to
-    // prevent the links from escaping the share root, but it can't avoid
-    // accidentally following links at all.
+    auto qids = WalkMany({&name, 1});
+    if (!qids)
+    {
+        return qids.Unexpected();
+    }
+
+    return qids->front();
+}
+
+// Walks through one or more path components, returning the qid of each of them. Must be called with
+// a newly constructed file, not one that has been opened. On failure, the file is left unchanged.
+// N.B. Each intermediate directory is opened relative to the previous one without following
+//      symlinks, and the last component is looked up relative to the final directory, which
+//      becomes the file's parent handle. This means none of the components can be replaced with
+//      a symlink between determining its qid and resolving the next component.
+Expected<std::vector<Qid>> File::WalkMany(gsl::span<const std::string_view> names)
+{
+    if (names.empty())
+    {
+        return std::vector<Qid>{};
+    }
+
     if (!WI_IsFlagSet(m_Qid.Type, QidType::Directory))
     {
         return LxError{LX_ENOTDIR};
@@ -211,142 +288,181 @@ Expected<Qid> File::Walk(std::string_view name)
     // No lock is taken here; this function is only called on fid's that have
     // not yet been inserted in the list and are therefore not reachable from
     // other threads.
-    AppendPath(m_FileName, name);
-
-    // Revert to the old info on error.
-    const auto oldQid = m_Qid;
-    const auto oldDevice = m_Device;
-    auto restoreName = wil::scope_exit([&]() {
-        m_Qid = oldQid;
-        m_Device = oldDevice;
-        const auto index = m_FileName.find_last_of('/');
-        if (index == std::string::npos)
-        {
-            m_FileName.resize(0);
-        }
-        else
+    util::FsUserContext userContext{m_Root->Uid, m_Root->Gid, m_Root->Groups};
+    wil::unique_fd directory;
+    int dirFd = m_Root->RootFd;
+    if (!m_FileName.empty())
+    {
+        const auto self = LocationWithLockHeld();
+        auto result = util::OpenAt(self.DirFd, self.Name, O_PATH | O_DIRECTORY | O_NOFOLLOW);
+        if (!result)
         {
-            m_FileName.resize(index);
+            return result.Unexpected();
         }
-    });
 
-    // TODO: Maybe handle multiple items in a single walk call so changing ids is done only once.
-    util::FsUserContext userContext{m_Root->Uid, m_Root->Gid, m_Root->Groups};
-    const auto parentDevice = m_Device;
-    LX_INT err = ValidateExists();
-    if (err != 0)
-    {
-        return LxError{err};
+        directory = std::move(result.Get());
+        dirFd = directory.get();
     }
 
-    // Check if this is a mount point, and if so if it's a drvfs or 9p mount.
-    if (parentDevice != m_Device)
+    std::vector<Qid> qids;
+    qids.reserve(names.size());
+    std::string fileName{m_FileName};
+    auto device = m_Device;
+    for (size_t index = 0; index < names.size(); ++index)
     {
-        try
+        const std::string name{names[index]};
+        struct stat st;
+        if (index < names.size() - 1)
         {
-            // Because this thread might not be in the same mount namespace than the rest of the process,
-            // look at /proc/<tid>/mountinfo instead of /proc/self/
-            const std::string mountInfoPath = std::format("/proc/{}/mountinfo", gettid());
-            mountutil::MountEnum mountEnum(mountInfoPath.c_str());
-            bool found = mountEnum.FindMount([this](auto entry) { return entry.Device == m_Device; });
-
-            // If the mount was found and it's a drvfs mount, deny access.
-            if (found && (mountEnum.Current().FileSystemType == c_drvfsFsType || mountEnum.Current().FileSystemType == c_p9FsType ||
-                          mountEnum.Current().FileSystemType == c_virtioFsType))
+            auto next = util::OpenBeneath(dirFd, name, O_PATH | O_DIRECTORY);
+            if (!next)
             {
-                return LxError{LX_EACCES};
+                return next.Unexpected();
             }
+
+            directory = std::move(next.Get());
+            dirFd = directory.get();
+            if (fstat(dirFd, &st) < 0)
+            {
+                return LxError{-errno};
+            }
+        }
+        else if (fstatat(dirFd, name.c_str(), &st, AT_SYMLINK_NOFOLLOW) < 0)
+        {
+            return LxError{-errno};
+        }
+
+        if (st.st_dev != device && IsBlockedMount(st.st_dev))
+        {
+            return LxError{LX_EACCES};
         }
-        CATCH_LOG()
+
+        device = st.st_dev;
+        AppendPath(fileName, name);
+        qids.push_back(StatToQid(st));
     }
 
-    restoreName.release();
-    return m_Qid;
+    m_FileName = std::move(fileName);
+    m_Parent = directory ? DirectoryHandle::Create(std::move(directory)) : nullptr;
+    m_Qid = qids.back();
+    m_Device = device;
+    return qids;
 }
 
 // Reads the attributes of a file or directory.
 Expected<std::tuple<UINT64, Qid, StatResult>> File::GetAttr(UINT64 mask)
 {
-    std::string fileName;
+    // Only query the fields the client asked for.
+    unsigned int statxMask = 0;
+    for (const auto& mapping : c_getAttrMaskMapping)
+    {
+        if (WI_IsAnyFlagSet(mask, mapping.GetAttrMask))
+        {
+            WI_SetAllFlags(statxMask, mapping.StatxMask);
+        }
+    }
+
+    FileLocation location;
     Qid qid;
+    dev_t device;
     {
-        // Retrieve the qid and open a handle under lock.
+        // Retrieve the qid and the file's location under lock.
         std::shared_lock<std::shared_mutex> lock{m_Lock};
         qid = m_Qid;
-        fileName = m_FileName;
+        device = m_Device;
+        location = LocationWithLockHeld();
     }
 
-    util::FsUserContext userContext{m_Root->Uid, m_Root->Gid, m_Root->Groups};
-    struct stat stat;
-    int error = fstatat(m_Root->RootFd, fileName.c_str(), &stat, AT_SYMLINK_NOFOLLOW | AT_EMPTY_PATH);
-    if (error < 0)
+    // The size and times of the file must include writes buffered by any fid open on it.
+    if (WI_IsAnyFlagSet(mask, GetAttrSize | GetAttrBlocks | GetAttrMtime | GetAttrCtime))
     {
-        return LxError{-errno};
+        const auto error = FlushFileWriteBehind(device, qid.Path);
+        if (error != 0)
+        {
+            return LxError{error};
+        }
     }
 
+    // Use the attributes from a recent directory enumeration if there are any.
+    struct statx stat;
+    if (auto cached = AttributeCache::Lookup(device, qid.Path, statxMask))
+    {
+        stat = *cached;
+    }
+    else
+    {
+        util::FsUserContext userContext{m_Root->Uid, m_Root->Gid, m_Root->Groups};
+        int error = statx(location.DirFd, location.Name.c_str(), AT_SYMLINK_NOFOLLOW | AT_EMPTY_PATH | AT_STATX_SYNC_AS_STAT, statxMask, &stat);
+        if (error < 0)
+        {
+            return LxError{-errno};
+        }
+    }
+
+    const StatResult attributes = StatxToStatResult(stat);
     StatResult result{};
     UINT64 valid = GetAttrIno;
     if (WI_IsFlagSet(mask, GetAttrMode))
     {
-        result.Mode = stat.st_mode;
+        result.Mode = attributes.Mode;
         WI_SetFlag(valid, GetAttrMode);
     }
 
     if (WI_IsFlagSet(mask, GetAttrNlink))
     {
-        result.NLink = stat.st_nlink;
+        result.NLink = attributes.NLink;
         WI_SetFlag(valid, GetAttrNlink);
     }
 
     if (WI_IsFlagSet(mask, GetAttrRdev))
     {
-        result.RDev = stat.st_rdev;
+        result.RDev = attributes.RDev;
         WI_SetFlag(valid, GetAttrRdev);
     }
 
     if (WI_IsFlagSet(mask, GetAttrSize))
     {
-        result.Size = stat.st_size;
+        result.Size = attributes.Size;
         WI_SetFlag(valid, GetAttrSize);
     }
 
     if (WI_IsFlagSet(mask, GetAttrBlocks))
     {
-        result.BlockSize = stat.st_blksize;
-        result.Blocks = stat.st_blocks;
+        result.BlockSize = attributes.BlockSize;
+        result.Blocks = attributes.Blocks;
         WI_SetFlag(valid, GetAttrBlocks);
     }
 
     if (WI_IsFlagSet(mask, GetAttrAtime))
     {
-        result.AtimeSec = stat.st_atim.tv_sec;
-        result.AtimeNsec = stat.st_atim.tv_nsec;
+        result.AtimeSec = attributes.AtimeSec;
+        result.AtimeNsec = attributes.AtimeNsec;
         WI_SetFlag(valid, GetAttrAtime);
     }
 
     if (WI_IsFlagSet(mask, GetAttrMtime))
     {
-        result.MtimeSec = stat.st_mtim.tv_sec;
-        result.MtimeNsec = stat.st_mtim.tv_nsec;
+        result.MtimeSec = attributes.MtimeSec;
+        result.MtimeNsec = attributes.MtimeNsec;
         WI_SetFlag(valid, GetAttrMtime);
     }
 
     if (WI_IsFlagSet(mask, GetAttrCtime))
     {
-        result.CtimeSec = stat.st_ctim.tv_sec;
-        result.CtimeNsec = stat.st_ctim.tv_nsec;
+        result.CtimeSec = attributes.CtimeSec;
+        result.CtimeNsec = attributes.CtimeNsec;
         WI_SetFlag(valid, GetAttrCtime);
     }
 
     if (WI_IsFlagSet(mask, GetAttrUid))
     {
-        result.Uid = stat.st_uid;
+        result.Uid = attributes.Uid;
         WI_SetFlag(valid, GetAttrUid);
     }
 
     if (WI_IsFlagSet(mask, GetAttrGid))
     {
-        result.Gid = stat.st_gid;
+        result.Gid = attributes.Gid;
         WI_SetFlag(valid, GetAttrGid);
     }
 
@@ -356,17 +472,34 @@ Expected<std::tuple<UINT64, Qid, StatResult>> File::GetAttr(UINT64 mask)
 // Sets the attributes for a file or directory.
 LX_INT File::SetAttr(UINT32 valid, const StatResult& stat)
 {
+    // Cached attributes are invalidated once the operation completes, whether or not it succeeded.
+    // N.B. Changing the mode or owner may also change extended attributes, such as ACLs and file
+    //      capabilities.
+    const auto xattrVersion = XAttrVersion();
+    const auto invalidateAttributes = wil::scope_exit([&xattrVersion] {
+        AttributeCache::Invalidate();
+        XAttrCache::Invalidate(xattrVersion.Device, xattrVersion.Inode);
+    });
+
     if (m_Root->ReadOnly())
     {
         return LX_EROFS;
     }
 
+    // Write any buffered data first so it can't be written past a new size.
+    const auto error = FlushWriteBehind();
+    if (error != 0)
+    {
+        return error;
+    }
+
     util::FsUserContext userContext{m_Root->Uid, m_Root->Gid, m_Root->Groups};
 
     // Multiple operations may be performed, so it would be preferable to open the file. However,
     // most operations don't support O_PATH and any other flags will check for permissions that the
     // operation may not need.
-    const auto fileName = GetFileName();
+    const auto location = Location();
+    const auto fileName = location.Name.c_str();
 
     // Ctime is updated by most of the operations below, so don't explicitly
     // update it if not needed.
@@ -376,7 +509,7 @@ LX_INT File::SetAttr(UINT32 valid, const StatResult& stat)
     {
         // Open the file to truncate because truncate will always follow symlinks and there is no
         // ftruncateat.
-        auto file = OpenFile(O_WRONLY);
+        auto file = util::OpenAt(location.DirFd, location.Name, O_WRONLY | O_NOFOLLOW);
         if (!file)
         {
             return file.Error();
@@ -393,7 +526,7 @@ LX_INT File::SetAttr(UINT32 valid, const StatResult& stat)
 
     if (WI_IsFlagSet(valid, SetAttrMode))
     {
-        int error = fchmodat(m_Root->RootFd, fileName.c_str(), stat.Mode, AT_SYMLINK_NOFOLLOW);
+        int error = fchmodat(location.DirFd, fileName, stat.Mode, AT_SYMLINK_NOFOLLOW);
         if (error < 0)
         {
             return -errno;
@@ -406,7 +539,7 @@ LX_INT File::SetAttr(UINT32 valid, const StatResult& stat)
     {
         uid_t uid = WI_IsFlagSet(valid, SetAttrUid) ? stat.Uid : -1;
         uid_t gid = WI_IsFlagSet(valid, SetAttrGid) ? stat.Gid : -1;
-        int error = fchownat(m_Root->RootFd, fileName.c_str(), uid, gid, AT_SYMLINK_NOFOLLOW);
+        int error = fchownat(location.DirFd, fileName, uid, gid, AT_SYMLINK_NOFOLLOW);
         if (error < 0)
         {
             return -errno;
@@ -450,7 +583,7 @@ LX_INT File::SetAttr(UINT32 valid, const StatResult& stat)
             }
         }
 
-        int error = utimensat(m_Root->RootFd, fileName.c_str(), times, AT_SYMLINK_NOFOLLOW);
+        int error = utimensat(location.DirFd, fileName, times, AT_SYMLINK_NOFOLLOW);
         if (error < 0)
         {
             return -errno;
@@ -463,7 +596,7 @@ LX_INT File::SetAttr(UINT32 valid, const StatResult& stat)
     // operation that has a ctime update as a side-effect.
     if (needCTimeUpdate)
     {
-        int error = fchownat(m_Root->RootFd, fileName.c_str(), -1, -1, AT_SYMLINK_NOFOLLOW);
+        int error = fchownat(location.DirFd, fileName, -1, -1, AT_SYMLINK_NOFOLLOW);
         if (error < 0)
         {
             return -errno;
@@ -485,9 +618,16 @@ Expected<Qid> File::Open(OpenFlags flags)
     }
 
     WI_ClearFlag(flags, OpenFlags::Create);
+    auto invalidateAttributes = wil::scope_exit([] { AttributeCache::Invalidate(); });
+    if (!WI_IsFlagSet(flags, OpenFlags::Truncate))
+    {
+        invalidateAttributes.release();
+    }
+
     util::FsUserContext userContext{m_Root->Uid, m_Root->Gid, m_Root->Groups};
-    // Don't use OpenHandle because the lock is already held.
-    auto file{util::OpenAt(m_Root->RootFd, m_FileName, OpenFlagsToLinuxFlags(flags) | O_NOFOLLOW)};
+    // Don't use OpenFile because the lock is already held.
+    const auto location = LocationWithLockHeld();
+    auto file{util::OpenAt(location.DirFd, location.Name, OpenFlagsToLinuxFlags(flags) | O_NOFOLLOW)};
     if (!file)
     {
         return file.Unexpected();
@@ -495,12 +635,15 @@ Expected<Qid> File::Open(OpenFlags flags)
 
     m_Io = CoroutineIoIssuer(file->get());
     m_File = std::move(file.Get());
+    EnableWriteBehind(flags);
     return m_Qid;
 }
 
 // Creates a file in a directory, updating this object to point to the new file.
 Expected<Qid> File::Create(std::string_view name, OpenFlags flags, UINT32 mode, UINT32 /* gid */)
 {
+    const auto invalidateAttributes = wil::scope_exit([] { AttributeCache::Invalidate(); });
+
     // Acquire the lock exclusive because the file name will be modified,
     // and to protect against concurrent opens and creates.
     std::lock_guard<std::shared_mutex> lock{m_Lock};
@@ -517,8 +660,13 @@ Expected<Qid> File::Create(std::string_view name, OpenFlags flags, UINT32 mode,
     // The specified gid is currently ignored. Supporting it would be possible, but it would be
     // necessary to make sure that the user is a member of the specified group.
     util::FsUserContext userContext{m_Root->Uid, m_Root->Gid, m_Root->Groups};
-    auto newFileName = ChildPathWithLockHeld(name);
-    auto file{util::OpenAt(m_Root->RootFd, newFileName, OpenFlagsToLinuxFlags(flags) | O_CREAT | O_NOFOLLOW, mode)};
+    auto location = ChildLocationWithLockHeld(name);
+    if (!location)
+    {
+        return location.Unexpected();
+    }
+
+    auto file{util::OpenAt(location->DirFd, location->Name, OpenFlagsToLinuxFlags(flags) | O_CREAT | O_NOFOLLOW, mode)};
     if (!file)
     {
         return file.Unexpected();
@@ -531,29 +679,41 @@ Expected<Qid> File::Create(std::string_view name, OpenFlags flags, UINT32 mode,
         return LxError{-errno};
     }
 
-    m_FileName = std::move(newFileName);
+    AppendPath(m_FileName, name);
+    if (location->Directory)
+    {
+        m_Parent = DirectoryHandle::Create(std::move(location->Directory));
+    }
+
     m_Io = CoroutineIoIssuer(file->get());
     m_File = std::move(file.Get());
     m_Qid = StatToQid(st);
     m_Device = st.st_dev;
+    EnableWriteBehind(flags);
     return m_Qid;
 }
 
 // Creates a subdirectory.
 Expected<Qid> File::MkDir(std::string_view name, UINT32 mode, UINT32 /* gid */)
 {
-    const auto newFileName = ChildPath(name);
+    const auto invalidateAttributes = wil::scope_exit([] { AttributeCache::Invalidate(); });
 
     // The specified gid is currently ignored. Supporting it would be possible, but it would be
     // necessary to make sure that the user is a member of the specified group.
     util::FsUserContext userContext{m_Root->Uid, m_Root->Gid, m_Root->Groups};
-    int result = mkdirat(m_Root->RootFd, newFileName.c_str(), mode);
+    const auto location = ChildLocation(name);
+    if (!location)
+    {
+        return location.Unexpected();
+    }
+
+    int result = mkdirat(location->DirFd, location->Name.c_str(), mode);
     if (result < 0)
     {
         return LxError{-errno};
     }
 
-    return GetFileQidByPath(m_Root->RootFd, newFileName);
+    return GetFileQidByPath(location->DirFd, location->Name);
 }
 
 // Reads the contents of a directory, starting at the specified offset.
@@ -564,86 +724,150 @@ LX_INT File::ReadDir(UINT64 offset, SpanWriter& writer, bool includeAttributes)
         return LX_EBADF;
     }
 
-    // Acquire an exclusive lock to protect enumerator state.
-    std::lock_guard<std::shared_mutex> lock{m_Lock};
-    if (!m_Enumerator)
+    if (includeAttributes)
     {
-        m_Enumerator.reset(new DirectoryEnumerator(m_File.get()));
-        // The fd is now owned by the enumerator.
-        m_File.release();
+        return ReadDirWithAttributes(offset, writer);
     }
 
-    m_Enumerator->Seek(offset);
+    // Acquire an exclusive lock to protect enumerator state.
+    std::lock_guard<std::shared_mutex> lock{m_Lock};
+    DirectoryEnumerator& enumerator = GetEnumeratorWithLockHeld();
+    enumerator.Seek(offset);
 
     bool dirEntriesWritten = false;
     for (;;)
     {
-        auto entry = m_Enumerator->Next();
+        auto entry = enumerator.Next();
         if (entry == nullptr)
         {
             break;
         }
 
-        StatResult attributes;
-        StatResult* attributesToUse = nullptr;
-        if (includeAttributes)
+        Qid qid{};
+        qid.Path = entry->d_ino;
+        qid.Type = util::DirEntryTypeToQidType(entry->d_type);
+        if (!util::SpanWriteDirectoryEntry(writer, entry->d_name, qid, entry->d_off, entry->d_type))
         {
-            attributesToUse = &attributes;
-            struct stat st;
-            const char* name = entry->d_name;
-
-            // Return attributes of the directory for both . and ..
-            if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+            if (!dirEntriesWritten)
             {
-                name = "";
+                return LX_EINVAL;
             }
 
-            int result = fstatat(m_Enumerator->Fd(), name, &st, AT_SYMLINK_NOFOLLOW | AT_EMPTY_PATH);
-            if (result < 0)
+            break;
+        }
+
+        dirEntriesWritten = true;
+    }
+
+    return {};
+}
+
+// Reads the contents of a directory, including the attributes of each entry.
+// N.B. The entries that fit in the buffer are collected under the lock, but their attributes are
+//      retrieved after it is released, so other operations on this fid are not blocked while all
+//      the entries are being queried.
+LX_INT File::ReadDirWithAttributes(UINT64 offset, SpanWriter& writer)
+{
+    struct Entry
+    {
+        std::string Name;
+        Qid Qid;
+        UINT64 NextOffset;
+        UCHAR Type;
+    };
+
+    std::vector<Entry> entries;
+    int directoryFd;
+    {
+        // Acquire an exclusive lock to protect enumerator state.
+        std::lock_guard<std::shared_mutex> lock{m_Lock};
+        DirectoryEnumerator& enumerator = GetEnumeratorWithLockHeld();
+        enumerator.Seek(offset);
+
+        // N.B. The enumerator, and therefore its file descriptor, lives until this object is
+        //      destructed, so the descriptor can be used after the lock is released.
+        directoryFd = enumerator.Fd();
+        auto available = static_cast<size_t>(writer.Peek().size());
+        for (;;)
+        {
+            auto entry = enumerator.Next();
+            if (entry == nullptr)
             {
-                // Fill out basic attributes if real attributes can't be determined.
-                attributes = {};
-                attributes.Mode = util::DirEntryTypeToMode(entry->d_type);
-                attributes.NLink = 1;
+                break;
             }
-            else
+
+            const auto size = util::DirectoryEntrySize(entry->d_name, true);
+            if (size > available)
             {
-                attributes.Mode = st.st_mode;
-                attributes.Uid = st.st_uid;
-                attributes.Gid = st.st_gid;
-                attributes.NLink = st.st_nlink;
-                attributes.RDev = st.st_rdev;
-                attributes.Size = st.st_size;
-                attributes.BlockSize = st.st_blksize;
-                attributes.Blocks = st.st_blocks;
-                attributes.AtimeSec = st.st_atim.tv_sec;
-                attributes.AtimeNsec = st.st_atim.tv_nsec;
-                attributes.MtimeSec = st.st_mtim.tv_sec;
-                attributes.MtimeNsec = st.st_mtim.tv_nsec;
-                attributes.CtimeSec = st.st_ctim.tv_sec;
-                attributes.CtimeNsec = st.st_ctim.tv_nsec;
+                if (entries.empty())
+                {
+                    return LX_EINVAL;
+                }
+
+                break;
             }
+
+            available -= size;
+            Qid qid{};
+            qid.Path = entry->d_ino;
+            qid.Type = util::DirEntryTypeToQidType(entry->d_type);
+            entries.push_back({entry->d_name, qid, static_cast<UINT64>(entry->d_off), entry->d_type});
         }
+    }
 
-        Qid qid{};
-        qid.Path = entry->d_ino;
-        qid.Type = util::DirEntryTypeToQidType(entry->d_type);
-        if (!util::SpanWriteDirectoryEntry(writer, entry->d_name, qid, entry->d_off, entry->d_type, attributesToUse))
+    if (entries.empty())
+    {
+        return {};
+    }
+
+    // Only request the fields that are returned to the client. The attributes are also cached, since
+    // clients commonly query the attributes of the files they just listed.
+    const auto generation = AttributeCache::Generation();
+    util::FsUserContext userContext{m_Root->Uid, m_Root->Gid, m_Root->Groups};
+    for (const auto& entry : entries)
+    {
+        // Return attributes of the directory for both . and ..
+        const char* name = entry.Name.c_str();
+        if (entry.Name == "." || entry.Name == "..")
         {
-            if (!dirEntriesWritten)
-            {
-                return LX_EINVAL;
-            }
+            name = "";
+        }
 
-            break;
+        StatResult attributes;
+        struct statx st;
+        if (statx(directoryFd, name, AT_SYMLINK_NOFOLLOW | AT_EMPTY_PATH | AT_STATX_SYNC_AS_STAT, c_readDirStatxMask, &st) < 0)
+        {
+            // Fill out basic attributes if real attributes can't be determined.
+            attributes = {};
+            attributes.Mode = util::DirEntryTypeToMode(entry.Type);
+            attributes.NLink = 1;
+        }
+        else
+        {
+            attributes = StatxToStatResult(st);
+            AttributeCache::Insert(st, generation);
         }
 
-        dirEntriesWritten = true;
+        const bool written = util::SpanWriteDirectoryEntry(writer, entry.Name, entry.Qid, entry.NextOffset, entry.Type, &attributes);
+        FAIL_FAST_IF(!written);
     }
 
     return {};
 }
 
+// Gets the directory enumerator, creating it if this is the first enumeration.
+DirectoryEnumerator& File::GetEnumeratorWithLockHeld()
+{
+    if (!m_Enumerator)
+    {
+        m_Enumerator.reset(new DirectoryEnumerator(m_File.get()));
+        // The fd is now owned by the enumerator.
+        m_File.release();
+    }
+
+    return *m_Enumerator;
+}
+
 // Reads the contents of an open file.
 Task<Expected<UINT32>> File::Read(UINT64 offset, gsl::span<gsl::byte> buffer)
 {
@@ -654,6 +878,21 @@ Task<Expected<UINT32>> File::Read(UINT64 offset, gsl::span<gsl::byte> buffer)
         co_return LxError{LX_EBADF};
     }
 
+    // Writes buffered by any fid open on the file must be visible to the read.
+    if (!FileWriteBehindEmpty())
+    {
+        const auto error = co_await BlockingCode([&]() { return FlushFileWriteBehind(m_Device, m_Qid.Path); });
+        if (error != 0)
+        {
+            co_return LxError{error};
+        }
+    }
+
+    if (const auto range = m_ReadAhead.OnRead(offset, static_cast<UINT32>(buffer.size())))
+    {
+        co_await BlockingCode([&]() { return Prefetch(*range); });
+    }
+
     CancelToken token;
     auto result = co_await ReadAsync(m_Io, offset, buffer, token);
     if (result.Error != 0 && result.Error != LX_EOVERFLOW)
@@ -664,9 +903,123 @@ Task<Expected<UINT32>> File::Read(UINT64 offset, gsl::span<gsl::byte> buffer)
     co_return static_cast<UINT32>(result.BytesTransferred);
 }
 
+// Reads from an open file into a pipe, so the data can be sent to a socket without being copied
+// to user mode. Stops early at the end of the file, or if the pipe is full.
+Expected<UINT32> File::SpliceRead(UINT64 offset, UINT32 count, int pipe)
+{
+    // No locking needed; see File::Read.
+    if (!m_File)
+    {
+        return LxError{LX_EBADF};
+    }
+
+    const auto error = FlushFileWriteBehind(m_Device, m_Qid.Path);
+    if (error != 0)
+    {
+        return LxError{error};
+    }
+
+    if (const auto range = m_ReadAhead.OnRead(offset, count))
+    {
+        Prefetch(*range);
+    }
+
+    UINT32 total{};
+    while (total < count)
+    {
+        loff_t position = offset + total;
+        const auto result = splice(m_File.get(), &position, pipe, nullptr, count - total, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (result < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            // Report the data that was already moved; if there was an actual error, the next read
+            // will return it.
+            if (total > 0)
+            {
+                break;
+            }
+
+            return LxError{-errno};
+        }
+
+        if (result == 0)
+        {
+            break;
+        }
+
+        total += static_cast<UINT32>(result);
+    }
+
+    return total;
+}
+
+// Asks the kernel to start reading the specified range of the file into the page cache.
+LX_INT File::Prefetch(const ReadAheadTracker::Range& range)
+{
+    return -posix_fadvise(m_File.get(), range.Offset, range.Length, POSIX_FADV_WILLNEED);
+}
+
+// Buffers small sequential writes if the share allows it and the file was opened for write.
+// N.B. Writes to files opened for synchronous or direct I/O are never buffered, since the client
+//      expects them to have reached the file when they complete.
+void File::EnableWriteBehind(OpenFlags flags)
+{
+    const auto access = flags & OpenFlags::AccessMask;
+    if (!m_Root->Share->WriteBehind || m_Qid.Type != QidType::File || (access != OpenFlags::WriteOnly && access != OpenFlags::ReadWrite) ||
+        WI_IsAnyFlagSet(flags, OpenFlags::Sync | OpenFlags::DSync | OpenFlags::Direct))
+    {
+        return;
+    }
+
+    m_WriteBehind = std::make_unique<WriteBehindBuffer>(m_Device, m_Qid.Path);
+}
+
+// Writes any data buffered by previous writes, returning any error that occurred writing it.
+LX_INT File::FlushWriteBehind()
+{
+    if (!m_WriteBehind)
+    {
+        return {};
+    }
+
+    return m_WriteBehind->Flush();
+}
+
+// Writes the data buffered by all the fids open on the file, so it is visible through this one.
+// Only errors from this fid's own buffered writes are returned; the others are kept for the fids
+// that made them.
+LX_INT File::FlushFileWriteBehind(dev_t device, ino_t inode)
+{
+    if (!m_Root->Share->WriteBehind)
+    {
+        return {};
+    }
+
+    WriteBehindBuffer::FlushFile(device, inode);
+    return FlushWriteBehind();
+}
+
+// Checks, without waiting, whether no fid open on the file has buffered data and this fid has no
+// pending error to return.
+bool File::FileWriteBehindEmpty()
+{
+    if (!m_Root->Share->WriteBehind)
+    {
+        return true;
+    }
+
+    return (!m_WriteBehind || m_WriteBehind->Empty()) && WriteBehindBuffer::FileEmpty(m_Device, m_Qid.Path);
+}
+
 // Writes to an open file.
 Task<Expected<UINT32>> File::Write(UINT64 offset, gsl::span<const gsl::byte> buffer)
 {
+    const auto invalidateAttributes = wil::scope_exit([] { AttributeCache::Invalidate(); });
+
     // Since the file could not have been opened for write on a read-only file
     // system, there is no reason to check that here.
 
@@ -677,6 +1030,16 @@ Task<Expected<UINT32>> File::Write(UINT64 offset, gsl::span<const gsl::byte> buf
         co_return LxError{LX_EBADF};
     }
 
+    if (m_WriteBehind)
+    {
+        if (auto result = m_WriteBehind->TryAppend(m_File.get(), offset, buffer))
+        {
+            co_return std::move(*result);
+        }
+
+        co_return co_await BlockingCode([&]() { return m_WriteBehind->Write(m_File.get(), offset, buffer); });
+    }
+
     CancelToken token;
     auto result = co_await WriteAsync(m_Io, offset, buffer, token);
     if (result.Error != 0)
@@ -690,18 +1053,24 @@ Task<Expected<UINT32>> File::Write(UINT64 offset, gsl::span<const gsl::byte> buf
 // Unlinks a directory entry.
 LX_INT File::UnlinkAt(std::string_view name, UINT32 flags)
 {
+    const auto invalidateAttributes = wil::scope_exit([] { AttributeCache::Invalidate(); });
+
     if (m_Root->ReadOnly())
     {
         return LX_EROFS;
     }
 
-    const auto fileName = ChildPath(name);
     util::FsUserContext userContext{m_Root->Uid, m_Root->Gid, m_Root->Groups};
+    const auto location = ChildLocation(name);
+    if (!location)
+    {
+        return location.Error();
+    }
 
     // TODO: it's unclear whether this is the correct usage of the
     // flags field. The Windows implementation unlinks either directory or
     // file regardless of flags.
-    int result = unlinkat(m_Root->RootFd, fileName.c_str(), flags);
+    int result = unlinkat(location->DirFd, location->Name.c_str(), flags);
     if (result < 0)
     {
         return -errno;
@@ -713,6 +1082,8 @@ LX_INT File::UnlinkAt(std::string_view name, UINT32 flags)
 // Removes the directory entry represented by the current fid.
 LX_INT File::Remove()
 {
+    const auto invalidateAttributes = wil::scope_exit([] { AttributeCache::Invalidate(); });
+
     if (m_Root->ReadOnly())
     {
         return LX_EROFS;
@@ -720,15 +1091,15 @@ LX_INT File::Remove()
 
     int flags = 0;
     WI_SetFlagIf(flags, AT_REMOVEDIR, WI_IsFlagSet(m_Qid.Type, QidType::Directory));
-    const std::string fileName = GetFileName();
-    if (fileName.length() == 0)
+    const auto location = Location();
+    if (location.Name.length() == 0)
     {
         // Can't unlink the root.
         return LX_EPERM;
     }
 
     util::FsUserContext userContext{m_Root->Uid, m_Root->Gid, m_Root->Groups};
-    const int result = unlinkat(m_Root->RootFd, fileName.c_str(), flags);
+    const int result = unlinkat(location.DirFd, location.Name.c_str(), flags);
     if (result < 0)
     {
         return -errno;
@@ -744,24 +1115,76 @@ std::string File::GetFileName() const
     return m_FileName;
 }
 
-// Constructs a child path of the current path from a valid Linux path segment.
-std::string File::ChildPath(std::string_view name)
+// Gets the location of this file, taking the lock to retrieve it.
+FileLocation File::Location() const
 {
-    auto result = GetFileName();
-    AppendPath(result, name);
-    return result;
+    std::shared_lock<std::shared_mutex> lock{m_Lock};
+    return LocationWithLockHeld();
 }
 
-std::string File::ChildPathWithLockHeld(std::string_view name)
+// Gets the location of this file. If the parent directory handle is still open, only the last
+// component of the name is resolved relative to it; otherwise, the full path is resolved relative
+// to the share root.
+FileLocation File::LocationWithLockHeld() const
 {
-    std::string result{m_FileName};
-    AppendPath(result, name);
-    return result;
+    FileLocation location;
+    if (m_Parent)
+    {
+        location.Lease = m_Parent->Use();
+        if (location.Lease)
+        {
+            location.DirFd = location.Lease.Fd();
+            location.Name = m_FileName.substr(m_FileName.find_last_of('/') + 1);
+            return location;
+        }
+    }
+
+    location.DirFd = m_Root->RootFd;
+    location.Name = m_FileName;
+    return location;
+}
+
+// Gets the location of a child of this directory from a valid Linux path segment, taking the lock
+// to retrieve it.
+Expected<FileLocation> File::ChildLocation(std::string_view name) const
+{
+    std::shared_lock<std::shared_mutex> lock{m_Lock};
+    return ChildLocationWithLockHeld(name);
+}
+
+// Gets the location of a child of this directory from a valid Linux path segment. Unless this is
+// the share root, an O_PATH descriptor for this directory is opened, and the child is resolved
+// relative to it.
+// N.B. The caller is responsible for setting the right thread uid/gid before calling this.
+Expected<FileLocation> File::ChildLocationWithLockHeld(std::string_view name) const
+{
+    FileLocation location;
+    if (m_FileName.empty())
+    {
+        location.DirFd = m_Root->RootFd;
+    }
+    else
+    {
+        const auto self = LocationWithLockHeld();
+        auto directory = util::OpenAt(self.DirFd, self.Name, O_PATH | O_DIRECTORY | O_NOFOLLOW);
+        if (!directory)
+        {
+            return directory.Unexpected();
+        }
+
+        location.Directory = std::move(directory.Get());
+        location.DirFd = location.Directory.get();
+    }
+
+    location.Name = name;
+    return location;
 }
 
 // Renames a directory entry.
 LX_INT File::RenameAt(std::string_view oldName, Fid& newParent, std::string_view newName)
 {
+    const auto invalidateAttributes = wil::scope_exit([] { AttributeCache::Invalidate(); });
+
     if (!newParent.IsFile() || !newParent.IsOnRoot(m_Root))
     {
         return LX_EINVAL;
@@ -772,11 +1195,21 @@ LX_INT File::RenameAt(std::string_view oldName, Fid& newParent, std::string_view
         return LX_EROFS;
     }
 
-    auto newParentFile = static_cast<File&>(newParent);
-    const auto oldPath = ChildPath(oldName);
-    const auto newPath = newParentFile.ChildPath(newName);
+    const auto& newParentFile = static_cast<File&>(newParent);
     util::FsUserContext userContext{m_Root->Uid, m_Root->Gid, m_Root->Groups};
-    int result = renameat(m_Root->RootFd, oldPath.c_str(), m_Root->RootFd, newPath.c_str());
+    const auto oldLocation = ChildLocation(oldName);
+    if (!oldLocation)
+    {
+        return oldLocation.Error();
+    }
+
+    const auto newLocation = newParentFile.ChildLocation(newName);
+    if (!newLocation)
+    {
+        return newLocation.Error();
+    }
+
+    int result = renameat(oldLocation->DirFd, oldLocation->Name.c_str(), newLocation->DirFd, newLocation->Name.c_str());
     if (result < 0)
     {
         return -errno;
@@ -788,6 +1221,8 @@ LX_INT File::RenameAt(std::string_view oldName, Fid& newParent, std::string_view
 // Renames the current directory entry.
 LX_INT File::Rename(Fid& newParent, std::string_view newName)
 {
+    const auto invalidateAttributes = wil::scope_exit([] { AttributeCache::Invalidate(); });
+
     if (!newParent.IsFile() || !newParent.IsOnRoot(m_Root))
     {
         return LX_EINVAL;
@@ -798,8 +1233,18 @@ LX_INT File::Rename(Fid& newParent, std::string_view newName)
         return LX_EROFS;
     }
 
-    auto newParentFile = static_cast<File&>(newParent);
+    const auto& newParentFile = static_cast<File&>(newParent);
+    auto newPath = newParentFile.GetFileName();
+    AppendPath(newPath, newName);
+
     // Take an exclusive lock because the file name will be changed.
+    util::FsUserContext userContext{m_Root->Uid, m_Root->Gid, m_Root->Groups};
+    auto newLocation = newParentFile.ChildLocation(newName);
+    if (!newLocation)
+    {
+        return newLocation.Error();
+    }
+
     std::lock_guard<std::shared_mutex> lock{m_Lock};
     if (m_FileName.length() == 0)
     {
@@ -807,50 +1252,56 @@ LX_INT File::Rename(Fid& newParent, std::string_view newName)
         return LX_EPERM;
     }
 
-    const auto oldPath = m_FileName;
-    auto newPath = newParentFile.ChildPath(newName);
-    util::FsUserContext userContext{m_Root->Uid, m_Root->Gid, m_Root->Groups};
-    int result = renameat(m_Root->RootFd, oldPath.c_str(), m_Root->RootFd, newPath.c_str());
+    const auto oldLocation = LocationWithLockHeld();
+    int result = renameat(oldLocation.DirFd, oldLocation.Name.c_str(), newLocation->DirFd, newLocation->Name.c_str());
     if (result < 0)
     {
         return -errno;
     }
 
-    m_FileName = newPath;
+    m_FileName = std::move(newPath);
+    m_Parent = newLocation->Directory ? DirectoryHandle::Create(std::move(newLocation->Directory)) : nullptr;
     return {};
 }
 
 // Creates a symbolic link in a directory.
 Expected<Qid> File::SymLink(std::string_view name, std::string_view target, UINT32 /* gid */)
 {
+    const auto invalidateAttributes = wil::scope_exit([] { AttributeCache::Invalidate(); });
+
     if (m_Root->ReadOnly())
     {
         return LxError{LX_EROFS};
     }
 
     // TODO: Gid is being ignored.
-    const auto linkName = ChildPath(name);
     // Need a null-terminated string:
     const std::string linkTarget{target.data(), target.size()};
 
     // The specified gid is currently ignored. Supporting it would be possible, but it would be
     // necessary to make sure that the user is a member of the specified group.
     util::FsUserContext userContext{m_Root->Uid, m_Root->Gid, m_Root->Groups};
-    int result = symlinkat(linkTarget.c_str(), m_Root->RootFd, linkName.c_str());
+    const auto location = ChildLocation(name);
+    if (!location)
+    {
+        return location.Unexpected();
+    }
+
+    int result = symlinkat(linkTarget.c_str(), location->DirFd, location->Name.c_str());
     if (result < 0)
     {
         return LxError{-errno};
     }
 
-    return GetFileQidByPath(m_Root->RootFd, linkName);
+    return GetFileQidByPath(location->DirFd, location->Name);
 }
 
 // Reads the target of a symbolic link.
 Expected<UINT32> File::ReadLink(gsl::span<char> name)
 {
-    const auto fileName = GetFileName();
+    const auto location = Location();
     util::FsUserContext userContext{m_Root->Uid, m_Root->Gid, m_Root->Groups};
-    int result = readlinkat(m_Root->RootFd, fileName.c_str(), name.data(), name.size());
+    int result = readlinkat(location.DirFd, location.Name.c_str(), name.data(), name.size());
     if (result < 0)
     {
         return LxError{-errno};
@@ -862,6 +1313,8 @@ Expected<UINT32> File::ReadLink(gsl::span<char> name)
 // Creates a hard link in a directory to another file.
 LX_INT File::Link(std::string_view newName, Fid& target)
 {
+    const auto invalidateAttributes = wil::scope_exit([] { AttributeCache::Invalidate(); });
+
     if (!target.IsFile() || !target.IsOnRoot(m_Root))
     {
         return LX_EINVAL;
@@ -872,13 +1325,16 @@ LX_INT File::Link(std::string_view newName, Fid& target)
         return LX_EROFS;
     }
 
-    const auto targetFile = static_cast<File&>(target);
-
-    // Construct the new name relative to the share root.
-    const auto newLinkName = ChildPath(newName);
-    const auto targetName = targetFile.GetFileName();
+    const auto& targetFile = static_cast<File&>(target);
+    const auto targetLocation = targetFile.Location();
     util::FsUserContext userContext{m_Root->Uid, m_Root->Gid, m_Root->Groups};
-    int result = linkat(m_Root->RootFd, targetName.c_str(), m_Root->RootFd, newLinkName.c_str(), 0);
+    const auto location = ChildLocation(newName);
+    if (!location)
+    {
+        return location.Error();
+    }
+
+    int result = linkat(targetLocation.DirFd, targetLocation.Name.c_str(), location->DirFd, location->Name.c_str(), 0);
     if (result < 0)
     {
         return -errno;
@@ -890,23 +1346,29 @@ LX_INT File::Link(std::string_view newName, Fid& target)
 // Creates a device object in a directory.
 Expected<Qid> File::MkNod(std::string_view name, UINT32 mode, UINT32 major, UINT32 minor, UINT32 gid)
 {
+    const auto invalidateAttributes = wil::scope_exit([] { AttributeCache::Invalidate(); });
+
     if (m_Root->ReadOnly())
     {
         return LxError{LX_EROFS};
     }
 
-    const auto path = ChildPath(name);
-
     // The specified gid is currently ignored. Supporting it would be possible, but it would be
     // necessary to make sure that the user is a member of the specified group.
     util::FsUserContext userContext{m_Root->Uid, m_Root->Gid, m_Root->Groups};
-    int result = mknodat(m_Root->RootFd, path.c_str(), mode, makedev(major, minor));
+    const auto location = ChildLocation(name);
+    if (!location)
+    {
+        return location.Unexpected();
+    }
+
+    int result = mknodat(location->DirFd, location->Name.c_str(), mode, makedev(major, minor));
     if (result < 0)
     {
         return LxError{-errno};
     }
 
-    return GetFileQidByPath(m_Root->RootFd, path);
+    return GetFileQidByPath(location->DirFd, location->Name);
 }
 
 // Flushes a file's buffers.
@@ -917,6 +1379,12 @@ LX_INT File::Fsync()
         return LX_EINVAL;
     }
 
+    const auto error = FlushWriteBehind();
+    if (error != 0)
+    {
+        return error;
+    }
+
     int result = fsync(m_File.get());
     if (result < 0)
     {
@@ -930,6 +1398,7 @@ LX_INT File::Fsync()
 Expected<StatFsResult> File::StatFs()
 {
     // Open the file because there is no statfsat.
+    util::FsUserContext userContext{m_Root->Uid, m_Root->Gid, m_Root->Groups};
     auto file{OpenFile(O_PATH)};
     if (!file)
     {
@@ -937,7 +1406,6 @@ Expected<StatFsResult> File::StatFs()
     }
 
     struct statfs statFs;
-    util::FsUserContext userContext{m_Root->Uid, m_Root->Gid, m_Root->Groups};
     int result = fstatfs(file->get(), &statFs);
     if (result < 0)
     {
@@ -1008,9 +1476,36 @@ Expected<std::shared_ptr<XAttrBase>> File::XattrWalk(const std::string& name)
     // on symlinks. This means there's no way to support xattrs on symlinks
     // without using the full file name, which is less than ideal.
     // TODO: Use a chroot environment to make this safer.
+    // N.B. Resolving the full file name is expensive, so the file's change time is retrieved from
+    //      its location first to check for a cached value.
+    auto version = XAttrVersion();
+    {
+        const auto location = Location();
+        util::FsUserContext userContext{m_Root->Uid, m_Root->Gid, m_Root->Groups};
+        struct statx stat;
+        if (statx(location.DirFd, location.Name.c_str(), AT_SYMLINK_NOFOLLOW | AT_EMPTY_PATH | AT_STATX_SYNC_AS_STAT, STATX_CTIME, &stat) < 0)
+        {
+            return LxError{-errno};
+        }
+
+        version.ChangeTime = stat.stx_ctime;
+    }
+
+    std::shared_ptr<XAttrBase> xattr;
+    if (auto cached = XAttrCache::Lookup(version, name))
+    {
+        if (cached->Error != 0)
+        {
+            return LxError{cached->Error};
+        }
+
+        xattr = std::make_shared<XAttr>(m_Root, name, std::move(cached->Data));
+        return xattr;
+    }
+
     auto path = util::GetFdPath(m_Root->RootFd);
     AppendPath(path, GetFileName());
-    std::shared_ptr<XAttrBase> xattr = std::make_shared<XAttr>(m_Root, path, name, XAttr::Access::Read);
+    xattr = std::make_shared<XAttr>(m_Root, path, name, XAttr::Access::Read, version);
     return xattr;
 }
 
@@ -1031,10 +1526,30 @@ Expected<std::shared_ptr<XAttrBase>> File::XattrCreate(const std::string& name,
     // See above for the reason for doing this.
     auto path = util::GetFdPath(m_Root->RootFd);
     AppendPath(path, GetFileName());
-    std::shared_ptr<XAttrBase> xattr = std::make_shared<XAttr>(m_Root, path, name, XAttr::Access::Write, size, flags);
+    std::shared_ptr<XAttrBase> xattr = std::make_shared<XAttr>(m_Root, path, name, XAttr::Access::Write, XAttrVersion(), size, flags);
     return xattr;
 }
 
+// Gets the identity of this file for the extended attribute cache. The change time is not set.
+XAttrFileVersion File::XAttrVersion() const
+{
+    XAttrFileVersion version;
+    version.Generation = XAttrCache::Generation();
+    version.Uid = m_Root->Uid;
+    version.Gid = m_Root->Gid;
+    std::shared_lock<std::shared_mutex> lock{m_Lock};
+    version.Device = m_Device;
+    version.Inode = m_Qid.Path;
+    return version;
+}
+
+// Writes any buffered data when the fid is clunked, so the client sees errors from it in the
+// close call.
+LX_INT File::Clunk()
+{
+    return FlushWriteBehind();
+}
+
 LX_INT File::Access(AccessFlags flags)
 {
     AccessFlags flagsWithoutDelete = flags;
@@ -4,6 +4,10 @@
 #include "p9io.h"
 #include "p9fid.h"
 #include "p9readdir.h"
+#include "p9dirhandle.h"
+#include "p9readahead.h"
+#include "p9writebehind.h"
+#include "p9xattrcache.h"
 #include <pwd.h>
 #include <grp.h>
 
@@ -12,6 +16,9 @@ namespace p9fs {
 struct Share
 {
     wil::unique_fd RootFd;
+
+    // Whether small sequential writes to files on this share are buffered.
+    bool WriteBehind{};
 };
 
 struct Root final : public IRoot
@@ -68,6 +75,15 @@ struct Root final : public IRoot
     }
 };
 
+// A file name and the directory file descriptor it is relative to.
+struct FileLocation
+{
+    int DirFd{-1};
+    std::string Name;
+    DirectoryHandle::Lease Lease;
+    wil::unique_fd Directory;
+};
+
 class File final : public Fid
 {
 public:
@@ -76,6 +92,7 @@ public:
 
     Expected<Qid> Initialize();
     Expected<Qid> Walk(std::string_view Name) override;
+    Expected<std::vector<Qid>> WalkMany(gsl::span<const std::string_view> Names) override;
     Expected<std::tuple<UINT64, Qid, StatResult>> GetAttr(UINT64 Mask) override;
     LX_INT SetAttr(UINT32 Valid, const StatResult& Stat) override;
     Expected<Qid> Open(OpenFlags Flags) override;
@@ -84,6 +101,7 @@ public:
     LX_INT ReadDir(UINT64 Offset, SpanWriter& writer, bool includeAttributes) override;
     Task<Expected<UINT32>> Read(UINT64 Offset, gsl::span<gsl::byte> Buffer) override;
     Task<Expected<UINT32>> Write(UINT64 Offset, gsl::span<const gsl::byte> Buffer) override;
+    Expected<UINT32> SpliceRead(UINT64 Offset, UINT32 Count, int Pipe) override;
     LX_INT UnlinkAt(std::string_view Name, UINT32 /* Flags */) override;
     LX_INT Remove() override;
     LX_INT RenameAt(std::string_view OldName, Fid& NewParent, std::string_view NewName) override;
@@ -99,6 +117,7 @@ public:
         LockType Type, UINT64 Start, UINT64 Length, UINT32 ProcId, std::string_view ClientId) override;
     Expected<std::shared_ptr<XAttrBase>> XattrWalk(const std::string& Name) override;
     Expected<std::shared_ptr<XAttrBase>> XattrCreate(const std::string& Name, UINT64 Size, UINT32 Flags) override;
+    LX_INT Clunk() override;
 
     // 9P2000.W operations
     LX_INT Access(AccessFlags Flags) override;
@@ -113,20 +132,41 @@ private:
     Expected<wil::unique_fd> OpenFile(int openFlags);
     LX_INT ValidateExists();
     std::string GetFileName() const;
-    std::string ChildPath(std::string_view name);
-    std::string ChildPathWithLockHeld(std::string_view name);
+    FileLocation Location() const;
+    FileLocation LocationWithLockHeld() const;
+    Expected<FileLocation> ChildLocation(std::string_view name) const;
+    Expected<FileLocation> ChildLocationWithLockHeld(std::string_view name) const;
     Expected<struct stat> Stat();
-    LX_INT ReadDirHelper(UINT64 offset, SpanWriter& writer, bool extendedAttributes);
+    LX_INT ReadDirWithAttributes(UINT64 offset, SpanWriter& writer);
+    DirectoryEnumerator& GetEnumeratorWithLockHeld();
+    LX_INT Prefetch(const ReadAheadTracker::Range& range);
+    void EnableWriteBehind(OpenFlags flags);
+    LX_INT FlushWriteBehind();
+    LX_INT FlushFileWriteBehind(dev_t device, ino_t inode);
+    bool FileWriteBehindEmpty();
+    XAttrFileVersion XAttrVersion() const;
 
     // This lock protects all state except:
-    // - Read access to m_File: once non-NULL, this member never becomes NULL
-    //   again.
+    // - Read access to m_File and m_WriteBehind: once non-NULL, these members
+    //   never become NULL again.
     // - m_Root, m_Uid: these members don't change after initialization.
+    // - Read access to m_Qid and m_Device once m_File is set: these members don't change after
+    //   the file is opened.
+    // - m_ReadAhead: this member has its own lock.
     mutable std::shared_mutex m_Lock;
     std::string m_FileName;
+
+    // Handle to the parent directory, if any. When it is set (and still open), operations on this
+    // file resolve only the last component of m_FileName relative to it, rather than the full path.
+    std::shared_ptr<DirectoryHandle> m_Parent;
     std::unique_ptr<DirectoryEnumerator> m_Enumerator;
     wil::unique_fd m_File;
     CoroutineIoIssuer m_Io;
+
+    // N.B. This must be declared after m_File, so buffered data is written before the file is
+    //      closed.
+    std::unique_ptr<WriteBehindBuffer> m_WriteBehind;
+    ReadAheadTracker m_ReadAhead;
     const std::shared_ptr<const Root> m_Root;
     Qid m_Qid{};
     dev_t m_Device{};
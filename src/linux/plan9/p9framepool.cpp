@@ -0,0 +1,206 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+#include "precomp.h"
+#include "p9framepool.h"
+
+namespace p9fs {
+
+namespace {
+
+// Size classes are powers of two from 64 bytes up to 16KB. Larger blocks come from the heap.
+constexpr size_t c_minimumBlockShift = 6;
+constexpr size_t c_sizeClassCount = 9;
+constexpr size_t c_maximumBlockSize = size_t{1} << (c_minimumBlockShift + c_sizeClassCount - 1);
+
+// When a thread caches more than this many blocks of a size class, a batch of them is moved to the
+// depot. A thread that runs out of blocks takes a batch from the depot before using the heap.
+constexpr size_t c_threadCacheLimit = 64;
+constexpr size_t c_batchSize = c_threadCacheLimit / 2;
+
+// Blocks beyond this many per size class in the depot are returned to the heap.
+constexpr size_t c_depotLimit = 1024;
+
+struct FreeBlock
+{
+    FreeBlock* Next;
+};
+
+struct FreeList
+{
+    FreeBlock* Head;
+    size_t Count;
+
+    void Push(void* block) noexcept
+    {
+        const auto entry = static_cast<FreeBlock*>(block);
+        entry->Next = Head;
+        Head = entry;
+        ++Count;
+    }
+
+    void* Pop() noexcept
+    {
+        const auto entry = Head;
+        Head = entry->Next;
+        --Count;
+        return entry;
+    }
+};
+
+struct DepotList
+{
+    std::mutex Lock;
+    FreeList Blocks;
+};
+
+// N.B. The cache is trivially destructible so it stays usable while the thread exits, after its
+//      blocks have been flushed to the depot.
+struct ThreadCache
+{
+    FreeList Lists[c_sizeClassCount];
+    bool Registered;
+    bool Exited;
+};
+
+// Flushes the thread's cache to the depot when the thread exits.
+struct ThreadCacheFlusher
+{
+    ~ThreadCacheFlusher();
+
+    void Register() noexcept
+    {
+    }
+};
+
+DepotList g_Depot[c_sizeClassCount];
+std::atomic<UINT64> g_HeapAllocations;
+thread_local ThreadCache tls_Cache;
+thread_local ThreadCacheFlusher tls_Flusher;
+
+// Moves up to count blocks from one list to another, and returns how many were moved.
+size_t MoveBlocks(FreeList& from, FreeList& to, size_t count) noexcept
+{
+    size_t moved = 0;
+    for (; moved < count && from.Head != nullptr; ++moved)
+    {
+        to.Push(from.Pop());
+    }
+
+    return moved;
+}
+
+// Returns blocks from the thread's list to the depot, or to the heap if the depot is full.
+void ReturnToDepot(size_t sizeClass, FreeList& list, size_t count) noexcept
+{
+    auto& depot = g_Depot[sizeClass];
+    {
+        std::lock_guard<std::mutex> lock{depot.Lock};
+        count -= MoveBlocks(list, depot.Blocks, std::min(count, c_depotLimit - std::min(depot.Blocks.Count, c_depotLimit)));
+    }
+
+    for (; count > 0 && list.Head != nullptr; --count)
+    {
+        ::operator delete(list.Pop());
+    }
+}
+
+ThreadCacheFlusher::~ThreadCacheFlusher()
+{
+    for (size_t sizeClass = 0; sizeClass < c_sizeClassCount; ++sizeClass)
+    {
+        auto& list = tls_Cache.Lists[sizeClass];
+        ReturnToDepot(sizeClass, list, list.Count);
+    }
+
+    tls_Cache.Exited = true;
+}
+
+// Gets the cache for the current thread, or null if the thread is exiting.
+ThreadCache* GetThreadCache() noexcept
+{
+    if (!tls_Cache.Registered)
+    {
+        // N.B. Using the flusher makes sure it is constructed, so its destructor runs on exit.
+        tls_Flusher.Register();
+        tls_Cache.Registered = true;
+    }
+
+    return tls_Cache.Exited ? nullptr : &tls_Cache;
+}
+
+size_t SizeClass(size_t size) noexcept
+{
+    return std::bit_width((std::max(size, size_t{1}) - 1) >> c_minimumBlockShift);
+}
+
+} // namespace
+
+// Allocates a block of the specified size.
+void* FramePool::Allocate(size_t size)
+{
+    if (size <= c_maximumBlockSize)
+    {
+        const auto sizeClass = SizeClass(size);
+        const auto cache = GetThreadCache();
+        if (cache != nullptr)
+        {
+            auto& list = cache->Lists[sizeClass];
+            if (list.Head == nullptr)
+            {
+                auto& depot = g_Depot[sizeClass];
+                std::lock_guard<std::mutex> lock{depot.Lock};
+                MoveBlocks(depot.Blocks, list, c_batchSize);
+            }
+
+            if (list.Head != nullptr)
+            {
+                return list.Pop();
+            }
+        }
+
+        size = size_t{1} << (sizeClass + c_minimumBlockShift);
+    }
+
+    g_HeapAllocations.fetch_add(1, std::memory_order_relaxed);
+    return ::operator new(size);
+}
+
+// Frees a block. The size must match the size that was passed to Allocate.
+void FramePool::Free(void* block, size_t size) noexcept
+{
+    if (block == nullptr)
+    {
+        return;
+    }
+
+    if (size > c_maximumBlockSize)
+    {
+        ::operator delete(block);
+        return;
+    }
+
+    const auto sizeClass = SizeClass(size);
+    const auto cache = GetThreadCache();
+    if (cache == nullptr)
+    {
+        FreeList list{};
+        list.Push(block);
+        ReturnToDepot(sizeClass, list, 1);
+        return;
+    }
+
+    auto& list = cache->Lists[sizeClass];
+    list.Push(block);
+    if (list.Count > c_threadCacheLimit)
+    {
+        ReturnToDepot(sizeClass, list, c_batchSize);
+    }
+}
+
+// Returns how many blocks had to be allocated from the heap since the process started. Once the
+// pool has warmed up, handling requests should not increase this.
+UINT64 FramePool::HeapAllocations() noexcept
+{
+    return g_HeapAllocations.load(std::memory_order_relaxed);
+}
+
+} // namespace p9fs
@@ -0,0 +1,67 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+#pragma once
+
+namespace p9fs {
+
+// Allocator for coroutine frames and other per-request bookkeeping. Every request allocates
+// several coroutine frames, so blocks are kept in per-thread free lists by size class instead of
+// being returned to the heap. Threads that free more blocks than they allocate (e.g. because
+// coroutines resume on a different thread) hand them back to a shared depot in batches.
+class FramePool final
+{
+public:
+    static void* Allocate(size_t size);
+    static void Free(void* block, size_t size) noexcept;
+    static UINT64 HeapAllocations() noexcept;
+
+private:
+    FramePool() = delete;
+};
+
+// Standard allocator that uses the frame pool, for use with std::allocate_shared.
+template <class T>
+class FramePoolAllocator
+{
+public:
+    using value_type = T;
+
+    FramePoolAllocator() = default;
+
+    template <class U>
+    FramePoolAllocator(const FramePoolAllocator<U>&) noexcept
+    {
+    }
+
+    T* allocate(size_t count)
+    {
+        return static_cast<T*>(FramePool::Allocate(count * sizeof(T)));
+    }
+
+    void deallocate(T* block, size_t count) noexcept
+    {
+        FramePool::Free(block, count * sizeof(T));
+    }
+
+    template <class U>
+    bool operator==(const FramePoolAllocator<U>&) const noexcept
+    {
+        return true;
+    }
+};
+
+// Base class for coroutine promise types, which makes the compiler allocate the coroutine frames
+// from the frame pool.
+struct PooledFrame
+{
+    static void* operator new(size_t size)
+    {
+        return FramePool::Allocate(size);
+    }
+
+    static void operator delete(void* frame, size_t size) noexcept
+    {
+        FramePool::Free(frame, size);
+    }
+};
+
+} // namespace p9fs
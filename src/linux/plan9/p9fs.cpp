@@ -15,6 +15,10 @@ constexpr const char* c_NobodyGroupName = "nobody";
 class ShareList final : public IShareList
 {
 public:
+    ShareList(bool writeBehind) : m_WriteBehind{writeBehind}
+    {
+    }
+
     void Add(const std::string& name, int rootFd);
     void Remove(const std::string& name);
     std::shared_ptr<const Share> Get(std::string_view name);
@@ -24,6 +28,11 @@ public:
 private:
     std::mutex m_ShareLock;
     std::map<std::string, std::shared_ptr<Share>, std::less<>> m_Shares;
+
+    // N.B. The effective uid of worker threads depends on the last request they ran, so the
+    //      server's own uid is captured when the share list is created.
+    const uid_t m_ServerUid{geteuid()};
+    const bool m_WriteBehind;
 };
 
 void ShareList::Add(const std::string& name, int rootFd)
@@ -31,6 +40,7 @@ void ShareList::Add(const std::string& name, int rootFd)
     auto share = std::make_shared<Share>();
     share->RootFd.reset(rootFd);
     THROW_LAST_ERROR_IF(!share->RootFd);
+    share->WriteBehind = m_WriteBehind;
 
     std::lock_guard<std::mutex> lock{m_ShareLock};
     const bool inserted = m_Shares.try_emplace(name, std::move(share)).second;
@@ -80,7 +90,7 @@ Expected<std::shared_ptr<const IRoot>> ShareList::MakeRoot(std::string_view anam
     }
 
     gid_t gid;
-    uid_t currentUid = geteuid();
+    const uid_t currentUid = m_ServerUid;
     if (uid == currentUid)
     {
         // No need to change IDs if the requested user matches the user the server is running as.
@@ -116,18 +126,31 @@ Expected<std::shared_ptr<const IRoot>> ShareList::MakeRoot(std::string_view anam
 class FileSystem final : public IPlan9FileSystem
 {
 public:
-    // Creates a new file system, using the specified socket to listen.
-    // N.B. The socket must already be bound to an appropriate local address.
-    // N.B. The file system class takes ownership of the socket.
-    FileSystem(int socket)
+    // Creates a new file system, using the specified sockets to listen.
+    // N.B. The sockets must already be bound to an appropriate local address.
+    // N.B. The file system class takes ownership of the sockets.
+    FileSystem(const std::vector<int>& sockets, size_t requestLimit, unsigned int warmThreads, bool writeBehind, unsigned int epollThreads) :
+        m_ShareList{writeBehind}, m_RequestLimit{requestLimit}
     {
-        if (!g_Watcher)
+        // Take ownership of all the sockets before anything can fail.
+        std::vector<wil::unique_fd> ownedSockets;
+        for (const auto socket : sockets)
         {
-            g_Watcher.Run();
+            ownedSockets.emplace_back(socket);
         }
 
-        m_Server.Reset(socket);
-        THROW_LAST_ERROR_IF(listen(socket, 1) < 0);
+        THROW_ERRNO_IF(EINVAL, ownedSockets.empty());
+        g_ThreadPool.SetMinimumThreads(warmThreads);
+        g_Watchers.Run(epollThreads == c_AutomaticEpollThreads ? AutomaticEpollThreads() : epollThreads);
+        g_IoRing.Run();
+
+        // N.B. The listening sockets are created after the watchers are running so they are spread
+        //      across them like connections.
+        for (auto& socket : ownedSockets)
+        {
+            THROW_LAST_ERROR_IF(listen(socket.get(), 1) < 0);
+            m_Servers.emplace_back(std::make_unique<Socket>(socket.release()));
+        }
     }
 
     // Destructs a file system instance.
@@ -178,10 +201,13 @@ public:
         m_RunTask = Run();
     }
 
-    // Tears down the server socket.
+    // Tears down the server sockets.
     void Teardown() override
     {
-        m_Server.Reset();
+        for (auto& server : m_Servers)
+        {
+            server->Reset();
+        }
     }
 
     bool HasConnections() const noexcept override
@@ -190,22 +216,43 @@ public:
     }
 
 private:
+    // Uses one epoll thread per processor, up to a limit, since each one only dispatches socket
+    // readiness and the requests themselves run on the thread pool.
+    static unsigned int AutomaticEpollThreads() noexcept
+    {
+        constexpr unsigned int c_maximumAutomaticEpollThreads = 8;
+        return std::clamp(std::thread::hardware_concurrency(), 1u, c_maximumAutomaticEpollThreads);
+    }
+
     // Asynchronously handles incoming connections.
     AsyncTask Run() noexcept
     {
-        return HandleConnections(m_Server, m_ShareList, m_CancelToken, m_WaitGroup);
+        std::vector<ISocket*> listeners;
+        for (auto& server : m_Servers)
+        {
+            listeners.push_back(server.get());
+        }
+
+        return HandleConnections(std::move(listeners), m_ShareList, m_CancelToken, m_WaitGroup, m_RequestLimit);
     }
 
-    Socket m_Server;
+    std::vector<std::unique_ptr<Socket>> m_Servers;
     AsyncTask m_RunTask;
     CancelToken m_CancelToken;
     WaitGroup m_WaitGroup;
     ShareList m_ShareList;
+    size_t m_RequestLimit;
 };
 
-std::unique_ptr<IPlan9FileSystem> CreateFileSystem(int socket)
+std::unique_ptr<IPlan9FileSystem> CreateFileSystem(int socket, size_t requestLimit, unsigned int warmThreads, bool writeBehind, unsigned int epollThreads)
+{
+    return std::make_unique<FileSystem>(std::vector<int>{socket}, requestLimit, warmThreads, writeBehind, epollThreads);
+}
+
+std::unique_ptr<IPlan9FileSystem> CreateFileSystem(
+    const std::vector<int>& sockets, size_t requestLimit, unsigned int warmThreads, bool writeBehind, unsigned int epollThreads)
 {
-    return std::make_unique<FileSystem>(socket);
+    return std::make_unique<FileSystem>(sockets, requestLimit, warmThreads, writeBehind, epollThreads);
 }
 
 } // namespace p9fs
@@ -20,6 +20,41 @@ public:
     virtual bool HasConnections() const noexcept = 0;
 };
 
-std::unique_ptr<IPlan9FileSystem> CreateFileSystem(int socket);
+// Default maximum number of requests processed concurrently for each connection.
+constexpr size_t c_DefaultRequestLimit = 32;
+
+// Request limit value that lets the server adjust the limit of each connection based on the
+// observed request latency.
+constexpr size_t c_AdaptiveRequestLimit = 0;
+
+// Default number of worker threads that are kept alive while the server is idle, so the first
+// request after an idle period doesn't wait for a thread to be created.
+constexpr unsigned int c_DefaultWarmThreads = 1;
+
+// Number of epoll threads that lets the server use one for each processor, up to a limit.
+constexpr unsigned int c_AutomaticEpollThreads = 0;
+
+// N.B. If write-behind is enabled, small sequential writes are buffered briefly and written
+//      together. Errors writing buffered data are reported by a later write, fsync or clunk of
+//      the same fid.
+// N.B. The readiness of the server's sockets is dispatched by a set of epoll threads, and each
+//      connection is assigned to the thread with the fewest sockets. The epoll threads are shared
+//      by all file systems in the process, so the largest count requested is used.
+std::unique_ptr<IPlan9FileSystem> CreateFileSystem(
+    int socket,
+    size_t requestLimit = c_DefaultRequestLimit,
+    unsigned int warmThreads = c_DefaultWarmThreads,
+    bool writeBehind = false,
+    unsigned int epollThreads = c_AutomaticEpollThreads);
+
+// Creates a file system that accepts connections on several listening sockets, each with its own
+// accept loop. For example, sockets bound to the same address with SO_REUSEPORT let the kernel
+// spread new connections across the accept loops.
+std::unique_ptr<IPlan9FileSystem> CreateFileSystem(
+    const std::vector<int>& sockets,
+    size_t requestLimit = c_DefaultRequestLimit,
+    unsigned int warmThreads = c_DefaultWarmThreads,
+    bool writeBehind = false,
+    unsigned int epollThreads = c_AutomaticEpollThreads);
 
 } // namespace p9fs
@@ -9,8 +9,13 @@
 #include "p9data.h"
 #include "p9await.h"
 #include "p9fid.h"
+#include "p9fidtable.h"
+#include "p9readahead.h"
+#include "p9stats.h"
 #include "p9handler.h"
 #include "p9commonutil.h"
+#include "p9window.h"
+#include "p9fs.h"
 
 namespace p9fs {
 
@@ -19,12 +24,16 @@ constexpr UINT32 c_staticBufferSize = 256;
 
 constexpr UINT32 c_createRetryCount = 3;
 
+// On socket connections, reads of at least this size move the file data to the socket with
+// splice instead of copying it through the response buffer.
+constexpr UINT32 c_spliceReadThreshold = 64 * 1024;
+
 // Handler for 9pfs protocol messages.
 class Handler final : public IHandler
 {
 public:
-    Handler(ISocket& s, IShareList& shareList) noexcept :
-        m_Socket{&s}, m_Requests{std::make_shared<RequestList>()}, m_ShareList{shareList}
+    Handler(ISocket& s, IShareList& shareList, size_t requestLimit) noexcept :
+        m_Socket{&s}, m_Requests{std::make_shared<RequestList>()}, m_RequestLimit{requestLimit}, m_ShareList{shareList}
     {
     }
 
@@ -34,6 +43,13 @@ public:
     }
 
 private:
+    // A pipe used to send file data to the socket without copying it to user mode.
+    struct SplicePipe
+    {
+        wil::unique_fd Read;
+        wil::unique_fd Write;
+    };
+
     // Encapsulates the buffer and SpanWriter used for sending a response to the client.
     class MessageResponse final
     {
@@ -84,6 +100,10 @@ private:
 
         SpanWriter Writer;
 
+        // Data that is sent after the response buffer, directly from a pipe.
+        SplicePipe Payload;
+        UINT32 PayloadSize{};
+
     private:
         MessageResponse(const MessageResponse&) = delete;
         MessageResponse& operator=(const MessageResponse&) = delete;
@@ -112,12 +132,74 @@ private:
         bool Cancelled{};
     };
 
+    // A response that is queued to be sent on the socket.
+    struct PendingResponse
+    {
+        PendingResponse(gsl::span<const gsl::byte> buffer, int payload = -1, size_t payloadSize = 0) :
+            Buffer{buffer}, Payload{payload}, PayloadSize{payloadSize}
+        {
+        }
+
+        gsl::span<const gsl::byte> Buffer;
+        int Payload;
+        size_t PayloadSize;
+        AsyncEvent Sent;
+        std::exception_ptr Error;
+    };
+
     struct RequestList
     {
         std::mutex Lock;
         util::LinkedList<RequestInfo> Requests;
     };
 
+    using RequestSlab = std::shared_ptr<std::vector<gsl::byte>>;
+
+    // Pool of receive buffers. Messages are processed directly from the buffer they were received
+    // into, so a buffer can't be reused until all messages that reference it have completed; each
+    // buffer is reference counted and returned to the pool when the last reference is released.
+    class RequestSlabPool : public std::enable_shared_from_this<RequestSlabPool>
+    {
+    public:
+        RequestSlab Get()
+        {
+            std::vector<gsl::byte>* buffer{};
+
+            {
+                std::lock_guard<std::mutex> lock{m_Lock};
+                if (!m_Free.empty())
+                {
+                    buffer = m_Free.back().release();
+                    m_Free.pop_back();
+                }
+            }
+
+            if (buffer == nullptr)
+            {
+                buffer = new std::vector<gsl::byte>(MaximumRequestBufferSize);
+            }
+
+            return RequestSlab{buffer, [pool = shared_from_this()](std::vector<gsl::byte>* buffer) { pool->Return(buffer); }};
+        }
+
+    private:
+        // The number of idle buffers kept for reuse; any more than that are freed.
+        static constexpr size_t c_maxFreeSlabs = 4;
+
+        void Return(std::vector<gsl::byte>* buffer) noexcept
+        {
+            std::unique_ptr<std::vector<gsl::byte>> localBuffer{buffer};
+            std::lock_guard<std::mutex> lock{m_Lock};
+            if (m_Free.size() < c_maxFreeSlabs)
+            {
+                m_Free.emplace_back(std::move(localBuffer));
+            }
+        }
+
+        std::mutex m_Lock;
+        std::vector<std::unique_ptr<std::vector<gsl::byte>>> m_Free;
+    };
+
     class RequestTracker
     {
     public:
@@ -434,17 +516,18 @@ private:
         const auto entry = LookupFid(fid);
         const auto newFile = entry->Clone();
 
+        // Resolve all the components at once, so the user context is only set once.
+        auto qids = newFile->WalkMany(names);
+        if (!qids)
+        {
+            return qids.Error();
+        }
+
         response.EnsureSize(MessageType::Rwalk, nameCount * QidSize, m_NegotiatedSize);
         response.Writer.U16(nameCount);
-        for (const auto& name : names)
+        for (const auto& qid : *qids)
         {
-            auto qid = newFile->Walk(name);
-            if (!qid)
-            {
-                return qid.Error();
-            }
-
-            response.Writer.Qid(qid.Get());
+            response.Writer.Qid(qid);
         }
 
         EmplaceFid(newfid, newFile);
@@ -455,19 +538,11 @@ private:
     {
         const auto fid = reader.U32();
 
-        std::shared_ptr<Fid> item;
-
+        // Erase regardless of whether the clunk call succeeded.
+        const auto item = m_Fids.Remove(fid);
+        if (!item)
         {
-            std::lock_guard<std::shared_mutex> lock{m_FidsLock};
-            const auto iterator = m_Fids.find(fid);
-            if (iterator == m_Fids.end())
-            {
-                return LX_EINVAL;
-            }
-
-            item = std::move(iterator->second);
-            // Erase regardless of whether the clunk call succeeded.
-            m_Fids.erase(iterator);
+            return LX_EINVAL;
         }
 
         return item->Clunk();
@@ -628,6 +703,11 @@ private:
         const auto count = reader.U32();
 
         const auto file = LookupFid(fid);
+        if (co_await SpliceRead(*file, offset, count, response))
+        {
+            co_return LX_INT{};
+        }
+
         response.EnsureSize(MessageType::Rread, count, m_NegotiatedSize);
         auto result = co_await file->Read(offset, response.Writer.Peek(sizeof(UINT32) + count).subspan(sizeof(UINT32)));
         if (!result)
@@ -640,6 +720,83 @@ private:
         co_return LX_INT{};
     }
 
+    // Tries to read file data into a pipe, so it can be sent to the socket after the response
+    // without copying it. Returns false if the regular read path must be used instead.
+    Task<bool> SpliceRead(Fid& file, UINT64 offset, UINT32 count, MessageResponse& response)
+    {
+        // N.B. Oversized reads are left to the regular path, which fails them.
+        if (m_Socket == nullptr || count < c_spliceReadThreshold || GetMessageSize(MessageType::Rread) + count > m_NegotiatedSize)
+        {
+            co_return false;
+        }
+
+        auto pipe = GetSplicePipe();
+        if (!pipe.Read)
+        {
+            co_return false;
+        }
+
+        // If the file can't be spliced, the pipe is still empty and the regular path will either
+        // read the file or return the error.
+        auto result = co_await BlockingCode([&]() { return file.SpliceRead(offset, count, pipe.Write.get()); });
+        if (!result || result.Get() == 0)
+        {
+            ReturnSplicePipe(std::move(pipe));
+            if (!result)
+            {
+                co_return false;
+            }
+        }
+
+        response.Writer.U32(result.Get());
+        if (result.Get() > 0)
+        {
+            response.Payload = std::move(pipe);
+            response.PayloadSize = result.Get();
+        }
+
+        co_return true;
+    }
+
+    // Gets an empty pipe from the pool, or creates a new one that can hold the largest possible
+    // read. Returns a pipe with invalid descriptors on failure.
+    SplicePipe GetSplicePipe()
+    {
+        {
+            std::lock_guard<std::mutex> lock{m_PipeLock};
+            if (!m_FreePipes.empty())
+            {
+                auto pipe = std::move(m_FreePipes.back());
+                m_FreePipes.pop_back();
+                return pipe;
+            }
+        }
+
+        int fds[2];
+        if (pipe2(fds, O_CLOEXEC) < 0)
+        {
+            return {};
+        }
+
+        SplicePipe pipe{wil::unique_fd{fds[0]}, wil::unique_fd{fds[1]}};
+        if (fcntl(pipe.Write.get(), F_SETPIPE_SZ, MaximumRequestBufferSize) < MaximumRequestBufferSize)
+        {
+            return {};
+        }
+
+        return pipe;
+    }
+
+    // Returns an empty pipe to the pool.
+    void ReturnSplicePipe(SplicePipe&& pipe)
+    {
+        std::lock_guard<std::mutex> lock{m_PipeLock};
+        if (m_FreePipes.size() < c_maxFreePipes)
+        {
+            m_FreePipes.push_back(std::move(pipe));
+        }
+    }
+
     Task<LX_INT> HandleWrite(SpanReader& reader, MessageResponse& response)
     {
         const auto fid = reader.U32();
@@ -826,10 +983,7 @@ private:
 
         // Unlike xattrwalk, xattrcreate updates the current fid, so replace
         // it.
-        std::lock_guard<std::shared_mutex> lock{m_FidsLock};
-        const auto iterator = m_Fids.find(fid);
-        THROW_UNEXPECTED_IF((iterator == m_Fids.end()) || (iterator->second != entry));
-        iterator->second = xattr.Get();
+        THROW_UNEXPECTED_IF(!m_Fids.Replace(fid, entry, xattr.Get()));
         return {};
     }
 
@@ -1164,15 +1318,39 @@ private:
     {
         WI_ASSERT(m_RequestData.size() < requiredBytes);
 
+        if (!m_RequestSlab)
+        {
+            m_RequestSlab = m_SlabPool->Get();
+            m_RequestData = gsl::span<gsl::byte>(*m_RequestSlab).subspan(0, 0);
+        }
+
+        // Data can keep being appended to the current slab as long as the message fits; messages
+        // still being processed only reference the part of the slab before the unprocessed data.
+        // Otherwise, the unprocessed data must be moved to the start of a slab. If any previous
+        // messages still reference the current one, switch to a fresh slab instead of overwriting
+        // it.
         UINT32 validLength = static_cast<UINT32>(m_RequestData.size());
-        if (validLength > 0 && m_RequestData.data() != m_RequestBuffer.data())
+        auto offset = static_cast<size_t>(m_RequestData.data() - m_RequestSlab->data());
+        if (offset + requiredBytes > m_RequestSlab->size())
         {
-            std::copy(m_RequestData.begin(), m_RequestData.end(), m_RequestBuffer.begin());
+            if (m_RequestSlab.use_count() > 1)
+            {
+                auto slab = m_SlabPool->Get();
+                std::copy(m_RequestData.begin(), m_RequestData.end(), slab->begin());
+                m_RequestSlab = std::move(slab);
+            }
+            else if (validLength > 0)
+            {
+                std::copy(m_RequestData.begin(), m_RequestData.end(), m_RequestSlab->begin());
+            }
+
+            offset = 0;
         }
 
+        auto buffer = gsl::span<gsl::byte>(*m_RequestSlab).subspan(offset);
         while (validLength < requiredBytes)
         {
-            size_t count = co_await m_Socket->RecvAsync(gsl::span<gsl::byte>(m_RequestBuffer).subspan(validLength), token);
+            size_t count = co_await m_Socket->RecvAsync(buffer.subspan(validLength), token);
             if (count == 0)
             {
                 break;
@@ -1181,7 +1359,7 @@ private:
             validLength += static_cast<int>(count);
         }
 
-        m_RequestData = gsl::span<gsl::byte>(m_RequestBuffer).subspan(0, validLength);
+        m_RequestData = buffer.subspan(0, validLength);
         co_return validLength >= requiredBytes;
     }
 
@@ -1212,7 +1390,7 @@ private:
     }
 
     // Process a message received from a socket.
-    Task<void> ProcessMessage(gsl::span<const gsl::byte> message, CancelToken& sendToken)
+    Task<void> ProcessMessage(gsl::span<const gsl::byte> message, CancelToken& sendToken, RequestStatistics::Clock::time_point received)
     {
         SpanReader reader{message};
 
@@ -1223,30 +1401,110 @@ private:
         //      EnsureSize since the static buffer is always big enough for that.
         gsl::byte staticBuffer[c_staticBufferSize];
         MessageResponse response{staticBuffer};
-        co_await ProcessMessage(reader, response);
-        auto m = response.Writer.Result();
+        co_await ProcessMessage(reader, response, received);
+        PendingResponse pending{response.Writer.Result(), response.Payload.Read.get(), response.PayloadSize};
+        co_await SendResponse(pending, sendToken);
+
+        // N.B. If sending failed, the pipe may still contain data so it is closed instead.
+        if (response.PayloadSize > 0)
+        {
+            ReturnSplicePipe(std::move(response.Payload));
+        }
+    }
+
+    // Queue a response to be sent on the socket. If no other coroutine is sending, this one sends
+    // all queued responses, including ones queued while it was sending, with a single vectored
+    // send per batch. Otherwise, it waits until the sending coroutine has sent its response.
+    // N.B. Responses are sent in the order they were queued, and a coroutine does not resume until
+    //      its response has been sent, so a request is not completed (which is what Tflush waits
+    //      for) before its response is on the wire.
+    Task<void> SendResponse(PendingResponse& response, CancelToken& token)
+    {
+        bool sending;
+
+        {
+            std::lock_guard<std::mutex> lock{m_SendLock};
+            m_SendQueue.push_back(&response);
+            sending = !m_Sending;
+            m_Sending = true;
+        }
 
+        if (sending)
         {
-            auto lock = co_await m_SocketLock.Lock();
+            for (;;)
+            {
+                {
+                    std::lock_guard<std::mutex> lock{m_SendLock};
+                    if (m_SendQueue.empty())
+                    {
+                        m_Sending = false;
+                        break;
+                    }
+
+                    m_SendBatch.swap(m_SendQueue);
+                }
+
+                std::exception_ptr error;
+                try
+                {
+                    // Responses with a payload in a pipe are sent in pieces: everything up to and
+                    // including the response header, then the payload.
+                    m_SendBuffers.clear();
+                    for (const auto* entry : m_SendBatch)
+                    {
+                        m_SendBuffers.push_back(entry->Buffer);
+                        if (entry->PayloadSize > 0)
+                        {
+                            co_await m_Socket->SendAsync(m_SendBuffers, token);
+                            m_SendBuffers.clear();
+                            co_await m_Socket->SpliceAsync(entry->Payload, entry->PayloadSize, token);
+                        }
+                    }
 
-            // Send the response.
-            co_await m_Socket->SendAsync(m, sendToken);
+                    if (!m_SendBuffers.empty())
+                    {
+                        co_await m_Socket->SendAsync(m_SendBuffers, token);
+                    }
+                }
+                catch (...)
+                {
+                    error = std::current_exception();
+                }
+
+                // N.B. Once its event is set, an entry may be destroyed by its owner at any time.
+                for (auto* entry : m_SendBatch)
+                {
+                    entry->Error = error;
+                    entry->Sent.Set();
+                }
+
+                m_SendBatch.clear();
+            }
+        }
+
+        co_await response.Sent;
+        if (response.Error)
+        {
+            std::rethrow_exception(response.Error);
         }
     }
 
-    // Process a Plan 9 message, and write the response to the specified buffer.
-    Task<void> ProcessMessage(SpanReader& reader, MessageResponse& response)
+    // Process a Plan 9 message, and write the response to the specified buffer. The time the
+    // message was received is used to record how long it waited before being processed.
+    Task<void> ProcessMessage(SpanReader& reader, MessageResponse& response, RequestStatistics::Clock::time_point received)
     {
+        const auto start = RequestStatistics::Clock::now();
         LogMessage(reader.Span());
         reader.U32(); // message size, already validated
         auto messageType = reader.U8();
+        const auto requestType = static_cast<MessageType>(messageType);
         const auto messageTag = reader.U16();
         const SpanWriter errorWriter{response.Writer};
 
         LX_INT error;
         try
         {
-            error = co_await HandleMessage(static_cast<MessageType>(messageType), reader, response);
+            error = co_await HandleMessage(requestType, reader, response);
         }
         catch (...)
         {
@@ -1256,19 +1514,29 @@ private:
 
         if (error != 0)
         {
+            response.Payload = {};
+            response.PayloadSize = 0;
             response.Writer = errorWriter;
             response.Writer.U32(static_cast<UINT32>(-error));
             messageType = static_cast<UINT8>(MessageType::Tlerror);
         }
 
-        response.Writer.Header(static_cast<MessageType>(messageType + 1), messageTag);
+        response.Writer.Header(static_cast<MessageType>(messageType + 1), messageTag, response.PayloadSize);
         LogMessage(response.Writer.Result());
+        RequestStatistics::Record(
+            requestType,
+            reader.Size(),
+            response.Writer.Size() + response.PayloadSize,
+            error,
+            start - received,
+            RequestStatistics::Clock::now() - start);
     }
 
     // Process a message received from virtio.
     void ProcessMessageAsync(std::vector<gsl::byte>&& message, size_t responseSize, HandlerCallback&& callback) override
     {
         // Register the request so Tflush can wait on it if needed.
+        const auto received = RequestStatistics::Clock::now();
         const auto tag = SpanReader{gsl::make_span(message).subspan(TagOffset)}.U16();
         RequestTracker request{m_Requests, tag};
 
@@ -1284,6 +1552,7 @@ private:
              localMessage = std::move(message),
              localRequest = std::move(request),
              responseSize,
+             received,
              completionCallback = std::move(callback)]() mutable -> Task<void> {
                 std::vector<gsl::byte> responseBuffer;
                 try
@@ -1295,7 +1564,7 @@ private:
                     responseBuffer.resize(responseSize);
                     MessageResponse response{responseBuffer, false};
 
-                    co_await ProcessMessage(reader, response);
+                    co_await ProcessMessage(reader, response, received);
                     responseBuffer.resize(response.Writer.Size());
                 }
                 catch (...)
@@ -1315,8 +1584,7 @@ public:
         CancelToken connectionToken(parentToken);
         CancelToken recvToken(connectionToken);
         CancelToken sendToken(connectionToken);
-        constexpr size_t maximumMessages = 32; // maximum number of concurrent messages
-        AsyncSemaphore messageSemaphore(maximumMessages);
+        RequestWindow window{m_RequestLimit};
         while (!connectionToken.Cancelled())
         {
             // Only a single read is performed at a time, so no locking is
@@ -1337,23 +1605,28 @@ public:
             }
 
             // Register the request so Tflush can wait on it if needed.
+            const auto received = RequestStatistics::Clock::now();
             const auto tag = SpanReader{message.subspan(TagOffset)}.U16();
             RequestTracker request{m_Requests, tag};
-            co_await messageSemaphore.Acquire(1);
+            co_await window.Acquire();
 
-            // Process the message on a separate scheduled coroutine. Receiving
-            // messages uses a shared buffer, which can be changed after the
-            // next call to NextMessage, so make a copy of the message.
+            // Process the message on a separate scheduled coroutine. The message is processed in
+            // place, so keep a reference to its receive buffer; the receive loop will not overwrite
+            // a buffer that is still referenced.
             RunScheduledTask(
                 [this,
-                 releaseSemaphore = wil::scope_exit([&]() { messageSemaphore.Release(1); }),
-                 localMessage = std::vector<gsl::byte>{message.begin(), message.end()},
+                 releaseWindow = wil::scope_exit([&, start = RequestWindow::Clock::now()]() {
+                     window.Release(RequestWindow::Clock::now() - start);
+                 }),
+                 localSlab = m_RequestSlab,
+                 localMessage = gsl::span<const gsl::byte>{message},
                  localRequest = std::move(request),
+                 received,
                  &connectionToken,
                  &sendToken]() mutable -> Task<void> {
                     try
                     {
-                        co_await ProcessMessage(localMessage, sendToken);
+                        co_await ProcessMessage(localMessage, sendToken, received);
                     }
                     catch (...)
                     {
@@ -1365,7 +1638,7 @@ public:
 
         // Wait until all messages are finished.
         connectionToken.Cancel();
-        co_await messageSemaphore.Acquire(maximumMessages);
+        co_await window.Drain();
         Plan9TraceLoggingProvider::ConnectionDisconnected();
         co_return;
     }
@@ -1373,27 +1646,21 @@ public:
 private:
     std::shared_ptr<Fid> LookupFid(UINT32 fid)
     {
-        std::shared_lock<std::shared_mutex> lock{m_FidsLock};
-        const auto it = m_Fids.find(fid);
-        THROW_UNEXPECTED_IF(it == m_Fids.end());
-        return it->second;
+        auto item = m_Fids.Find(fid);
+        THROW_UNEXPECTED_IF(!item);
+        return item;
     }
 
     std::pair<std::shared_ptr<Fid>, std::shared_ptr<Fid>> LookupFidPair(UINT32 fid1, UINT32 fid2)
     {
-        std::shared_lock<std::shared_mutex> lock{m_FidsLock};
-        const auto it1 = m_Fids.find(fid1);
-        THROW_UNEXPECTED_IF(it1 == m_Fids.end());
-        const auto it2 = m_Fids.find(fid2);
-        THROW_UNEXPECTED_IF(it2 == m_Fids.end());
-        return {it1->second, it2->second};
+        auto item1 = LookupFid(fid1);
+        auto item2 = LookupFid(fid2);
+        return {std::move(item1), std::move(item2)};
     }
 
     void EmplaceFid(UINT32 fid, std::shared_ptr<Fid> item)
     {
-        std::lock_guard<std::shared_mutex> lock{m_FidsLock};
-        const auto result = m_Fids.try_emplace(fid, item);
-        THROW_INVALID_IF(!result.second);
+        THROW_INVALID_IF(!m_Fids.Insert(fid, std::move(item)));
     }
 
     // Returns the maximum size of an IO request (0 for no limit).
@@ -1406,13 +1673,23 @@ private:
     static constexpr UINT32 MaximumRequestBufferSize = 256 * 1024;
     static constexpr UINT32 InitialResponseBufferSize = 64;
 
-    AsyncLock m_SocketLock;
+    // The number of idle splice pipes kept for reuse; any more than that are closed.
+    static constexpr size_t c_maxFreePipes = 8;
+
+    std::mutex m_SendLock;
+    std::vector<PendingResponse*> m_SendQueue;
+    bool m_Sending{false};
+    std::vector<PendingResponse*> m_SendBatch;
+    std::vector<gsl::span<const gsl::byte>> m_SendBuffers;
+    std::mutex m_PipeLock;
+    std::vector<SplicePipe> m_FreePipes;
     ISocket* m_Socket{};
-    std::shared_mutex m_FidsLock;
-    std::map<UINT32, std::shared_ptr<Fid>> m_Fids;
-    std::vector<gsl::byte> m_RequestBuffer{MaximumRequestBufferSize};
+    FidTable m_Fids;
+    std::shared_ptr<RequestSlabPool> m_SlabPool{std::make_shared<RequestSlabPool>()};
+    RequestSlab m_RequestSlab;
     gsl::span<gsl::byte> m_RequestData;
     std::shared_ptr<RequestList> m_Requests;
+    size_t m_RequestLimit{c_DefaultRequestLimit};
     UINT32 m_NegotiatedSize{InitialResponseBufferSize};
     bool m_Negotiated{false};
     bool m_AllowRenegotiate{false};
@@ -1420,16 +1697,22 @@ private:
     IShareList& m_ShareList;
 };
 
-AsyncTask HandleConnections(ISocket& listen, IShareList& shareList, CancelToken& token, WaitGroup& waitGroup)
-{
-    std::atomic<size_t> connectionCount{};
+namespace {
 
+// Accepts connections on a listening socket until the token is canceled, and runs a handler for
+// each of them.
+// N.B. A token can only have one outstanding operation, so the accepts use a child token in case
+//      there are several listeners.
+Task<void> AcceptConnections(
+    ISocket& listen, IShareList& shareList, CancelToken& token, WaitGroup& waitGroup, std::atomic<size_t>& connectionCount, size_t requestLimit)
+{
+    CancelToken acceptToken{token};
     try
     {
-        while (!token.Cancelled())
+        while (!acceptToken.Cancelled())
         {
             Plan9TraceLoggingProvider::PreAccept();
-            auto client = co_await listen.AcceptAsync(token);
+            auto client = co_await listen.AcceptAsync(acceptToken);
             Plan9TraceLoggingProvider::PostAccept();
 
             // If the operation was aborted, no socket is returned.
@@ -1453,12 +1736,15 @@ AsyncTask HandleConnections(ISocket& listen, IShareList& shareList, CancelToken&
                 ++connectionCount;
                 Plan9TraceLoggingProvider::ClientConnected(connectionCount);
 
-                RunScheduledTask([client = std::move(client), keepAlive = waitGroup.Add(), &connectionCount, &shareList, &token]() -> Task<void> {
+                RunScheduledTask([client = std::move(client), keepAlive = waitGroup.Add(), &connectionCount, &shareList, &token, requestLimit]() -> Task<void> {
                     auto decrementCount = wil::scope_exit([&]() {
                         --connectionCount;
                         Plan9TraceLoggingProvider::ClientDisconnected(connectionCount);
+                        Plan9TraceLoggingProvider::FrameHeapAllocations(FramePool::HeapAllocations());
+                        const auto [sequentialReads, prefetchHits] = ReadAheadTracker::Statistics();
+                        Plan9TraceLoggingProvider::ReadAheadStatistics(sequentialReads, prefetchHits);
                     });
-                    Handler handler{*client, shareList};
+                    Handler handler{*client, shareList, requestLimit};
                     co_await handler.Run(token);
                 });
             }
@@ -1469,6 +1755,33 @@ AsyncTask HandleConnections(ISocket& listen, IShareList& shareList, CancelToken&
         LOG_CAUGHT_EXCEPTION();
         token.Cancel();
     }
+}
+
+} // namespace
+
+// Accepts connections on each of the listening sockets until the token is canceled, and then waits
+// for all connections to finish. If any accept loop fails, the token is canceled so the others stop.
+// N.B. The accept loops use their own wait group, since the caller's wait group only tracks
+//      connections.
+AsyncTask HandleConnections(std::vector<ISocket*> listeners, IShareList& shareList, CancelToken& token, WaitGroup& waitGroup, size_t requestLimit)
+{
+    std::atomic<size_t> connectionCount{};
+    WaitGroup acceptors;
+    if (listeners.size() == 1)
+    {
+        co_await AcceptConnections(*listeners.front(), shareList, token, waitGroup, connectionCount, requestLimit);
+    }
+    else
+    {
+        for (auto* listen : listeners)
+        {
+            RunScheduledTask([listen, keepAlive = acceptors.Add(), &shareList, &token, &waitGroup, &connectionCount, requestLimit]() -> Task<void> {
+                co_await AcceptConnections(*listen, shareList, token, waitGroup, connectionCount, requestLimit);
+            });
+        }
+    }
+
+    co_await acceptors.Wait();
 
     // Wait for the connection tasks to complete.
     co_await waitGroup.Wait();
@@ -54,6 +54,6 @@ private:
     std::atomic<ULONG_PTR> m_Count{1};
 };
 
-AsyncTask HandleConnections(ISocket& listen, IShareList& shareList, CancelToken& token, WaitGroup& waitGroup);
+AsyncTask HandleConnections(std::vector<ISocket*> listeners, IShareList& shareList, CancelToken& token, WaitGroup& waitGroup, size_t requestLimit);
 
 } // namespace p9fs
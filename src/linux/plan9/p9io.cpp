@@ -15,7 +15,260 @@
 
 namespace p9fs {
 
-EpollWatcher g_Watcher;
+EpollWatcherSet g_Watchers;
+IoRing g_IoRing;
+
+// Number of submission queue entries for the io_uring. If the queue is full, IO falls back to
+// POSIX aio for that request rather than waiting.
+constexpr unsigned int c_ioRingEntries = 256;
+
+// User data value used for entries whose completion should be ignored (e.g. cancel requests).
+constexpr __u64 c_ignoredUserData = 0;
+
+// Delay before waiting for completions again if the wait failed.
+constexpr std::chrono::milliseconds c_ioRingRetryDelay{10};
+
+// Completes the operation, resuming the coroutine if it is already waiting.
+void CoroutineIoOperation::Complete(IoResult result)
+{
+    Result = result;
+    if (!DoneOrCoroutine.exchange(true))
+    {
+        return;
+    }
+
+    g_Scheduler.Schedule(Coroutine);
+}
+
+void CoroutineIoOperation::Cancel()
+{
+    if (UsesRing)
+    {
+        g_IoRing.Cancel(*this);
+    }
+    else
+    {
+        aio_cancel(ControlBlock.aio_fildes, &ControlBlock);
+    }
+}
+
+// Creates the io_uring and starts the completion thread. If the kernel does not support io_uring,
+// the ring is left uninitialized and all IO will use POSIX aio.
+// N.B. Only the first call does anything, so a kernel without io_uring isn't probed again for every
+//      file system instance.
+void IoRing::Run()
+{
+    std::call_once(m_RunOnce, [this]() { Initialize(); });
+}
+
+void IoRing::Initialize()
+{
+    io_uring_params params{};
+    wil::unique_fd ring{static_cast<int>(syscall(__NR_io_uring_setup, c_ioRingEntries, &params))};
+    if (!ring)
+    {
+        Plan9TraceLoggingProvider::LogMessage(std::format("io_uring unavailable, using aio, errno={}", errno), TRACE_LEVEL_INFORMATION);
+        return;
+    }
+
+    // Without this feature, completions are dropped if the completion queue overflows, which
+    // would leave the waiting coroutines suspended forever.
+    if (WI_IsFlagClear(params.features, IORING_FEAT_NODROP))
+    {
+        Plan9TraceLoggingProvider::LogMessage("io_uring does not support IORING_FEAT_NODROP, using aio", TRACE_LEVEL_INFORMATION);
+        return;
+    }
+
+    const size_t sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    size_t cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    const bool singleMap = WI_IsFlagSet(params.features, IORING_FEAT_SINGLE_MMAP);
+    if (singleMap)
+    {
+        cqRingSize = std::max(cqRingSize, sqRingSize);
+    }
+
+    std::vector<std::pair<void*, size_t>> mappings;
+    auto unmapRing = wil::scope_exit([&mappings]() {
+        for (const auto& [address, size] : mappings)
+        {
+            munmap(address, size);
+        }
+    });
+
+    const auto mapRing = [&](size_t size, off_t offset) -> gsl::byte* {
+        void* address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.get(), offset);
+        if (address == MAP_FAILED)
+        {
+            Plan9TraceLoggingProvider::LogMessage(std::format("io_uring mmap failed, using aio, errno={}", errno), TRACE_LEVEL_INFORMATION);
+            return nullptr;
+        }
+
+        mappings.emplace_back(address, size);
+        return static_cast<gsl::byte*>(address);
+    };
+
+    auto* sqRing = mapRing(singleMap ? cqRingSize : sqRingSize, IORING_OFF_SQ_RING);
+    auto* cqRing = (sqRing == nullptr || singleMap) ? sqRing : mapRing(cqRingSize, IORING_OFF_CQ_RING);
+    auto* sqes = cqRing == nullptr ? nullptr : mapRing(params.sq_entries * sizeof(io_uring_sqe), IORING_OFF_SQES);
+    if (sqes == nullptr)
+    {
+        return;
+    }
+
+    unmapRing.release();
+
+    // N.B. The mappings are never released since the ring lives for the duration of the process,
+    //      like the epoll watcher.
+    m_Entries = params.sq_entries;
+    m_SqHead = reinterpret_cast<unsigned int*>(sqRing + params.sq_off.head);
+    m_SqTail = reinterpret_cast<unsigned int*>(sqRing + params.sq_off.tail);
+    m_SqMask = reinterpret_cast<unsigned int*>(sqRing + params.sq_off.ring_mask);
+    m_SqArray = reinterpret_cast<unsigned int*>(sqRing + params.sq_off.array);
+    m_Sqes = reinterpret_cast<io_uring_sqe*>(sqes);
+    m_CqHead = reinterpret_cast<unsigned int*>(cqRing + params.cq_off.head);
+    m_CqTail = reinterpret_cast<unsigned int*>(cqRing + params.cq_off.tail);
+    m_CqMask = reinterpret_cast<unsigned int*>(cqRing + params.cq_off.ring_mask);
+    m_Cqes = reinterpret_cast<io_uring_cqe*>(cqRing + params.cq_off.cqes);
+    m_RingFileDescriptor = ring.release();
+
+    std::thread(ReapThread, this).detach();
+}
+
+// Returns the next free submission queue entry, or null if the queue is full.
+// N.B. Must be called with the submit lock held.
+io_uring_sqe* IoRing::NextSubmissionEntry()
+{
+    const unsigned int tail = *m_SqTail;
+    if (tail - __atomic_load_n(m_SqHead, __ATOMIC_ACQUIRE) >= m_Entries)
+    {
+        return nullptr;
+    }
+
+    const unsigned int index = tail & *m_SqMask;
+    m_SqArray[index] = index;
+    auto* entry = &m_Sqes[index];
+    *entry = {};
+    return entry;
+}
+
+// Submits a read or write operation to the ring.
+// Returns false if the operation could not be queued, in which case the caller should fall back to
+// POSIX aio.
+bool IoRing::Submit(CoroutineIoOperation& operation)
+{
+    unsigned int tail;
+    {
+        std::lock_guard<std::mutex> lock{m_SubmitLock};
+        auto* entry = NextSubmissionEntry();
+        if (entry == nullptr)
+        {
+            return false;
+        }
+
+        FillEntry(*entry, operation);
+        tail = *m_SqTail + 1;
+        __atomic_store_n(m_SqTail, tail, __ATOMIC_RELEASE);
+    }
+
+    // N.B. Once the tail is advanced the entry can't be taken back, since another thread may
+    //      already be submitting it, so this waits until the kernel consumed it. The system call is
+    //      made without the lock so submitters aren't serialized on it; each call submits all
+    //      the queued entries, including those added by other threads.
+    bool logged = false;
+    for (;;)
+    {
+        const int result = TEMP_FAILURE_RETRY(syscall(__NR_io_uring_enter, m_RingFileDescriptor, m_Entries, 0, 0, nullptr, 0));
+        if (static_cast<int>(__atomic_load_n(m_SqHead, __ATOMIC_ACQUIRE) - tail) >= 0)
+        {
+            return true;
+        }
+
+        if (result < 0 && !logged)
+        {
+            Plan9TraceLoggingProvider::LogMessage(std::format("io_uring submit failed, retrying, errno={}", errno), TRACE_LEVEL_WARNING);
+            logged = true;
+        }
+
+        std::this_thread::yield();
+    }
+}
+
+// Describes a read or write operation in a submission queue entry.
+void IoRing::FillEntry(io_uring_sqe& entry, CoroutineIoOperation& operation)
+{
+    const auto& controlBlock = operation.ControlBlock;
+    operation.Buffer.iov_base = const_cast<void*>(controlBlock.aio_buf);
+    operation.Buffer.iov_len = controlBlock.aio_nbytes;
+    entry.opcode = controlBlock.aio_lio_opcode == LIO_WRITE ? IORING_OP_WRITEV : IORING_OP_READV;
+    entry.fd = controlBlock.aio_fildes;
+    entry.off = controlBlock.aio_offset;
+    entry.addr = reinterpret_cast<__u64>(&operation.Buffer);
+    entry.len = 1;
+    entry.user_data = reinterpret_cast<__u64>(&operation);
+    operation.UsesRing = true;
+}
+
+// Requests cancellation of an operation that was submitted to the ring. This is best effort; the
+// operation will still complete, possibly successfully.
+// N.B. If submitting fails, the request stays queued and is submitted with the next operation.
+void IoRing::Cancel(CoroutineIoOperation& operation)
+{
+    {
+        std::lock_guard<std::mutex> lock{m_SubmitLock};
+        auto* entry = NextSubmissionEntry();
+        if (entry == nullptr)
+        {
+            return;
+        }
+
+        entry->opcode = IORING_OP_ASYNC_CANCEL;
+        entry->fd = -1;
+        entry->addr = reinterpret_cast<__u64>(&operation);
+        entry->user_data = c_ignoredUserData;
+        __atomic_store_n(m_SqTail, *m_SqTail + 1, __ATOMIC_RELEASE);
+    }
+
+    TEMP_FAILURE_RETRY(syscall(__NR_io_uring_enter, m_RingFileDescriptor, m_Entries, 0, 0, nullptr, 0));
+}
+
+// Waits for completions and schedules the coroutines waiting on them.
+void IoRing::ReapThread(IoRing* ring)
+{
+    for (;;)
+    {
+        // N.B. Operations are already in flight, so they can't be moved to aio if waiting fails;
+        //      the error is logged and the wait retried, since completions are still posted.
+        const int result = TEMP_FAILURE_RETRY(syscall(__NR_io_uring_enter, ring->m_RingFileDescriptor, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0));
+        if (result < 0)
+        {
+            Plan9TraceLoggingProvider::LogMessage(std::format("io_uring wait failed, errno={}", errno), TRACE_LEVEL_WARNING);
+            std::this_thread::sleep_for(c_ioRingRetryDelay);
+        }
+
+        unsigned int head = *ring->m_CqHead;
+        const unsigned int tail = __atomic_load_n(ring->m_CqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head)
+        {
+            const auto& entry = ring->m_Cqes[head & *ring->m_CqMask];
+            if (entry.user_data == c_ignoredUserData)
+            {
+                continue;
+            }
+
+            const auto operation = reinterpret_cast<CoroutineIoOperation*>(entry.user_data);
+            if (entry.res < 0)
+            {
+                operation->Complete({entry.res, 0});
+            }
+            else
+            {
+                operation->Complete({0, static_cast<size_t>(entry.res)});
+            }
+        }
+
+        __atomic_store_n(ring->m_CqHead, head, __ATOMIC_RELEASE);
+    }
+}
 
 CoroutineIoIssuer::CoroutineIoIssuer(int fd) : m_FileDescriptor(fd)
 {
@@ -28,17 +281,31 @@ void CoroutineIoIssuer::Callback(sigval value)
     int error = 0;
     if (bytesTransferred < 0)
     {
-        error = aio_error(&operation->ControlBlock);
+        error = -aio_error(&operation->ControlBlock);
+    }
+
+    operation->Complete({error, static_cast<size_t>(bytesTransferred)});
+}
+
+// Submits the IO described by the operation's control block, using the io_uring if available.
+IoResult CoroutineIoIssuer::Submit(CoroutineIoOperation& operation)
+{
+    if (g_IoRing && g_IoRing.Submit(operation))
+    {
+        return {};
     }
 
-    operation->Result = {error, static_cast<size_t>(bytesTransferred)};
-    if (!operation->DoneOrCoroutine.exchange(true))
+    auto& controlBlock = operation.ControlBlock;
+    controlBlock.aio_sigevent.sigev_notify = SIGEV_THREAD;
+    controlBlock.aio_sigevent.sigev_notify_function = Callback;
+    controlBlock.aio_sigevent.sigev_value.sival_ptr = &operation;
+    const int error = controlBlock.aio_lio_opcode == LIO_WRITE ? aio_write(&controlBlock) : aio_read(&controlBlock);
+    if (error < 0)
     {
-        return;
+        return {-errno, 0};
     }
 
-    // TODO: Can we use this thread to resume the coroutine?
-    g_Scheduler.Schedule(operation->Coroutine);
+    return {};
 }
 
 bool CoroutineIoIssuer::PreIssue(CoroutineIoOperation& operation, CancelToken& token)
@@ -46,16 +313,13 @@ bool CoroutineIoIssuer::PreIssue(CoroutineIoOperation& operation, CancelToken& t
     // Register the IO for cancellation.
     operation.ControlBlock = {};
     operation.ControlBlock.aio_fildes = m_FileDescriptor;
-    operation.ControlBlock.aio_sigevent.sigev_notify = SIGEV_THREAD;
-    operation.ControlBlock.aio_sigevent.sigev_notify_function = Callback;
-    operation.ControlBlock.aio_sigevent.sigev_value.sival_ptr = &operation;
     if (token.Register(operation))
     {
         return true;
     }
 
     // The operation has already been cancelled. Don't even issue the IO.
-    operation.Result = {ECANCELED, 0};
+    operation.Result = {LX_ECANCELED, 0};
     operation.DoneOrCoroutine = true;
     return false;
 }
@@ -81,7 +345,7 @@ void CoroutineIoIssuer::PostIssue(CoroutineIoOperation& operation, CancelToken&
         // The IO did not complete synchronously, but the operation has been
         // cancelled. Depending on when the cancel occurred, the IO may not have
         // been cancelled, so cancel it now.
-        aio_cancel(operation.ControlBlock.aio_fildes, &operation.ControlBlock);
+        operation.Cancel();
     }
 }
 
@@ -193,11 +457,22 @@ void EpollWatcher::Add(int fd, int events, EpollDispatcher& dispatcher)
     event.events = events;
     event.data.ptr = &dispatcher;
     THROW_LAST_ERROR_IF(epoll_ctl(m_EpollFileDescriptor, EPOLL_CTL_ADD, fd, &event) < 0);
+    m_Sockets.fetch_add(1, std::memory_order_relaxed);
+    m_TotalSockets.fetch_add(1, std::memory_order_relaxed);
 }
 
 void EpollWatcher::Remove(int fd)
 {
     THROW_LAST_ERROR_IF(epoll_ctl(m_EpollFileDescriptor, EPOLL_CTL_DEL, fd, nullptr) < 0);
+    m_Sockets.fetch_sub(1, std::memory_order_relaxed);
+}
+
+EpollThreadStatistics EpollWatcher::Statistics() const noexcept
+{
+    return {
+        m_Sockets.load(std::memory_order_relaxed),
+        m_TotalSockets.load(std::memory_order_relaxed),
+        m_Events.load(std::memory_order_relaxed)};
 }
 
 void EpollWatcher::WatchThread(EpollWatcher* watcher)
@@ -208,6 +483,8 @@ void EpollWatcher::WatchThread(EpollWatcher* watcher)
         int result = TEMP_FAILURE_RETRY(epoll_wait(watcher->m_EpollFileDescriptor, events, 10, -1));
         THROW_LAST_ERROR_IF(result < 0);
 
+        // N.B. Only this thread updates the event count.
+        watcher->m_Events.store(watcher->m_Events.load(std::memory_order_relaxed) + result, std::memory_order_relaxed);
         for (int i = 0; i < result; ++i)
         {
             if (events[i].data.ptr != nullptr)
@@ -219,6 +496,58 @@ void EpollWatcher::WatchThread(EpollWatcher* watcher)
     }
 }
 
+// Starts watchers until the set has the specified number of them. Watchers are never stopped, so
+// if the set is already running, it can only grow.
+void EpollWatcherSet::Run(unsigned int count)
+{
+    count = std::clamp(count, 1u, MaximumWatchers);
+    std::lock_guard<std::mutex> lock{m_Lock};
+    for (auto current = m_Count.load(std::memory_order_relaxed); current < count; ++current)
+    {
+        m_Watchers[current].Run();
+        m_Count.store(current + 1, std::memory_order_release);
+    }
+}
+
+// Selects the watcher for a new socket. Sockets are spread evenly across the watchers by picking
+// the one with the fewest sockets, starting the search at a different watcher each time so ties
+// don't all go to the first one.
+// N.B. If the set is not running yet, the first watcher is returned; sockets can't be added to it
+//      until the set is started.
+EpollWatcher& EpollWatcherSet::Select() noexcept
+{
+    const auto count = m_Count.load(std::memory_order_acquire);
+    if (count <= 1)
+    {
+        return m_Watchers[0];
+    }
+
+    const auto start = m_Next.fetch_add(1, std::memory_order_relaxed);
+    auto* selected = &m_Watchers[start % count];
+    for (unsigned int i = 1; i < count; ++i)
+    {
+        auto& watcher = m_Watchers[(start + i) % count];
+        if (watcher.Sockets() < selected->Sockets())
+        {
+            selected = &watcher;
+        }
+    }
+
+    return *selected;
+}
+
+std::vector<EpollThreadStatistics> EpollWatcherSet::Statistics() const
+{
+    std::vector<EpollThreadStatistics> result;
+    const auto count = m_Count.load(std::memory_order_acquire);
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        result.push_back(m_Watchers[i].Statistics());
+    }
+
+    return result;
+}
+
 Task<size_t> RecvAsync(CoroutineEpollIssuer& socket, gsl::span<gsl::byte> buffer, CancelToken& token)
 {
     CoroutineEpollOperation operation;
@@ -247,6 +576,41 @@ Task<size_t> SendAsync(CoroutineEpollIssuer& socket, gsl::span<const gsl::byte>
     co_return static_cast<size_t>(result);
 }
 
+Task<size_t> SendAsync(CoroutineEpollIssuer& socket, gsl::span<const iovec> buffers, CancelToken& token)
+{
+    CoroutineEpollOperation operation;
+    auto result = co_await socket.Issue<ssize_t>(operation, token, EPOLLOUT, [&](int fd) {
+        msghdr message{};
+        message.msg_iov = const_cast<iovec*>(buffers.data());
+        message.msg_iovlen = buffers.size();
+        return sendmsg(fd, &message, 0);
+    });
+
+    if (result < 0)
+    {
+        THROW_ERRNO(-result);
+    }
+
+    co_return static_cast<size_t>(result);
+}
+
+// Moves data from a pipe to the socket.
+// N.B. The pipe must already contain the data, so only the socket can cause the operation to wait.
+Task<size_t> SpliceAsync(CoroutineEpollIssuer& socket, int pipe, size_t count, CancelToken& token)
+{
+    CoroutineEpollOperation operation;
+    auto result = co_await socket.Issue<ssize_t>(operation, token, EPOLLOUT, [&](int fd) {
+        return splice(pipe, nullptr, fd, nullptr, count, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    });
+
+    if (result < 0)
+    {
+        THROW_ERRNO(-result);
+    }
+
+    co_return static_cast<size_t>(result);
+}
+
 Task<int> AcceptAsync(CoroutineEpollIssuer& listen, CancelToken& token)
 {
     CoroutineEpollOperation operation;
@@ -264,32 +628,22 @@ Task<int> AcceptAsync(CoroutineEpollIssuer& listen, CancelToken& token)
 Task<IoResult> ReadAsync(CoroutineIoIssuer& file, std::uint64_t offset, gsl::span<gsl::byte> buffer, CancelToken& token)
 {
     CoroutineIoOperation operation;
-    co_return co_await file.Issue(operation, token, [&](aiocb& cb) -> IoResult {
+    co_return co_await file.Issue(operation, token, [&](aiocb& cb) {
+        cb.aio_lio_opcode = LIO_READ;
         cb.aio_buf = buffer.data();
         cb.aio_nbytes = buffer.size();
         cb.aio_offset = offset;
-        if (aio_read(&cb) < 0)
-        {
-            return {-errno, 0};
-        }
-
-        return {};
     });
 }
 
 Task<IoResult> WriteAsync(CoroutineIoIssuer& file, std::uint64_t offset, gsl::span<const gsl::byte> buffer, CancelToken& token)
 {
     CoroutineIoOperation operation;
-    co_return co_await file.Issue(operation, token, [&](aiocb& cb) -> IoResult {
+    co_return co_await file.Issue(operation, token, [&](aiocb& cb) {
+        cb.aio_lio_opcode = LIO_WRITE;
         cb.aio_buf = (volatile void*)buffer.data();
         cb.aio_nbytes = buffer.size();
         cb.aio_offset = offset;
-        if (aio_write(&cb) < 0)
-        {
-            return {errno, 0};
-        }
-
-        return {};
     });
 }
 
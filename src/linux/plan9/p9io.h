@@ -3,6 +3,7 @@
 
 #include "p9await.h"
 #include "p9tracelogging.h"
+#include "p9stats.h"
 
 namespace p9fs {
 
@@ -14,17 +15,59 @@ struct IoResult
 
 struct CoroutineIoOperation final : public ICancellable
 {
+    // Describes the IO; aio_lio_opcode must be LIO_READ or LIO_WRITE.
     aiocb ControlBlock;
     IoResult Result;
     std::coroutine_handle<> Coroutine{};
     std::atomic<bool> DoneOrCoroutine{false};
 
-    void Cancel() override
+    // Set if the IO was submitted to the io_uring rather than through POSIX aio.
+    bool UsesRing{};
+    iovec Buffer{};
+
+    void Complete(IoResult result);
+    void Cancel() override;
+};
+
+// Submits file IO through an io_uring, with a single thread that reaps completions and schedules
+// the waiting coroutines.
+// N.B. Kernels without io_uring support (or with io_uring disabled) leave the ring uninitialized,
+//      in which case IO falls back to POSIX aio.
+class IoRing
+{
+public:
+    void Run();
+    bool Submit(CoroutineIoOperation& operation);
+    void Cancel(CoroutineIoOperation& operation);
+
+    explicit operator bool() const noexcept
     {
-        aio_cancel(ControlBlock.aio_fildes, &ControlBlock);
+        return m_RingFileDescriptor >= 0;
     }
+
+private:
+    static void ReapThread(IoRing* ring);
+    static void FillEntry(io_uring_sqe& entry, CoroutineIoOperation& operation);
+    void Initialize();
+    io_uring_sqe* NextSubmissionEntry();
+
+    std::once_flag m_RunOnce;
+    std::mutex m_SubmitLock;
+    int m_RingFileDescriptor{-1};
+    unsigned int m_Entries{};
+    unsigned int* m_SqHead{};
+    unsigned int* m_SqTail{};
+    unsigned int* m_SqMask{};
+    unsigned int* m_SqArray{};
+    io_uring_sqe* m_Sqes{};
+    unsigned int* m_CqHead{};
+    unsigned int* m_CqTail{};
+    unsigned int* m_CqMask{};
+    io_uring_cqe* m_Cqes{};
 };
 
+extern IoRing g_IoRing;
+
 struct CoroutineEpollOperation final : public ICancellable
 {
     std::atomic<int> Result{EWOULDBLOCK};
@@ -100,7 +143,8 @@ public:
             IoResult result;
             try
             {
-                result = func(operation.ControlBlock);
+                func(operation.ControlBlock);
+                result = Submit(operation);
             }
             catch (...)
             {
@@ -117,6 +161,7 @@ public:
 private:
     static void Callback(sigval value);
 
+    IoResult Submit(CoroutineIoOperation& operation);
     bool PreIssue(CoroutineIoOperation& operation, CancelToken& token);
     static void IssueFailed(CancelToken& token);
     void PostIssue(CoroutineIoOperation& operation, CancelToken& token, IoResult result);
@@ -145,6 +190,12 @@ public:
     void Run();
     void Add(int fd, int events, EpollDispatcher& dispatcher);
     void Remove(int fd);
+    EpollThreadStatistics Statistics() const noexcept;
+
+    size_t Sockets() const noexcept
+    {
+        return m_Sockets.load(std::memory_order_relaxed);
+    }
 
     explicit operator bool() const noexcept
     {
@@ -155,9 +206,36 @@ private:
     static void WatchThread(EpollWatcher* watcher);
 
     int m_EpollFileDescriptor{-1};
+    std::atomic<size_t> m_Sockets{};
+    std::atomic<UINT64> m_TotalSockets{};
+    std::atomic<UINT64> m_Events{};
+};
+
+// A set of epoll watchers, each with its own thread, so the readiness of all connections isn't
+// dispatched by a single thread. Each socket is assigned to the watcher with the fewest sockets
+// when it is created, and keeps that watcher until it is closed.
+class EpollWatcherSet
+{
+public:
+    static constexpr unsigned int MaximumWatchers = 64;
+
+    void Run(unsigned int count);
+    EpollWatcher& Select() noexcept;
+    std::vector<EpollThreadStatistics> Statistics() const;
+
+    explicit operator bool() const noexcept
+    {
+        return m_Count.load(std::memory_order_acquire) > 0;
+    }
+
+private:
+    std::array<EpollWatcher, MaximumWatchers> m_Watchers;
+    std::atomic<unsigned int> m_Count{};
+    std::atomic<unsigned int> m_Next{};
+    std::mutex m_Lock;
 };
 
-extern EpollWatcher g_Watcher;
+extern EpollWatcherSet g_Watchers;
 
 class CoroutineEpollIssuer
 {
@@ -282,6 +360,8 @@ private:
 Task<int> AcceptAsync(CoroutineEpollIssuer& listen, CancelToken& token);
 Task<size_t> RecvAsync(CoroutineEpollIssuer& socket, gsl::span<gsl::byte> buffer, CancelToken& token);
 Task<size_t> SendAsync(CoroutineEpollIssuer& socket, gsl::span<const gsl::byte> buffer, CancelToken& token);
+Task<size_t> SendAsync(CoroutineEpollIssuer& socket, gsl::span<const iovec> buffers, CancelToken& token);
+Task<size_t> SpliceAsync(CoroutineEpollIssuer& socket, int pipe, size_t count, CancelToken& token);
 Task<IoResult> ReadAsync(CoroutineIoIssuer& file, std::uint64_t offset, gsl::span<gsl::byte> buffer, CancelToken& token);
 Task<IoResult> WriteAsync(CoroutineIoIssuer& file, std::uint64_t offset, gsl::span<const gsl::byte> buffer, CancelToken& token);
 
@@ -6,11 +6,29 @@ using namespace std::chrono_literals;
 namespace p9fs {
 
 constexpr auto ThreadPoolTimeout = 10s;
+constexpr unsigned int ThreadPoolMinimumSpinCount = 64;
+constexpr unsigned int ThreadPoolMaximumSpinCount = 4096;
 
 ThreadPool g_ThreadPool;
 
+namespace {
+
+// Hints to the processor that this is a spin-wait loop.
+void CpuRelax() noexcept
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+} // namespace
+
 // Create a socket class with a socket fd.
-Socket::Socket(int socket) : m_Io{g_Watcher}
+// N.B. The socket is assigned to an epoll watcher when it is created, so it keeps using the same
+//      watcher if it's reset.
+Socket::Socket(int socket) : m_Io{g_Watchers.Select()}
 {
     Reset(socket);
 }
@@ -40,6 +58,56 @@ Task<size_t> Socket::SendAsync(gsl::span<const gsl::byte> buffer, CancelToken& t
     co_return totalSent;
 }
 
+// Asynchronously send multiple buffers, using as few system calls as possible.
+Task<size_t> Socket::SendAsync(gsl::span<const gsl::span<const gsl::byte>> buffers, CancelToken& token)
+{
+    std::vector<iovec> vectors;
+    vectors.reserve(buffers.size());
+    for (const auto& buffer : buffers)
+    {
+        if (!buffer.empty())
+        {
+            vectors.push_back({const_cast<gsl::byte*>(buffer.data()), buffer.size()});
+        }
+    }
+
+    size_t totalSent{};
+    gsl::span<iovec> remaining{vectors};
+    while (!remaining.empty())
+    {
+        auto sent = co_await p9fs::SendAsync(m_Io, remaining.subspan(0, std::min<size_t>(remaining.size(), IOV_MAX)), token);
+        totalSent += sent;
+
+        // Skip the buffers that were sent completely, and adjust the first one if it was only
+        // partially sent.
+        while (!remaining.empty() && sent >= remaining[0].iov_len)
+        {
+            sent -= remaining[0].iov_len;
+            remaining = remaining.subspan(1);
+        }
+
+        if (sent > 0)
+        {
+            remaining[0].iov_base = static_cast<char*>(remaining[0].iov_base) + sent;
+            remaining[0].iov_len -= sent;
+        }
+    }
+
+    co_return totalSent;
+}
+
+// Asynchronously send data that was placed in a pipe, without copying it to user mode.
+Task<size_t> Socket::SpliceAsync(int pipe, size_t count, CancelToken& token)
+{
+    size_t totalSent{};
+    while (totalSent < count)
+    {
+        totalSent += co_await p9fs::SpliceAsync(m_Io, pipe, count - totalSent, token);
+    }
+
+    co_return totalSent;
+}
+
 void Socket::Reset(int socket)
 {
     m_Io.Reset(socket);
@@ -47,70 +115,233 @@ void Socket::Reset(int socket)
 }
 
 // Create a new work item for a specific callback.
-WorkItem::WorkItem(std::function<void()> callback) : m_Callback{callback}
+WorkItem::WorkItem(std::function<void()> callback) : m_Callback{std::move(callback)}
 {
 }
 
 // Submit the work item to the thread pool.
+// N.B. The thread pool queues the work item itself, so the callback isn't copied.
 void WorkItem::Submit()
 {
-    g_ThreadPool.SubmitWork(m_Callback);
+    g_ThreadPool.SubmitWork(*this);
+}
+
+// Run the work item's callback.
+void WorkItem::Run()
+{
+    m_Callback();
 }
 
 // Create a new work item for a specific callback.
 std::unique_ptr<IWorkItem> CreateWorkItem(std::function<void()> callback)
 {
-    return std::make_unique<WorkItem>(callback);
+    return std::make_unique<WorkItem>(std::move(callback));
 }
 
 // Create a new thread pool.
-ThreadPool::ThreadPool() : m_MaxThreads{std::thread::hardware_concurrency()}
+ThreadPool::ThreadPool() : m_SpinCount{ThreadPoolMinimumSpinCount}, m_MaxThreads{std::max(std::thread::hardware_concurrency(), 1u)}
 {
+    for (size_t index = 0; index < m_Queue.size(); ++index)
+    {
+        m_Queue[index].Sequence.store(index, std::memory_order_relaxed);
+    }
+}
+
+// Set the number of worker threads that are kept alive while idle, and start them.
+void ThreadPool::SetMinimumThreads(unsigned int count)
+{
+    m_MinThreads = std::min(count, m_MaxThreads);
+    while (m_RunningThreads.load() < m_MinThreads.load() && TryStartThread())
+    {
+    }
 }
 
 // Submit work to the thread pool.
-void ThreadPool::SubmitWork(std::function<void()> callback)
+void ThreadPool::SubmitWork(WorkItem& work)
+{
+    // N.B. The scheduler, which is the only user of the thread pool, has at most one work item
+    //      queued per run queue, so the ring should never fill up; if it does, wait for a worker
+    //      to make room.
+    while (!TryPush(work))
+    {
+        std::this_thread::yield();
+    }
+
+    // N.B. This fence pairs with the one in WaitForWork, so either this thread sees the worker as
+    //      idle or sleeping, or that worker sees the new work item before it goes to sleep.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_SleepingThreads.load(std::memory_order_relaxed) > 0)
+    {
+        m_WakeSequence.fetch_add(1, std::memory_order_relaxed);
+        syscall(SYS_futex, &m_WakeSequence, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+    }
+    else if (m_IdleThreads.load(std::memory_order_relaxed) == 0)
+    {
+        // If there are no threads to run the work right now, and it's not at the max, start a
+        // new thread.
+        TryStartThread();
+    }
+}
+
+// Add a work item to the ring. Returns false if the ring is full.
+bool ThreadPool::TryPush(WorkItem& work) noexcept
+{
+    auto position = m_Tail.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        auto& cell = m_Queue[position % m_Queue.size()];
+        const auto sequence = cell.Sequence.load(std::memory_order_acquire);
+        const auto difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+        if (difference == 0)
+        {
+            if (m_Tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+            {
+                cell.Work = &work;
+                cell.Sequence.store(position + 1, std::memory_order_release);
+                return true;
+            }
+        }
+        else if (difference < 0)
+        {
+            return false;
+        }
+        else
+        {
+            position = m_Tail.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+// Remove the oldest work item from the ring. Returns null if the ring is empty.
+WorkItem* ThreadPool::TryPop() noexcept
+{
+    auto position = m_Head.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        auto& cell = m_Queue[position % m_Queue.size()];
+        const auto sequence = cell.Sequence.load(std::memory_order_acquire);
+        const auto difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position + 1);
+        if (difference == 0)
+        {
+            if (m_Head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+            {
+                const auto work = cell.Work;
+                cell.Sequence.store(position + m_Queue.size(), std::memory_order_release);
+                return work;
+            }
+        }
+        else if (difference < 0)
+        {
+            return nullptr;
+        }
+        else
+        {
+            position = m_Head.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+// Start a new worker thread, unless the maximum number of threads is already running.
+bool ThreadPool::TryStartThread()
+{
+    auto running = m_RunningThreads.load();
+    do
+    {
+        if (running >= m_MaxThreads)
+        {
+            return false;
+        }
+    } while (!m_RunningThreads.compare_exchange_weak(running, running + 1));
+
+    std::thread(&ThreadPool::WorkerCallback, this).detach();
+    return true;
+}
+
+// Account for an idle worker thread exiting, unless that would leave fewer than the minimum number
+// of threads.
+bool ThreadPool::TryRetireThread() noexcept
+{
+    auto running = m_RunningThreads.load();
+    do
+    {
+        if (running <= m_MinThreads.load())
+        {
+            return false;
+        }
+    } while (!m_RunningThreads.compare_exchange_weak(running, running - 1));
+
+    return true;
+}
+
+// Wait until there is work to run. Returns null if the thread was idle for long enough that it
+// should exit.
+WorkItem* ThreadPool::WaitForWork() noexcept
 {
-    std::lock_guard<std::mutex> lock{m_Lock};
-    m_WorkQueue.push(callback);
-    // If there are no threads to run the work right now, and it's not at the
-    // max, start a new thread.
-    if (m_AvailableThreads == 0 && m_RunningThreads < m_MaxThreads)
+    m_IdleThreads.fetch_add(1);
+
+    // Spin for a while first, since work often arrives shortly after the previous item completed.
+    // The spin count adapts to whether spinning has recently been successful.
+    const auto spinCount = m_SpinCount.load(std::memory_order_relaxed);
+    for (unsigned int spin = 0; spin < spinCount; ++spin)
     {
-        ++m_RunningThreads;
-        std::thread(&ThreadPool::WorkerCallback, this).detach();
+        if (const auto work = TryPop())
+        {
+            m_IdleThreads.fetch_sub(1);
+            m_SpinCount.store(std::min(spinCount * 2, ThreadPoolMaximumSpinCount), std::memory_order_relaxed);
+            return work;
+        }
+
+        CpuRelax();
     }
-    else
+
+    m_SpinCount.store(std::max(spinCount / 2, ThreadPoolMinimumSpinCount), std::memory_order_relaxed);
+    for (;;)
     {
-        m_Condition.notify_one();
+        const auto wakeSequence = m_WakeSequence.load();
+        m_SleepingThreads.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (const auto work = TryPop())
+        {
+            m_SleepingThreads.fetch_sub(1);
+            m_IdleThreads.fetch_sub(1);
+            return work;
+        }
+
+        const timespec timeout{std::chrono::duration_cast<std::chrono::seconds>(ThreadPoolTimeout).count(), 0};
+        const auto result = syscall(SYS_futex, &m_WakeSequence, FUTEX_WAIT_PRIVATE, wakeSequence, &timeout, nullptr, 0);
+        const bool timedOut = result < 0 && errno == ETIMEDOUT;
+        m_SleepingThreads.fetch_sub(1);
+        if (!timedOut || !TryRetireThread())
+        {
+            continue;
+        }
+
+        // Check for work once more after retiring; a thread that submitted work while this thread
+        // was still counted as idle won't have started a new thread.
+        m_IdleThreads.fetch_sub(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (const auto work = TryPop())
+        {
+            m_RunningThreads.fetch_add(1);
+            return work;
+        }
+
+        return nullptr;
     }
 }
 
 // Runs a worker thread that executes queued work items.
 void ThreadPool::WorkerCallback()
 {
-    std::unique_lock<std::mutex> lock{m_Lock, std::defer_lock};
     for (;;)
     {
-        lock.lock();
-        ++m_AvailableThreads;
-        // Wait for work.
-        if (m_WorkQueue.empty() && !m_Condition.wait_for(lock, ThreadPoolTimeout, [this]() { return !m_WorkQueue.empty(); }))
+        const auto work = WaitForWork();
+        if (work == nullptr)
         {
-            // The wait timed out, so shut down this thread.
-            --m_AvailableThreads;
-            --m_RunningThreads;
             return;
         }
 
-        // Take ownership of the work item.
-        --m_AvailableThreads;
-        auto work = m_WorkQueue.front();
-        m_WorkQueue.pop();
-        lock.unlock();
-
-        // Run the work outside the lock.
-        work();
+        work->Run();
     }
 }
 
@@ -14,6 +14,8 @@ public:
     Task<std::unique_ptr<ISocket>> AcceptAsync(CancelToken& token) override;
     Task<size_t> RecvAsync(gsl::span<gsl::byte> buffer, CancelToken& token) override;
     Task<size_t> SendAsync(gsl::span<const gsl::byte> buffer, CancelToken& token) override;
+    Task<size_t> SendAsync(gsl::span<const gsl::span<const gsl::byte>> buffers, CancelToken& token) override;
+    Task<size_t> SpliceAsync(int pipe, size_t count, CancelToken& token) override;
     void Reset(int socket = -1);
 
 private:
@@ -27,27 +29,52 @@ public:
     WorkItem(std::function<void()> callback);
 
     void Submit() override;
+    void Run();
 
 private:
     std::function<void()> m_Callback;
 };
 
+// Runs work items on a set of worker threads. Submitted work items are kept in a fixed-size
+// lock-free ring; idle workers spin for a short time before sleeping on a futex, and a minimum
+// number of workers is kept alive so work submitted after an idle period doesn't have to wait for a
+// thread to be created.
 class ThreadPool final
 {
 public:
     ThreadPool();
 
-    void SubmitWork(std::function<void()> callback);
+    void SetMinimumThreads(unsigned int count);
+    void SubmitWork(WorkItem& work);
 
 private:
+    static constexpr size_t c_queueSize = 1024;
+
+    struct Cell
+    {
+        std::atomic<size_t> Sequence;
+        WorkItem* Work;
+    };
+
+    bool TryPush(WorkItem& work) noexcept;
+    WorkItem* TryPop() noexcept;
+    bool TryStartThread();
+    bool TryRetireThread() noexcept;
+    WorkItem* WaitForWork() noexcept;
     void WorkerCallback();
 
-    std::queue<std::function<void()>> m_WorkQueue;
-    std::mutex m_Lock;
-    std::condition_variable m_Condition;
+    std::array<Cell, c_queueSize> m_Queue;
+    alignas(64) std::atomic<size_t> m_Head{};
+    alignas(64) std::atomic<size_t> m_Tail{};
+    alignas(64) std::atomic<uint32_t> m_WakeSequence{};
+    std::atomic<unsigned int> m_SleepingThreads{};
+    std::atomic<unsigned int> m_IdleThreads{};
+    std::atomic<unsigned int> m_RunningThreads{};
+    std::atomic<unsigned int> m_MinThreads{};
+    std::atomic<unsigned int> m_SpinCount;
     unsigned int m_MaxThreads{};
-    unsigned int m_AvailableThreads{};
-    unsigned int m_RunningThreads{};
 };
 
+extern ThreadPool g_ThreadPool;
+
 } // namespace p9fs
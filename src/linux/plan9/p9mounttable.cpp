@@ -0,0 +1,122 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+#include "precomp.h"
+#include "p9mounttable.h"
+#include <mountutilcpp.h>
+
+namespace p9fs {
+
+namespace {
+
+// Tables for each mount namespace, indexed by the namespace's inode number.
+std::mutex g_TablesLock;
+std::unordered_map<ino_t, std::shared_ptr<MountTable>> g_Tables;
+
+// The table for the calling thread's mount namespace.
+// N.B. The file server never changes the mount namespace of its threads, so a thread's namespace
+//      is the one it was created in.
+thread_local std::shared_ptr<MountTable> t_Table;
+
+} // namespace
+
+// Gets the table for the mount namespace of the calling thread.
+std::shared_ptr<MountTable> MountTable::ForCurrentThread()
+{
+    if (!t_Table)
+    {
+        struct stat st;
+        THROW_LAST_ERROR_IF(stat("/proc/thread-self/ns/mnt", &st) < 0);
+
+        std::lock_guard<std::mutex> lock{g_TablesLock};
+        auto& table = g_Tables[st.st_ino];
+        if (!table)
+        {
+            table = std::make_shared<MountTable>();
+        }
+
+        t_Table = table;
+    }
+
+    return t_Table;
+}
+
+// Opens the mountinfo file of the calling thread, which is in the namespace the table is for.
+// N.B. Because this thread might not be in the same mount namespace than the rest of the process,
+//      /proc/thread-self/mountinfo is used instead of /proc/self/.
+MountTable::MountTable() : m_MountInfo{open("/proc/thread-self/mountinfo", O_RDONLY | O_CLOEXEC)}
+{
+    THROW_LAST_ERROR_IF(!m_MountInfo);
+}
+
+// Gets the file system type of the mount with the specified device number, or an empty string if
+// there is no such mount.
+std::string MountTable::GetFileSystemType(dev_t device)
+{
+    std::lock_guard<std::mutex> lock{m_Lock};
+    ReloadIfChanged();
+    const auto entry = m_FileSystemTypes.find(device);
+    if (entry == m_FileSystemTypes.end())
+    {
+        return {};
+    }
+
+    return entry->second;
+}
+
+// Reparses the mountinfo file if it was never loaded or if mounts were added or removed since.
+// N.B. The file descriptor was opened in the table's namespace, so it keeps reporting that
+//      namespace regardless of which thread reads it.
+void MountTable::ReloadIfChanged()
+{
+    pollfd pollDescriptor{m_MountInfo.get(), POLLPRI, 0};
+    const int result = poll(&pollDescriptor, 1, 0);
+    THROW_LAST_ERROR_IF(result < 0);
+
+    const bool changed = result > 0 && WI_IsAnyFlagSet(pollDescriptor.revents, POLLPRI | POLLERR);
+    if (m_Loaded && !changed)
+    {
+        return;
+    }
+
+    THROW_LAST_ERROR_IF(lseek(m_MountInfo.get(), 0, SEEK_SET) < 0);
+    std::string contents;
+    std::array<char, 4096> buffer;
+    for (;;)
+    {
+        const auto bytesRead = TEMP_FAILURE_RETRY(read(m_MountInfo.get(), buffer.data(), buffer.size()));
+        THROW_LAST_ERROR_IF(bytesRead < 0);
+        if (bytesRead == 0)
+        {
+            break;
+        }
+
+        contents.append(buffer.data(), bytesRead);
+    }
+
+    // Invalid lines are skipped. If a device is mounted more than once, all mounts have the same
+    // file system type, so only the first one is kept.
+    m_FileSystemTypes.clear();
+    for (size_t start = 0; start < contents.size();)
+    {
+        auto end = contents.find('\n', start);
+        if (end == std::string::npos)
+        {
+            end = contents.size();
+        }
+        else
+        {
+            contents[end] = '\0';
+        }
+
+        MOUNT_ENTRY entry;
+        if (MountParseMountInfoLine(&contents[start], &entry) >= 0)
+        {
+            m_FileSystemTypes.try_emplace(entry.Device, entry.FileSystemType);
+        }
+
+        start = end + 1;
+    }
+
+    m_Loaded = true;
+}
+
+} // namespace p9fs
@@ -0,0 +1,30 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+#pragma once
+
+namespace p9fs {
+
+// A cached view of the mounts in a mount namespace, indexed by device number.
+// N.B. The table is reloaded only when the kernel reports a change to the namespace's mounts, by
+//      signaling POLLPRI on its mountinfo file.
+class MountTable final
+{
+public:
+    static std::shared_ptr<MountTable> ForCurrentThread();
+
+    MountTable();
+
+    MountTable(const MountTable&) = delete;
+    MountTable& operator=(const MountTable&) = delete;
+
+    std::string GetFileSystemType(dev_t device);
+
+private:
+    void ReloadIfChanged();
+
+    std::mutex m_Lock;
+    wil::unique_fd m_MountInfo;
+    std::unordered_map<dev_t, std::string> m_FileSystemTypes;
+    bool m_Loaded{};
+};
+
+} // namespace p9fs
@@ -14,6 +14,8 @@ public:
     virtual Task<std::unique_ptr<ISocket>> AcceptAsync(CancelToken& token) = 0;
     virtual Task<size_t> RecvAsync(gsl::span<gsl::byte> buffer, CancelToken& token) = 0;
     virtual Task<size_t> SendAsync(gsl::span<const gsl::byte> buffer, CancelToken& token) = 0;
+    virtual Task<size_t> SendAsync(gsl::span<const gsl::span<const gsl::byte>> buffers, CancelToken& token) = 0;
+    virtual Task<size_t> SpliceAsync(int pipe, size_t count, CancelToken& token) = 0;
 };
 
 // Platform-independent wrapper around threadpool work
@@ -346,10 +346,12 @@ public:
         return s;
     }
 
-    void Header(MessageType messageType, UINT16 tag) const
+    // Writes the message header. The payload size is the size of any data that is sent after the
+    // message without being written to this buffer.
+    void Header(MessageType messageType, UINT16 tag, UINT32 payloadSize = 0) const
     {
         SpanWriter headerWriter{Message.subspan(0, HeaderSize)};
-        headerWriter.U32(static_cast<UINT32>(Offset));
+        headerWriter.U32(static_cast<UINT32>(Offset) + payloadSize);
         headerWriter.U8(static_cast<UINT8>(messageType));
         headerWriter.U16(tag);
     }
@@ -0,0 +1,76 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+#include "precomp.h"
+#include "p9readahead.h"
+
+namespace p9fs {
+
+namespace {
+
+// The number of consecutive sequential reads before read-ahead starts.
+constexpr UINT32 c_minimumStreak = 2;
+
+// The initial and maximum amount of data to prefetch after the latest read.
+constexpr UINT64 c_initialWindow = 256 * 1024;
+constexpr UINT64 c_maximumWindow = 4 * 1024 * 1024;
+
+// Clients may have several reads outstanding, which can arrive out of order, so a read that is
+// within this many requests of the expected offset still counts as sequential.
+constexpr UINT64 c_reorderTolerance = 8;
+
+std::atomic<UINT64> g_SequentialReads;
+std::atomic<UINT64> g_PrefetchHits;
+
+} // namespace
+
+// Records a read of the file, and returns the range that should be prefetched, if any.
+std::optional<ReadAheadTracker::Range> ReadAheadTracker::OnRead(UINT64 offset, UINT32 count)
+{
+    const UINT64 end = offset + count;
+    const UINT64 tolerance = static_cast<UINT64>(count) * c_reorderTolerance;
+
+    std::lock_guard<std::mutex> lock{m_Lock};
+    const bool sequential = m_Streak > 0 && offset + tolerance >= m_NextOffset && offset <= m_NextOffset + tolerance;
+    if (!sequential)
+    {
+        m_Streak = 1;
+        m_NextOffset = end;
+        m_PrefetchEnd = 0;
+        m_Window = c_initialWindow;
+        return {};
+    }
+
+    m_Streak += 1;
+    m_NextOffset = std::max(m_NextOffset, end);
+    if (m_Streak < c_minimumStreak)
+    {
+        return {};
+    }
+
+    g_SequentialReads.fetch_add(1, std::memory_order_relaxed);
+    if (end <= m_PrefetchEnd)
+    {
+        g_PrefetchHits.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Only prefetch more once the client has consumed half of the window, so the prefetch requests
+    // are reasonably large.
+    if (m_PrefetchEnd > end && m_PrefetchEnd - end >= m_Window / 2)
+    {
+        return {};
+    }
+
+    const UINT64 start = std::max(m_PrefetchEnd, end);
+    const UINT64 target = end + m_Window;
+    m_PrefetchEnd = target;
+    m_Window = std::min(m_Window * 2, c_maximumWindow);
+    return Range{start, target - start};
+}
+
+// Returns the number of reads that were part of a sequential stream, and how many of those were
+// for data that had already been prefetched.
+std::pair<UINT64, UINT64> ReadAheadTracker::Statistics() noexcept
+{
+    return {g_SequentialReads.load(std::memory_order_relaxed), g_PrefetchHits.load(std::memory_order_relaxed)};
+}
+
+} // namespace p9fs
@@ -0,0 +1,32 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+#pragma once
+
+namespace p9fs {
+
+// Detects sequential reads on an open file, so the data after them can be requested from the
+// storage before the client asks for it. Clients split large reads into requests no larger than
+// the negotiated message size, so without this every request waits for its own I/O.
+// N.B. The read-ahead window doubles for as long as the stream stays sequential, up to a fixed
+//      maximum, which bounds how much data each file can have prefetched but not yet read.
+class ReadAheadTracker final
+{
+public:
+    struct Range
+    {
+        UINT64 Offset;
+        UINT64 Length;
+    };
+
+    std::optional<Range> OnRead(UINT64 offset, UINT32 count);
+
+    static std::pair<UINT64, UINT64> Statistics() noexcept;
+
+private:
+    std::mutex m_Lock;
+    UINT64 m_NextOffset{};
+    UINT64 m_PrefetchEnd{};
+    UINT64 m_Window{};
+    UINT32 m_Streak{};
+};
+
+} // namespace p9fs
@@ -7,33 +7,59 @@ namespace p9fs {
 
 Scheduler g_Scheduler;
 thread_local bool Scheduler::tls_Blocked{};
-thread_local bool Scheduler::tls_SchedulerThread{};
+thread_local Scheduler::Slot* Scheduler::tls_Slot{};
+thread_local size_t Scheduler::tls_LastSlot{};
 
-Scheduler::Scheduler() : m_Work{CreateWorkItem(std::bind(&Scheduler::WorkerCallback, this))}
+/// Creates one run queue per processor, so coroutines can run on all of them
+/// concurrently.
+Scheduler::Scheduler()
 {
+    const size_t count = std::max(std::thread::hardware_concurrency(), 1u);
+    m_Slots.reserve(count);
+    for (size_t index = 0; index < count; ++index)
+    {
+        auto slot = std::make_unique<Slot>();
+        slot->Index = index;
+        slot->Work = CreateWorkItem([this, slot = slot.get()]() { WorkerCallback(*slot); });
+        m_Slots.push_back(std::move(slot));
+    }
 }
 
 /// Schedules a coroutine to run. It will run sometime after this coroutine
 /// yields or enters a blocking region.
+///
+/// Coroutines scheduled by a thread that is running a queue are added to that
+/// queue; other threads (e.g. IO completions) distribute them across the
+/// queues.
 void Scheduler::Schedule(Coroutine coroutine) noexcept
 {
+    Slot& slot = tls_Slot != nullptr ? *tls_Slot : *m_Slots[m_NextSlot.fetch_add(1, std::memory_order_relaxed) % m_Slots.size()];
     bool kick = false;
+    bool backlog = false;
 
     {
-        std::unique_lock<std::shared_mutex> lock(m_Lock);
+        std::lock_guard<std::mutex> lock(slot.Lock);
 
         // N.B. This could throw in very low memory situations, which would terminate the process.
-        m_Queue.push(coroutine);
-        if (!m_Running && !m_ThreadEnqueued)
+        slot.Queue.push_back(coroutine);
+        if (!slot.Running && !slot.ThreadEnqueued)
         {
-            m_ThreadEnqueued = true;
+            slot.ThreadEnqueued = true;
             kick = true;
         }
+
+        backlog = slot.Running && slot.Queue.size() > 1;
     }
 
     if (kick)
     {
-        m_Work->Submit();
+        slot.Work->Submit();
+    }
+    else if (backlog)
+    {
+        // The queue's thread has more work than it can run right now, so wake
+        // up another queue to steal some of it.
+        WakeIdleSlot();
     }
 }
 
@@ -41,7 +67,7 @@ void Scheduler::Schedule(Coroutine coroutine) noexcept
 /// coroutine to run.
 void Scheduler::DonateThreadAndResume(Coroutine coroutine) noexcept
 {
-    const bool run = Claim(false);
+    const bool run = ClaimAny(tls_LastSlot);
     Schedule(coroutine);
     if (run)
     {
@@ -49,36 +75,54 @@ void Scheduler::DonateThreadAndResume(Coroutine coroutine) noexcept
     }
 }
 
-/// Runs coroutines until there are no more in the queue or until this thread
-/// gave up the queue in order to run blocking code.
+/// Runs coroutines until there are no more in this thread's queue or in any
+/// other queue, or until this thread gave up its queue in order to run
+/// blocking code.
 ///
 /// Must be called on the thread that called Claim().
 void Scheduler::RunAndRelease() noexcept
 {
     WI_ASSERT(!tls_Blocked);
+    WI_ASSERT(tls_Slot != nullptr);
 
-    tls_SchedulerThread = true;
-    std::unique_lock<std::shared_mutex> lock(m_Lock);
-    while (!m_Queue.empty())
+    for (;;)
     {
-        auto coroutine = m_Queue.front();
-        m_Queue.pop();
-        lock.unlock();
+        // N.B. The queue can change while a coroutine runs, if it blocked and
+        //      then claimed a different queue when it was done.
+        Slot& slot = *tls_Slot;
+        Coroutine coroutine;
+        {
+            std::lock_guard<std::mutex> lock(slot.Lock);
+            if (!slot.Queue.empty())
+            {
+                coroutine = slot.Queue.front();
+                slot.Queue.pop_front();
+            }
+        }
+
+        if (!coroutine && !Steal(coroutine))
+        {
+            // Recheck the queue under the lock before giving it up, since
+            // coroutines may have been added to it after it was checked.
+            std::unique_lock<std::mutex> lock(slot.Lock);
+            if (!slot.Queue.empty())
+            {
+                continue;
+            }
+
+            slot.Running = false;
+            m_RunningSlots.fetch_sub(1, std::memory_order_relaxed);
+            tls_Slot = nullptr;
+            return;
+        }
+
         coroutine.resume();
         if (tls_Blocked)
         {
             tls_Blocked = false;
-            tls_SchedulerThread = false;
             return;
         }
-
-        lock.lock();
     }
-
-    WI_ASSERT(m_Queue.empty() || m_Running || m_ThreadEnqueued);
-
-    m_Running = false;
-    tls_SchedulerThread = false;
 }
 
 /// Called when the current thread may block for some time. Gives up queue
@@ -86,7 +130,7 @@ void Scheduler::RunAndRelease() noexcept
 /// non-blocking code.
 bool Scheduler::Block() noexcept
 {
-    if (!tls_SchedulerThread)
+    if (tls_Slot == nullptr)
     {
         return false;
     }
@@ -94,79 +138,162 @@ bool Scheduler::Block() noexcept
     WI_ASSERT(!tls_Blocked);
 
     tls_Blocked = true;
-
-    bool kick = false;
-
-    {
-        std::unique_lock<std::shared_mutex> lock(m_Lock);
-
-        WI_ASSERT(m_Running);
-
-        m_Running = false;
-        if (!m_Queue.empty() && !m_ThreadEnqueued)
-        {
-            m_ThreadEnqueued = true;
-            kick = true;
-        }
-    }
-
-    if (kick)
-    {
-        m_Work->Submit();
-    }
-
+    Release(*tls_Slot);
     return true;
 }
 
 /// Awaitable function called when the current thread is done running blocking
-/// code. Tries to reclaim ownership of the queue and resumes the current
-/// coroutine.
+/// code. Tries to claim ownership of a queue, preferring the one it ran
+/// before, and resumes the current coroutine.
 Scheduler::Unblocker Scheduler::Unblock() noexcept
 {
     WI_ASSERT(tls_Blocked);
 
     // Try to reuse this thread to run async tasks.
-    const bool run = Claim(false);
+    const bool run = ClaimAny(tls_LastSlot);
     if (run)
     {
         tls_Blocked = false;
     }
 
     // Unblocker will either resume the current coroutine or schedule it to run
-    // on the new queue owner.
+    // on a queue owned by another thread.
     return Unblocker{*this, run};
 }
 
-/// Try to claim queue ownership for the current thread. If this function
+/// Try to claim ownership of a queue for the current thread. If this function
 /// returns true, then the caller must call RunAndRelease to process the queue.
 ///
 /// If fromKick, then the caller is the thread that was explicitly kicked to
 /// process the queue. Otherwise, this is an IO completion or other
 /// opportunistic thread.
-bool Scheduler::Claim(bool fromKick) noexcept
+bool Scheduler::Claim(Slot& slot, bool fromKick) noexcept
 {
-    std::unique_lock<std::shared_mutex> lock(m_Lock);
+    std::lock_guard<std::mutex> lock(slot.Lock);
 
-    WI_ASSERT(!fromKick || m_ThreadEnqueued);
+    WI_ASSERT(!fromKick || slot.ThreadEnqueued);
 
     if (fromKick)
     {
-        m_ThreadEnqueued = false;
+        slot.ThreadEnqueued = false;
     }
 
-    if (m_Running)
+    if (slot.Running)
     {
         return false;
     }
 
-    m_Running = true;
+    slot.Running = true;
+    m_RunningSlots.fetch_add(1, std::memory_order_relaxed);
+    tls_Slot = &slot;
+    tls_LastSlot = slot.Index;
     return true;
 }
 
-/// Threadpool callback called to process the queue.
-void Scheduler::WorkerCallback() noexcept
+/// Try to claim any queue that isn't running, starting with the preferred one.
+/// A thread that already owns a queue can't claim another one.
+bool Scheduler::ClaimAny(size_t preferred) noexcept
+{
+    if (tls_Slot != nullptr)
+    {
+        return false;
+    }
+
+    for (size_t offset = 0; offset < m_Slots.size(); ++offset)
+    {
+        if (Claim(*m_Slots[(preferred + offset) % m_Slots.size()], false))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/// Gives up ownership of the current thread's queue, scheduling another thread
+/// to run it if it isn't empty.
+void Scheduler::Release(Slot& slot) noexcept
+{
+    WI_ASSERT(tls_Slot == &slot);
+
+    bool kick = false;
+
+    {
+        std::lock_guard<std::mutex> lock(slot.Lock);
+
+        WI_ASSERT(slot.Running);
+
+        slot.Running = false;
+        m_RunningSlots.fetch_sub(1, std::memory_order_relaxed);
+        if (!slot.Queue.empty() && !slot.ThreadEnqueued)
+        {
+            slot.ThreadEnqueued = true;
+            kick = true;
+        }
+    }
+
+    tls_Slot = nullptr;
+    if (kick)
+    {
+        slot.Work->Submit();
+    }
+}
+
+/// Takes the oldest coroutine from another queue, so coroutines still start
+/// roughly in the order they were scheduled. Queues that are busy are skipped
+/// rather than waited on.
+bool Scheduler::Steal(Coroutine& coroutine) noexcept
+{
+    const size_t start = tls_Slot->Index;
+    for (size_t offset = 1; offset < m_Slots.size(); ++offset)
+    {
+        Slot& victim = *m_Slots[(start + offset) % m_Slots.size()];
+        std::unique_lock<std::mutex> lock(victim.Lock, std::try_to_lock);
+        if (!lock.owns_lock() || victim.Queue.empty())
+        {
+            continue;
+        }
+
+        coroutine = victim.Queue.front();
+        victim.Queue.pop_front();
+        return true;
+    }
+
+    return false;
+}
+
+/// Schedules a thread to run a queue that has no thread, so it can steal work
+/// from busy queues.
+void Scheduler::WakeIdleSlot() noexcept
+{
+    if (m_RunningSlots.load(std::memory_order_relaxed) >= m_Slots.size())
+    {
+        return;
+    }
+
+    const size_t start = tls_Slot != nullptr ? tls_Slot->Index + 1 : 0;
+    for (size_t offset = 0; offset < m_Slots.size(); ++offset)
+    {
+        Slot& slot = *m_Slots[(start + offset) % m_Slots.size()];
+        {
+            std::unique_lock<std::mutex> lock(slot.Lock, std::try_to_lock);
+            if (!lock.owns_lock() || slot.Running || slot.ThreadEnqueued)
+            {
+                continue;
+            }
+
+            slot.ThreadEnqueued = true;
+        }
+
+        slot.Work->Submit();
+        return;
+    }
+}
+
+/// Threadpool callback called to process a queue.
+void Scheduler::WorkerCallback(Slot& slot) noexcept
 {
-    if (Claim(true))
+    if (Claim(slot, true))
     {
         RunAndRelease();
     }
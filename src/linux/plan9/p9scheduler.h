@@ -37,17 +37,32 @@ public:
     struct Unblocker Unblock() noexcept;
 
 private:
+    // A run queue. Coroutines are run by at most one thread per queue at a time, and a thread that
+    // runs out of work in its own queue steals from the other queues.
+    struct Slot
+    {
+        std::mutex Lock;
+        std::deque<Coroutine> Queue;
+        std::unique_ptr<IWorkItem> Work;
+        size_t Index{};
+        bool Running{};
+        bool ThreadEnqueued{};
+    };
+
     void RunAndRelease() noexcept;
-    bool Claim(bool owner) noexcept;
-    void WorkerCallback() noexcept;
-
-    std::shared_mutex m_Lock;
-    std::queue<Coroutine> m_Queue;
-    std::unique_ptr<IWorkItem> m_Work;
-    bool m_Running;
-    bool m_ThreadEnqueued;
+    bool Claim(Slot& slot, bool fromKick) noexcept;
+    bool ClaimAny(size_t preferred) noexcept;
+    void Release(Slot& slot) noexcept;
+    bool Steal(Coroutine& coroutine) noexcept;
+    void WakeIdleSlot() noexcept;
+    void WorkerCallback(Slot& slot) noexcept;
+
+    std::vector<std::unique_ptr<Slot>> m_Slots;
+    std::atomic<size_t> m_NextSlot{};
+    std::atomic<size_t> m_RunningSlots{};
     static thread_local bool tls_Blocked;
-    static thread_local bool tls_SchedulerThread;
+    static thread_local Slot* tls_Slot;
+    static thread_local size_t tls_LastSlot;
 };
 
 extern Scheduler g_Scheduler;
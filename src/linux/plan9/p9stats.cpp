@@ -0,0 +1,434 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+#include "precomp.h"
+#include "p9stats.h"
+#include "p9io.h"
+
+namespace p9fs {
+
+namespace {
+
+// Message types are indexed by their value divided by two, since request and response types
+// share an index and only request types are recorded.
+constexpr size_t c_operationSlots = 128;
+
+// Errors with a larger errno value are counted as this value.
+constexpr int c_maximumErrno = 255;
+
+using Counter = std::atomic<UINT64>;
+
+// Adds to a counter that is only written by the current thread.
+// N.B. This is cheaper than fetch_add since it doesn't need a locked instruction, and other
+//      threads reading the counter still see a value that was actually stored.
+void Increment(Counter& counter, UINT64 value) noexcept
+{
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+struct OperationCounters
+{
+    Counter Count{};
+    Counter Errors{};
+    Counter BytesIn{};
+    Counter BytesOut{};
+    std::array<Counter, LatencyHistogram::BucketCount> Queued{};
+    std::array<Counter, LatencyHistogram::BucketCount> Executed{};
+};
+
+// The counters written by a single thread. The counters for each message type are allocated the
+// first time the thread records that type, since most threads only see a few types.
+struct ThreadCounters
+{
+    ~ThreadCounters()
+    {
+        for (auto& operation : Operations)
+        {
+            delete operation.load(std::memory_order_relaxed);
+        }
+    }
+
+    OperationCounters& Operation(MessageType type)
+    {
+        auto& slot = Operations[static_cast<size_t>(type) / 2];
+        auto* operation = slot.load(std::memory_order_relaxed);
+        if (operation == nullptr)
+        {
+            operation = new OperationCounters{};
+            slot.store(operation, std::memory_order_release);
+        }
+
+        return *operation;
+    }
+
+    std::array<std::atomic<OperationCounters*>, c_operationSlots> Operations{};
+    std::array<Counter, c_maximumErrno + 1> ErrorsByErrno{};
+    bool InUse{};
+};
+
+// Keeps the counters of all threads. Counters are never freed; when a thread exits, its counters
+// are kept so their values are not lost, and reused by the next thread that starts recording.
+class Registry
+{
+public:
+    ThreadCounters* Acquire()
+    {
+        std::lock_guard<std::mutex> lock{m_Lock};
+        for (auto& counters : m_Counters)
+        {
+            if (!counters->InUse)
+            {
+                counters->InUse = true;
+                return counters.get();
+            }
+        }
+
+        auto& counters = m_Counters.emplace_back(std::make_unique<ThreadCounters>());
+        counters->InUse = true;
+        return counters.get();
+    }
+
+    void Release(ThreadCounters* counters) noexcept
+    {
+        std::lock_guard<std::mutex> lock{m_Lock};
+        counters->InUse = false;
+    }
+
+    template <typename Callback>
+    void ForEach(const Callback& callback)
+    {
+        std::lock_guard<std::mutex> lock{m_Lock};
+        for (const auto& counters : m_Counters)
+        {
+            callback(*counters);
+        }
+    }
+
+private:
+    std::mutex m_Lock;
+    std::vector<std::unique_ptr<ThreadCounters>> m_Counters;
+};
+
+// N.B. The registry is intentionally leaked, since threads may still be recording or exiting
+//      while static objects are destructed.
+Registry& GetRegistry()
+{
+    static Registry* registry = new Registry();
+    return *registry;
+}
+
+// Returns the counters for the current thread to the registry when the thread exits.
+class ThreadCountersOwner
+{
+public:
+    ~ThreadCountersOwner()
+    {
+        if (m_Counters != nullptr)
+        {
+            GetRegistry().Release(m_Counters);
+        }
+    }
+
+    ThreadCounters& Get()
+    {
+        if (m_Counters == nullptr)
+        {
+            m_Counters = GetRegistry().Acquire();
+        }
+
+        return *m_Counters;
+    }
+
+private:
+    ThreadCounters* m_Counters{};
+};
+
+thread_local ThreadCountersOwner t_counters;
+
+void AddHistogram(LatencyHistogram& histogram, const std::array<Counter, LatencyHistogram::BucketCount>& counters)
+{
+    for (size_t i = 0; i < histogram.Buckets.size(); ++i)
+    {
+        histogram.Buckets[i] += counters[i].load(std::memory_order_relaxed);
+    }
+}
+
+const char* OperationName(MessageType type)
+{
+    switch (type)
+    {
+    case MessageType::Tstatfs:
+        return "statfs";
+    case MessageType::Tlopen:
+        return "lopen";
+    case MessageType::Tlcreate:
+        return "lcreate";
+    case MessageType::Tsymlink:
+        return "symlink";
+    case MessageType::Tmknod:
+        return "mknod";
+    case MessageType::Trename:
+        return "rename";
+    case MessageType::Treadlink:
+        return "readlink";
+    case MessageType::Tgetattr:
+        return "getattr";
+    case MessageType::Tsetattr:
+        return "setattr";
+    case MessageType::Txattrwalk:
+        return "xattrwalk";
+    case MessageType::Txattrcreate:
+        return "xattrcreate";
+    case MessageType::Treaddir:
+        return "readdir";
+    case MessageType::Tfsync:
+        return "fsync";
+    case MessageType::Tlock:
+        return "lock";
+    case MessageType::Tgetlock:
+        return "getlock";
+    case MessageType::Tlink:
+        return "link";
+    case MessageType::Tmkdir:
+        return "mkdir";
+    case MessageType::Trenameat:
+        return "renameat";
+    case MessageType::Tunlinkat:
+        return "unlinkat";
+    case MessageType::Tversion:
+        return "version";
+    case MessageType::Tauth:
+        return "auth";
+    case MessageType::Tattach:
+        return "attach";
+    case MessageType::Tflush:
+        return "flush";
+    case MessageType::Twalk:
+        return "walk";
+    case MessageType::Tread:
+        return "read";
+    case MessageType::Twrite:
+        return "write";
+    case MessageType::Tclunk:
+        return "clunk";
+    case MessageType::Tremove:
+        return "remove";
+    case MessageType::Taccess:
+        return "access";
+    case MessageType::Twreaddir:
+        return "wreaddir";
+    case MessageType::Twopen:
+        return "wopen";
+    default:
+        return nullptr;
+    }
+}
+
+double Microseconds(std::chrono::nanoseconds value)
+{
+    return std::chrono::duration<double, std::micro>(value).count();
+}
+
+} // namespace
+
+// Returns the index of the bucket that counts the specified value.
+size_t LatencyHistogram::BucketIndex(UINT64 value) noexcept
+{
+    if (value < SubBuckets)
+    {
+        return static_cast<size_t>(value);
+    }
+
+    const unsigned int exponent = std::bit_width(value) - 1;
+    if (exponent >= MaximumBits)
+    {
+        return BucketCount - 1;
+    }
+
+    const auto shift = exponent - SubBucketBits;
+    return SubBuckets + (shift * SubBuckets) + static_cast<size_t>((value >> shift) & (SubBuckets - 1));
+}
+
+// Returns the largest value counted by the specified bucket.
+UINT64 LatencyHistogram::BucketLimit(size_t index) noexcept
+{
+    if (index < SubBuckets)
+    {
+        return index;
+    }
+
+    const auto shift = (index - SubBuckets) / SubBuckets;
+    const auto subBucket = (index - SubBuckets) % SubBuckets;
+    return ((SubBuckets + subBucket + 1) << shift) - 1;
+}
+
+UINT64 LatencyHistogram::Count() const noexcept
+{
+    UINT64 count{};
+    for (const auto bucket : Buckets)
+    {
+        count += bucket;
+    }
+
+    return count;
+}
+
+// Returns the value that the specified fraction of the counted values is less than or equal to,
+// rounded up to the limit of its bucket.
+std::chrono::nanoseconds LatencyHistogram::Percentile(double percentile) const noexcept
+{
+    const auto count = Count();
+    if (count == 0)
+    {
+        return {};
+    }
+
+    const auto rank = std::max<UINT64>(static_cast<UINT64>(std::ceil(percentile * count)), 1);
+    UINT64 seen{};
+    for (size_t i = 0; i < Buckets.size(); ++i)
+    {
+        seen += Buckets[i];
+        if (seen >= rank)
+        {
+            return std::chrono::nanoseconds{BucketLimit(i)};
+        }
+    }
+
+    return std::chrono::nanoseconds{BucketLimit(Buckets.size() - 1)};
+}
+
+// Records a completed request. The sizes include the message headers, and the response size
+// includes any data spliced after the response.
+void RequestStatistics::Record(MessageType type, size_t bytesIn, size_t bytesOut, LX_INT error, Clock::duration queued, Clock::duration executed) noexcept
+try
+{
+    auto& counters = t_counters.Get();
+    auto& operation = counters.Operation(type);
+    Increment(operation.Count, 1);
+    Increment(operation.BytesIn, bytesIn);
+    Increment(operation.BytesOut, bytesOut);
+    Increment(operation.Queued[LatencyHistogram::BucketIndex(std::chrono::duration_cast<std::chrono::nanoseconds>(queued).count())], 1);
+    Increment(operation.Executed[LatencyHistogram::BucketIndex(std::chrono::duration_cast<std::chrono::nanoseconds>(executed).count())], 1);
+    if (error != 0)
+    {
+        Increment(operation.Errors, 1);
+        Increment(counters.ErrorsByErrno[std::min(-error, c_maximumErrno)], 1);
+    }
+}
+catch (...)
+{
+    // The counters could not be allocated; the request is not counted.
+}
+
+// Sums the counters of all threads.
+StatisticsSnapshot RequestStatistics::Snapshot()
+{
+    std::array<std::optional<OperationStatistics>, c_operationSlots> operations;
+    std::array<UINT64, c_maximumErrno + 1> errors{};
+    GetRegistry().ForEach([&](const ThreadCounters& counters) {
+        for (size_t i = 0; i < counters.Operations.size(); ++i)
+        {
+            const auto* operation = counters.Operations[i].load(std::memory_order_acquire);
+            if (operation == nullptr)
+            {
+                continue;
+            }
+
+            auto& result = operations[i];
+            if (!result)
+            {
+                result.emplace();
+                result->Type = static_cast<MessageType>(i * 2);
+            }
+
+            result->Count += operation->Count.load(std::memory_order_relaxed);
+            result->Errors += operation->Errors.load(std::memory_order_relaxed);
+            result->BytesIn += operation->BytesIn.load(std::memory_order_relaxed);
+            result->BytesOut += operation->BytesOut.load(std::memory_order_relaxed);
+            AddHistogram(result->Queued, operation->Queued);
+            AddHistogram(result->Executed, operation->Executed);
+        }
+
+        for (size_t i = 0; i < errors.size(); ++i)
+        {
+            errors[i] += counters.ErrorsByErrno[i].load(std::memory_order_relaxed);
+        }
+    });
+
+    StatisticsSnapshot snapshot;
+    for (auto& operation : operations)
+    {
+        if (operation)
+        {
+            snapshot.Operations.emplace_back(std::move(*operation));
+        }
+    }
+
+    for (size_t i = 0; i < errors.size(); ++i)
+    {
+        if (errors[i] != 0)
+        {
+            snapshot.ErrorsByErrno.emplace_back(static_cast<int>(i), errors[i]);
+        }
+    }
+
+    snapshot.EpollThreads = g_Watchers.Statistics();
+    return snapshot;
+}
+
+// Formats a snapshot as a table with a line per message type, with latencies in microseconds.
+std::string RequestStatistics::Format(const StatisticsSnapshot& snapshot)
+{
+    std::string result = std::format(
+        "{:<12}{:>12}{:>10}{:>14}{:>14}{:>10}{:>10}{:>10}{:>10}{:>10}{:>10}\n",
+        "operation",
+        "count",
+        "errors",
+        "bytes-in",
+        "bytes-out",
+        "queue-p50",
+        "queue-p99",
+        "queue-p999",
+        "exec-p50",
+        "exec-p99",
+        "exec-p999");
+
+    for (const auto& operation : snapshot.Operations)
+    {
+        const auto* name = OperationName(operation.Type);
+        result += std::format(
+            "{:<12}{:>12}{:>10}{:>14}{:>14}{:>10.1f}{:>10.1f}{:>10.1f}{:>10.1f}{:>10.1f}{:>10.1f}\n",
+            name != nullptr ? std::string{name} : std::to_string(static_cast<int>(operation.Type)),
+            operation.Count,
+            operation.Errors,
+            operation.BytesIn,
+            operation.BytesOut,
+            Microseconds(operation.Queued.Percentile(0.5)),
+            Microseconds(operation.Queued.Percentile(0.99)),
+            Microseconds(operation.Queued.Percentile(0.999)),
+            Microseconds(operation.Executed.Percentile(0.5)),
+            Microseconds(operation.Executed.Percentile(0.99)),
+            Microseconds(operation.Executed.Percentile(0.999)));
+    }
+
+    if (!snapshot.ErrorsByErrno.empty())
+    {
+        result += "\nerrno       count\n";
+        for (const auto& [error, count] : snapshot.ErrorsByErrno)
+        {
+            result += std::format("{:<12}{}\n", error, count);
+        }
+    }
+
+    if (!snapshot.EpollThreads.empty())
+    {
+        result += std::format("\n{:<12}{:>12}{:>14}{:>14}\n", "epoll", "sockets", "total-sockets", "events");
+        for (size_t i = 0; i < snapshot.EpollThreads.size(); ++i)
+        {
+            const auto& thread = snapshot.EpollThreads[i];
+            result += std::format("{:<12}{:>12}{:>14}{:>14}\n", i, thread.Sockets, thread.TotalSockets, thread.Events);
+        }
+    }
+
+    return result;
+}
+
+} // namespace p9fs
@@ -0,0 +1,82 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+#pragma once
+
+#include "p9defs.h"
+
+namespace p9fs {
+
+// A log-linear latency histogram in nanoseconds, similar to HdrHistogram. Values are grouped by
+// their highest set bit, and each group is split into a fixed number of linear sub-buckets, so a
+// value is never off by more than 1/SubBuckets of itself.
+class LatencyHistogram
+{
+public:
+    static constexpr unsigned int SubBucketBits = 3;
+    static constexpr unsigned int SubBuckets = 1 << SubBucketBits;
+
+    // Values of 2^MaximumBits nanoseconds (about 68 seconds) or more are counted in the last bucket.
+    static constexpr unsigned int MaximumBits = 36;
+    static constexpr size_t BucketCount = SubBuckets + ((MaximumBits - SubBucketBits) * SubBuckets);
+
+    static size_t BucketIndex(UINT64 value) noexcept;
+    static UINT64 BucketLimit(size_t index) noexcept;
+
+    UINT64 Count() const noexcept;
+    std::chrono::nanoseconds Percentile(double percentile) const noexcept;
+
+    std::array<UINT64, BucketCount> Buckets{};
+};
+
+struct OperationStatistics
+{
+    MessageType Type{};
+    UINT64 Count{};
+    UINT64 Errors{};
+    UINT64 BytesIn{};
+    UINT64 BytesOut{};
+
+    // The time from receiving a request until a worker starts processing it, which includes
+    // waiting for the connection's request window and for the scheduler.
+    LatencyHistogram Queued;
+
+    // The time spent processing the request, up to the point its response is ready to send.
+    LatencyHistogram Executed;
+};
+
+// The load of one of the threads that dispatch socket readiness, which shows how evenly the
+// connections are spread across them.
+struct EpollThreadStatistics
+{
+    // The number of sockets currently watched, and watched in total.
+    size_t Sockets{};
+    UINT64 TotalSockets{};
+
+    // The number of readiness events dispatched.
+    UINT64 Events{};
+};
+
+struct StatisticsSnapshot
+{
+    // Only message types that were received at least once are included.
+    std::vector<OperationStatistics> Operations;
+
+    // The number of requests that failed with each error, by positive errno value.
+    std::vector<std::pair<int, UINT64>> ErrorsByErrno;
+
+    std::vector<EpollThreadStatistics> EpollThreads;
+};
+
+// Counters and latency histograms for each message type handled by the server.
+// N.B. Each thread records into its own counters without locking or atomic read-modify-write
+//      operations; taking a snapshot sums the counters of all threads.
+class RequestStatistics
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static void Record(MessageType type, size_t bytesIn, size_t bytesOut, LX_INT error, Clock::duration queued, Clock::duration executed) noexcept;
+    static StatisticsSnapshot Snapshot();
+    static std::string Format(const StatisticsSnapshot& snapshot);
+};
+
+} // namespace p9fs
@@ -208,6 +208,19 @@ void Plan9TraceLoggingProvider::ClientDisconnected(unsigned int connectionCount)
     LogMessage(std::format("ClientDisconnected, connectionCount={}", connectionCount), TRACE_LEVEL_VERBOSE);
 }
 
+// The number of coroutine frames that were allocated from the heap instead of the frame pool
+void Plan9TraceLoggingProvider::FrameHeapAllocations(unsigned long long allocationCount)
+{
+    LogMessage(std::format("FrameHeapAllocations, allocationCount={}", allocationCount), TRACE_LEVEL_VERBOSE);
+}
+
+// The number of sequential reads, and how many of them were for data that was already prefetched
+void Plan9TraceLoggingProvider::ReadAheadStatistics(unsigned long long sequentialReads, unsigned long long prefetchHits)
+{
+    LogMessage(
+        std::format("ReadAheadStatistics, sequentialReads={}, prefetchHits={}", sequentialReads, prefetchHits), TRACE_LEVEL_VERBOSE);
+}
+
 // Adds the message name to the log message.
 // N.B. This should be the first call on a new LogMessageBuilder.
 void LogMessageBuilder::AddName(std::string_view name)
@@ -37,6 +37,8 @@ public:
     static void OperationAborted();
     static void ClientConnected(unsigned int connectionCount);
     static void ClientDisconnected(unsigned int connectionCount);
+    static void FrameHeapAllocations(unsigned long long allocationCount);
+    static void ReadAheadStatistics(unsigned long long sequentialReads, unsigned long long prefetchHits);
 
 private:
     Plan9TraceLoggingProvider() = delete;
@@ -43,8 +43,30 @@ inline int sys_setgroups(size_t size, const gid_t* list)
     return syscall(SYS_setgroups, size, list);
 }
 
+inline int sys_openat2(int dirFd, const char* pathName, open_how* how)
+{
+    return syscall(__NR_openat2, dirFd, pathName, how, sizeof(*how));
+}
+
 constexpr long c_PasswordFileBufferSize = 1024;
 
+namespace {
+
+// The identity the current thread is running as, as set by FsUserContext.
+// N.B. A thread inherits the credentials of the thread that created it, so the identity of a new
+//      thread is unknown until it has been set once.
+struct ThreadIdentity
+{
+    bool Known{};
+    uid_t Uid{};
+    gid_t Gid{};
+    std::vector<gid_t> Groups;
+};
+
+thread_local ThreadIdentity t_Identity;
+
+} // namespace
+
 namespace p9fs::util {
 
 Expected<wil::unique_fd> OpenAt(int dirfd, const std::string& name, int openFlags, mode_t mode)
@@ -63,6 +85,35 @@ Expected<wil::unique_fd> OpenAt(int dirfd, const std::string& name, int openFlag
     return wil::unique_fd{fd};
 }
 
+// Opens a file relative to the specified directory, without following any symlinks and without
+// allowing the name to resolve outside of that directory.
+// N.B. If openat2 is not supported by the kernel, this falls back to openat with O_NOFOLLOW, which
+//      only guards the last component; callers should only pass single components in that case.
+Expected<wil::unique_fd> OpenBeneath(int dirfd, const std::string& name, int openFlags)
+{
+    static std::atomic<bool> s_openat2Supported{true};
+    if (s_openat2Supported.load(std::memory_order_relaxed))
+    {
+        open_how how{};
+        how.flags = openFlags | O_NOFOLLOW | O_CLOEXEC;
+        how.resolve = RESOLVE_BENEATH | RESOLVE_NO_SYMLINKS | RESOLVE_NO_MAGICLINKS;
+        int fd = sys_openat2(dirfd, name.c_str(), &how);
+        if (fd >= 0)
+        {
+            return wil::unique_fd{fd};
+        }
+
+        if (errno != ENOSYS)
+        {
+            return LxError{-errno};
+        }
+
+        s_openat2Supported.store(false, std::memory_order_relaxed);
+    }
+
+    return OpenAt(dirfd, name, openFlags | O_NOFOLLOW);
+}
+
 Expected<wil::unique_fd> Reopen(int fd, int openFlags)
 {
     const char* pathToOpen;
@@ -220,39 +271,49 @@ gid_t GetGroupIdByName(const char* name)
     return result->gr_gid;
 }
 
-// Sets the effective uid and gid of the thread to the specified values.
+// Sets the effective uid, gid and supplementary groups of the thread to the specified values.
+// An invalid uid and an empty group list select the identity of the server itself.
 FsUserContext::FsUserContext(uid_t uid, gid_t gid, const std::vector<gid_t>& groups)
 {
-    if (!groups.empty())
+    auto& current = t_Identity;
+    if (current.Known && current.Uid == uid && current.Gid == gid && current.Groups == groups)
     {
-        THROW_LAST_ERROR_IF(sys_setgroups(groups.size(), groups.data()) < 0);
-        m_restoreGroups = true;
+        return;
     }
 
-    if (uid != c_InvalidUid)
-    {
-        m_Restore = true;
-        // Use the syscall directly since the wrappers change the value on all threads.
-        // Set the GID first since the capability to do that is lost once the UID changes to non-root.
-        THROW_LAST_ERROR_IF(sys_setresgid(c_InvalidGid, gid, c_InvalidGid) < 0);
-        THROW_LAST_ERROR_IF(sys_setresuid(c_InvalidUid, uid, c_InvalidUid) < 0);
-    }
-}
+    // If this fails part way, the thread's identity is unknown and will be fully reset next time.
+    const bool restoreIds = !current.Known || current.Uid != c_InvalidUid;
+    const bool restoreGroups = !current.Known || !current.Groups.empty();
+    current.Known = false;
 
-// Restores the effective uid and gid to root.
-FsUserContext::~FsUserContext()
-{
-    if (m_Restore)
+    // Go back to root first, since changing the gid and groups requires it.
+    // N.B. Use the syscall directly since the wrappers change the value on all threads.
+    if (restoreIds)
     {
-        // Use the syscall directly since the wrappers change the value on all threads.
         THROW_LAST_ERROR_IF(sys_setresuid(-1, 0, -1) < 0);
         THROW_LAST_ERROR_IF(sys_setresgid(c_InvalidGid, 0, c_InvalidGid) < 0);
     }
 
-    if (m_restoreGroups)
+    if (!groups.empty())
+    {
+        THROW_LAST_ERROR_IF(sys_setgroups(groups.size(), groups.data()) < 0);
+    }
+    else if (restoreGroups)
     {
         THROW_LAST_ERROR_IF(sys_setgroups(0, nullptr) < 0);
     }
+
+    if (uid != c_InvalidUid)
+    {
+        // Set the GID first since the capability to do that is lost once the UID changes to non-root.
+        THROW_LAST_ERROR_IF(sys_setresgid(c_InvalidGid, gid, c_InvalidGid) < 0);
+        THROW_LAST_ERROR_IF(sys_setresuid(c_InvalidUid, uid, c_InvalidUid) < 0);
+    }
+
+    current.Uid = uid;
+    current.Gid = gid;
+    current.Groups = groups;
+    current.Known = true;
 }
 
 } // namespace p9fs::util
@@ -12,6 +12,8 @@ Expected<wil::unique_fd> Reopen(int fd, int openFlags);
 
 Expected<wil::unique_fd> OpenAt(int dirfd, const std::string& name, int openFlags, mode_t mode = 0600);
 
+Expected<wil::unique_fd> OpenBeneath(int dirfd, const std::string& name, int openFlags);
+
 std::string GetFdPath(int fd);
 
 LX_INT AccessHelper(int fd, const std::string& path, int mode);
@@ -22,16 +24,15 @@ gid_t GetUserGroupId(uid_t uid);
 
 gid_t GetGroupIdByName(const char* name);
 
-// Changes the effective uid and gid of the current thread for the lifetime of this object.
+// Changes the effective uid, gid and supplementary groups of the current thread.
+// N.B. The identity is not restored when this object is destroyed; the thread keeps it until a
+//      context for a different identity is created, so consecutive operations for the same user
+//      don't need any system calls. Because of this, every file system operation must run
+//      inside a context for the identity it should use.
 class FsUserContext final
 {
 public:
     FsUserContext(uid_t uid, gid_t gid, const std::vector<gid_t>& groups);
-    ~FsUserContext();
-
-private:
-    bool m_Restore{};
-    bool m_restoreGroups{};
 };
 
 } // namespace p9fs::util
@@ -0,0 +1,143 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+#include "precomp.h"
+#include "p9window.h"
+#include "p9fs.h"
+#include "p9tracelogging.h"
+
+namespace p9fs {
+
+// Creates a new request window. If the limit is c_AdaptiveRequestLimit, the window starts at a
+// default size and is adjusted as requests complete.
+RequestWindow::RequestWindow(size_t limit) :
+    m_Adaptive{limit == c_AdaptiveRequestLimit},
+    m_Semaphore{m_Adaptive ? c_initialAdaptiveLimit : limit},
+    m_Limit{m_Adaptive ? c_initialAdaptiveLimit : limit}
+{
+}
+
+// Waits until there is room in the window for another request.
+Task<void> RequestWindow::Acquire()
+{
+    if (m_Semaphore.TryAcquire(1))
+    {
+        co_return;
+    }
+
+    const auto start = Clock::now();
+    co_await m_Semaphore.Acquire(1);
+    if (m_Adaptive)
+    {
+        std::lock_guard<std::mutex> lock{m_Lock};
+        m_QueueDelay += Clock::now() - start;
+        ++m_QueuedSamples;
+    }
+}
+
+// Releases the window slot held by a completed request.
+void RequestWindow::Release(Clock::duration latency) noexcept
+{
+    if (!m_Adaptive)
+    {
+        m_Semaphore.Release(1);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock{m_Lock};
+        if (!m_Draining)
+        {
+            m_Latency += latency;
+            if (++m_Samples >= std::max(m_Limit, c_minimumSamples))
+            {
+                Adjust();
+            }
+
+            // If the window was shrunk, the slot is retired instead of being made available again.
+            if (m_Excess > 0)
+            {
+                --m_Excess;
+                return;
+            }
+        }
+    }
+
+    // N.B. This must be done after the lock is released, since releasing the last slot while
+    //      draining allows the window to be destroyed.
+    m_Semaphore.Release(1);
+}
+
+// Waits until all requests in the window have completed.
+Task<void> RequestWindow::Drain()
+{
+    size_t count;
+
+    {
+        std::lock_guard<std::mutex> lock{m_Lock};
+        m_Draining = true;
+        count = m_Limit + m_Excess;
+    }
+
+    co_await m_Semaphore.Acquire(count);
+}
+
+// Adjusts the window size based on the samples collected since the last adjustment.
+// N.B. The lowest average latency seen is used as the latency of an unloaded server. If the
+//      average latency rises well above that, the server is saturated and the window shrinks
+//      in proportion. Otherwise, if requests had to wait for the window, it grows. The baseline
+//      is periodically reset so it can follow changes in the workload.
+void RequestWindow::Adjust() noexcept
+{
+    const auto latency = m_Latency / static_cast<Clock::rep>(m_Samples);
+    const auto queueDelay = m_QueueDelay / static_cast<Clock::rep>(m_Samples);
+    if (m_Intervals++ % c_baselineResetInterval == 0 || latency < m_BaselineLatency)
+    {
+        m_BaselineLatency = std::max(latency, Clock::duration{1});
+    }
+
+    size_t limit = m_Limit;
+    if (latency > m_BaselineLatency * c_latencyTolerance)
+    {
+        const auto gradient = std::max(static_cast<double>(m_BaselineLatency.count()) / latency.count(), c_minimumGradient);
+        limit = std::max(static_cast<size_t>(m_Limit * gradient), c_minimumAdaptiveLimit);
+    }
+    else if (m_QueuedSamples > 0)
+    {
+        limit = std::min<size_t>(m_Limit + std::max<size_t>(std::sqrt(m_Limit), 1), c_maximumAdaptiveLimit);
+    }
+
+    if (limit > m_Limit)
+    {
+        // Cancel any pending shrink before making new slots available.
+        auto added = limit - m_Limit;
+        const auto retired = std::min(added, m_Excess);
+        m_Excess -= retired;
+        added -= retired;
+        if (added > 0)
+        {
+            m_Semaphore.Release(added);
+        }
+    }
+    else if (limit < m_Limit)
+    {
+        m_Excess += m_Limit - limit;
+    }
+
+    if (limit != m_Limit)
+    {
+        Plan9TraceLoggingProvider::LogMessage(std::format(
+            "Request window {} -> {} (latency {}us, queue delay {}us)",
+            m_Limit,
+            limit,
+            std::chrono::duration_cast<std::chrono::microseconds>(latency).count(),
+            std::chrono::duration_cast<std::chrono::microseconds>(queueDelay).count()));
+
+        m_Limit = limit;
+    }
+
+    m_Samples = 0;
+    m_QueuedSamples = 0;
+    m_Latency = {};
+    m_QueueDelay = {};
+}
+
+} // namespace p9fs
@@ -0,0 +1,50 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+#pragma once
+
+#include "p9await.h"
+
+namespace p9fs {
+
+// Limits the number of requests a connection processes concurrently.
+// The limit is either fixed, or adjusted based on the latency of completed requests and on how
+// long requests had to wait for the window to open.
+class RequestWindow final
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    RequestWindow(size_t limit);
+
+    RequestWindow(const RequestWindow&) = delete;
+    RequestWindow& operator=(const RequestWindow&) = delete;
+
+    Task<void> Acquire();
+    void Release(Clock::duration latency) noexcept;
+    Task<void> Drain();
+
+private:
+    void Adjust() noexcept;
+
+    static constexpr size_t c_initialAdaptiveLimit = 32;
+    static constexpr size_t c_minimumAdaptiveLimit = 4;
+    static constexpr size_t c_maximumAdaptiveLimit = 1024;
+    static constexpr size_t c_minimumSamples = 16;
+    static constexpr size_t c_baselineResetInterval = 64;
+    static constexpr size_t c_latencyTolerance = 2;
+    static constexpr double c_minimumGradient = 0.5;
+
+    const bool m_Adaptive;
+    AsyncSemaphore m_Semaphore;
+    std::mutex m_Lock;
+    size_t m_Limit;
+    size_t m_Excess{};
+    size_t m_Samples{};
+    size_t m_QueuedSamples{};
+    size_t m_Intervals{};
+    Clock::duration m_Latency{};
+    Clock::duration m_QueueDelay{};
+    Clock::duration m_BaselineLatency{};
+    bool m_Draining{};
+};
+
+} // namespace p9fs
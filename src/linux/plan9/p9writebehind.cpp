@@ -0,0 +1,442 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+#include "precomp.h"
+#include "p9errors.h"
+#include "p9attrcache.h"
+#include "p9writebehind.h"
+
+namespace p9fs {
+
+namespace {
+
+// The maximum amount of data buffered for each file.
+constexpr size_t c_bufferSize = 64 * 1024;
+
+// Writes at least this large are not buffered.
+constexpr size_t c_maximumBufferedWrite = 16 * 1024;
+
+// How long data can stay buffered before it is written.
+constexpr auto c_flushDelay = std::chrono::milliseconds(10);
+
+// Writes buffered data once its deadline passes. Buffers are registered when data is buffered
+// while they aren't registered yet, and unregistered by the flusher once they are empty or when
+// they are destroyed.
+// N.B. The lock is not held while buffers are flushed, so registering a buffer never waits for
+//      I/O. Buffers are taken out of the set while they are being checked.
+class Flusher
+{
+public:
+    void Register(WriteBehindBuffer& buffer)
+    {
+        std::lock_guard<std::mutex> lock{m_Lock};
+        RegisterWithLockHeld(buffer);
+    }
+
+    bool TryRegister(WriteBehindBuffer& buffer)
+    {
+        std::unique_lock<std::mutex> lock{m_Lock, std::try_to_lock};
+        if (!lock.owns_lock())
+        {
+            return false;
+        }
+
+        RegisterWithLockHeld(buffer);
+        return true;
+    }
+
+    // N.B. This waits for the flusher to finish with the buffer if it is currently flushing it, so
+    //      the buffer can't be in use by the flusher once this returns.
+    void Unregister(WriteBehindBuffer& buffer)
+    {
+        std::unique_lock<std::mutex> lock{m_Lock};
+        m_Buffers.erase(&buffer);
+        std::erase(m_Pending, &buffer);
+        if (m_Current == &buffer)
+        {
+            m_CurrentUnregistered = true;
+            m_Idle.wait(lock, [this, &buffer]() { return m_Current != &buffer; });
+        }
+    }
+
+private:
+    void RegisterWithLockHeld(WriteBehindBuffer& buffer)
+    {
+        if (!m_Started)
+        {
+            std::thread(&Flusher::Run, this).detach();
+            m_Started = true;
+        }
+
+        m_Buffers.insert(&buffer);
+        m_Condition.notify_one();
+    }
+
+    void Run()
+    {
+        std::unique_lock<std::mutex> lock{m_Lock};
+        for (;;)
+        {
+            m_Condition.wait(lock, [this]() { return !m_Buffers.empty(); });
+            m_Condition.wait_for(lock, c_flushDelay);
+            const auto now = WriteBehindBuffer::Clock::now();
+            m_Pending.assign(m_Buffers.begin(), m_Buffers.end());
+            m_Buffers.clear();
+            while (!m_Pending.empty())
+            {
+                m_Current = m_Pending.back();
+                m_Pending.pop_back();
+                lock.unlock();
+                const bool empty = m_Current->FlushIfExpired(now);
+                lock.lock();
+                if (!empty && !m_CurrentUnregistered)
+                {
+                    m_Buffers.insert(m_Current);
+                }
+
+                m_Current = nullptr;
+                m_CurrentUnregistered = false;
+                m_Idle.notify_all();
+            }
+        }
+    }
+
+    std::mutex m_Lock;
+    std::condition_variable m_Condition;
+    std::condition_variable m_Idle;
+    std::unordered_set<WriteBehindBuffer*> m_Buffers;
+    std::vector<WriteBehindBuffer*> m_Pending;
+    WriteBehindBuffer* m_Current{};
+    bool m_CurrentUnregistered{};
+    bool m_Started{};
+};
+
+// N.B. The flusher's thread is never stopped, so the flusher is intentionally leaked.
+Flusher& GetFlusher()
+{
+    static Flusher* flusher = new Flusher();
+    return *flusher;
+}
+
+struct FileKey
+{
+    dev_t Device;
+    ino_t Inode;
+
+    bool operator==(const FileKey&) const = default;
+};
+
+struct FileKeyHash
+{
+    size_t operator()(const FileKey& key) const noexcept
+    {
+        return std::hash<ino_t>{}(key.Inode) ^ (std::hash<dev_t>{}(key.Device) << 1);
+    }
+};
+
+// Files with buffers. An entry is removed when the last buffer of the file is destroyed.
+// N.B. This lock is never held while a file's lock is acquired, so looking up a file never waits
+//      for I/O.
+std::mutex g_FilesLock;
+std::unordered_map<FileKey, std::weak_ptr<WriteBehindFile>, FileKeyHash> g_Files;
+
+std::shared_ptr<WriteBehindFile> LookupFile(dev_t device, ino_t inode)
+{
+    std::lock_guard<std::mutex> lock{g_FilesLock};
+    const auto entry = g_Files.find(FileKey{device, inode});
+    if (entry == g_Files.end())
+    {
+        return {};
+    }
+
+    return entry->second.lock();
+}
+
+} // namespace
+
+// The buffers of the fids open on a file. The lock is held while they are flushed, so they can't
+// be destroyed until that is done.
+struct WriteBehindFile
+{
+    FileKey Key;
+    std::mutex Lock;
+    std::vector<WriteBehindBuffer*> Buffers;
+};
+
+WriteBehindBuffer::WriteBehindBuffer(dev_t device, ino_t inode)
+{
+    const FileKey key{device, inode};
+    {
+        std::lock_guard<std::mutex> lock{g_FilesLock};
+        auto& entry = g_Files[key];
+        m_File = entry.lock();
+        if (!m_File)
+        {
+            m_File = std::make_shared<WriteBehindFile>();
+            m_File->Key = key;
+            entry = m_File;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock{m_File->Lock};
+    m_File->Buffers.push_back(this);
+}
+
+// Writes any buffered data before the buffer is destroyed. There's no one left to report errors to
+// at this point.
+WriteBehindBuffer::~WriteBehindBuffer()
+{
+    {
+        std::lock_guard<std::mutex> lock{m_File->Lock};
+        std::erase(m_File->Buffers, this);
+    }
+
+    const auto key = m_File->Key;
+    m_File.reset();
+    {
+        std::lock_guard<std::mutex> lock{g_FilesLock};
+        const auto entry = g_Files.find(key);
+        if (entry != g_Files.end() && entry->second.expired())
+        {
+            g_Files.erase(entry);
+        }
+    }
+
+    GetFlusher().Unregister(*this);
+    std::lock_guard<std::mutex> lock{m_Lock};
+    FlushWithLockHeld();
+}
+
+// Checks whether a write of the specified size is small enough to be buffered.
+bool WriteBehindBuffer::CanBuffer(size_t size) noexcept
+{
+    return size > 0 && size < c_maximumBufferedWrite;
+}
+
+// Writes the data buffered by all the fids open on a file. Errors are kept by each buffer, to be
+// returned by the next flush of its owner.
+void WriteBehindBuffer::FlushFile(dev_t device, ino_t inode)
+{
+    const auto file = LookupFile(device, inode);
+    if (!file)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock{file->Lock};
+    for (auto* buffer : file->Buffers)
+    {
+        buffer->FlushData();
+    }
+}
+
+// Checks whether no fid open on a file has buffered data, in which case there is no need to call
+// FlushFile.
+// N.B. This doesn't wait for any lock, since it is called from the scheduler thread. If a lock is
+//      busy, the file is reported as not empty.
+bool WriteBehindBuffer::FileEmpty(dev_t device, ino_t inode)
+{
+    std::shared_ptr<WriteBehindFile> file;
+    {
+        std::unique_lock<std::mutex> lock{g_FilesLock, std::try_to_lock};
+        if (!lock.owns_lock())
+        {
+            return false;
+        }
+
+        const auto entry = g_Files.find(FileKey{device, inode});
+        if (entry == g_Files.end())
+        {
+            return true;
+        }
+
+        file = entry->second.lock();
+        if (!file)
+        {
+            return true;
+        }
+    }
+
+    std::unique_lock<std::mutex> lock{file->Lock, std::try_to_lock};
+    if (!lock.owns_lock())
+    {
+        return false;
+    }
+
+    return std::all_of(file->Buffers.begin(), file->Buffers.end(), [](auto* buffer) { return buffer->DataEmpty(); });
+}
+
+// Tries to buffer a write without waiting for any I/O, including I/O done by another thread while
+// holding one of the locks. Returns nothing if that isn't possible, in which case the caller must
+// use Write from a context where it is allowed to block.
+std::optional<Expected<UINT32>> WriteBehindBuffer::TryAppend(int fd, UINT64 offset, gsl::span<const gsl::byte> data)
+{
+    std::unique_lock<std::mutex> lock{m_Lock, std::try_to_lock};
+    if (!lock.owns_lock() || !CanBuffer(data.size()) || !RegisterWithLockHeld(false) || !AppendWithLockHeld(fd, offset, data))
+    {
+        return {};
+    }
+
+    return static_cast<UINT32>(data.size());
+}
+
+// Writes any buffered data that the write can't be appended to, and then either buffers the write
+// or writes it directly.
+// N.B. If writing the buffered data fails, the error is kept for the next flush; it doesn't belong
+//      to this write.
+Expected<UINT32> WriteBehindBuffer::Write(int fd, UINT64 offset, gsl::span<const gsl::byte> data)
+{
+    std::lock_guard<std::mutex> lock{m_Lock};
+    if (!AppendWithLockHeld(fd, offset, data))
+    {
+        FlushWithLockHeld();
+        if (!CanBuffer(data.size()))
+        {
+            const auto result = pwrite(fd, data.data(), data.size(), offset);
+            if (result < 0)
+            {
+                return LxError{-errno};
+            }
+
+            return static_cast<UINT32>(result);
+        }
+
+        AppendWithLockHeld(fd, offset, data);
+    }
+
+    RegisterWithLockHeld(true);
+    return static_cast<UINT32>(data.size());
+}
+
+// Writes any buffered data, and returns the error from this or any previous attempt to write it.
+LX_INT WriteBehindBuffer::Flush()
+{
+    std::lock_guard<std::mutex> lock{m_Lock};
+    FlushWithLockHeld();
+    return std::exchange(m_Error, 0);
+}
+
+// Writes the buffered data if it has been buffered for long enough. Returns true if the buffer is
+// now empty.
+// N.B. The memory for the buffer is released at this point, so files that are no longer being
+//      written to don't keep it.
+bool WriteBehindBuffer::FlushIfExpired(Clock::time_point now)
+{
+    std::lock_guard<std::mutex> lock{m_Lock};
+    if (m_Data.empty())
+    {
+        m_Registered = false;
+        return true;
+    }
+
+    if (now < m_Deadline)
+    {
+        return false;
+    }
+
+    FlushWithLockHeld();
+    std::vector<gsl::byte>{}.swap(m_Data);
+    m_Registered = false;
+    return true;
+}
+
+// Checks whether there is no buffered data or pending error, in which case there is no need to
+// call Flush.
+// N.B. This doesn't wait for the lock, since it is called from the scheduler thread. If the buffer
+//      is busy, it is reported as not empty.
+bool WriteBehindBuffer::Empty()
+{
+    std::unique_lock<std::mutex> lock{m_Lock, std::try_to_lock};
+    return lock.owns_lock() && m_Data.empty() && m_Error == 0;
+}
+
+// Writes any buffered data, keeping any error for the next flush.
+void WriteBehindBuffer::FlushData()
+{
+    std::lock_guard<std::mutex> lock{m_Lock};
+    FlushWithLockHeld();
+}
+
+// Checks whether there is no buffered data, without waiting for the lock.
+bool WriteBehindBuffer::DataEmpty()
+{
+    std::unique_lock<std::mutex> lock{m_Lock, std::try_to_lock};
+    return lock.owns_lock() && m_Data.empty();
+}
+
+// Appends the write to the buffered data if it is small enough, contiguous with it, and fits.
+bool WriteBehindBuffer::AppendWithLockHeld(int fd, UINT64 offset, gsl::span<const gsl::byte> data)
+{
+    if (!CanBuffer(data.size()))
+    {
+        return false;
+    }
+
+    if (m_Data.empty())
+    {
+        m_Data.reserve(c_bufferSize);
+        m_Fd = fd;
+        m_Offset = offset;
+        m_Deadline = Clock::now() + c_flushDelay;
+    }
+    else if (fd != m_Fd || offset != m_Offset + m_Data.size() || m_Data.size() + data.size() > c_bufferSize)
+    {
+        return false;
+    }
+
+    m_Data.insert(m_Data.end(), data.begin(), data.end());
+    return true;
+}
+
+// Makes sure the flusher will check the buffer. If wait is false, this fails instead of waiting
+// for the flusher's lock.
+bool WriteBehindBuffer::RegisterWithLockHeld(bool wait)
+{
+    if (m_Registered)
+    {
+        return true;
+    }
+
+    if (wait)
+    {
+        GetFlusher().Register(*this);
+    }
+    else if (!GetFlusher().TryRegister(*this))
+    {
+        return false;
+    }
+
+    m_Registered = true;
+    return true;
+}
+
+// Writes the buffered data. If that fails, the error is kept to be returned later, and the data
+// is discarded.
+LX_INT WriteBehindBuffer::FlushWithLockHeld() noexcept
+{
+    size_t written = 0;
+    while (written < m_Data.size())
+    {
+        const auto result = pwrite(m_Fd, m_Data.data() + written, m_Data.size() - written, m_Offset + written);
+        if (result < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            m_Error = -errno;
+            break;
+        }
+
+        written += result;
+    }
+
+    if (!m_Data.empty())
+    {
+        m_Data.clear();
+        AttributeCache::Invalidate();
+    }
+
+    return m_Error;
+}
+
+} // namespace p9fs
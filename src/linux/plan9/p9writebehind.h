@@ -0,0 +1,58 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+#pragma once
+
+namespace p9fs {
+
+struct WriteBehindFile;
+
+// Buffers small contiguous writes to an open file, so they can be written with a single system
+// call. Buffered data is written when a write isn't contiguous with it or doesn't fit, when the
+// owner flushes it (e.g. for fsync, clunk, reads and attribute queries), or shortly after the
+// first write was buffered.
+// N.B. Errors writing buffered data can't be returned to the write that buffered it, so they are
+//      kept and returned by the next flush (e.g. fsync or clunk), like deferred write-back errors
+//      on Linux. Later writes are unaffected by them.
+// N.B. The buffers of all the fids open on a file are tracked by the file's device and inode, so
+//      reads and attribute queries through any fid can write them first.
+class WriteBehindBuffer final
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    WriteBehindBuffer(dev_t device, ino_t inode);
+    ~WriteBehindBuffer();
+
+    WriteBehindBuffer(const WriteBehindBuffer&) = delete;
+    WriteBehindBuffer& operator=(const WriteBehindBuffer&) = delete;
+
+    static bool CanBuffer(size_t size) noexcept;
+    static void FlushFile(dev_t device, ino_t inode);
+    static bool FileEmpty(dev_t device, ino_t inode);
+
+    std::optional<Expected<UINT32>> TryAppend(int fd, UINT64 offset, gsl::span<const gsl::byte> data);
+    Expected<UINT32> Write(int fd, UINT64 offset, gsl::span<const gsl::byte> data);
+    LX_INT Flush();
+    bool FlushIfExpired(Clock::time_point now);
+    bool Empty();
+
+private:
+    bool AppendWithLockHeld(int fd, UINT64 offset, gsl::span<const gsl::byte> data);
+    bool RegisterWithLockHeld(bool wait);
+    LX_INT FlushWithLockHeld() noexcept;
+    void FlushData();
+    bool DataEmpty();
+
+    std::shared_ptr<WriteBehindFile> m_File;
+    std::mutex m_Lock;
+    std::vector<gsl::byte> m_Data;
+    UINT64 m_Offset{};
+    int m_Fd{-1};
+    LX_INT m_Error{};
+    Clock::time_point m_Deadline;
+
+    // Whether the flusher will check this buffer again. Cleared by the flusher when it finds the
+    // buffer empty.
+    bool m_Registered{};
+};
+
+} // namespace p9fs
@@ -3,11 +3,25 @@
 #include "p9file.h"
 #include "p9xattr.h"
 #include "p9util.h"
+#include "p9attrcache.h"
 
 namespace p9fs {
 
-XAttr::XAttr(const std::shared_ptr<const Root>& root, const std::string& fileName, const std::string& name, Access access, UINT64 size, UINT32 flags) :
-    m_Root{root}, m_FileName{fileName}, m_Name{name}, m_Value{size}, m_Access{access}, m_Flags{flags}
+XAttr::XAttr(
+    const std::shared_ptr<const Root>& root,
+    const std::string& fileName,
+    const std::string& name,
+    Access access,
+    const XAttrFileVersion& version,
+    UINT64 size,
+    UINT32 flags) :
+    m_Root{root}, m_FileName{fileName}, m_Name{name}, m_Value{size}, m_Access{access}, m_Version{version}, m_Flags{flags}
+{
+}
+
+// Creates a read fid for a value retrieved from the cache, which doesn't need the file name.
+XAttr::XAttr(const std::shared_ptr<const Root>& root, const std::string& name, std::vector<gsl::byte>&& value) :
+    m_Root{root}, m_Name{name}, m_Value{std::move(value)}, m_Access{Access::Read}, m_Flags{}, m_Loaded{true}
 {
 }
 
@@ -21,6 +35,18 @@ Task<Expected<UINT32>> XAttr::Read(UINT64 offset, gsl::span<gsl::byte> buffer)
         co_return LxError{LX_EINVAL};
     }
 
+    if (m_Loaded)
+    {
+        std::shared_lock<std::shared_mutex> lock{m_Lock};
+        if (buffer.size() < m_Value.size())
+        {
+            co_return LxError{LX_ERANGE};
+        }
+
+        gsl::copy(gsl::make_span(m_Value), buffer);
+        co_return static_cast<UINT32>(m_Value.size());
+    }
+
     auto result = GetValue(buffer);
     if (!result)
     {
@@ -66,7 +92,13 @@ LX_INT XAttr::Clunk()
     }
 
     // Make sure in-flight write operations are finished.
+    const auto invalidateAttributes = wil::scope_exit([this] {
+        AttributeCache::Invalidate();
+        XAttrCache::Invalidate(m_Version.Device, m_Version.Inode);
+    });
+
     std::shared_lock<std::shared_mutex> lock{m_Lock};
+    util::FsUserContext userContext{m_Root->Uid, m_Root->Gid, m_Root->Groups};
 
     // Remove the xattr if its size is 0; otherwise, set the value.
     // N.B. Plan 9 does not support xattrs with zero-length values.
@@ -92,9 +124,55 @@ LX_INT XAttr::Clunk()
 
 Expected<UINT64> XAttr::GetSize()
 {
+    if (m_Access == Access::Read)
+    {
+        return Load();
+    }
+
     return GetValue({});
 }
 
+// Retrieves the value, or the list of names, with a buffer large enough for most values so the
+// size and the value are retrieved with a single call. Small values, and attributes that don't
+// exist, are added to the cache.
+Expected<UINT64> XAttr::Load()
+{
+    std::lock_guard<std::shared_mutex> lock{m_Lock};
+    if (m_Loaded)
+    {
+        return m_Value.size();
+    }
+
+    XAttrValue value;
+    value.Data.resize(XAttrCache::MaximumValueSize);
+    auto result = GetValue(value.Data);
+    if (!result)
+    {
+        // N.B. Other errors may be transient, or caused by the caller's access to the file.
+        if (result.Error() == LX_ENODATA || result.Error() == LX_EOPNOTSUPP)
+        {
+            value.Error = result.Error();
+            value.Data.clear();
+            XAttrCache::Insert(m_Version, m_Name, value);
+        }
+
+        // The value is too large for the buffer, so only retrieve the size and let the read
+        // retrieve the value.
+        if (result.Error() == LX_ERANGE)
+        {
+            return GetValue({});
+        }
+
+        return result;
+    }
+
+    value.Data.resize(result.Get());
+    XAttrCache::Insert(m_Version, m_Name, value);
+    m_Value = std::move(value.Data);
+    m_Loaded = true;
+    return m_Value.size();
+}
+
 Expected<UINT64> XAttr::GetValue(gsl::span<gsl::byte> buffer)
 {
     util::FsUserContext userContext{m_Root->Uid, m_Root->Gid, m_Root->Groups};
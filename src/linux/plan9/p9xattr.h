@@ -2,6 +2,7 @@
 #pragma once
 
 #include "p9fid.h"
+#include "p9xattrcache.h"
 
 namespace p9fs {
 
@@ -14,7 +15,16 @@ public:
         Write
     };
 
-    XAttr(const std::shared_ptr<const Root>& root, const std::string& fileName, const std::string& name, Access access, UINT64 size = 0, UINT32 flags = 0);
+    XAttr(
+        const std::shared_ptr<const Root>& root,
+        const std::string& fileName,
+        const std::string& name,
+        Access access,
+        const XAttrFileVersion& version,
+        UINT64 size = 0,
+        UINT32 flags = 0);
+
+    XAttr(const std::shared_ptr<const Root>& root, const std::string& name, std::vector<gsl::byte>&& value);
 
     Task<Expected<UINT32>> Read(UINT64 Offset, gsl::span<gsl::byte> Buffer) override;
     Task<Expected<UINT32>> Write(UINT64 Offset, gsl::span<const gsl::byte> Buffer) override;
@@ -24,6 +34,7 @@ public:
 
 private:
     Expected<UINT64> GetValue(gsl::span<gsl::byte> Buffer);
+    Expected<UINT64> Load();
 
     std::shared_mutex m_Lock;
     const std::shared_ptr<const Root> m_Root;
@@ -31,7 +42,12 @@ private:
     const std::string m_Name;
     std::vector<gsl::byte> m_Value;
     const Access m_Access;
+    const XAttrFileVersion m_Version;
     const UINT32 m_Flags;
+
+    // Set if m_Value holds the complete value for a read, either from the cache or because it was
+    // small enough to retrieve together with its size.
+    bool m_Loaded{};
 };
 
 } // namespace p9fs
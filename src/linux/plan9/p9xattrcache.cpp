@@ -0,0 +1,144 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+#include "precomp.h"
+#include "p9xattrcache.h"
+
+namespace p9fs {
+
+namespace {
+
+// Maximum number of files, and total size of the values, in the cache. When either is exceeded,
+// the cache is cleared before adding more.
+constexpr size_t c_maximumFiles = 4096;
+constexpr size_t c_maximumBytes = 4 * 1024 * 1024;
+
+// Values of files whose change time is this recent are not cached, since another change in the
+// same clock tick would not update the change time.
+constexpr auto c_changeTimeGranularity = std::chrono::seconds(2);
+
+struct CacheKey
+{
+    dev_t Device;
+    ino_t Inode;
+
+    bool operator==(const CacheKey&) const = default;
+};
+
+struct CacheKeyHash
+{
+    size_t operator()(const CacheKey& key) const noexcept
+    {
+        return std::hash<ino_t>{}(key.Inode) ^ (std::hash<dev_t>{}(key.Device) << 1);
+    }
+};
+
+// The values of a file are keyed by the user they were retrieved as, and the attribute name.
+using ValueKey = std::tuple<uid_t, gid_t, std::string>;
+
+struct CacheEntry
+{
+    struct statx_timestamp ChangeTime;
+    std::map<ValueKey, XAttrValue> Values;
+};
+
+bool IsSameTime(const struct statx_timestamp& left, const struct statx_timestamp& right) noexcept
+{
+    return left.tv_sec == right.tv_sec && left.tv_nsec == right.tv_nsec;
+}
+
+// Checks whether a file could still be changed without its change time being updated.
+bool IsRecent(const struct statx_timestamp& changeTime) noexcept
+{
+    timespec now{};
+    if (clock_gettime(CLOCK_REALTIME_COARSE, &now) < 0)
+    {
+        return true;
+    }
+
+    return changeTime.tv_sec + c_changeTimeGranularity.count() >= now.tv_sec;
+}
+
+std::atomic<UINT64> g_Generation;
+std::mutex g_Lock;
+size_t g_Bytes;
+std::unordered_map<CacheKey, CacheEntry, CacheKeyHash> g_Entries;
+
+} // namespace
+
+// Gets the current generation of the cache. Attributes must be retrieved after getting the
+// generation, and inserted with it, so invalidations made concurrently with retrieving them are
+// not missed.
+UINT64 XAttrCache::Generation() noexcept
+{
+    return g_Generation.load(std::memory_order_acquire);
+}
+
+// Adds the value of an extended attribute to the cache, unless it's too large, the file changed
+// too recently, or the cache was invalidated since the value was retrieved.
+void XAttrCache::Insert(const XAttrFileVersion& version, const std::string& name, const XAttrValue& value)
+{
+    if (value.Data.size() > MaximumValueSize || IsRecent(version.ChangeTime))
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock{g_Lock};
+    if (version.Generation != Generation())
+    {
+        return;
+    }
+
+    if (g_Entries.size() >= c_maximumFiles || g_Bytes + name.size() + value.Data.size() > c_maximumBytes)
+    {
+        g_Entries.clear();
+        g_Bytes = 0;
+    }
+
+    auto& entry = g_Entries[{version.Device, version.Inode}];
+    if (!IsSameTime(entry.ChangeTime, version.ChangeTime))
+    {
+        entry.ChangeTime = version.ChangeTime;
+        entry.Values.clear();
+    }
+
+    // N.B. The size of a replaced value is not subtracted, so the total size may be overestimated
+    //      until the cache is cleared.
+    entry.Values.insert_or_assign(ValueKey{version.Uid, version.Gid, name}, value);
+    g_Bytes += name.size() + value.Data.size();
+}
+
+// Retrieves the cached value of an extended attribute, if the file hasn't changed since it was
+// retrieved.
+std::optional<XAttrValue> XAttrCache::Lookup(const XAttrFileVersion& version, const std::string& name)
+{
+    std::lock_guard<std::mutex> lock{g_Lock};
+    const auto entry = g_Entries.find({version.Device, version.Inode});
+    if (entry == g_Entries.end())
+    {
+        return {};
+    }
+
+    if (!IsSameTime(entry->second.ChangeTime, version.ChangeTime))
+    {
+        g_Entries.erase(entry);
+        return {};
+    }
+
+    const auto value = entry->second.Values.find(ValueKey{version.Uid, version.Gid, name});
+    if (value == entry->second.Values.end())
+    {
+        return {};
+    }
+
+    return value->second;
+}
+
+// Invalidates the cached attributes of a file. This must be called after every operation that may
+// change a file's extended attributes, including changing its mode or owner.
+void XAttrCache::Invalidate(dev_t device, ino_t inode) noexcept
+{
+    g_Generation.fetch_add(1, std::memory_order_acq_rel);
+    std::lock_guard<std::mutex> lock{g_Lock};
+    g_Entries.erase({device, inode});
+}
+
+} // namespace p9fs
@@ -0,0 +1,50 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+#pragma once
+
+namespace p9fs {
+
+// Identifies the version of a file that extended attributes were retrieved from. Cached values are
+// only used while the file's change time is the same, since changing an extended attribute updates
+// the change time.
+// N.B. Values are retrieved with the credentials of the share's user, which may determine whether
+//      they can be read, so they are cached separately for each user.
+struct XAttrFileVersion
+{
+    dev_t Device{};
+    ino_t Inode{};
+    uid_t Uid{};
+    gid_t Gid{};
+    struct statx_timestamp ChangeTime{};
+    UINT64 Generation{};
+};
+
+// The result of retrieving an extended attribute, or the list of extended attribute names if the
+// name is empty.
+struct XAttrValue
+{
+    LX_INT Error{};
+    std::vector<gsl::byte> Data;
+};
+
+// A bounded cache of small extended attribute values and name lists, including attributes that
+// don't exist, so clients that probe the same attributes on every file (like the security and ACL
+// attributes checked by ls and cp) don't need to resolve the file's path twice for each probe.
+// N.B. Operations through the server that may change a file's extended attributes invalidate the
+//      cached attributes for that file. Changes made by other processes are detected by the file's
+//      change time.
+class XAttrCache final
+{
+public:
+    // Values larger than this are not cached.
+    static constexpr size_t MaximumValueSize = 4096;
+
+    static UINT64 Generation() noexcept;
+    static void Insert(const XAttrFileVersion& version, const std::string& name, const XAttrValue& value);
+    static std::optional<XAttrValue> Lookup(const XAttrFileVersion& version, const std::string& name);
+    static void Invalidate(dev_t device, ino_t inode) noexcept;
+
+private:
+    XAttrCache() = delete;
+};
+
+} // namespace p9fs
@@ -3,6 +3,7 @@
 
 #include <sys/time.h>
 #include <sys/epoll.h>
+#include <poll.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
@@ -17,27 +18,41 @@
 #include <unistd.h>
 #include <dirent.h>
 #include <sys/uio.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <linux/io_uring.h>
+#include <linux/openat2.h>
 
 // C standard library
 #include <cstdint>
 #include <cstdio>
+#include <cmath>
 #include <cwctype>
 
 // C++ standard library
 #include <exception>
+#include <array>
 #include <vector>
 #include <queue>
+#include <deque>
 #include <list>
 #include <map>
+#include <unordered_map>
+#include <unordered_set>
 #include <variant>
 #include <optional>
 #include <chrono>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
 #include <shared_mutex>
 #include <atomic>
+#include <bit>
 #include <string>
 #include <string_view>
+#include <format>
 #include <filesystem>
 
 // Guideline Support Library
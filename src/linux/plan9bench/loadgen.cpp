@@ -0,0 +1,779 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+#include "precomp.h"
+#include <random>
+#include "p9defs.h"
+#include "p9protohelpers.h"
+#include "p9fs.h"
+#include "p9stats.h"
+#include "loadgen.h"
+
+using namespace p9fs;
+
+namespace p9bench {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// The message size requested from the server; the server may negotiate a smaller one.
+constexpr UINT32 c_messageSize = 1024 * 1024;
+
+constexpr UINT16 c_noTag = 0xffff;
+constexpr UINT32 c_rootFid = 0;
+
+// The attributes a Linux client asks for on stat.
+constexpr UINT64 c_getAttrMask = GetAttrMode | GetAttrNlink | GetAttrUid | GetAttrGid | GetAttrRdev | GetAttrAtime |
+                                 GetAttrMtime | GetAttrCtime | GetAttrIno | GetAttrSize | GetAttrBlocks;
+
+// The directories created on the share. Files in each directory are named "f0", "f1", etc.
+constexpr const char* c_filesDirectory = "files";
+constexpr const char* c_listDirectory = "dir";
+constexpr const char* c_dataDirectory = "data";
+constexpr const char* c_outputDirectory = "out";
+
+// The individual requests a mix is made of.
+enum class Step
+{
+    WalkFile,
+    WalkDataFile,
+    WalkListDirectory,
+    WalkOutputDirectory,
+    Open,
+    OpenDirectory,
+    CreateOutput,
+    GetAttr,
+    ReadDir,
+    Read,
+    Write,
+    Clunk
+};
+
+struct MixDefinition
+{
+    Mix Mix;
+    const char* Name;
+
+    // Steps that are run once by each slot before the measurement starts.
+    std::vector<Step> Setup;
+
+    // Steps that are repeated by each slot while measuring.
+    std::vector<Step> Steps;
+
+    UINT32 BlockSize;
+    bool Random;
+};
+
+const MixDefinition c_mixes[] = {
+    {Mix::Walk, "walk", {}, {Step::WalkFile, Step::Clunk}, 0, true},
+    {Mix::GetAttr, "getattr", {Step::WalkFile}, {Step::GetAttr}, 0, true},
+    {Mix::Metadata, "metadata", {}, {Step::WalkFile, Step::GetAttr, Step::Clunk}, 0, true},
+    {Mix::ReadDir, "readdir", {}, {Step::WalkListDirectory, Step::OpenDirectory, Step::ReadDir, Step::Clunk}, 0, false},
+    {Mix::Churn, "churn", {}, {Step::WalkFile, Step::Open, Step::Clunk}, 0, true},
+    {Mix::SeqRead, "seqread", {Step::WalkDataFile, Step::Open}, {Step::Read}, 64 * 1024, false},
+    {Mix::RandRead, "randread", {Step::WalkDataFile, Step::Open}, {Step::Read}, 4 * 1024, true},
+    {Mix::SeqWrite, "seqwrite", {Step::WalkOutputDirectory, Step::CreateOutput}, {Step::Write}, 64 * 1024, false},
+    {Mix::RandWrite, "randwrite", {Step::WalkOutputDirectory, Step::CreateOutput}, {Step::Write}, 4 * 1024, true},
+    {Mix::Append, "append", {Step::WalkOutputDirectory, Step::CreateOutput}, {Step::Write}, 128, false}};
+
+const MixDefinition& GetMixDefinition(Mix mix)
+{
+    const auto* definition = std::find_if(std::begin(c_mixes), std::end(c_mixes), [mix](const auto& entry) { return entry.Mix == mix; });
+    FAIL_FAST_IF(definition == std::end(c_mixes));
+    return *definition;
+}
+
+std::string FileName(unsigned int index)
+{
+    return "f" + std::to_string(index);
+}
+
+// The state of one sequence of requests on a connection. Each slot uses its own tag and fid, so
+// all slots can have a request outstanding at the same time.
+struct Slot
+{
+    unsigned int Index{};
+    UINT16 Tag{};
+    UINT32 Fid{};
+    size_t Step{};
+    MessageType Type{};
+    Clock::time_point Start;
+    UINT64 Offset{};
+    UINT32 Transferred{};
+    bool Repeat{};
+    std::minstd_rand Random;
+};
+
+// A connection to the server that issues the requests for a number of slots.
+class Client
+{
+public:
+    Client(const std::string& socketPath, unsigned int index, const ShareOptions& share, const RunOptions& options, const MixDefinition& mix) :
+        m_SocketPath{socketPath}, m_Share{share}, m_Options{options}, m_Mix{mix}, m_Slots(options.Depth)
+    {
+        for (unsigned int i = 0; i < options.Depth; ++i)
+        {
+            auto& slot = m_Slots[i];
+            slot.Index = (index * options.Depth) + i;
+            slot.Tag = static_cast<UINT16>(i + 1);
+            slot.Fid = i + 1;
+            slot.Random.seed(slot.Index + 1);
+        }
+    }
+
+    Client(const Client&) = delete;
+    Client& operator=(const Client&) = delete;
+
+    // Connects to the server, negotiates the protocol and runs the setup steps of the mix.
+    void Connect()
+    {
+        m_Socket.reset(socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+        THROW_LAST_ERROR_IF(!m_Socket);
+
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        THROW_ERRNO_IF(ENAMETOOLONG, m_SocketPath.size() >= sizeof(address.sun_path));
+        m_SocketPath.copy(address.sun_path, m_SocketPath.size());
+        THROW_LAST_ERROR_IF(connect(m_Socket.get(), reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0);
+
+        m_Scratch.resize(c_messageSize);
+        {
+            SpanWriter writer{m_Scratch};
+            writer.Next(HeaderSize);
+            writer.U32(c_messageSize);
+            writer.String(ProtocolVersionL);
+            writer.Header(MessageType::Tversion, c_noTag);
+            auto reply = Transact(writer, MessageType::Tversion);
+            SpanReader reader{reply};
+            reader.Read(HeaderSize);
+            m_MessageSize = std::min(reader.U32(), c_messageSize);
+            THROW_ERRNO_IF(EPROTONOSUPPORT, reader.String() != ProtocolVersionL);
+        }
+
+        {
+            SpanWriter writer{m_Scratch};
+            writer.Next(HeaderSize);
+            writer.U32(c_rootFid);
+            writer.U32(NoFid);
+            writer.String("");
+            writer.String("");
+            writer.U32(geteuid());
+            writer.Header(MessageType::Tattach, 1);
+            Transact(writer, MessageType::Tattach);
+        }
+
+        m_BlockSize = std::min(m_Options.BlockSize, m_MessageSize - IoHeaderSize);
+        m_Data.resize(m_BlockSize, gsl::byte{'x'});
+        Drive(true, Clock::time_point::max());
+    }
+
+    // Issues requests until the deadline, recording the latency of each one that completes before
+    // the deadline.
+    void Run(Clock::time_point deadline)
+    {
+        m_Latencies.reserve(1024 * 1024);
+        Drive(false, deadline);
+    }
+
+    UINT64 Operations() const
+    {
+        return m_Operations;
+    }
+
+    UINT64 Errors() const
+    {
+        return m_Errors;
+    }
+
+    UINT64 Bytes() const
+    {
+        return m_Bytes;
+    }
+
+    const std::vector<UINT32>& Latencies() const
+    {
+        return m_Latencies;
+    }
+
+private:
+    // Runs the setup or measured steps of the mix on all slots.
+    void Drive(bool setup, Clock::time_point deadline)
+    {
+        const auto& steps = setup ? m_Mix.Setup : m_Mix.Steps;
+        if (steps.empty())
+        {
+            return;
+        }
+
+        for (auto& slot : m_Slots)
+        {
+            slot.Step = 0;
+            Issue(slot, steps[0]);
+        }
+
+        size_t active = m_Slots.size();
+        while (active > 0)
+        {
+            Pump([&](gsl::span<const gsl::byte> message) {
+                SpanReader reader{message};
+                reader.U32();
+                const auto type = static_cast<MessageType>(reader.U8());
+                const auto tag = reader.U16();
+                THROW_ERRNO_IF(EPROTO, tag == 0 || tag > m_Slots.size());
+
+                const auto now = Clock::now();
+                auto& slot = m_Slots[tag - 1];
+                const auto error = Complete(slot, steps[slot.Step], type, reader);
+                if (setup)
+                {
+                    THROW_ERRNO_IF(-error, error != 0);
+                }
+                else if (now <= deadline)
+                {
+                    m_Operations += 1;
+                    m_Bytes += slot.Transferred;
+                    if (error != 0)
+                    {
+                        m_Errors += 1;
+                    }
+
+                    const auto latency = std::chrono::duration_cast<std::chrono::nanoseconds>(now - slot.Start).count();
+                    m_Latencies.push_back(static_cast<UINT32>(std::min<INT64>(latency, UINT32_MAX)));
+                }
+
+                if (!slot.Repeat)
+                {
+                    slot.Step += 1;
+                }
+
+                if (slot.Step == steps.size())
+                {
+                    if (setup)
+                    {
+                        active -= 1;
+                        return;
+                    }
+
+                    slot.Step = 0;
+                }
+
+                if (now >= deadline)
+                {
+                    active -= 1;
+                    return;
+                }
+
+                Issue(slot, steps[slot.Step]);
+            });
+        }
+    }
+
+    // Queues the request for the next step of a slot.
+    void Issue(Slot& slot, Step step)
+    {
+        SpanWriter writer{m_Scratch};
+        writer.Next(HeaderSize);
+        switch (step)
+        {
+        case Step::WalkFile:
+            slot.Type = MessageType::Twalk;
+            writer.U32(c_rootFid);
+            writer.U32(slot.Fid);
+            writer.U16(2);
+            writer.String(c_filesDirectory);
+            writer.String(FileName(slot.Random() % std::max(m_Share.Files, 1u)));
+            break;
+
+        case Step::WalkDataFile:
+            slot.Type = MessageType::Twalk;
+            writer.U32(c_rootFid);
+            writer.U32(slot.Fid);
+            writer.U16(2);
+            writer.String(c_dataDirectory);
+            writer.String(FileName(slot.Index % std::max(m_Share.DataFiles, 1u)));
+            break;
+
+        case Step::WalkListDirectory:
+        case Step::WalkOutputDirectory:
+            slot.Type = MessageType::Twalk;
+            writer.U32(c_rootFid);
+            writer.U32(slot.Fid);
+            writer.U16(1);
+            writer.String(step == Step::WalkListDirectory ? c_listDirectory : c_outputDirectory);
+            break;
+
+        case Step::Open:
+        case Step::OpenDirectory:
+            slot.Type = MessageType::Tlopen;
+            writer.U32(slot.Fid);
+            writer.U32(static_cast<UINT32>(step == Step::OpenDirectory ? OpenFlags::Directory : OpenFlags::ReadOnly));
+            break;
+
+        case Step::CreateOutput:
+            slot.Type = MessageType::Tlcreate;
+            writer.U32(slot.Fid);
+            writer.String(FileName(slot.Index));
+            writer.U32(static_cast<UINT32>(OpenFlags::ReadWrite | OpenFlags::Truncate));
+            writer.U32(0644);
+            writer.U32(getegid());
+            break;
+
+        case Step::GetAttr:
+            slot.Type = MessageType::Tgetattr;
+            writer.U32(slot.Fid);
+            writer.U64(c_getAttrMask);
+            break;
+
+        case Step::ReadDir:
+            slot.Type = MessageType::Treaddir;
+            writer.U32(slot.Fid);
+            writer.U64(slot.Offset);
+            writer.U32(m_MessageSize - IoHeaderSize);
+            break;
+
+        case Step::Read:
+        case Step::Write:
+            if (m_Mix.Random)
+            {
+                slot.Offset = (slot.Random() % std::max<UINT64>(m_Share.FileSize / m_BlockSize, 1)) * m_BlockSize;
+            }
+
+            slot.Type = step == Step::Read ? MessageType::Tread : MessageType::Twrite;
+            writer.U32(slot.Fid);
+            writer.U64(slot.Offset);
+            writer.U32(m_BlockSize);
+            if (step == Step::Write)
+            {
+                writer.Write(m_Data);
+            }
+
+            break;
+
+        case Step::Clunk:
+            slot.Type = MessageType::Tclunk;
+            writer.U32(slot.Fid);
+            break;
+
+        default:
+            FAIL_FAST();
+        }
+
+        writer.Header(slot.Type, slot.Tag);
+        const auto message = writer.Result();
+        m_Send.insert(m_Send.end(), message.begin(), message.end());
+        slot.Start = Clock::now();
+    }
+
+    // Processes the reply for a step, and returns the error if it failed.
+    LX_INT Complete(Slot& slot, Step step, MessageType type, SpanReader& reader)
+    {
+        slot.Transferred = 0;
+        slot.Repeat = false;
+        if (type == MessageType::Rlerror)
+        {
+            slot.Offset = 0;
+            return -static_cast<LX_INT>(reader.U32());
+        }
+
+        if (static_cast<UINT8>(type) != static_cast<UINT8>(slot.Type) + 1)
+        {
+            return LX_EPROTO;
+        }
+
+        switch (step)
+        {
+        case Step::WalkFile:
+        case Step::WalkDataFile:
+            return reader.U16() == 2 ? 0 : LX_ENOENT;
+
+        case Step::WalkListDirectory:
+        case Step::WalkOutputDirectory:
+            return reader.U16() == 1 ? 0 : LX_ENOENT;
+
+        case Step::ReadDir:
+        {
+            // Keep reading until the end of the directory.
+            const auto count = reader.U32();
+            slot.Transferred = count;
+            if (count == 0)
+            {
+                slot.Offset = 0;
+                break;
+            }
+
+            SpanReader entries{reader.Read(count)};
+            for (auto entry = entries.TryDirectoryEntry(); entry.Success; entry = entries.TryDirectoryEntry())
+            {
+                slot.Offset = entry.Result.Offset;
+            }
+
+            slot.Repeat = true;
+            break;
+        }
+
+        case Step::Read:
+        case Step::Write:
+            slot.Transferred = reader.U32();
+            if (!m_Mix.Random)
+            {
+                slot.Offset += m_BlockSize;
+                if (slot.Transferred == 0 || slot.Offset + m_BlockSize > m_Share.FileSize)
+                {
+                    slot.Offset = 0;
+                }
+            }
+
+            break;
+
+        default:
+            break;
+        }
+
+        return 0;
+    }
+
+    // Sends a request and waits for its reply. Only used before any slot is active.
+    std::vector<gsl::byte> Transact(SpanWriter& writer, MessageType requestType)
+    {
+        const auto message = writer.Result();
+        m_Send.insert(m_Send.end(), message.begin(), message.end());
+
+        std::vector<gsl::byte> reply;
+        while (reply.empty())
+        {
+            Pump([&](gsl::span<const gsl::byte> message) { reply.assign(message.begin(), message.end()); });
+        }
+
+        SpanReader reader{reply};
+        reader.U32();
+        const auto type = static_cast<MessageType>(reader.U8());
+        if (type == MessageType::Rlerror)
+        {
+            reader.U16();
+            THROW_ERRNO(reader.U32());
+        }
+
+        THROW_ERRNO_IF(EPROTO, static_cast<UINT8>(type) != static_cast<UINT8>(requestType) + 1);
+        return reply;
+    }
+
+    // Waits until the socket is ready, sends as much of the queued requests as possible and calls
+    // the callback for each complete reply received.
+    template <typename Callback>
+    void Pump(const Callback& callback)
+    {
+        pollfd pollFd{m_Socket.get(), POLLIN, 0};
+        if (m_SendOffset < m_Send.size())
+        {
+            pollFd.events |= POLLOUT;
+        }
+
+        if (poll(&pollFd, 1, -1) < 0)
+        {
+            THROW_LAST_ERROR_IF(errno != EINTR);
+            return;
+        }
+
+        if (WI_IsFlagSet(pollFd.revents, POLLOUT))
+        {
+            const auto result = send(m_Socket.get(), m_Send.data() + m_SendOffset, m_Send.size() - m_SendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (result < 0)
+            {
+                THROW_LAST_ERROR_IF(errno != EAGAIN && errno != EINTR);
+            }
+            else
+            {
+                m_SendOffset += result;
+                if (m_SendOffset == m_Send.size())
+                {
+                    m_Send.clear();
+                    m_SendOffset = 0;
+                }
+            }
+        }
+
+        if (WI_IsAnyFlagSet(pollFd.revents, POLLIN | POLLHUP | POLLERR))
+        {
+            if (m_Receive.size() - m_ReceiveSize < m_MessageSize)
+            {
+                m_Receive.resize(m_ReceiveSize + m_MessageSize);
+            }
+
+            const auto result = recv(m_Socket.get(), m_Receive.data() + m_ReceiveSize, m_Receive.size() - m_ReceiveSize, MSG_DONTWAIT);
+            if (result < 0)
+            {
+                THROW_LAST_ERROR_IF(errno != EAGAIN && errno != EINTR);
+                return;
+            }
+
+            THROW_ERRNO_IF(ECONNRESET, result == 0);
+            m_ReceiveSize += result;
+            size_t offset = 0;
+            while (m_ReceiveSize - offset >= HeaderSize)
+            {
+                UINT32 size;
+                memcpy(&size, m_Receive.data() + offset, sizeof(size));
+                THROW_ERRNO_IF(EPROTO, size < HeaderSize);
+                if (m_ReceiveSize - offset < size)
+                {
+                    break;
+                }
+
+                callback(gsl::span<const gsl::byte>{m_Receive.data() + offset, size});
+                offset += size;
+            }
+
+            memmove(m_Receive.data(), m_Receive.data() + offset, m_ReceiveSize - offset);
+            m_ReceiveSize -= offset;
+        }
+    }
+
+    std::string m_SocketPath;
+    const ShareOptions& m_Share;
+    const RunOptions& m_Options;
+    const MixDefinition& m_Mix;
+    wil::unique_fd m_Socket;
+    UINT32 m_MessageSize{c_messageSize};
+    UINT32 m_BlockSize{};
+    std::vector<Slot> m_Slots;
+    std::vector<gsl::byte> m_Scratch;
+    std::vector<gsl::byte> m_Data;
+    std::vector<gsl::byte> m_Send;
+    size_t m_SendOffset{};
+    std::vector<gsl::byte> m_Receive;
+    size_t m_ReceiveSize{};
+    UINT64 m_Operations{};
+    UINT64 m_Errors{};
+    UINT64 m_Bytes{};
+    std::vector<UINT32> m_Latencies;
+};
+
+// Creates a directory with the specified number of files, filling each one with data up to the
+// specified size. Files that already have the right size are left alone, so a share can be reused.
+void CreateFiles(const std::filesystem::path& directory, unsigned int count, UINT64 size)
+{
+    std::filesystem::create_directories(directory);
+    std::vector<char> buffer;
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        const auto path = directory / FileName(i);
+        wil::unique_fd file{open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644)};
+        THROW_LAST_ERROR_IF(!file);
+
+        struct stat st;
+        THROW_LAST_ERROR_IF(fstat(file.get(), &st) < 0);
+        if (static_cast<UINT64>(st.st_size) == size)
+        {
+            continue;
+        }
+
+        // N.B. The data is actually written rather than leaving a sparse file, since reading holes
+        //      doesn't exercise the same paths in the file system.
+        THROW_LAST_ERROR_IF(ftruncate(file.get(), 0) < 0);
+        if (buffer.empty())
+        {
+            buffer.resize(1024 * 1024);
+            for (size_t j = 0; j < buffer.size(); ++j)
+            {
+                buffer[j] = static_cast<char>(j * 31);
+            }
+        }
+
+        for (UINT64 written = 0; written < size;)
+        {
+            const auto result = write(file.get(), buffer.data(), std::min<UINT64>(buffer.size(), size - written));
+            THROW_LAST_ERROR_IF(result < 0);
+            written += result;
+        }
+    }
+}
+
+// Returns the latency at the specified percentile. The samples are partially reordered.
+std::chrono::nanoseconds Percentile(std::vector<UINT32>& samples, double percentile)
+{
+    if (samples.empty())
+    {
+        return {};
+    }
+
+    const auto index = std::min(samples.size() - 1, static_cast<size_t>(percentile * samples.size()));
+    std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+    return std::chrono::nanoseconds{samples[index]};
+}
+
+} // namespace
+
+std::optional<Mix> ParseMix(std::string_view name)
+{
+    for (const auto& definition : c_mixes)
+    {
+        if (name == definition.Name)
+        {
+            return definition.Mix;
+        }
+    }
+
+    return {};
+}
+
+const char* MixName(Mix mix)
+{
+    return GetMixDefinition(mix).Name;
+}
+
+std::string MixNames()
+{
+    std::string names;
+    for (const auto& definition : c_mixes)
+    {
+        if (!names.empty())
+        {
+            names += ", ";
+        }
+
+        names += definition.Name;
+    }
+
+    return names;
+}
+
+UINT32 DefaultBlockSize(Mix mix)
+{
+    return GetMixDefinition(mix).BlockSize;
+}
+
+// Creates the files used by the mixes.
+void PrepareShare(const ShareOptions& options)
+{
+    const std::filesystem::path root{options.Path};
+    CreateFiles(root / c_filesDirectory, options.Files, 0);
+    CreateFiles(root / c_listDirectory, options.DirectoryEntries, 0);
+    CreateFiles(root / c_dataDirectory, options.DataFiles, options.FileSize);
+    std::filesystem::create_directories(root / c_outputDirectory);
+}
+
+// Starts a server for the share with the specified configuration, and runs the mix against it
+// from the specified number of connections.
+RunResult Run(const ShareOptions& share, const RunOptions& options)
+{
+    const auto& mix = GetMixDefinition(options.Mix);
+    auto effectiveOptions = options;
+    if (effectiveOptions.BlockSize == 0)
+    {
+        effectiveOptions.BlockSize = mix.BlockSize;
+    }
+
+    THROW_ERRNO_IF(EINVAL, options.Connections == 0 || options.Depth == 0 || options.Depth >= c_noTag || options.Listeners == 0);
+
+    // The server's sockets are created in a private temporary directory.
+    auto directory = (std::filesystem::temp_directory_path() / "plan9bench.XXXXXX").string();
+    THROW_LAST_ERROR_IF(mkdtemp(directory.data()) == nullptr);
+    std::vector<std::string> socketPaths;
+    const auto removeDirectory = wil::scope_exit([&]() {
+        for (const auto& path : socketPaths)
+        {
+            unlink(path.c_str());
+        }
+
+        rmdir(directory.c_str());
+    });
+
+    // N.B. Unix sockets don't support SO_REUSEPORT, so each listener is bound to its own path and
+    //      the clients are spread across them.
+    std::vector<wil::unique_fd> listenSockets;
+    for (unsigned int i = 0; i < options.Listeners; ++i)
+    {
+        const auto& socketPath = socketPaths.emplace_back(std::format("{}/server{}", directory, i));
+        auto& listenSocket = listenSockets.emplace_back(socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0));
+        THROW_LAST_ERROR_IF(!listenSocket);
+
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        THROW_ERRNO_IF(ENAMETOOLONG, socketPath.size() >= sizeof(address.sun_path));
+        socketPath.copy(address.sun_path, socketPath.size());
+        THROW_LAST_ERROR_IF(bind(listenSocket.get(), reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0);
+    }
+
+    std::vector<int> sockets;
+    for (auto& listenSocket : listenSockets)
+    {
+        sockets.push_back(listenSocket.release());
+    }
+
+    auto fileSystem = CreateFileSystem(sockets, options.RequestLimit, options.WarmThreads, options.WriteBehind, options.EpollThreads);
+    const auto epollBefore = RequestStatistics::Snapshot().EpollThreads;
+
+    // The share takes ownership of the fd.
+    wil::unique_fd rootFd{open(share.Path.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC)};
+    THROW_LAST_ERROR_IF(!rootFd);
+    fileSystem->AddShare("", rootFd.get());
+    rootFd.release();
+    fileSystem->Resume();
+
+    std::vector<std::unique_ptr<Client>> clients;
+    for (unsigned int i = 0; i < options.Connections; ++i)
+    {
+        clients.emplace_back(std::make_unique<Client>(socketPaths[i % socketPaths.size()], i, share, effectiveOptions, mix))->Connect();
+    }
+
+    // Each connection is driven by its own thread.
+    std::vector<std::exception_ptr> exceptions(clients.size());
+    std::vector<std::thread> threads;
+    const auto deadline = Clock::now() + options.Duration;
+    for (size_t i = 0; i < clients.size(); ++i)
+    {
+        threads.emplace_back([&, i]() {
+            try
+            {
+                clients[i]->Run(deadline);
+            }
+            catch (...)
+            {
+                exceptions[i] = std::current_exception();
+            }
+        });
+    }
+
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    for (const auto& exception : exceptions)
+    {
+        if (exception)
+        {
+            std::rethrow_exception(exception);
+        }
+    }
+
+    RunResult result;
+    std::vector<UINT32> latencies;
+    for (const auto& client : clients)
+    {
+        result.Operations += client->Operations();
+        result.Errors += client->Errors();
+        result.Bytes += client->Bytes();
+        latencies.insert(latencies.end(), client->Latencies().begin(), client->Latencies().end());
+    }
+
+    result.Seconds = std::chrono::duration<double>(options.Duration).count();
+    result.P50 = Percentile(latencies, 0.5);
+    result.P99 = Percentile(latencies, 0.99);
+    result.P999 = Percentile(latencies, 0.999);
+
+    // N.B. The epoll threads are shared by all runs in the process, so only the difference is
+    //      reported.
+    const auto epollAfter = RequestStatistics::Snapshot().EpollThreads;
+    for (size_t i = 0; i < epollAfter.size(); ++i)
+    {
+        const auto before = i < epollBefore.size() ? epollBefore[i] : EpollThreadStatistics{};
+        result.EpollThreads.emplace_back(epollAfter[i].TotalSockets - before.TotalSockets, epollAfter[i].Events - before.Events);
+    }
+
+    // Disconnect before stopping the server.
+    clients.clear();
+    fileSystem.reset();
+    return result;
+}
+
+} // namespace p9bench
@@ -0,0 +1,95 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+#pragma once
+
+namespace p9bench {
+
+// The request patterns that the load generator can issue. Each client connection runs a number of
+// independent request sequences ("slots") concurrently, each repeating the steps of the mix.
+enum class Mix
+{
+    // Walk to a random file, then clunk the new fid.
+    Walk,
+
+    // Query the attributes of an already walked file.
+    GetAttr,
+
+    // Walk to a random file, query its attributes and clunk it.
+    Metadata,
+
+    // Open a large directory, read all of it and clunk it.
+    ReadDir,
+
+    // Walk to a random file, open it and clunk it.
+    Churn,
+
+    // Read an open file sequentially, or at random block-aligned offsets.
+    SeqRead,
+    RandRead,
+
+    // Write an open file sequentially, or at random block-aligned offsets.
+    SeqWrite,
+    RandWrite,
+
+    // Write small blocks sequentially to an open file.
+    Append
+};
+
+std::optional<Mix> ParseMix(std::string_view name);
+const char* MixName(Mix mix);
+std::string MixNames();
+UINT32 DefaultBlockSize(Mix mix);
+
+// The files created on the share before running any mix.
+struct ShareOptions
+{
+    std::string Path;
+
+    // The number of empty files that the metadata mixes pick from.
+    unsigned int Files{1000};
+
+    // The number of entries in the directory read by the ReadDir mix.
+    unsigned int DirectoryEntries{10000};
+
+    // The number and size of the files read by the read mixes. The size also bounds the files
+    // written by the write mixes.
+    unsigned int DataFiles{8};
+    UINT64 FileSize{4 * 1024 * 1024};
+};
+
+// The parameters for a single run, including the server configuration.
+struct RunOptions
+{
+    Mix Mix{Mix::GetAttr};
+    unsigned int Connections{1};
+    unsigned int Depth{1};
+    UINT32 BlockSize{};
+    std::chrono::milliseconds Duration{std::chrono::seconds{5}};
+    size_t RequestLimit{p9fs::c_DefaultRequestLimit};
+    unsigned int WarmThreads{p9fs::c_DefaultWarmThreads};
+    bool WriteBehind{};
+    unsigned int EpollThreads{p9fs::c_AutomaticEpollThreads};
+
+    // The number of listening sockets the server accepts on; connections are spread across them.
+    unsigned int Listeners{1};
+};
+
+struct RunResult
+{
+    UINT64 Operations{};
+    UINT64 Errors{};
+    UINT64 Bytes{};
+    double Seconds{};
+    std::chrono::nanoseconds P50{};
+    std::chrono::nanoseconds P99{};
+    std::chrono::nanoseconds P999{};
+
+    // The sockets added to, and readiness events dispatched by, each of the server's epoll threads
+    // during the run.
+    std::vector<std::pair<UINT64, UINT64>> EpollThreads;
+};
+
+void PrepareShare(const ShareOptions& options);
+
+RunResult Run(const ShareOptions& share, const RunOptions& options);
+
+} // namespace p9bench
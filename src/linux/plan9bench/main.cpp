@@ -0,0 +1,369 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+#include "precomp.h"
+#include <getopt.h>
+#include <charconv>
+#include "p9fs.h"
+#include "loadgen.h"
+
+using namespace p9bench;
+
+namespace {
+
+constexpr auto c_usage =
+    "Usage: plan9bench [options]\n"
+    "\n"
+    "Runs an in-process plan9 server on a Unix socket and measures it with a 9P2000.L load\n"
+    "generator. Reports operations per second, latency percentiles and throughput.\n"
+    "\n"
+    "  --suite                  Run the standard benchmark suite instead of a single mix.\n"
+    "  --mix, -m NAME           Request mix to run ({}).\n"
+    "  --connections, -c LIST   Comma-separated client connection counts; each is a separate run.\n"
+    "  --depth, -d COUNT        Outstanding requests per connection.\n"
+    "  --block-size, -b BYTES   Read and write size; defaults depend on the mix.\n"
+    "  --duration, -t SECONDS   Measurement time for each run.\n"
+    "  --request-limit, -l N    Server request limit per connection, or 'adaptive'.\n"
+    "  --warm-threads, -w N     Server worker threads kept alive while idle.\n"
+    "  --write-behind           Enable write-behind on the server.\n"
+    "  --epoll-threads N        Server epoll threads; defaults to one per processor.\n"
+    "  --listeners N            Listening sockets the server accepts connections on.\n"
+    "  --share, -s PATH         Directory to share; defaults to a temporary directory on tmpfs.\n"
+    "  --files N                Files used by the metadata mixes.\n"
+    "  --dir-entries N          Entries in the directory used by the readdir mix.\n"
+    "  --file-size BYTES        Size of the files used by the read and write mixes.\n";
+
+struct Scenario
+{
+    std::string Name;
+    RunOptions Options;
+};
+
+template <typename T>
+bool ParseNumber(std::string_view value, T& result)
+{
+    const auto end = value.data() + value.size();
+    const auto parsed = std::from_chars(value.data(), end, result);
+    return parsed.ec == std::errc{} && parsed.ptr == end;
+}
+
+std::optional<std::vector<unsigned int>> ParseList(std::string_view value)
+{
+    std::vector<unsigned int> result;
+    while (!value.empty())
+    {
+        const auto comma = value.find(',');
+        unsigned int number;
+        if (!ParseNumber(value.substr(0, comma), number) || number == 0)
+        {
+            return {};
+        }
+
+        result.push_back(number);
+        value = comma == std::string_view::npos ? std::string_view{} : value.substr(comma + 1);
+    }
+
+    if (result.empty())
+    {
+        return {};
+    }
+
+    return result;
+}
+
+// Builds the standard suite. Besides a baseline for each mix, it covers:
+// - the per-connection request window at fixed and adaptive limits;
+// - many concurrent walk/getattr/clunk requests contending on one connection;
+// - scaling of a getattr storm from one connection to the number of processors and beyond;
+// - small sequential appends with and without write-behind;
+// - a getattr storm over several listeners and epoll threads.
+std::vector<Scenario> BuildSuite(const RunOptions& base)
+{
+    std::vector<Scenario> suite;
+    auto add = [&](std::string name, Mix mix, unsigned int connections, unsigned int depth) -> RunOptions& {
+        auto options = base;
+        options.Mix = mix;
+        options.Connections = connections;
+        options.Depth = depth;
+        return suite.emplace_back(Scenario{std::move(name), options}).Options;
+    };
+
+    add("walk", Mix::Walk, 1, 16);
+    add("getattr", Mix::GetAttr, 4, 16);
+    add("readdir", Mix::ReadDir, 1, 4);
+    add("churn", Mix::Churn, 4, 16);
+    add("seqread", Mix::SeqRead, 1, 4);
+    add("randread", Mix::RandRead, 4, 8);
+    add("seqwrite", Mix::SeqWrite, 1, 4);
+    add("randwrite", Mix::RandWrite, 4, 8);
+    add("contention", Mix::Metadata, 1, 64);
+    add("window-32", Mix::RandRead, 1, 256).RequestLimit = 32;
+    add("window-128", Mix::RandRead, 1, 256).RequestLimit = 128;
+    add("window-adaptive", Mix::RandRead, 1, 256).RequestLimit = p9fs::c_AdaptiveRequestLimit;
+
+    const unsigned int processors = std::max(std::thread::hardware_concurrency(), 1u);
+    for (unsigned int connections = 1; connections < processors * 2; connections *= 2)
+    {
+        add("scaling-" + std::to_string(connections), Mix::GetAttr, connections, 8);
+    }
+
+    add("scaling-" + std::to_string(processors * 2), Mix::GetAttr, processors * 2, 8);
+    add("append", Mix::Append, 1, 1).WriteBehind = false;
+    add("append-write-behind", Mix::Append, 1, 1).WriteBehind = true;
+    auto& sharded = add("listeners-4", Mix::GetAttr, std::max(processors * 2, 8u), 8);
+    sharded.Listeners = 4;
+    sharded.EpollThreads = 4;
+    return suite;
+}
+
+void PrintHeader()
+{
+    std::printf(
+        "%-24s %6s %6s %12s %10s %10s %10s %10s %8s\n", "scenario", "conns", "depth", "ops/s", "p50(us)", "p99(us)", "p999(us)", "MB/s", "errors");
+}
+
+void PrintResult(const std::string& name, const RunOptions& options, const RunResult& result)
+{
+    auto micros = [](std::chrono::nanoseconds value) { return std::chrono::duration<double, std::micro>(value).count(); };
+    std::printf(
+        "%-24s %6u %6u %12.0f %10.1f %10.1f %10.1f %10.1f %8llu\n",
+        name.c_str(),
+        options.Connections,
+        options.Depth,
+        result.Operations / result.Seconds,
+        micros(result.P50),
+        micros(result.P99),
+        micros(result.P999),
+        result.Bytes / result.Seconds / (1024 * 1024),
+        static_cast<unsigned long long>(result.Errors));
+
+    // Show how the connections and their socket events were spread across the epoll threads.
+    if (result.EpollThreads.size() > 1)
+    {
+        std::string sockets;
+        std::string events;
+        for (const auto& [threadSockets, threadEvents] : result.EpollThreads)
+        {
+            sockets += std::format("{}{}", sockets.empty() ? "" : "/", threadSockets);
+            events += std::format("{}{}", events.empty() ? "" : "/", threadEvents);
+        }
+
+        std::printf("%-24s sockets %s, events %s\n", "  epoll threads", sockets.c_str(), events.c_str());
+    }
+
+    std::fflush(stdout);
+}
+
+int Usage(const char* message = nullptr)
+{
+    if (message != nullptr)
+    {
+        std::fprintf(stderr, "%s\n\n", message);
+    }
+
+    std::fputs(std::format(c_usage, MixNames()).c_str(), stderr);
+    return 1;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+try
+{
+    enum Option
+    {
+        Suite = 0x100,
+        WriteBehind,
+        EpollThreads,
+        Listeners,
+        Files,
+        DirectoryEntries,
+        FileSize
+    };
+
+    const option options[] = {
+        {"suite", no_argument, nullptr, Suite},
+        {"mix", required_argument, nullptr, 'm'},
+        {"connections", required_argument, nullptr, 'c'},
+        {"depth", required_argument, nullptr, 'd'},
+        {"block-size", required_argument, nullptr, 'b'},
+        {"duration", required_argument, nullptr, 't'},
+        {"request-limit", required_argument, nullptr, 'l'},
+        {"warm-threads", required_argument, nullptr, 'w'},
+        {"write-behind", no_argument, nullptr, WriteBehind},
+        {"epoll-threads", required_argument, nullptr, EpollThreads},
+        {"listeners", required_argument, nullptr, Listeners},
+        {"share", required_argument, nullptr, 's'},
+        {"files", required_argument, nullptr, Files},
+        {"dir-entries", required_argument, nullptr, DirectoryEntries},
+        {"file-size", required_argument, nullptr, FileSize},
+        {"help", no_argument, nullptr, 'h'},
+        {}};
+
+    bool suite = false;
+    RunOptions runOptions;
+    ShareOptions shareOptions;
+    std::vector<unsigned int> connections{1};
+    int current;
+    while ((current = getopt_long(argc, argv, "m:c:d:b:t:l:w:s:h", options, nullptr)) != -1)
+    {
+        const std::string_view value{optarg != nullptr ? optarg : ""};
+        bool valid = true;
+        switch (current)
+        {
+        case Suite:
+            suite = true;
+            break;
+
+        case 'm':
+            if (const auto mix = ParseMix(value))
+            {
+                runOptions.Mix = *mix;
+            }
+            else
+            {
+                valid = false;
+            }
+
+            break;
+
+        case 'c':
+            if (auto list = ParseList(value))
+            {
+                connections = std::move(*list);
+            }
+            else
+            {
+                valid = false;
+            }
+
+            break;
+
+        case 'd':
+            valid = ParseNumber(value, runOptions.Depth) && runOptions.Depth > 0;
+            break;
+
+        case 'b':
+            valid = ParseNumber(value, runOptions.BlockSize);
+            break;
+
+        case 't':
+        {
+            double seconds;
+            valid = ParseNumber(value, seconds) && seconds > 0;
+            runOptions.Duration = std::chrono::milliseconds{static_cast<INT64>(seconds * 1000)};
+            break;
+        }
+
+        case 'l':
+            if (value == "adaptive")
+            {
+                runOptions.RequestLimit = p9fs::c_AdaptiveRequestLimit;
+            }
+            else
+            {
+                valid = ParseNumber(value, runOptions.RequestLimit) && runOptions.RequestLimit > 0;
+            }
+
+            break;
+
+        case 'w':
+            valid = ParseNumber(value, runOptions.WarmThreads);
+            break;
+
+        case WriteBehind:
+            runOptions.WriteBehind = true;
+            break;
+
+        case EpollThreads:
+            valid = ParseNumber(value, runOptions.EpollThreads);
+            break;
+
+        case Listeners:
+            valid = ParseNumber(value, runOptions.Listeners) && runOptions.Listeners > 0;
+            break;
+
+        case 's':
+            shareOptions.Path = value;
+            break;
+
+        case Files:
+            valid = ParseNumber(value, shareOptions.Files);
+            break;
+
+        case DirectoryEntries:
+            valid = ParseNumber(value, shareOptions.DirectoryEntries);
+            break;
+
+        case FileSize:
+            valid = ParseNumber(value, shareOptions.FileSize);
+            break;
+
+        default:
+            return Usage();
+        }
+
+        if (!valid)
+        {
+            return Usage(std::format("Invalid value for {}: '{}'", argv[optind - 1], value).c_str());
+        }
+    }
+
+    if (optind < argc)
+    {
+        return Usage(std::format("Unexpected argument: '{}'", argv[optind]).c_str());
+    }
+
+    // The pipes to the server are closed when the runs finish.
+    signal(SIGPIPE, SIG_IGN);
+
+    // Unless a share was specified, use a temporary directory on tmpfs so the results reflect the
+    // server rather than the storage.
+    std::string temporaryShare;
+    const auto removeShare = wil::scope_exit([&]() {
+        if (!temporaryShare.empty())
+        {
+            std::error_code error;
+            std::filesystem::remove_all(temporaryShare, error);
+        }
+    });
+
+    if (shareOptions.Path.empty())
+    {
+        const std::filesystem::path base = std::filesystem::is_directory("/dev/shm") ? "/dev/shm" : std::filesystem::temp_directory_path();
+        temporaryShare = (base / "plan9bench-share.XXXXXX").string();
+        THROW_LAST_ERROR_IF(mkdtemp(temporaryShare.data()) == nullptr);
+        shareOptions.Path = temporaryShare;
+    }
+
+    PrepareShare(shareOptions);
+
+    std::vector<Scenario> scenarios;
+    if (suite)
+    {
+        scenarios = BuildSuite(runOptions);
+    }
+    else
+    {
+        for (const auto count : connections)
+        {
+            auto options = runOptions;
+            options.Connections = count;
+            scenarios.push_back(Scenario{MixName(options.Mix), options});
+        }
+    }
+
+    PrintHeader();
+    UINT64 errors = 0;
+    for (const auto& scenario : scenarios)
+    {
+        const auto result = Run(shareOptions, scenario.Options);
+        PrintResult(scenario.Name, scenario.Options, result);
+        errors += result.Errors;
+    }
+
+    return errors == 0 ? 0 : 1;
+}
+catch (...)
+{
+    std::fprintf(stderr, "plan9bench failed: %s\n", strerror(wil::ResultFromCaughtException()));
+    return 1;
+}
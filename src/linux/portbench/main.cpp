@@ -0,0 +1,376 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+#include <arpa/inet.h>
+#include <getopt.h>
+#include <sys/resource.h>
+#include <charconv>
+#include "common.h"
+#include "GnsPortTracker.h"
+
+// Definitions normally provided by init, which the port tracker depends on.
+int g_LogFd = STDERR_FILENO;
+int g_TelemetryFd = -1;
+thread_local std::string g_threadName;
+
+void UtilSetThreadName(const char* Name)
+{
+    g_threadName = Name;
+}
+
+namespace {
+
+constexpr auto c_usage =
+    "Usage: portbench [options]\n"
+    "\n"
+    "Opens loopback TCP connections, then measures how long the GNS port tracker takes to look\n"
+    "up the sockets bound to its tracked ports, and how long it takes to notice that one of them\n"
+    "was closed. Each run reports the lookup latency and the number of sockets found.\n"
+    "Up to 64 tracked ports per family and protocol are looked up with a filter; above that,\n"
+    "that family and protocol is dumped unfiltered, like every refresh used to be.\n"
+    "Release is detected through socket destroy notifications, which need CAP_NET_ADMIN.\n"
+    "Without it, the tracker waits for the refresh interval instead.\n"
+    "\n"
+    "  --connections, -c COUNT  Loopback TCP connections to open. Each one is two sockets.\n"
+    "  --ports, -p LIST         Comma-separated tracked port counts; each is a separate run.\n"
+    "  --spread, -s             Spread the tracked ports over TCP and UDP, IPv4 and IPv6,\n"
+    "                           instead of only TCP over IPv4.\n"
+    "  --iterations, -i COUNT   Lookups measured in each run.\n";
+
+// Connections accepted by each listener. This keeps the backlog of pending connections small.
+constexpr unsigned int c_connectionsPerBatch = 1024;
+
+// Time between the start of the wait for a release and the tracked socket being closed.
+constexpr auto c_releaseDelay = std::chrono::milliseconds(20);
+
+struct RunOptions
+{
+    unsigned int Connections = 25000;
+    unsigned int Ports = 16;
+    bool Spread = false;
+    unsigned int Iterations = 100;
+};
+
+struct RunResult
+{
+    size_t Found = 0;
+    std::chrono::nanoseconds Mean{};
+    std::chrono::nanoseconds P99{};
+    std::chrono::nanoseconds Release{};
+};
+
+struct TrackedSocket
+{
+    wil::unique_fd Socket;
+    GnsPortTracker::PortAllocation Allocation;
+};
+
+// Raises the file descriptor limit to the hard limit, and returns it.
+rlim_t RaiseFileLimit()
+{
+    rlimit limit{};
+    THROW_LAST_ERROR_IF(getrlimit(RLIMIT_NOFILE, &limit) < 0);
+    limit.rlim_cur = limit.rlim_max;
+    THROW_LAST_ERROR_IF(setrlimit(RLIMIT_NOFILE, &limit) < 0);
+    return limit.rlim_cur;
+}
+
+// Binds a socket to an unused loopback port.
+TrackedSocket OpenTrackedSocket(int family, int protocol)
+{
+    wil::unique_fd socket{::socket(family, (protocol == IPPROTO_TCP ? SOCK_STREAM : SOCK_DGRAM) | SOCK_CLOEXEC, protocol)};
+    THROW_LAST_ERROR_IF(!socket);
+
+    sockaddr_storage address{};
+    socklen_t addressSize{};
+    if (family == AF_INET)
+    {
+        auto* ipv4 = reinterpret_cast<sockaddr_in*>(&address);
+        ipv4->sin_family = AF_INET;
+        ipv4->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addressSize = sizeof(*ipv4);
+    }
+    else
+    {
+        auto* ipv6 = reinterpret_cast<sockaddr_in6*>(&address);
+        ipv6->sin6_family = AF_INET6;
+        ipv6->sin6_addr = in6addr_loopback;
+        addressSize = sizeof(*ipv6);
+    }
+
+    THROW_LAST_ERROR_IF(bind(socket.get(), reinterpret_cast<sockaddr*>(&address), addressSize) < 0);
+    THROW_LAST_ERROR_IF(getsockname(socket.get(), reinterpret_cast<sockaddr*>(&address), &addressSize) < 0);
+    if (protocol == IPPROTO_TCP)
+    {
+        THROW_LAST_ERROR_IF(listen(socket.get(), SOMAXCONN) < 0);
+    }
+
+    // The tracker only matches the port, so the address is left empty.
+    in6_addr any{};
+    const auto port = family == AF_INET ? reinterpret_cast<sockaddr_in*>(&address)->sin_port : reinterpret_cast<sockaddr_in6*>(&address)->sin6_port;
+    return {std::move(socket), GnsPortTracker::PortAllocation{ntohs(port), family, protocol, any}};
+}
+
+// Opens the requested number of loopback connections and keeps both ends of each open.
+void OpenConnections(unsigned int count)
+{
+    while (count > 0)
+    {
+        const auto batch = std::min(count, c_connectionsPerBatch);
+        auto listener = OpenTrackedSocket(AF_INET, IPPROTO_TCP);
+
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons(listener.Allocation.Port);
+
+        for (unsigned int index = 0; index < batch; index++)
+        {
+            wil::unique_fd client{socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP)};
+            THROW_LAST_ERROR_IF(!client);
+
+            // Reset the connection when it's closed, so it doesn't linger in TIME_WAIT and slow down the next runs.
+            const linger linger{1, 0};
+            THROW_LAST_ERROR_IF(setsockopt(client.get(), SOL_SOCKET, SO_LINGER, &linger, sizeof(linger)) < 0);
+            THROW_LAST_ERROR_IF(connect(client.get(), reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0);
+
+            wil::unique_fd server{accept4(listener.Socket.get(), nullptr, nullptr, SOCK_CLOEXEC)};
+            THROW_LAST_ERROR_IF(!server);
+
+            client.release();
+            server.release();
+        }
+
+        count -= batch;
+    }
+}
+
+// Opens the connections in child processes, so the number of sockets isn't capped by the file
+// descriptor limit of a single process. The children exit once the returned pipe is closed.
+wil::unique_fd StartConnectionProcesses(unsigned int count, unsigned int perProcess)
+{
+    auto ready = wil::unique_pipe::create(O_CLOEXEC);
+    auto stop = wil::unique_pipe::create(O_CLOEXEC);
+
+    unsigned int processes = 0;
+    while (count > 0)
+    {
+        const auto connections = std::min(count, perProcess);
+        const auto pid = fork();
+        THROW_LAST_ERROR_IF(pid < 0);
+        if (pid == 0)
+        {
+            try
+            {
+                ready.read().reset();
+                stop.write().reset();
+                OpenConnections(connections);
+                THROW_LAST_ERROR_IF(write(ready.write().get(), "", 1) != 1);
+                ready.write().reset();
+
+                char buffer;
+                while (read(stop.read().get(), &buffer, sizeof(buffer)) != 0)
+                {
+                }
+
+                _exit(0);
+            }
+            catch (...)
+            {
+                std::fprintf(stderr, "Failed to open %u connections: %s\n", connections, strerror(wil::ResultFromCaughtException()));
+                _exit(1);
+            }
+        }
+
+        processes++;
+        count -= connections;
+    }
+
+    // Each child reports that its connections are open. If one fails, the pipe is closed before all of them did.
+    ready.write().reset();
+    for (unsigned int index = 0; index < processes; index++)
+    {
+        char buffer;
+        THROW_ERRNO_IF(ECONNABORTED, read(ready.read().get(), &buffer, sizeof(buffer)) != 1);
+    }
+
+    return std::move(stop.write());
+}
+
+RunResult Run(GnsPortTracker& tracker, const RunOptions& options)
+{
+    constexpr std::pair<int, int> combinations[] = {
+        {AF_INET, IPPROTO_TCP}, {AF_INET6, IPPROTO_TCP}, {AF_INET, IPPROTO_UDP}, {AF_INET6, IPPROTO_UDP}};
+
+    std::vector<TrackedSocket> sockets;
+    std::set<GnsPortTracker::PortAllocation> trackedPorts;
+    for (unsigned int index = 0; index < options.Ports; index++)
+    {
+        const auto [family, protocol] = combinations[options.Spread ? index % std::size(combinations) : 0];
+        auto& socket = sockets.emplace_back(OpenTrackedSocket(family, protocol));
+        trackedPorts.insert(socket.Allocation);
+    }
+
+    RunResult result;
+    std::vector<std::chrono::nanoseconds> samples;
+    for (unsigned int index = 0; index < options.Iterations; index++)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        result.Found = tracker.ListAllocatedPorts(trackedPorts).size();
+        samples.emplace_back(std::chrono::steady_clock::now() - start);
+    }
+
+    std::sort(samples.begin(), samples.end());
+    result.Mean = std::accumulate(samples.begin(), samples.end(), std::chrono::nanoseconds{}) / samples.size();
+    result.P99 = samples[std::min(samples.size() - 1, samples.size() * 99 / 100)];
+
+    // Close a tracked socket while the tracker waits for a release, and measure how long it takes to notice.
+    auto destroyNotifications = GnsPortTracker::OpenSocketDestroyNotifications();
+    std::chrono::steady_clock::time_point closed;
+    std::thread closer{[&]() {
+        std::this_thread::sleep_for(c_releaseDelay);
+        closed = std::chrono::steady_clock::now();
+        sockets.front().Socket.reset();
+    }};
+
+    GnsPortTracker::WaitForPortRelease(destroyNotifications, trackedPorts);
+    const auto released = std::chrono::steady_clock::now();
+    closer.join();
+    result.Release = released - closed;
+
+    return result;
+}
+
+template <typename T>
+bool ParseNumber(std::string_view value, T& result)
+{
+    const auto end = value.data() + value.size();
+    const auto parsed = std::from_chars(value.data(), end, result);
+    return parsed.ec == std::errc{} && parsed.ptr == end;
+}
+
+std::optional<std::vector<unsigned int>> ParseList(std::string_view value)
+{
+    std::vector<unsigned int> result;
+    while (!value.empty())
+    {
+        const auto comma = value.find(',');
+        unsigned int number;
+        if (!ParseNumber(value.substr(0, comma), number) || number == 0)
+        {
+            return {};
+        }
+
+        result.push_back(number);
+        value = comma == std::string_view::npos ? std::string_view{} : value.substr(comma + 1);
+    }
+
+    if (result.empty())
+    {
+        return {};
+    }
+
+    return result;
+}
+
+int Usage(const char* message = nullptr)
+{
+    if (message != nullptr)
+    {
+        std::fprintf(stderr, "%s\n\n", message);
+    }
+
+    std::fputs(c_usage, stderr);
+    return 1;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+try
+{
+    const option options[] = {
+        {"connections", required_argument, nullptr, 'c'},
+        {"ports", required_argument, nullptr, 'p'},
+        {"spread", no_argument, nullptr, 's'},
+        {"iterations", required_argument, nullptr, 'i'},
+        {"help", no_argument, nullptr, 'h'},
+        {}};
+
+    RunOptions runOptions;
+    std::vector<unsigned int> ports{1, 16, 64, 65};
+    int current;
+    while ((current = getopt_long(argc, argv, "c:p:si:h", options, nullptr)) != -1)
+    {
+        const std::string_view value{optarg != nullptr ? optarg : ""};
+        bool valid = true;
+        switch (current)
+        {
+        case 'c':
+            valid = ParseNumber(value, runOptions.Connections);
+            break;
+
+        case 'p':
+            if (auto list = ParseList(value))
+            {
+                ports = std::move(*list);
+            }
+            else
+            {
+                valid = false;
+            }
+
+            break;
+
+        case 's':
+            runOptions.Spread = true;
+            break;
+
+        case 'i':
+            valid = ParseNumber(value, runOptions.Iterations) && runOptions.Iterations > 0;
+            break;
+
+        default:
+            return Usage();
+        }
+
+        if (!valid)
+        {
+            return Usage(std::format("Invalid value for {}: '{}'", argv[optind - 1], value).c_str());
+        }
+    }
+
+    if (optind < argc)
+    {
+        return Usage(std::format("Unexpected argument: '{}'", argv[optind]).c_str());
+    }
+
+    // Each process keeps two sockets per connection, and a listener, open.
+    const auto perProcess = static_cast<unsigned int>(std::min<rlim_t>((RaiseFileLimit() - 64) / 2, std::numeric_limits<unsigned int>::max()));
+    const auto connections = StartConnectionProcesses(runOptions.Connections, perProcess);
+    GnsPortTracker tracker{nullptr, NetlinkChannel(SOCK_RAW, NETLINK_SOCK_DIAG), nullptr};
+
+    std::printf("%8s %8s %8s %12s %12s %12s\n", "sockets", "tracked", "found", "mean(us)", "p99(us)", "release(ms)");
+    for (const auto count : ports)
+    {
+        auto options = runOptions;
+        options.Ports = count;
+        const auto result = Run(tracker, options);
+
+        std::printf(
+            "%8u %8u %8zu %12.1f %12.1f %12.1f\n",
+            runOptions.Connections * 2,
+            options.Ports,
+            result.Found,
+            std::chrono::duration<double, std::micro>(result.Mean).count(),
+            std::chrono::duration<double, std::micro>(result.P99).count(),
+            std::chrono::duration<double, std::milli>(result.Release).count());
+
+        std::fflush(stdout);
+    }
+
+    return 0;
+}
+catch (...)
+{
+    std::fprintf(stderr, "portbench failed: %s\n", strerror(wil::ResultFromCaughtException()));
+    return 1;
+}
@@ -232,6 +232,10 @@ Abstract:
 #define LX_INIT_PLAN9_LOG_LEVEL_ARG "--log-level"
 #define LX_INIT_PLAN9_PIPE_FD_ARG "--pipe-fd"
 #define LX_INIT_PLAN9_TRUNCATE_LOG_ARG "--log-truncate"
+#define LX_INIT_PLAN9_REQUEST_LIMIT_ARG "--request-limit"
+#define LX_INIT_PLAN9_WARM_THREADS_ARG "--warm-threads"
+#define LX_INIT_PLAN9_WRITE_BEHIND_ARG "--write-behind"
+#define LX_INIT_PLAN9_EPOLL_THREADS_ARG "--epoll-threads"
 
 //
 // wsl-capture-crash
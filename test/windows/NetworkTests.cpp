@@ -2153,11 +2153,19 @@ class NetworkTests
         return listenSocket;
     }
 
-    static std::tuple<unique_kill_process, bool, wil::unique_handle> BindGuestPortHelper(std::wstring_view BindSpec)
+    // Starts socat in the guest, listening as specified by BindSpec and relaying connections to Target.
+    static std::tuple<unique_kill_process, bool, wil::unique_handle> BindGuestPortHelper(
+        std::wstring_view BindSpec, std::wstring_view Target = L"STDOUT", std::wstring_view Options = L"")
     {
         auto [stdErrRead, stdErrWrite] = CreateSubprocessPipe(false, true);
         auto [stdOutRead, stdOutWrite] = CreateSubprocessPipe(false, true);
-        const std::wstring wslCmd = L"socat -dd " + std::wstring(BindSpec) + L" STDOUT";
+        std::wstring wslCmd = L"socat -dd ";
+        if (!Options.empty())
+        {
+            wslCmd += std::wstring(Options) + L" ";
+        }
+
+        wslCmd += std::wstring(BindSpec) + L" " + std::wstring(Target);
         auto cmd = LxssGenerateWslCommandLine(wslCmd.data());
 
         auto process = LxsstuStartProcess(cmd.data(), nullptr, stdOutWrite.get(), stdErrWrite.get());
@@ -2206,9 +2214,10 @@ class NetworkTests
         return std::tuple(std::move(process), success, std::move(stdOutRead));
     }
 
-    static std::tuple<unique_kill_process, wil::unique_handle> BindGuestPort(std::wstring_view BindSpec, bool ExpectSuccess)
+    static std::tuple<unique_kill_process, wil::unique_handle> BindGuestPort(
+        std::wstring_view BindSpec, bool ExpectSuccess, std::wstring_view Target = L"STDOUT", std::wstring_view Options = L"")
     {
-        auto [process, success, read] = BindGuestPortHelper(BindSpec);
+        auto [process, success, read] = BindGuestPortHelper(BindSpec, Target, Options);
 
         VERIFY_ARE_EQUAL(ExpectSuccess, success);
 
@@ -2325,12 +2334,15 @@ class NetworkTests
         VerifyNotBoundLoopback(port, false);
     }
 
-    static void ValidateLocalhostRelayTraffic(bool ipv6)
-    {
-        // Bind a port in the guest.
-        auto [guestProcess, read] = BindGuestPort(ipv6 ? L"TCP6-LISTEN:1234,bind=::1" : L"TCP4-LISTEN:1234,bind=127.0.0.1", true);
+    static constexpr auto c_relayGuestBindSpec4 = L"TCP4-LISTEN:1234,bind=127.0.0.1";
+    static constexpr auto c_relayGuestBindSpec6 = L"TCP6-LISTEN:1234,bind=::1";
+
+    // Once one direction reaches the end of the stream, socat waits this long for the other one.
+    static constexpr auto c_relayGuestHalfCloseOptions = L"-t 60";
 
-        // Connect to the port via the localhost relay
+    // Connect to port 1234 via the localhost relay.
+    static wil::unique_socket ConnectToLocalhostRelay(bool ipv6)
+    {
         wil::unique_socket hostSocket;
         SOCKADDR_INET addr{};
         addr.si_family = ipv6 ? AF_INET6 : AF_INET;
@@ -2353,6 +2365,75 @@ class NetworkTests
             VERIFY_FAIL();
         }
 
+        // Don't wait forever if the relay stops forwarding data.
+        DWORD timeout = 60 * 1000;
+        VERIFY_ARE_NOT_EQUAL(
+            setsockopt(hostSocket.get(), SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<char*>(&timeout), sizeof(timeout)), SOCKET_ERROR);
+        VERIFY_ARE_NOT_EQUAL(
+            setsockopt(hostSocket.get(), SOL_SOCKET, SO_SNDTIMEO, reinterpret_cast<char*>(&timeout), sizeof(timeout)), SOCKET_ERROR);
+
+        return hostSocket;
+    }
+
+    // Sends the whole buffer. Returns false if the connection failed.
+    static bool SendAll(SOCKET socket, std::string_view buffer)
+    {
+        while (!buffer.empty())
+        {
+            const auto bytesSent = send(socket, buffer.data(), static_cast<int>(std::min<size_t>(buffer.size(), 1024 * 1024)), 0);
+            if (bytesSent == SOCKET_ERROR)
+            {
+                LogError("send failed, %d", WSAGetLastError());
+                return false;
+            }
+
+            buffer.remove_prefix(bytesSent);
+        }
+
+        return true;
+    }
+
+    // Receives until the end of the stream.
+    static std::string ReceiveAll(SOCKET socket)
+    {
+        std::string content;
+        std::vector<char> buffer(1024 * 1024);
+        for (;;)
+        {
+            const auto bytesRead = recv(socket, buffer.data(), static_cast<int>(buffer.size()), 0);
+            if (bytesRead == SOCKET_ERROR)
+            {
+                LogError("recv failed after %zu bytes, %d", content.size(), WSAGetLastError());
+                VERIFY_FAIL();
+            }
+            else if (bytesRead == 0)
+            {
+                return content;
+            }
+
+            content.append(buffer.data(), bytesRead);
+        }
+    }
+
+    // Returns test data whose period isn't a power of two, so data that is reordered or lost is detected.
+    static std::string GenerateRelayTestData(size_t size)
+    {
+        std::string data(size, '\0');
+        for (size_t i = 0; i < size; ++i)
+        {
+            data[i] = static_cast<char>(i % 251);
+        }
+
+        return data;
+    }
+
+    static void ValidateLocalhostRelayTraffic(bool ipv6)
+    {
+        // Bind a port in the guest.
+        auto [guestProcess, read] = BindGuestPort(ipv6 ? c_relayGuestBindSpec6 : c_relayGuestBindSpec4, true);
+
+        auto hostSocket = ConnectToLocalhostRelay(ipv6);
+
         // Send data from host to guest.
         constexpr auto buffer = "test-relay-buffer";
         VERIFY_ARE_EQUAL(send(hostSocket.get(), buffer, static_cast<int>(strlen(buffer)), 0), strlen(buffer));
@@ -2394,6 +2475,86 @@ class NetworkTests
         ValidateLocalhostRelayTraffic(false);
     }
 
+    // Sends a large amount of data through the relay to a guest echo server while receiving it back,
+    // so both directions are busy at the same time.
+    static void ValidateLocalhostRelayLargeTransfer(bool ipv6)
+    {
+        auto [guestProcess, read] =
+            BindGuestPort(ipv6 ? c_relayGuestBindSpec6 : c_relayGuestBindSpec4, true, L"EXEC:cat", c_relayGuestHalfCloseOptions);
+
+        auto hostSocket = ConnectToLocalhostRelay(ipv6);
+
+        const auto data = GenerateRelayTestData(64 * 1024 * 1024);
+        bool sent = false;
+        std::thread sender{[&sent, &data, socket = hostSocket.get()]() {
+            sent = SendAll(socket, data) && shutdown(socket, SD_SEND) != SOCKET_ERROR;
+        }};
+
+        // If receiving fails, the sender stops once its send timeout expires.
+        auto joinSender = wil::scope_exit([&sender]() { sender.join(); });
+
+        // The echo server only ends its stream once it received the end of the host's stream.
+        const auto received = ReceiveAll(hostSocket.get());
+        joinSender.reset();
+
+        VERIFY_IS_TRUE(sent);
+        VERIFY_ARE_EQUAL(data.size(), received.size());
+        VERIFY_IS_TRUE(data == received);
+    }
+
+    TEST_METHOD(NatLocalhostRelayLargeTransfer)
+    {
+        WSL2_TEST_ONLY();
+        WslKeepAlive keepAlive;
+
+        ValidateLocalhostRelayLargeTransfer(false);
+        ValidateLocalhostRelayLargeTransfer(true);
+    }
+
+    // Tests that each side of a relayed connection can end its stream while the other side keeps
+    // sending.
+    TEST_METHOD(NatLocalhostRelayHalfClose)
+    {
+        WSL2_TEST_ONLY();
+        WslKeepAlive keepAlive;
+
+        constexpr size_t size = 16 * 1024 * 1024;
+
+        // The host ends its stream first. The guest only starts sending once it received the end
+        // of the host's stream.
+        {
+            const auto target = L"SYSTEM:'cat > /dev/null; head -c " + std::to_wstring(size) + L" /dev/zero',pipes";
+            auto [guestProcess, read] = BindGuestPort(c_relayGuestBindSpec4, true, target, c_relayGuestHalfCloseOptions);
+
+            auto hostSocket = ConnectToLocalhostRelay(false);
+            VERIFY_IS_TRUE(SendAll(hostSocket.get(), GenerateRelayTestData(1024 * 1024)));
+            VERIFY_ARE_NOT_EQUAL(shutdown(hostSocket.get(), SD_SEND), SOCKET_ERROR);
+
+            const auto received = ReceiveAll(hostSocket.get());
+            VERIFY_ARE_EQUAL(size, received.size());
+            VERIFY_IS_TRUE(std::all_of(received.begin(), received.end(), [](char c) { return c == '\0'; }));
+        }
+
+        // The guest ends its stream first, and counts what the host sends afterwards.
+        {
+            auto cleanup = wil::scope_exit_log(WI_DIAGNOSTICS_INFO, []() { LxsstuLaunchWsl(L"rm -f /tmp/relay-received"); });
+            const auto target = L"SYSTEM:'exec >&-; wc -c > /tmp/relay-received',pipes";
+            auto [guestProcess, read] = BindGuestPort(c_relayGuestBindSpec4, true, target, c_relayGuestHalfCloseOptions);
+
+            auto hostSocket = ConnectToLocalhostRelay(false);
+            VERIFY_IS_TRUE(ReceiveAll(hostSocket.get()).empty());
+
+            VERIFY_IS_TRUE(SendAll(hostSocket.get(), GenerateRelayTestData(size)));
+            VERIFY_ARE_NOT_EQUAL(shutdown(hostSocket.get(), SD_SEND), SOCKET_ERROR);
+
+            // socat exits once the host's stream ended and was counted.
+            VERIFY_ARE_EQUAL(WaitForSingleObject(guestProcess.m_process.get(), 60 * 1000), WAIT_OBJECT_0);
+
+            auto [output, _] = LxsstuLaunchWslAndCaptureOutput(L"cat /tmp/relay-received");
+            VERIFY_ARE_EQUAL(output, std::to_wstring(size) + L"\n");
+        }
+    }
+
     TEST_METHOD(MirroredGuestPortCantBeBoundByHost)
     {
         MIRRORED_NETWORKING_TEST_ONLY();
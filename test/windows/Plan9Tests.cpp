@@ -495,6 +495,159 @@ class Plan9Tests
         VERIFY_ARE_EQUAL(content, L"foo");
     }
 
+    static auto EnableWriteBehind()
+    {
+        LxssWriteWslDistroConfig("[fileServer]\nwriteBehind=true");
+        TerminateDistribution();
+
+        return wil::scope_exit_log(WI_DIAGNOSTICS_INFO, [] {
+            // clean up wsl.conf file
+            LxsstuLaunchWsl(L"rm /etc/wsl.conf");
+            TerminateDistribution();
+        });
+    }
+
+    // Tests that small writes buffered by write-behind are seen by size queries and reads on the
+    // same handle.
+    TEST_METHOD(TestWriteBehindReadAfterWrite)
+    {
+        auto revertWriteBehind = EnableWriteBehind();
+
+        const auto file = CreateTestFile(L"\\writebehindread", FILE_GENERIC_READ | FILE_GENERIC_WRITE, CREATE_NEW);
+        const auto expected = WriteSmallChunks(file.get(), 100);
+
+        LARGE_INTEGER size{};
+        VERIFY_WIN32_BOOL_SUCCEEDED(GetFileSizeEx(file.get(), &size));
+        VERIFY_ARE_EQUAL(static_cast<LONGLONG>(expected.size()), size.QuadPart);
+
+        VERIFY_WIN32_BOOL_SUCCEEDED(SetFilePointerEx(file.get(), {}, nullptr, FILE_BEGIN));
+        std::string buffer(expected.size() + 1, '\0');
+        DWORD bytes;
+        VERIFY_WIN32_BOOL_SUCCEEDED(ReadFile(file.get(), buffer.data(), static_cast<DWORD>(buffer.size()), &bytes, nullptr));
+        VERIFY_ARE_EQUAL(expected.size(), bytes);
+        VERIFY_ARE_EQUAL(std::string_view{expected}, std::string_view(buffer.data(), bytes));
+    }
+
+    // Tests that small writes buffered by write-behind on one handle are seen by size queries and
+    // reads on another handle to the same file.
+    TEST_METHOD(TestWriteBehindOtherHandle)
+    {
+        auto revertWriteBehind = EnableWriteBehind();
+
+        const auto file = CreateTestFile(L"\\writebehindother", FILE_GENERIC_READ | FILE_GENERIC_WRITE, CREATE_NEW);
+        const auto other = CreateTestFile(L"\\writebehindother", FILE_GENERIC_READ);
+        const auto expected = WriteSmallChunks(file.get(), 100);
+
+        LARGE_INTEGER size{};
+        VERIFY_WIN32_BOOL_SUCCEEDED(GetFileSizeEx(other.get(), &size));
+        VERIFY_ARE_EQUAL(static_cast<LONGLONG>(expected.size()), size.QuadPart);
+
+        std::string buffer(expected.size() + 1, '\0');
+        DWORD bytes;
+        VERIFY_WIN32_BOOL_SUCCEEDED(ReadFile(other.get(), buffer.data(), static_cast<DWORD>(buffer.size()), &bytes, nullptr));
+        VERIFY_ARE_EQUAL(expected.size(), bytes);
+        VERIFY_ARE_EQUAL(std::string_view{expected}, std::string_view(buffer.data(), bytes));
+    }
+
+    // Tests that buffered writes reach the file in Linux when the file is flushed and when it is
+    // closed.
+    TEST_METHOD(TestWriteBehindFlush)
+    {
+        auto revertWriteBehind = EnableWriteBehind();
+
+        auto file = CreateTestFile(L"\\writebehindflush", FILE_GENERIC_READ | FILE_GENERIC_WRITE, CREATE_NEW);
+        auto expected = WriteSmallChunks(file.get(), 50);
+        VERIFY_WIN32_BOOL_SUCCEEDED(FlushFileBuffers(file.get()));
+        VERIFY_ARE_EQUAL(ReadLinuxFile(L"/data/p9_test/writebehindflush"), expected);
+
+        expected += WriteSmallChunks(file.get(), 50);
+        file.reset();
+        VERIFY_ARE_EQUAL(ReadLinuxFile(L"/data/p9_test/writebehindflush"), expected);
+    }
+
+    // Tests that an error writing buffered data is not lost: it is returned either by a write or
+    // by the next flush.
+    TEST_METHOD(TestWriteBehindDeferredError)
+    {
+        auto revertWriteBehind = EnableWriteBehind();
+
+        // Use a file system that is too small for the data.
+        VERIFY_ARE_EQUAL(LxsstuLaunchWsl(L"-u root mkdir -p /data/p9_test/full && mount -t tmpfs -o size=64k tmpfs /data/p9_test/full"), 0u);
+        auto unmount = wil::scope_exit_log(WI_DIAGNOSTICS_INFO, []() { LxsstuLaunchWsl(L"-u root umount /data/p9_test/full"); });
+
+        auto file = CreateTestFile(L"\\full\\writebehinderror", FILE_GENERIC_READ | FILE_GENERIC_WRITE, CREATE_NEW);
+        const std::string chunk(4096, 'x');
+        bool writeFailed = false;
+        for (int i = 0; i < 32 && !writeFailed; ++i)
+        {
+            DWORD bytes;
+            writeFailed = !WriteFile(file.get(), chunk.data(), static_cast<DWORD>(chunk.size()), &bytes, nullptr);
+        }
+
+        if (!writeFailed)
+        {
+            VERIFY_IS_FALSE(FlushFileBuffers(file.get()));
+        }
+
+        const auto error = GetLastError();
+        LogInfo("Write-behind error: %u", error);
+        VERIFY_ARE_EQUAL(static_cast<DWORD>(ERROR_DISK_FULL), error);
+    }
+
+    // Tests that an extended attribute set through plan9 is returned by the next read, even if the
+    // previous value was cached.
+    TEST_METHOD(TestXattrGetAfterSet)
+    {
+        const auto file = CreateNewXattrTestFile(L"\\xattrset");
+        if (!SetXattr(file.get(), "one"))
+        {
+            return;
+        }
+
+        ReadCachedXattr(file.get(), "one");
+
+        VERIFY_IS_TRUE(SetXattr(file.get(), "two"));
+        VERIFY_ARE_EQUAL(QueryXattr(file.get()).value_or(""), std::string{"two"});
+    }
+
+    // Tests that an extended attribute removed through plan9 is no longer returned, even if its
+    // value was cached.
+    TEST_METHOD(TestXattrGetAfterRemove)
+    {
+        const auto file = CreateNewXattrTestFile(L"\\xattrremove");
+        if (!SetXattr(file.get(), "one"))
+        {
+            return;
+        }
+
+        ReadCachedXattr(file.get(), "one");
+
+        VERIFY_IS_TRUE(SetXattr(file.get(), {}));
+        VERIFY_IS_FALSE(QueryXattr(file.get()).has_value());
+    }
+
+    // Tests that an extended attribute changed in Linux, bypassing plan9, is returned by the next
+    // read, even if the previous value was cached.
+    TEST_METHOD(TestXattrLinuxChange)
+    {
+        const auto file = CreateNewXattrTestFile(L"\\xattrlinux");
+        if (!SetXattr(file.get(), "one"))
+        {
+            return;
+        }
+
+        // The new value is copied from another file, so the test doesn't depend on how attribute
+        // names are mapped to Linux.
+        const auto source = CreateNewXattrTestFile(L"\\xattrlinuxsource");
+        VERIFY_IS_TRUE(SetXattr(source.get(), "two"));
+
+        ReadCachedXattr(file.get(), "one");
+
+        VERIFY_ARE_EQUAL(LxsstuLaunchWsl(L"cp --attributes-only --preserve=xattr /data/p9_test/xattrlinuxsource /data/p9_test/xattrlinux"), 0u);
+
+        VERIFY_ARE_EQUAL(QueryXattr(file.get()).value_or(""), std::string{"two"});
+    }
+
     /* Plan9 Test Helper Methods */
 
     static wil::unique_hfile CreateTestFile(std::wstring_view path, DWORD desiredAccess, DWORD disposition = OPEN_EXISTING, DWORD flags = 0)
@@ -566,5 +719,102 @@ class Plan9Tests
         VERIFY_WIN32_BOOL_SUCCEEDED(GetFileInformationByHandle(file.get(), &info));
         return static_cast<ULONGLONG>(info.nFileIndexHigh) << 32 | info.nFileIndexLow;
     }
+
+    // Writes small chunks to the file, each filled with a different letter, and returns the data
+    // that was written.
+    static std::string WriteSmallChunks(HANDLE file, int count)
+    {
+        std::string written;
+        for (int i = 0; i < count; ++i)
+        {
+            const std::string chunk(100, static_cast<char>('a' + i % 26));
+            DWORD bytes;
+            VERIFY_WIN32_BOOL_SUCCEEDED(WriteFile(file, chunk.data(), static_cast<DWORD>(chunk.size()), &bytes, nullptr));
+            VERIFY_ARE_EQUAL(chunk.size(), bytes);
+            written += chunk;
+        }
+
+        return written;
+    }
+
+    // Reads a file from Linux, bypassing plan9.
+    static std::string ReadLinuxFile(const std::wstring& path)
+    {
+        const auto [output, _] = LxsstuLaunchWslAndCaptureOutput(L"cat " + path);
+        return wsl::shared::string::WideToMultiByte(output);
+    }
+
+    static constexpr std::string_view c_xattrName{"WSLTEST"};
+
+    static wil::unique_hfile CreateNewXattrTestFile(std::wstring_view path)
+    {
+        return CreateTestFile(path, FILE_GENERIC_READ | FILE_GENERIC_WRITE | FILE_READ_EA | FILE_WRITE_EA, CREATE_NEW);
+    }
+
+    // Sets the test extended attribute on the file. An empty value removes it. Returns false, and
+    // marks the test as skipped, if extended attributes are not supported.
+    static bool SetXattr(HANDLE file, std::string_view value)
+    {
+        std::vector<char> buffer(FIELD_OFFSET(FILE_FULL_EA_INFORMATION, EaName) + c_xattrName.size() + 1 + value.size());
+        auto* ea = reinterpret_cast<PFILE_FULL_EA_INFORMATION>(buffer.data());
+        ea->EaNameLength = static_cast<UCHAR>(c_xattrName.size());
+        ea->EaValueLength = static_cast<USHORT>(value.size());
+        memcpy(ea->EaName, c_xattrName.data(), c_xattrName.size());
+        memcpy(ea->EaName + c_xattrName.size() + 1, value.data(), value.size());
+
+        IO_STATUS_BLOCK ioStatus{};
+        const auto status = ZwSetEaFile(file, &ioStatus, buffer.data(), static_cast<ULONG>(buffer.size()));
+        if (status == STATUS_EAS_NOT_SUPPORTED)
+        {
+            LogSkipped("Extended attributes are not supported by the plan9 redirector");
+            return false;
+        }
+
+        VERIFY_ARE_EQUAL(STATUS_SUCCESS, status);
+        return true;
+    }
+
+    // Returns the value of the test extended attribute, or nothing if the file doesn't have it.
+    static std::optional<std::string> QueryXattr(HANDLE file)
+    {
+        std::vector<char> buffer(64 * 1024);
+        IO_STATUS_BLOCK ioStatus{};
+        const auto status = ZwQueryEaFile(file, &ioStatus, buffer.data(), static_cast<ULONG>(buffer.size()), FALSE, nullptr, 0, nullptr, TRUE);
+        if (status == STATUS_NO_EAS_ON_FILE)
+        {
+            return {};
+        }
+
+        VERIFY_ARE_EQUAL(STATUS_SUCCESS, status);
+
+        // N.B. Attribute names may be returned in upper case.
+        auto* ea = reinterpret_cast<PFILE_FULL_EA_INFORMATION>(buffer.data());
+        for (;;)
+        {
+            if (ea->EaNameLength == c_xattrName.size() && _strnicmp(ea->EaName, c_xattrName.data(), c_xattrName.size()) == 0)
+            {
+                return std::string{ea->EaName + ea->EaNameLength + 1, ea->EaValueLength};
+            }
+
+            if (ea->NextEntryOffset == 0)
+            {
+                return {};
+            }
+
+            ea = reinterpret_cast<PFILE_FULL_EA_INFORMATION>(reinterpret_cast<char*>(ea) + ea->NextEntryOffset);
+        }
+    }
+
+    // Reads the test extended attribute until it is cached by the server. Attributes of files that
+    // changed in the last two seconds are not cached, since another change in the same clock tick
+    // would not update the file's change time.
+    static void ReadCachedXattr(HANDLE file, std::string_view expected)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(2500));
+        for (int i = 0; i < 2; ++i)
+        {
+            VERIFY_ARE_EQUAL(QueryXattr(file).value_or(""), std::string{expected});
+        }
+    }
 };
 } // namespace Plan9Tests
\ No newline at end of file